@@ -0,0 +1,447 @@
+
+/*===========================================================================*/
+
+/*
+ *  Copyright (C) 1998 Jason Hutchens
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the license or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE.  See the Gnu Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*===========================================================================*/
+
+/*
+ *		File:			dictionary.c
+ *
+ *		Purpose:		Measure how quickly words are looked up in a dictionary
+ *						of the size given.  The words are made up of syllables,
+ *						so that many of them share a beginning, as real words do.
+ *						The same words are then looked up in mixed case, along
+ *						with as many which are missing, in three ways: by
+ *						search_dictionary() on keys folded beforehand, by
+ *						find_word() from the words as they are, and by the binary
+ *						search the dictionary used before its keys were folded,
+ *						which folds every character of both words at every step.
+ *						The nanoseconds each lookup takes are printed for the
+ *						words found and for those missing, and the searches are
+ *						checked to agree.
+ *
+ *		Usage:		dictionary [<words> [<milliseconds>]]
+ */
+
+/*===========================================================================*/
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "megahal.h"
+#include "megahal_private.h"
+#include "timer.h"
+
+/*===========================================================================*/
+
+#define LONGEST 64
+
+BYTE4 add_word(DICTIONARY *, STRING);
+void error(char *, char *, ...);
+BYTE4 find_word(DICTIONARY *, STRING);
+STRING fold_word(STRING, char *);
+DICTIONARY *new_dictionary(void);
+void pop_guard(GUARD *);
+void push_guard(GUARD *);
+int search_dictionary(DICTIONARY *, STRING, bool *);
+
+char *syllable[]={
+	"A", "AN", "BE", "CON", "DE", "ER", "EX", "FOR", "GRA", "HI", "IN", "ING",
+	"KA", "LO", "MEN", "NO", "OR", "PRE", "QUI", "RE", "SH", "ST", "TER", "TH",
+	"UN", "VE", "WA", "Y", "ZO", "'S", NULL
+};
+int syllables=0;
+
+typedef struct {
+	int size;
+	STRING *word;
+	STRING *key;
+	bool *found;
+	int *position;
+} QUERIES;
+
+char **make_dictionary(int);
+void make_word(char *, bool);
+int order_words(const void *, const void *);
+void make_queries(QUERIES *, DICTIONARY *, char **, int, bool);
+void copy_string(STRING *, STRING);
+double time_folded(DICTIONARY *, QUERIES *, double);
+double time_find(DICTIONARY *, QUERIES *, double);
+double time_unfolded(DICTIONARY *, QUERIES *, double);
+int unfolded_search(DICTIONARY *, STRING, bool *);
+int unfolded_compare(STRING, STRING);
+
+/*===========================================================================*/
+
+int main(int argc, char *argv[])
+{
+	DICTIONARY *dictionary;
+	QUERIES queries[2];
+	GUARD guard;
+	char **words;
+	STRING entry;
+	double taken[3];
+	double limit=0.2;
+	int size=100000;
+	int failed=0;
+	int i;
+	int j;
+
+	if(argc>3) {
+		fprintf(stderr, "Usage: %s [<words> [<milliseconds>]]\n", argv[0]);
+		return(2);
+	}
+	if(argc>1) size=atoi(argv[1]);
+	if(argc>2) limit=atof(argv[2])/1000.0;
+	if((size<1)||(size>1000000)||(limit<=0.0)) {
+		fprintf(stderr, "%s: the words must be from 1 to 1000000, and the time positive\n",
+			argv[0]);
+		return(2);
+	}
+	while(syllable[syllables]!=NULL) ++syllables;
+
+	push_guard(&guard);
+	if(setjmp(guard.failed)!=0) {
+		pop_guard(&guard);
+		fprintf(stderr, "Unable to build the dictionary\n");
+		return(1);
+	}
+
+	/*
+	 *		The words are added in order, so that each goes on the end of the
+	 *		index rather than shuffling it along.
+	 */
+	srand(1);
+	words=make_dictionary(size);
+	dictionary=new_dictionary();
+	for(i=0; i<size; ++i) {
+		entry.word=words[i];
+		entry.length=strlen(words[i]);
+		add_word(dictionary, entry);
+	}
+	make_queries(&queries[0], dictionary, words, size, TRUE);
+	make_queries(&queries[1], dictionary, words, size, FALSE);
+	pop_guard(&guard);
+
+	printf("Nanoseconds a lookup in a dictionary of %d words\n", size);
+	printf("%8s %18s %12s %12s\n", "", "search_dictionary", "find_word", "unfolded");
+	for(i=0; i<2; ++i) {
+		taken[0]=time_folded(dictionary, &queries[i], limit);
+		taken[1]=time_find(dictionary, &queries[i], limit);
+		taken[2]=time_unfolded(dictionary, &queries[i], limit);
+		printf("%8s", (i==0)?"found":"missing");
+		for(j=0; j<3; ++j) {
+			if(taken[j]<0.0) {
+				printf(" %*s", (j==0)?18:12, "WRONG");
+				failed=1;
+			} else {
+				printf(" %*.1f", (j==0)?18:12, taken[j]);
+			}
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+
+	return(failed);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Make_Dictionary
+ *
+ *		Purpose:		Make the given number of different words, sorted the way
+ *						the index of a dictionary is.  Words are made until there
+ *						are enough, and those made twice are thrown away.
+ */
+char **make_dictionary(int size)
+{
+	char **words;
+	char word[LONGEST];
+	int count=0;
+	int tries=0;
+	register int i;
+	int j;
+
+	words=(char **)malloc(sizeof(char *)*size);
+	if(words==NULL) error("make_dictionary", "Unable to allocate the words.");
+
+	while(count<size) {
+		if(++tries>100) error("make_dictionary", "Unable to make enough different words.");
+		for(i=count; i<size; ++i) {
+			make_word(word, TRUE);
+			words[i]=strdup(word);
+			if(words[i]==NULL) error("make_dictionary", "Unable to copy a word.");
+		}
+		qsort(words, size, sizeof(char *), order_words);
+		for(i=1, j=1; i<size; ++i) {
+			if(strcmp(words[i], words[j-1])==0) free(words[i]);
+			else words[j++]=words[i];
+		}
+		count=j;
+	}
+
+	return(words);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Make_Word
+ *
+ *		Purpose:		Make a word of one to six syllables, in upper case, or
+ *						with each letter in either case.
+ */
+void make_word(char *word, bool folded)
+{
+	register int i;
+	int count=1+rand()%6;
+
+	word[0]='\0';
+	for(i=0; i<count; ++i) strcat(word, syllable[rand()%syllables]);
+	if(folded==TRUE) return;
+	for(i=0; word[i]!='\0'; ++i)
+		if(rand()%2==0) word[i]=(char)tolower((unsigned char)word[i]);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Order_Words
+ *
+ *		Purpose:		Order words the way the index of a dictionary does, for
+ *						qsort().
+ */
+int order_words(const void *first, const void *second)
+{
+	return(strcmp(*(char **)first, *(char **)second));
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Make_Queries
+ *
+ *		Purpose:		Make as many words to look up as the dictionary holds,
+ *						in mixed case, either taken from the dictionary in a
+ *						random order or made up and missing from it.  Their
+ *						folded keys are kept with them, along with where the
+ *						dictionary puts them.
+ */
+void make_queries(QUERIES *queries, DICTIONARY *dictionary, char **words, int size,
+	bool present)
+{
+	char word[LONGEST];
+	char buffer[KEY_BUFFER];
+	STRING query;
+	register int i;
+	int j;
+
+	queries->size=size;
+	queries->word=(STRING *)malloc(sizeof(STRING)*size);
+	queries->key=(STRING *)malloc(sizeof(STRING)*size);
+	queries->found=(bool *)malloc(sizeof(bool)*size);
+	queries->position=(int *)malloc(sizeof(int)*size);
+	if((queries->word==NULL)||(queries->key==NULL)||(queries->found==NULL)||
+		(queries->position==NULL)) error("make_queries", "Unable to allocate the queries.");
+
+	for(i=0; i<size; ++i) {
+		do {
+			if(present==TRUE) {
+				strcpy(word, words[rand()%size]);
+				for(j=0; word[j]!='\0'; ++j)
+					if(rand()%2==0) word[j]=(char)tolower((unsigned char)word[j]);
+			} else {
+				make_word(word, FALSE);
+			}
+			query.word=word;
+			query.length=strlen(word);
+			queries->position[i]=unfolded_search(dictionary, query, &queries->found[i]);
+		} while(queries->found[i]!=present);
+		copy_string(&queries->word[i], query);
+		copy_string(&queries->key[i], fold_word(query, buffer));
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Copy_String
+ *
+ *		Purpose:		Keep a copy of the characters of a string.
+ */
+void copy_string(STRING *to, STRING from)
+{
+	to->length=from.length;
+	to->word=(char *)malloc(sizeof(char)*(from.length+1));
+	if(to->word==NULL) error("copy_string", "Unable to copy a query.");
+	memcpy(to->word, from.word, from.length);
+	to->word[from.length]='\0';
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Time_Folded
+ *
+ *		Purpose:		Look the folded keys up with search_dictionary() until the
+ *						time given has passed, and return the nanoseconds each
+ *						lookup took, or -1 if one was put in the wrong place.
+ */
+double time_folded(DICTIONARY *dictionary, QUERIES *queries, double limit)
+{
+	register int i;
+	bool found;
+	double start;
+	double taken;
+	unsigned long lookups=0;
+
+	start=seconds();
+	do {
+		for(i=0; i<queries->size; ++i)
+			if((search_dictionary(dictionary, queries->key[i], &found)!=queries->position[i])||
+				(found!=queries->found[i])) return(-1.0);
+		lookups+=queries->size;
+		taken=seconds()-start;
+	} while(taken<limit);
+
+	return(taken*1.0e9/(double)lookups);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Time_Find
+ *
+ *		Purpose:		Look the words up with find_word(), which folds them and
+ *						goes through the hash table, until the time given has
+ *						passed, and return the nanoseconds each lookup took, or
+ *						-1 if one gave the wrong symbol.
+ */
+double time_find(DICTIONARY *dictionary, QUERIES *queries, double limit)
+{
+	register int i;
+	BYTE4 symbol;
+	double start;
+	double taken;
+	unsigned long lookups=0;
+
+	start=seconds();
+	do {
+		for(i=0; i<queries->size; ++i) {
+			symbol=(queries->found[i]==TRUE)?dictionary->index[queries->position[i]]:0;
+			if(find_word(dictionary, queries->word[i])!=symbol) return(-1.0);
+		}
+		lookups+=queries->size;
+		taken=seconds()-start;
+	} while(taken<limit);
+
+	return(taken*1.0e9/(double)lookups);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Time_Unfolded
+ *
+ *		Purpose:		Look the words up with the search the dictionary used
+ *						before its keys were folded, until the time given has
+ *						passed, and return the nanoseconds each lookup took.
+ */
+double time_unfolded(DICTIONARY *dictionary, QUERIES *queries, double limit)
+{
+	register int i;
+	bool found;
+	double start;
+	double taken;
+	unsigned long lookups=0;
+
+	start=seconds();
+	do {
+		for(i=0; i<queries->size; ++i)
+			if((unfolded_search(dictionary, queries->word[i], &found)!=queries->position[i])||
+				(found!=queries->found[i])) return(-1.0);
+		lookups+=queries->size;
+		taken=seconds()-start;
+	} while(taken<limit);
+
+	return(taken*1.0e9/(double)lookups);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Unfolded_Search
+ *
+ *		Purpose:		Search the dictionary for a word the way it was searched
+ *						before its keys were folded, returning its position in
+ *						the index if found, or the position where it should be
+ *						inserted otherwise.
+ */
+int unfolded_search(DICTIONARY *dictionary, STRING word, bool *find)
+{
+	int min=0;
+	int max=dictionary->size-1;
+	int middle;
+	int compar;
+
+	*find=FALSE;
+	while(min<=max) {
+		middle=(min+max)/2;
+		compar=unfolded_compare(word, dictionary->entry[dictionary->index[middle]]);
+		if(compar==0) {
+			*find=TRUE;
+			return(middle);
+		}
+		if(compar>0) min=middle+1;
+		else max=middle-1;
+	}
+
+	return(min);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Unfolded_Compare
+ *
+ *		Purpose:		Compare two words the way wordcmp() did before keys were
+ *						folded, putting both characters into upper case at every
+ *						step.
+ */
+int unfolded_compare(STRING word1, STRING word2)
+{
+	register int i;
+	int bound;
+
+	bound=MIN(word1.length,word2.length);
+
+	for(i=0; i<bound; ++i)
+		if(toupper(word1.word[i])!=toupper(word2.word[i]))
+			return((int)(toupper(word1.word[i])-toupper(word2.word[i])));
+
+	if(word1.length<word2.length) return(-1);
+	if(word1.length>word2.length) return(1);
+
+	return(0);
+}
+
+/*===========================================================================*/
@@ -0,0 +1,290 @@
+
+/*===========================================================================*/
+
+/*
+ *  Copyright (C) 1998 Jason Hutchens
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the license or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE.  See the Gnu Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*===========================================================================*/
+
+/*
+ *		File:			evaluate.c
+ *
+ *		Purpose:		Measure learn(), reply() and evaluate_reply() on the
+ *						brain in the directory given, which is best trained by
+ *						bench/training first.  Replies are made to inputs taken
+ *						from across the training text of the personality, both
+ *						as it is and frozen, and the time spent in reply() and in
+ *						evaluate_reply() is printed separately.  Every line of
+ *						the training text is then learnt again, which finds the
+ *						children it walks rather than adding them, as most of
+ *						what a brain learns does.  The brain isn't saved.
+ *						bench/sorted is the same program built with no node ever
+ *						given a hash table, to compare with.
+ *
+ *		Usage:		evaluate <directory> [<replies>]
+ */
+
+/*===========================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "megahal.h"
+#include "megahal_private.h"
+#include "timer.h"
+
+/*===========================================================================*/
+
+#define INPUTS 20
+#define REPEATS 10
+
+float evaluate_reply(MODEL *, KEYSET *, REPLY *, float);
+void learn(MODEL *, DICTIONARY *);
+KEYSET *make_keywords(PERSONALITY *, MODEL *, KEYSET *, DICTIONARY *);
+void pop_guard(GUARD *);
+void prepare_keys(WORKER *, KEYSET *, bool);
+void prepare_worker(WORKER *, MODEL *, unsigned short *);
+void push_guard(GUARD *);
+REPLY *reply(MODEL *, KEYSET *, REPLY *);
+DICTIONARY *session_words(SESSION *, char *);
+
+char **read_lines(char *, int *);
+int time_replies(char *, int, char **, int, int);
+int time_learn(char *, char **, int);
+
+/*===========================================================================*/
+
+int main(int argc, char *argv[])
+{
+	char **text;
+	int count=0;
+	int replies=2000;
+	int failed=0;
+	int i;
+
+	if((argc!=2)&&(argc!=3)) {
+		fprintf(stderr, "Usage: %s <directory> [<replies>]\n", argv[0]);
+		return(2);
+	}
+	if(argc>2) replies=atoi(argv[2]);
+	if(replies<INPUTS) {
+		fprintf(stderr, "%s: there must be at least %d replies\n", argv[0], INPUTS);
+		return(2);
+	}
+
+	text=read_lines(argv[1], &count);
+	if(text==NULL) return(1);
+
+	if(time_replies(argv[1], 0, text, count, replies)!=0) failed=1;
+	else if(time_replies(argv[1], MEGAHAL_FROZEN, text, count, replies)!=0) failed=1;
+	else if(time_learn(argv[1], text, count)!=0) failed=1;
+
+	for(i=0; i<count; ++i) free(text[i]);
+	free(text);
+
+	return(failed);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Read_Lines
+ *
+ *		Purpose:		Read the lines of the training text of the personality in
+ *						a directory, leaving out comments and empty lines as
+ *						training does.  NULL is returned if there are none.
+ */
+char **read_lines(char *directory, int *count)
+{
+	char filename[1024];
+	char line[4096];
+	char **text=NULL;
+	char **grown;
+	int room=0;
+	size_t length;
+	FILE *file;
+
+	sprintf(filename, "%s/.megahal/megahal.trn", directory);
+	file=fopen(filename, "r");
+	if(file==NULL) {
+		fprintf(stderr, "Unable to open %s\n", filename);
+		return(NULL);
+	}
+
+	while(fgets(line, sizeof(line), file)!=NULL) {
+		length=strcspn(line, "\r\n");
+		line[length]='\0';
+		if((line[0]=='#')||(length==0)) continue;
+		if(*count==room) {
+			room=(room==0)?1024:room*2;
+			grown=(char **)realloc(text, sizeof(char *)*room);
+			if(grown==NULL) break;
+			text=grown;
+		}
+		text[*count]=strdup(line);
+		if(text[*count]==NULL) break;
+		++*count;
+	}
+	fclose(file);
+
+	if(*count==0) {
+		fprintf(stderr, "There is nothing to learn in %s\n", filename);
+		free(text);
+		return(NULL);
+	}
+
+	return(text);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Time_Replies
+ *
+ *		Purpose:		Open the personality with the flags given, and make the
+ *						number of replies given to inputs spread across its
+ *						training text, the way a session does on one thread.
+ *						Each reply is evaluated several times, with no best
+ *						score to give up at, so that evaluate_reply() always
+ *						does all of its work and takes long enough to time.
+ */
+int time_replies(char *directory, int flags, char **text, int count, int replies)
+{
+	PERSONALITY *personality;
+	SESSION *session;
+	WORKER *worker;
+	DICTIONARY *words;
+	KEYSET *keys;
+	REPLY *made;
+	GUARD guard;
+	double start;
+	double replying=0.0;
+	double evaluating=0.0;
+	unsigned long symbols=0;
+	int done=0;
+	int i;
+	int j;
+	int k;
+
+	personality=megahal_open(directory, flags);
+	session=megahal_session(1);
+	if((personality==NULL)||(session==NULL)) {
+		fprintf(stderr, "Unable to open the personality in %s\n", directory);
+		megahal_end(session);
+		megahal_close(personality);
+		return(1);
+	}
+
+	push_guard(&guard);
+	guard.personality=personality;
+	if(setjmp(guard.failed)!=0) {
+		pop_guard(&guard);
+		megahal_end(session);
+		megahal_close(personality);
+		return(1);
+	}
+
+	worker=session->worker;
+	prepare_worker(worker, personality->model, session->random);
+	for(i=0; i<INPUTS; ++i) {
+		words=session_words(session, text[(long)i*count/INPUTS]);
+		keys=make_keywords(personality, worker->model, session->keys, words);
+		prepare_keys(worker, keys, TRUE);
+		for(j=0; j<replies/INPUTS; ++j) {
+			start=seconds();
+			made=reply(worker->model, worker->keys, worker->replies);
+			replying+=seconds()-start;
+			start=seconds();
+			for(k=0; k<REPEATS; ++k)
+				(void)evaluate_reply(worker->model, worker->keys, made, (float)-1.0);
+			evaluating+=seconds()-start;
+			symbols+=made->size;
+			++done;
+		}
+	}
+	pop_guard(&guard);
+
+	printf("%s brain, %d replies of %.1f words on average\n",
+		((flags&MEGAHAL_FROZEN)!=0)?"Frozen":"Thawed", done, (double)symbols/(double)done);
+	printf("%16s %14.0f calls/second\n", "reply()",
+		(replying>0.0)?(double)done/replying:0.0);
+	printf("%16s %14.0f calls/second\n", "evaluate_reply()",
+		(evaluating>0.0)?(double)done*REPEATS/evaluating:0.0);
+	printf("\n");
+
+	megahal_end(session);
+	megahal_close(personality);
+	return(0);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Time_Learn
+ *
+ *		Purpose:		Open the personality, and learn every line of its
+ *						training text again, timing only learn() itself.
+ */
+int time_learn(char *directory, char **text, int count)
+{
+	PERSONALITY *personality;
+	SESSION *session;
+	DICTIONARY *words;
+	GUARD guard;
+	double start;
+	double taken=0.0;
+	unsigned long symbols=0;
+	int i;
+
+	personality=megahal_open(directory, 0);
+	session=megahal_session(1);
+	if((personality==NULL)||(session==NULL)) {
+		fprintf(stderr, "Unable to open the personality in %s\n", directory);
+		megahal_end(session);
+		megahal_close(personality);
+		return(1);
+	}
+
+	push_guard(&guard);
+	guard.personality=personality;
+	if(setjmp(guard.failed)!=0) {
+		pop_guard(&guard);
+		megahal_end(session);
+		megahal_close(personality);
+		return(1);
+	}
+
+	for(i=0; i<count; ++i) {
+		words=session_words(session, text[i]);
+		start=seconds();
+		learn(personality->model, words);
+		taken+=seconds()-start;
+		symbols+=words->size;
+	}
+	pop_guard(&guard);
+
+	printf("Learnt %d lines of %lu words in %.3f seconds\n", count, symbols, taken);
+	printf("%16s %14.0f lines/second %12.0f words/second\n", "learn()",
+		(taken>0.0)?(double)count/taken:0.0, (taken>0.0)?(double)symbols/taken:0.0);
+
+	megahal_end(session);
+	megahal_close(personality);
+	return(0);
+}
+
+/*===========================================================================*/
@@ -0,0 +1,146 @@
+
+/*===========================================================================*/
+
+/*
+ *  Copyright (C) 1998 Jason Hutchens
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the license or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE.  See the Gnu Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*===========================================================================*/
+
+/*
+ *		File:			replies.c
+ *
+ *		Purpose:		Measure how many replies a personality makes each second
+ *						on a single thread.  Every line of the file of inputs
+ *						given, other than comments and empty lines, is replied
+ *						to, by the personality in the directory given both as it
+ *						is and frozen.  Rather than a time limit, which would fix
+ *						the rate, each reply is given the patience to stop after
+ *						so many candidates in a row are no better than the best.
+ *						Each megahal_reply() is timed as a whole, from looking up
+ *						the words of the input to writing out the reply, and the
+ *						replies made and the candidates tried each second are
+ *						printed.
+ *
+ *		Usage:		replies <directory> <inputs> [<patience>]
+ */
+
+/*===========================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "megahal.h"
+#include "timer.h"
+
+/*===========================================================================*/
+
+#define LONGEST 60000
+
+int answer(char *, int, char *, unsigned long);
+
+/*===========================================================================*/
+
+int main(int argc, char *argv[])
+{
+	unsigned long patience=100;
+
+	if((argc!=3)&&(argc!=4)) {
+		fprintf(stderr, "Usage: %s <directory> <inputs> [<patience>]\n", argv[0]);
+		return(2);
+	}
+	if(argc>3) patience=strtoul(argv[3], NULL, 10);
+	if(patience==0) {
+		fprintf(stderr, "%s: the patience must be positive\n", argv[0]);
+		return(2);
+	}
+
+	if(answer(argv[1], 0, argv[2], patience)!=0) return(1);
+	if(answer(argv[1], MEGAHAL_FROZEN, argv[2], patience)!=0) return(1);
+
+	return(0);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Answer
+ *
+ *		Purpose:		Open the personality with the flags given, reply to every
+ *						input in the file given, and print the rates at which
+ *						replies were made and candidates tried.
+ */
+int answer(char *directory, int flags, char *inputs, unsigned long patience)
+{
+	PERSONALITY *personality;
+	SESSION *session;
+	EFFORT effort;
+	FILE *file;
+	char line[4096];
+	char buffer[1024];
+	double start;
+	double taken=0.0;
+	unsigned long tried=0;
+	long replies=0;
+	size_t length;
+	int failed=0;
+
+	file=fopen(inputs, "r");
+	if(file==NULL) {
+		fprintf(stderr, "Unable to open %s\n", inputs);
+		return(1);
+	}
+	personality=megahal_open(directory, flags);
+	session=megahal_session(1);
+	if((personality==NULL)||(session==NULL)) {
+		fprintf(stderr, "Unable to open the personality in %s\n", directory);
+		megahal_end(session);
+		megahal_close(personality);
+		fclose(file);
+		return(1);
+	}
+	megahal_limit(session, LONGEST, patience, (float)0.0);
+
+	while(fgets(line, sizeof(line), file)!=NULL) {
+		length=strcspn(line, "\r\n");
+		line[length]='\0';
+		if((line[0]=='#')||(length==0)) continue;
+		start=seconds();
+		if(megahal_reply(personality, session, line, buffer, sizeof(buffer))<0) {
+			failed=1;
+			break;
+		}
+		taken+=seconds()-start;
+		megahal_effort(session, &effort);
+		tried+=effort.tried;
+		++replies;
+	}
+	fclose(file);
+
+	if(failed==0) {
+		printf("%s brain, %ld inputs, patience of %lu\n",
+			((flags&MEGAHAL_FROZEN)!=0)?"Frozen":"Thawed", replies, patience);
+		printf("%12.1f replies/second %12.0f tried/second\n\n",
+			(taken>0.0)?(double)replies/taken:0.0, (taken>0.0)?(double)tried/taken:0.0);
+	}
+
+	megahal_end(session);
+	megahal_close(personality);
+	return(failed);
+}
+
+/*===========================================================================*/
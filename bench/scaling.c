@@ -0,0 +1,162 @@
+
+/*===========================================================================*/
+
+/*
+ *  Copyright (C) 1998 Jason Hutchens
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the license or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE.  See the Gnu Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*===========================================================================*/
+
+/*
+ *		File:			scaling.c
+ *
+ *		Purpose:		Measure how the number of replies tried in the time given
+ *						grows with the number of threads a session replies on.
+ *						The personality in the directory given is opened both as
+ *						it is and frozen, and for each number of threads up to the
+ *						most given, the same inputs are replied to and the replies
+ *						tried each second are printed, along with how many times
+ *						more that is than with a single thread.
+ *
+ *		Usage:		scaling <directory> [<milliseconds> [<threads>]]
+ */
+
+/*===========================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "megahal.h"
+
+/*===========================================================================*/
+
+char *input[]={
+	"Tell me about the fox.",
+	"What is your name?",
+	"Do you like music?",
+	"Where do you live?",
+	"Why is the sky blue?",
+	NULL
+};
+
+int measure(char *, int, unsigned long, int);
+double rate(PERSONALITY *, int, unsigned long);
+
+/*===========================================================================*/
+
+int main(int argc, char *argv[])
+{
+	unsigned long limit=1000;
+	int threads=8;
+
+	if((argc<2)||(argc>4)) {
+		fprintf(stderr, "Usage: %s <directory> [<milliseconds> [<threads>]]\n", argv[0]);
+		return(2);
+	}
+	if(argc>2) limit=strtoul(argv[2], NULL, 10);
+	if(argc>3) threads=atoi(argv[3]);
+	if((limit==0)||(threads<1)) {
+		fprintf(stderr, "%s: the time and the threads must be positive\n", argv[0]);
+		return(2);
+	}
+
+	if(measure(argv[1], 0, limit, threads)!=0) return(1);
+	if(measure(argv[1], MEGAHAL_FROZEN, limit, threads)!=0) return(1);
+
+	return(0);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Measure
+ *
+ *		Purpose:		Open the personality with the flags given, and print the
+ *						rate at which replies are tried for each number of
+ *						threads, as a table.
+ */
+int measure(char *directory, int flags, unsigned long limit, int threads)
+{
+	PERSONALITY *personality;
+	double single=0.0;
+	double tried;
+	int i;
+
+	personality=megahal_open(directory, flags);
+	if(personality==NULL) {
+		fprintf(stderr, "Unable to open the personality in %s\n", directory);
+		return(1);
+	}
+
+	printf("%s brain, %lu milliseconds a reply\n",
+		((flags&MEGAHAL_FROZEN)!=0)?"Frozen":"Thawed", limit);
+	printf("%8s %16s %8s\n", "threads", "tried/second", "speedup");
+	for(i=1; i<=threads; ++i) {
+		tried=rate(personality, i, limit);
+		if(tried<0.0) {
+			megahal_close(personality);
+			return(1);
+		}
+		if(i==1) single=tried;
+		printf("%8d %16.0f %7.2fx\n", i, tried, (single>0.0)?tried/single:0.0);
+		fflush(stdout);
+	}
+	printf("\n");
+
+	megahal_close(personality);
+	return(0);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Rate
+ *
+ *		Purpose:		Reply to each of the inputs on a session with the number
+ *						of threads given, and return the replies tried each
+ *						second, or -1 if the session can't be started.
+ */
+double rate(PERSONALITY *personality, int threads, unsigned long limit)
+{
+	SESSION *session;
+	EFFORT effort;
+	char buffer[1024];
+	unsigned long tried=0;
+	unsigned long taken=0;
+	int i;
+
+	session=megahal_session(threads);
+	if(session==NULL) {
+		fprintf(stderr, "Unable to start a session with %d threads\n", threads);
+		return(-1.0);
+	}
+	megahal_limit(session, limit, 0, (float)0.0);
+
+	for(i=0; input[i]!=NULL; ++i) {
+		if(megahal_reply(personality, session, input[i], buffer, sizeof(buffer))<0) {
+			megahal_end(session);
+			return(-1.0);
+		}
+		megahal_effort(session, &effort);
+		tried+=effort.tried;
+		taken+=limit;
+	}
+
+	megahal_end(session);
+	return((double)tried*1000.0/(double)taken);
+}
+
+/*===========================================================================*/
@@ -0,0 +1,192 @@
+
+/*===========================================================================*/
+
+/*
+ *  Copyright (C) 1998 Jason Hutchens
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the license or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE.  See the Gnu Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*===========================================================================*/
+
+/*
+ *		File:			search.c
+ *
+ *		Purpose:		Measure the kernels which search_node() uses to find a
+ *						symbol among the children of a node.  For each number of
+ *						children, a sorted array of symbols is made, and the
+ *						scalar scan, each vector scan the processor supports, the
+ *						bisection and search_keys() itself, which picks between
+ *						them, look up the same symbols in it for the time given.
+ *						The nanoseconds each lookup takes are printed as a table,
+ *						and every kernel is checked to give the same positions as
+ *						the scalar scan.
+ *
+ *		Usage:		search [<milliseconds>]
+ */
+
+/*===========================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "megahal.h"
+#include "megahal_private.h"
+#include "timer.h"
+
+/*===========================================================================*/
+
+#define QUERIES 4096
+#define WIDEST 4096
+
+typedef struct {
+	char *name;
+	BYTE4 (*search)(BYTE4 *, BYTE4, BYTE4);
+	bool supported;
+} KERNEL;
+
+BYTE4 bisect_keys(BYTE4 *, BYTE4, BYTE4);
+BYTE4 scan_scalar(BYTE4 *, BYTE4, BYTE4);
+BYTE4 search_keys(BYTE4 *, BYTE4, BYTE4);
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+BYTE4 scan_sse2(BYTE4 *, BYTE4, BYTE4);
+BYTE4 scan_avx2(BYTE4 *, BYTE4, BYTE4);
+#endif
+
+KERNEL kernel[]={
+	{ "scalar", scan_scalar, TRUE },
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	{ "sse2", scan_sse2, FALSE },
+	{ "avx2", scan_avx2, FALSE },
+#endif
+	{ "bisect", bisect_keys, TRUE },
+	{ "search_keys", search_keys, TRUE },
+	{ NULL, NULL, FALSE }
+};
+
+BYTE4 fanout[]={ 1, 2, 4, 7, 8, 16, 32, 63, 64, 128, 256, 1024, WIDEST, 0 };
+
+void fill_keys(BYTE4 *, BYTE4, BYTE4 *);
+double time_kernel(KERNEL *, BYTE4 *, BYTE4, BYTE4 *, BYTE4 *, double);
+
+/*===========================================================================*/
+
+int main(int argc, char *argv[])
+{
+	static BYTE4 keys[WIDEST];
+	static BYTE4 query[QUERIES];
+	static BYTE4 expected[QUERIES];
+	double limit=0.1;
+	double taken;
+	int failed=0;
+	int i;
+	int j;
+
+	if(argc>2) {
+		fprintf(stderr, "Usage: %s [<milliseconds>]\n", argv[0]);
+		return(2);
+	}
+	if(argc>1) limit=atof(argv[1])/1000.0;
+	if(limit<=0.0) {
+		fprintf(stderr, "%s: the time must be positive\n", argv[0]);
+		return(2);
+	}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init();
+	kernel[1].supported=__builtin_cpu_supports("sse2")?TRUE:FALSE;
+	kernel[2].supported=__builtin_cpu_supports("avx2")?TRUE:FALSE;
+#endif
+
+	printf("Nanoseconds a lookup, scanning below %d children\n", SCAN_FANOUT);
+	printf("%8s", "children");
+	for(j=0; kernel[j].name!=NULL; ++j)
+		if(kernel[j].supported==TRUE) printf(" %11s", kernel[j].name);
+	printf("\n");
+
+	srand(1);
+	for(i=0; fanout[i]!=0; ++i) {
+		fill_keys(keys, fanout[i], query);
+		for(j=0; j<QUERIES; ++j) expected[j]=scan_scalar(keys, fanout[i], query[j]);
+		printf("%8lu", (unsigned long)fanout[i]);
+		for(j=0; kernel[j].name!=NULL; ++j) {
+			if(kernel[j].supported==FALSE) continue;
+			taken=time_kernel(&kernel[j], keys, fanout[i], query, expected, limit);
+			if(taken<0.0) {
+				printf(" %11s", "WRONG");
+				failed=1;
+			} else {
+				printf(" %11.1f", taken);
+			}
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+
+	return(failed);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Fill_Keys
+ *
+ *		Purpose:		Make a sorted array of distinct symbols with gaps between
+ *						them, and symbols to look up in it, about a third of
+ *						which are missing from it.
+ */
+void fill_keys(BYTE4 *keys, BYTE4 size, BYTE4 *query)
+{
+	register int i;
+	BYTE4 symbol=(BYTE4)(rand()%4);
+
+	for(i=0; i<(int)size; ++i) {
+		keys[i]=symbol;
+		symbol+=(BYTE4)(1+rand()%3);
+	}
+	for(i=0; i<QUERIES; ++i) query[i]=(BYTE4)(rand()%(int)symbol);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Time_Kernel
+ *
+ *		Purpose:		Look every symbol up with a kernel, over and over until
+ *						the time given has passed, and return the nanoseconds
+ *						each lookup took, or -1 if any position was wrong.
+ */
+double time_kernel(KERNEL *kernel, BYTE4 *keys, BYTE4 size, BYTE4 *query,
+	BYTE4 *expected, double limit)
+{
+	register int i;
+	double start;
+	double taken;
+	unsigned long lookups=0;
+
+	for(i=0; i<QUERIES; ++i)
+		if(kernel->search(keys, size, query[i])!=expected[i]) return(-1.0);
+
+	start=seconds();
+	do {
+		for(i=0; i<QUERIES; ++i)
+			if(kernel->search(keys, size, query[i])!=expected[i]) return(-1.0);
+		lookups+=QUERIES;
+		taken=seconds()-start;
+	} while(taken<limit);
+
+	return(taken*1.0e9/(double)lookups);
+}
+
+/*===========================================================================*/
@@ -0,0 +1,244 @@
+
+/*===========================================================================*/
+
+/*
+ *  Copyright (C) 1998 Jason Hutchens
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the license or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE.  See the Gnu Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*===========================================================================*/
+
+/*
+ *		File:			storage.c
+ *
+ *		Purpose:		Measure how quickly a brain is saved and loaded in each
+ *						of the formats it can be saved in.  The personality in
+ *						the directory given is saved in each format in turn and
+ *						opened again, the best time of several rounds is taken
+ *						for each, and the size of the brain and the rate at which
+ *						it was written and read are printed.  A brain which has
+ *						been mapped is always saved as an image again, so the
+ *						image goes last, and the brain the directory had is put
+ *						back at the end.  A brain is trained from megahal.trn if
+ *						the directory doesn't have one yet, so a large brain is
+ *						best made first with the training benchmark.
+ *
+ *		Usage:		storage <directory> [<rounds>]
+ */
+
+/*===========================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "megahal.h"
+#include "timer.h"
+
+/*===========================================================================*/
+
+typedef struct {
+	char *name;
+	int flags;
+} FORMAT;
+
+FORMAT format[]={
+	{ "plain", 0 },
+	{ "compact", MEGAHAL_COMPACT },
+	{ "mapped", MEGAHAL_MAPPED },
+	{ NULL, 0 }
+};
+
+int measure(char *, FORMAT *, int);
+double megabytes(long, double);
+long brain_size(char *);
+int copy_brain(char *, char *, char *);
+
+/*===========================================================================*/
+
+int main(int argc, char *argv[])
+{
+	PERSONALITY *personality;
+	char filename[1024];
+	int rounds=3;
+	int i;
+
+	if((argc!=2)&&(argc!=3)) {
+		fprintf(stderr, "Usage: %s <directory> [<rounds>]\n", argv[0]);
+		return(2);
+	}
+	if(argc>2) rounds=atoi(argv[2]);
+	if(rounds<1) {
+		fprintf(stderr, "%s: the rounds must be positive\n", argv[0]);
+		return(2);
+	}
+
+	/*
+	 *		Make sure there is a brain to measure before anything is timed.
+	 */
+	if(brain_size(argv[1])<0) {
+		personality=megahal_open(argv[1], 0);
+		if((personality==NULL)||(megahal_save(personality)!=0)) {
+			fprintf(stderr, "Unable to make a brain in %s\n", argv[1]);
+			megahal_close(personality);
+			return(1);
+		}
+		megahal_close(personality);
+	}
+
+	if(copy_brain(argv[1], "megahal.brn", "megahal.brn.bench")!=0) {
+		fprintf(stderr, "Unable to keep a copy of the brain in %s\n", argv[1]);
+		return(1);
+	}
+
+	printf("%-8s %12s %9s %9s %9s %9s\n",
+		"format", "bytes", "save s", "MB/s", "load s", "MB/s");
+	for(i=0; format[i].name!=NULL; ++i)
+		if(measure(argv[1], &format[i], rounds)!=0) break;
+
+	if(copy_brain(argv[1], "megahal.brn.bench", "megahal.brn")!=0) {
+		fprintf(stderr, "Unable to put the brain in %s back\n", argv[1]);
+		return(1);
+	}
+	sprintf(filename, "%s/.megahal/megahal.brn.bench", argv[1]);
+	remove(filename);
+
+	return((format[i].name==NULL)?0:1);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Measure
+ *
+ *		Purpose:		Save the brain in one format and open it again, as many
+ *						times as there are rounds, and print the best times.
+ */
+int measure(char *directory, FORMAT *format, int rounds)
+{
+	PERSONALITY *personality;
+	double save=0.0;
+	double load=0.0;
+	double start;
+	double taken;
+	long size;
+	int i;
+
+	personality=megahal_open(directory, format->flags);
+	for(i=0; i<rounds; ++i) {
+		if(personality==NULL) {
+			fprintf(stderr, "Unable to open the personality in %s\n", directory);
+			return(1);
+		}
+		start=seconds();
+		if(megahal_save(personality)!=0) {
+			fprintf(stderr, "Unable to save the brain in %s\n", directory);
+			megahal_close(personality);
+			return(1);
+		}
+		taken=seconds()-start;
+		if((i==0)||(taken<save)) save=taken;
+		megahal_close(personality);
+
+		start=seconds();
+		personality=megahal_open(directory, format->flags);
+		taken=seconds()-start;
+		if((i==0)||(taken<load)) load=taken;
+	}
+	megahal_close(personality);
+
+	size=brain_size(directory);
+	printf("%-8s %12ld %9.3f %9.1f %9.3f %9.1f\n", format->name, size,
+		save, megabytes(size, save), load, megabytes(size, load));
+	fflush(stdout);
+
+	return(0);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Megabytes
+ *
+ *		Purpose:		Return the number of megabytes each second at which the
+ *						given number of bytes were handled.
+ */
+double megabytes(long size, double taken)
+{
+	if(taken<=0.0) return(0.0);
+
+	return((double)size/(1024.0*1024.0)/taken);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Brain_Size
+ *
+ *		Purpose:		Return the size of the brain saved in a directory, or -1
+ *						if there isn't one.
+ */
+long brain_size(char *directory)
+{
+	char filename[1024];
+	FILE *file;
+	long size;
+
+	sprintf(filename, "%s/.megahal/megahal.brn", directory);
+	file=fopen(filename, "rb");
+	if(file==NULL) return(-1);
+	fseek(file, 0, SEEK_END);
+	size=ftell(file);
+	fclose(file);
+
+	return(size);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Copy_Brain
+ *
+ *		Purpose:		Copy one file kept by a personality to another,
+ *						returning zero if it worked.
+ */
+int copy_brain(char *directory, char *from, char *to)
+{
+	char filename[1024];
+	char buffer[65536];
+	FILE *input;
+	FILE *output;
+	size_t length;
+	int failed=0;
+
+	sprintf(filename, "%s/.megahal/%s", directory, from);
+	input=fopen(filename, "rb");
+	if(input==NULL) return(1);
+	sprintf(filename, "%s/.megahal/%s", directory, to);
+	output=fopen(filename, "wb");
+	if(output==NULL) {
+		fclose(input);
+		return(1);
+	}
+
+	while((length=fread(buffer, 1, sizeof(buffer), input))>0)
+		if(fwrite(buffer, 1, length, output)!=length) failed=1;
+	if(ferror(input)!=0) failed=1;
+	fclose(input);
+	if(fclose(output)!=0) failed=1;
+
+	return(failed);
+}
+
+/*===========================================================================*/
@@ -0,0 +1,54 @@
+
+/*===========================================================================*/
+
+/*
+ *  Copyright (C) 1998 Jason Hutchens
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the license or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE.  See the Gnu Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*===========================================================================*/
+
+/*
+ *		File:			timer.c
+ *
+ *		Purpose:		The clock which the benchmarks in this directory time
+ *						themselves with.
+ */
+
+/*===========================================================================*/
+
+#include <time.h>
+#include "timer.h"
+
+/*===========================================================================*/
+
+/*
+ *		Function:	Seconds
+ *
+ *		Purpose:		Return the number of seconds since some fixed time, from a
+ *						clock which is never set back, so that the difference
+ *						between two readings is the time which passed.
+ */
+double seconds(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return((double)now.tv_sec+(double)now.tv_nsec/1e9);
+}
+
+/*===========================================================================*/
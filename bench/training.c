@@ -0,0 +1,198 @@
+
+/*===========================================================================*/
+
+/*
+ *  Copyright (C) 1998 Jason Hutchens
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the license or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE.  See the Gnu Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*===========================================================================*/
+
+/*
+ *		File:			training.c
+ *
+ *		Purpose:		Measure how quickly a brain is trained.  The training
+ *						text given is copied into the directory given as many
+ *						times as asked, with the words of each copy after the
+ *						first tagged with letters of their own, so that the brain
+ *						grows with the copies as it would with more text, rather
+ *						than only its counts going up.  A personality is then
+ *						opened from the directory, which trains it, and the time
+ *						taken is printed along with the size of the brain.  The
+ *						brain is saved afterwards, so that the other benchmarks
+ *						can be run against it.
+ *
+ *		Usage:		training <training text> <directory> [<copies>]
+ */
+
+/*===========================================================================*/
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "megahal.h"
+#include "timer.h"
+
+/*===========================================================================*/
+
+char memory[256]="";
+
+int copy_text(char *, char *, int, long *);
+void tag_line(FILE *, char *, int);
+void keep_memory(char *);
+
+/*===========================================================================*/
+
+int main(int argc, char *argv[])
+{
+	PERSONALITY *personality;
+	char filename[1024];
+	double start;
+	double taken;
+	long lines=0;
+	int copies=1;
+
+	if((argc!=3)&&(argc!=4)) {
+		fprintf(stderr, "Usage: %s <training text> <directory> [<copies>]\n", argv[0]);
+		return(2);
+	}
+	if(argc>3) copies=atoi(argv[3]);
+	if(copies<1) {
+		fprintf(stderr, "%s: the copies must be positive\n", argv[0]);
+		return(2);
+	}
+
+	if(copy_text(argv[1], argv[2], copies, &lines)!=0) return(1);
+	sprintf(filename, "%s/.megahal/megahal.brn", argv[2]);
+	remove(filename);
+
+	start=seconds();
+	personality=megahal_open(argv[2], 0);
+	taken=seconds()-start;
+	if(personality==NULL) {
+		fprintf(stderr, "Unable to open the personality in %s\n", argv[2]);
+		return(1);
+	}
+
+	megahal_stats(personality, keep_memory);
+	printf("Trained on %ld lines in %.3f seconds, %.0f lines/second\n",
+		lines, taken, (taken>0.0)?(double)lines/taken:0.0);
+	printf("%s\n", memory);
+
+	if(megahal_save(personality)!=0) {
+		fprintf(stderr, "Unable to save the brain in %s\n", argv[2]);
+		megahal_close(personality);
+		return(1);
+	}
+	megahal_close(personality);
+
+	return(0);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Copy_Text
+ *
+ *		Purpose:		Write the training text of the personality in a
+ *						directory, made of the given number of copies of another
+ *						text, counting the lines it has.  The directory which
+ *						holds it is created if need be.
+ */
+int copy_text(char *from, char *directory, int copies, long *lines)
+{
+	char filename[1024];
+	char line[4096];
+	FILE *input;
+	FILE *output;
+	int failed;
+	int i;
+
+	input=fopen(from, "r");
+	if(input==NULL) {
+		fprintf(stderr, "Unable to open %s\n", from);
+		return(1);
+	}
+	mkdir(directory, 0755);
+	sprintf(filename, "%s/.megahal", directory);
+	mkdir(filename, 0755);
+	sprintf(filename, "%s/.megahal/megahal.trn", directory);
+	output=fopen(filename, "w");
+	if(output==NULL) {
+		fprintf(stderr, "Unable to create %s\n", filename);
+		fclose(input);
+		return(1);
+	}
+
+	for(i=0; i<copies; ++i) {
+		rewind(input);
+		while(fgets(line, sizeof(line), input)!=NULL) {
+			tag_line(output, line, i);
+			++*lines;
+		}
+	}
+
+	fclose(input);
+	failed=ferror(output);
+	if(fclose(output)!=0) failed=1;
+	if(failed!=0) fprintf(stderr, "Unable to write %s\n", filename);
+
+	return(failed);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Tag_Line
+ *
+ *		Purpose:		Write a line of text with the letters which make up the
+ *						number of its copy after every word, so that each copy
+ *						of the text has words of its own.  The first copy is left
+ *						as it is.  The tag is made of letters, since words are
+ *						split where letters meet digits.
+ */
+void tag_line(FILE *file, char *line, int copy)
+{
+	char tag[16];
+	int length=0;
+	int i;
+
+	for(i=copy; i>0; i/=26) tag[length++]=(char)('A'+i%26);
+	tag[length]='\0';
+
+	for(i=0; line[i]!='\0'; ++i) {
+		fputc(line[i], file);
+		if((length>0)&&(isalpha((unsigned char)line[i])!=0)&&
+			(isalpha((unsigned char)line[i+1])==0)&&(line[i+1]!='\'')) fputs(tag, file);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Keep_Memory
+ *
+ *		Purpose:		Keep the line of the report on a brain which gives the
+ *						memory it takes.
+ */
+void keep_memory(char *line)
+{
+	if(strncmp(line, "Memory:", 7)==0) strncpy(memory, line, sizeof(memory)-1);
+}
+
+/*===========================================================================*/
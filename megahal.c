@@ -128,7 +128,7 @@
 #else
 #include <sys/types.h>
 #endif
-#include "megahal.h"
+#include "megahal_private.h"
 #if defined(DEBUG)
 #include "debug.h"
 #endif
@@ -138,82 +138,237 @@
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#if !defined(DOS) && !defined(__mac_os)
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
+#define THREADS
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_SCAN
+#include <immintrin.h>
+#endif
 
 /*===========================================================================*/
 
-void add_aux(MODEL *, DICTIONARY *, STRING);
-void add_key(MODEL *, DICTIONARY *, STRING);
-void add_node(TREE *, TREE *, int);
+void add_aux(MODEL *, KEYSET *, STRING);
+void add_key(MODEL *, KEYSET *, STRING);
+void add_keyword(KEYSET *, BYTE4);
+void add_node(NODEPOOL *, TREE *, TREE *, int);
 void add_swap(SWAP *, char *, char *);
-TREE *add_symbol(TREE *, BYTE2);
-BYTE2 add_word(DICTIONARY *, STRING);
-int babble(MODEL *, DICTIONARY *, DICTIONARY *);
+TREE *add_symbol(NODEPOOL *, TREE *, BYTE4, BYTE4, BYTE4);
+BYTE4 add_word(DICTIONARY *, STRING);
+int babble(MODEL *, KEYSET *);
 bool boundary(char *, int);
+void bound_surprise(MODEL *, KEYSET *);
+size_t branch_size(BYTE4);
+int choose(unsigned short *, int);
+unsigned long compact_length(TREE *, BYTE4);
+int compare_counts(const void *, const void *);
+int compare_words(const void *, const void *);
+BYTE4 count_nodes(TREE *);
+void census_frozen(MODEL *, FROZEN *, unsigned long *);
+FROZEN *compact_frozen(FROZEN *, BYTE1 *);
 void capitalize(char *);
+void clear_keyset(PERSONALITY *, KEYSET *);
+void close_journal(PERSONALITY *);
+void census_model(MODEL *);
+void census_tree(MODEL *, TREE *, unsigned long *, int);
 void changevoice(DICTIONARY *, int);
-void change_personality(DICTIONARY *, int, MODEL **);
+unsigned long command_size(DICTIONARY *, int);
+void change_personality(DICTIONARY *, int, PERSONALITY **);
+PERSONALITY *current_personality(void);
 int comeco(char *orig, char *dest,int num);
 void delay(char *);
+void discard_journal(PERSONALITY *);
 void die(int);
-bool dissimilar(DICTIONARY *, DICTIONARY *);
+bool dissimilar(REPLY *, REPLY *);
 void error(char *, char *, ...);
-float evaluate_reply(MODEL *, DICTIONARY *, DICTIONARY *);
+float evaluate_reply(MODEL *, KEYSET *, REPLY *, float);
 COMMAND_WORDS execute_command(DICTIONARY *, int *);
 void exithal(void);
+BYTE4 find_frozen(FROZEN *, BYTE4, int);
+TREE *find_hashed(TREE *, int);
+BYTE4 *frozen_totals(FROZEN *, BYTE4);
+void total_frozen(FROZEN *);
 TREE *find_symbol(TREE *, int);
-TREE *find_symbol_add(TREE *, int);
-BYTE2 find_word(DICTIONARY *, STRING);
-char *format_output(char *);
+TREE *find_symbol_add(NODEPOOL *, TREE *, int);
+BYTE4 find_word(DICTIONARY *, STRING);
+char *format_output(SESSION *, char *, int);
+void flush_stream(STREAM *);
 void free_dictionary(DICTIONARY *);
+void free_frozen(FROZEN *);
+void free_image(MODEL *);
+void free_keyset(KEYSET *);
+unsigned long frozen_size(FROZEN *);
+void free_branch(NODEPOOL *, TREE **, BYTE4);
 void free_model(MODEL *);
-void free_tree(TREE *);
+void free_personality(PERSONALITY *);
+void free_pool(NODEPOOL *);
+void free_reply(REPLY *);
+bool free_stream(STREAM *);
+void free_swap(SWAP *);
+void free_tree(NODEPOOL *, TREE *);
 void free_word(STRING);
-void free_words(DICTIONARY *);
-char *generate_reply(MODEL *, DICTIONARY *);
+int fill_buffer(char *, char *, int);
+STRING fold_word(STRING, char *);
+void freeze_model(MODEL *);
+FROZEN *freeze_tree(FROZEN *, TREE *);
+unsigned long forget_symbols(NODEPOOL *, TREE *, BYTE1 *);
+unsigned long forget_frozen(FROZEN *, BYTE1 *, BYTE1 *);
+BYTE4 frozen_level(FROZEN *, int);
+char *generate_reply(PERSONALITY *, SESSION *, DICTIONARY *);
+char *greet_text(PERSONALITY *, SESSION *);
+void *generate_worker(void *);
+void generate_replies(WORKER *);
+unsigned long milliseconds(void);
+BYTE4 get_byte4(STREAM *);
+BYTE4 get_varint(STREAM *);
+bool get_bytes(STREAM *, void *, size_t);
+void hash_dictionary(DICTIONARY *);
+void hash_node(TREE *);
+void index_node(TREE *);
+BYTE4 hash_symbol(BYTE4);
+BYTE4 hash_key(STRING);
 void help(void);
 void ignore(int);
+void journal_words(PERSONALITY *, DICTIONARY *);
 void initialize_context(MODEL *);
 void initialize_dictionary(DICTIONARY *);
-bool initialize_error(char *);
+int keycmp(STRING, STRING);
+BYTE4 key_prefix(STRING);
 DICTIONARY *initialize_list(char *);
+bool index_dictionary(DICTIONARY *, bool);
+char *intern_word(DICTIONARY *, STRING);
 #ifdef __mac_os
 bool initialize_speech(void);
 #endif
-bool initialize_status(char *);
 SWAP *initialize_swap(char *);
 void learn(MODEL *, DICTIONARY *);
 void listvoices(void);
-void load_dictionary(FILE *, DICTIONARY *);
+void load_dictionary(STREAM *, DICTIONARY *, int);
+bool load_image(char *, MODEL *);
 bool load_model(char *, MODEL *);
-void load_personality(MODEL **);
-void load_tree(FILE *, TREE *);
-void load_word(FILE *, DICTIONARY *);
+bool load_node(STREAM *, NODEPOOL *, TREE *, BYTE4, int, bool *);
+void *load_section(void *);
+bool load_sections(STREAM *, char *, MODEL *, int);
+void load_personality(PERSONALITY **);
+void load_tree(STREAM *, NODEPOOL *, TREE *, int, int);
+BYTE4 load_byte4(FILE *);
 void lower(char *string);
-void make_greeting(DICTIONARY *);
-DICTIONARY *make_keywords(MODEL *, DICTIONARY *);
-char *make_output(DICTIONARY *);
+void make_greeting(PERSONALITY *, SESSION *);
+void make_guard_key(void);
+KEYSET *make_keywords(PERSONALITY *, MODEL *, KEYSET *, DICTIONARY *);
+void mark_frozen(FROZEN *, BYTE1 *);
+void mark_nodes(FROZEN *, BYTE1 *);
+void mark_symbols(TREE *, BYTE1 *);
+unsigned long model_size(MODEL *);
+float log_predict(MODEL *, int);
+char *make_output(SESSION *, DICTIONARY *, REPLY *);
+char *copy_output(SESSION *, char *);
 void make_words(char *, DICTIONARY *);
+FROZEN *map_tree(BYTE4 **, BYTE4, BYTE4);
+BYTE4 merge_branch(MODEL *, BYTE4, TREE *, BYTE4 **, BYTE4 **);
+void merge_pool(NODEPOOL *, NODEPOOL *);
 DICTIONARY *new_dictionary(void);
+KEYSET *new_keyset(void);
+PERSONALITY *new_personality(char *, int);
+void open_personality(PERSONALITY *);
+FILE *open_log(char *, char *);
+void open_session(SESSION *);
+REPLY *new_reply(void);
+SESSION *new_session(int);
 MODEL *new_model(int);
-TREE *new_node(void);
+TREE **new_branch(NODEPOOL *, BYTE4);
+TREE *new_node(NODEPOOL *);
+BYTE4 *node_totals(TREE *);
+NODEPOOL *new_pool(void);
+STREAM *new_stream(FILE *, unsigned long);
 SWAP *new_swap(void);
+char *pool_word(DICTIONARY *, BYTE4);
 bool print_header(FILE *);
+float predict_symbol(MODEL *, int, int);
 bool progress(char *, int, int);
+bool hopeless(KEYSET *, double, int, int, int, float);
+void push_guard(GUARD *);
+void put_byte4(STREAM *, BYTE4);
+void put_varint(STREAM *, BYTE4);
+void put_bytes(STREAM *, void *, size_t);
+unsigned long parse_size(STRING);
+unsigned long scale_size(unsigned long, char);
+void prune_dictionary(MODEL *);
+void pack_words(DICTIONARY *);
+unsigned long prune_model(MODEL *, unsigned long);
+unsigned long pruned_size(MODEL *, unsigned long);
+unsigned long packed_size(TREE *);
+unsigned long prune_tree(NODEPOOL *, TREE *, int, int, BYTE4, BYTE1 *);
+unsigned long prune_frozen(FROZEN *, BYTE1 *, int, BYTE4, BYTE1 *);
 char *read_input(char *);
-DICTIONARY *reply(MODEL *, DICTIONARY *);
-void save_dictionary(FILE *, DICTIONARY *);
-void save_model(char *, MODEL *);
-void save_tree(FILE *, TREE *);
-void save_word(FILE *, STRING);
+void report(char *);
+void respond(PERSONALITY *, SESSION *, char *, char *, int);
+char *reply_text(PERSONALITY *, SESSION *, char *);
+REPLY *reply(MODEL *, KEYSET *, REPLY *);
+void append_reply(REPLY *, BYTE4);
+void copy_reply(REPLY *, REPLY *);
+void grow_reply(REPLY *);
+void prepend_reply(REPLY *, BYTE4);
+void pop_guard(GUARD *);
+void fail_guard(GUARD *);
+void prepare_keys(WORKER *, KEYSET *, bool);
+void prepare_worker(WORKER *, MODEL *, unsigned short *);
+void release_words(DICTIONARY *);
+void renumber_tree(TREE *, BYTE4 *);
+void renumber_frozen(FROZEN *, BYTE4 *);
+long replay_file(MODEL *, char *);
+void replay_journal(PERSONALITY *);
+bool reap_save(PERSONALITY *, bool);
+void rotate_journal(PERSONALITY *);
+void run_sections(SECTION *, int, void *(*)(void *));
+void run_workers(WORKER *, int);
+bool save_background(PERSONALITY *);
+bool save_foreground(PERSONALITY *);
+bool save_image(FILE *, MODEL *);
+void save_byte4(FILE *, BYTE4);
+void save_dictionary(STREAM *, DICTIONARY *, int);
+bool save_model(PERSONALITY *);
+DICTIONARY *session_words(SESSION *, char *);
+void *save_section(void *);
+bool save_sections(FILE *, char *, MODEL *, int);
+void save_node(STREAM *, TREE *, BYTE4, int);
+void save_tree(STREAM *, TREE *, int);
+void save_word(STREAM *, STRING, int);
 int search_dictionary(DICTIONARY *, STRING, bool *);
+BYTE4 search_table(DICTIONARY *, STRING);
 int search_node(TREE *, int, bool *);
-int seed(MODEL *, DICTIONARY *);
-void show_dictionary(DICTIONARY *);
+BYTE4 sample_branch(BYTE4 *, BYTE4, BYTE4, BYTE4, BYTE4 *);
+BYTE4 bisect_keys(BYTE4 *, BYTE4, BYTE4);
+BYTE4 scan_scalar(BYTE4 *, BYTE4, BYTE4);
+BYTE4 scan_select(BYTE4 *, BYTE4, BYTE4);
+void select_scan(void);
+#ifdef SIMD_SCAN
+BYTE4 scan_sse2(BYTE4 *, BYTE4, BYTE4);
+BYTE4 scan_avx2(BYTE4 *, BYTE4, BYTE4);
+#endif
+BYTE4 search_keys(BYTE4 *, BYTE4, BYTE4);
+int seed(MODEL *, KEYSET *);
+void show_dictionary(PERSONALITY *);
+void show_effort(EFFORT *);
+void show_stats(MODEL *, void (*)(char *));
+BYTE4 *shrink_nodes(BYTE4 *, BYTE4);
+void split_tree(TREE *, SECTION *, int, int);
+void start_journal(PERSONALITY *);
+bool stop_workers(WORKER *, bool);
 void speak(char *);
+void start_context(MODEL *, TREE *, FROZEN *);
 bool status(char *, ...);
 #ifdef __mac_os
 char *strdup(const char *);
 #endif
+void thaw_model(MODEL *);
+GUARD *top_guard(void);
+TREE *thaw_tree(NODEPOOL *, FROZEN *);
 void train(MODEL *, char *);
 void typein(char);
 void update_context(MODEL *, int);
@@ -221,35 +376,41 @@ void update_model(MODEL *, int);
 void upper(char *);
 bool warn(char *, char *, ...);
 int wordcmp(STRING, STRING);
-bool word_exists(DICTIONARY *, STRING);
-void write_input(char *);
-void write_output(char *);
+STRING word_key(STRING);
+void write_input(SESSION *, char *);
+void write_output(SESSION *, char *);
 int rnd(int);
 #if defined(DOS) || defined(__mac_os)
 void usleep(int);
 #endif
 int fim(char *orig, char *dest, int num);
 void usage(char *argv);
+int varint_size(BYTE4);
 
 /*===========================================================================*/
 
-int width=75;
 int order=5;
-int timeout=2;
+unsigned long timeout=REPLY_LIMIT;
+unsigned long patience=0;
+int workers=1;
 int sd, port, quiet, debug;
 bool typing_delay=FALSE;
+int options=MEGAHAL_JOURNAL|MEGAHAL_LOG|MEGAHAL_BACKGROUND|MEGAHAL_PROGRESS;
 bool speech=FALSE;
-bool used_key;
 bool connected;
-DICTIONARY *ban=NULL;
-DICTIONARY *aux=NULL;
 DICTIONARY *fin=NULL;
-DICTIONARY *grt=NULL;
-SWAP *swp=NULL;
-FILE *errorfp=stderr;
-FILE *statusfp=stdout;
 char *directory=NULL;
 char *last=NULL;
+BYTE4 (*scan_keys)(BYTE4 *, BYTE4, BYTE4)=scan_select;
+#ifdef THREADS
+pthread_mutex_t totals_lock=PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t session_lock=PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t stop_lock=PTHREAD_MUTEX_INITIALIZER;
+pthread_key_t guard_key;
+pthread_once_t guard_once=PTHREAD_ONCE_INIT;
+#else
+GUARD *guarded=NULL;
+#endif
 char host[255],
   nick[32],
   pass[32],
@@ -272,6 +433,8 @@ COMMAND command[] = {
 	{ { 6, "VOICES" }, "list available voices for speech", VOICELIST },
 	{ { 5, "VOICE" }, "switches to voice specified", VOICE },
 	{ { 5, "BRAIN" }, "change to another MegaHAL personality", BRAIN },
+	{ { 5, "PRUNE" }, "forget rare phrases until the brain fits in the bytes specified", PRUNE },
+	{ { 5, "STATS" }, "shows the size and shape of MegaHAL's brain", STATS },
 	{ { 4, "HELP" }, "displays this message", HELP }
 };
 
@@ -281,6 +444,8 @@ COMMAND command_net[] = {
         { { 4, "SAVE" }, "saves the current MegaHAL brain", SAVE },
         { { 6, "RELOAD" }, "reload the last saved MegaHAL brain *without* save it", RELOAD },
         { { 5, "BRAIN" }, "change to another MegaHAL personality", BRAIN },
+        { { 5, "PRUNE" }, "forget rare phrases until the brain fits in the bytes specified", PRUNE },
+        { { 5, "STATS" }, "shows the size and shape of MegaHAL's brain", STATS },
         { { 4, "HELP" }, "displays this message", HELP }
 };
 
@@ -295,6 +460,7 @@ SpeechChannel gSpeechChannel = nil;
 
 /*===========================================================================*/
 
+#ifndef LIBMEGAHAL
 /*
  *		Function:	Main
  *
@@ -311,12 +477,27 @@ int main(int argc, char *argv[])
 	bool enabled[3];
 
 	char *input=NULL;
-	char *output=NULL;
+	char output[2048];
 	DICTIONARY *words=NULL;
-	DICTIONARY *greets=NULL;
-	MODEL *model=NULL;
+	PERSONALITY *personality=NULL;
+	SESSION *session=NULL;
+	EFFORT effort;
+	long size;
 	int position=0;
 	int opt, kind;
+	unsigned long budget=0;
+	STRING argument;
+	GUARD guard;
+
+	/*
+	 *		Anything which fails comes back here, which is the one place the
+	 *		program gives up from.
+	 */
+	push_guard(&guard);
+	if(setjmp(guard.failed)!=0) {
+		fprintf(stderr, "MegaHAL died for some reason; check the error log.\n");
+		exit(1);
+	}
 
 	/*
 	 *		Do some initialisation 
@@ -336,7 +517,7 @@ int main(int argc, char *argv[])
 	enabled[1] = FALSE;
 	enabled[2] = FALSE;
 
-	while ((opt = getopt(argc, argv, "h:p:a:i:d:c:n:w:s:qu")) != -1)
+	while ((opt = getopt(argc, argv, "h:p:a:i:d:c:n:w:s:P:t:r:k:qfmuz")) != -1)
 	switch (opt) {
 		case 'h':                                         // server  //
 			sprintf(host, "%s", optarg);
@@ -367,10 +548,41 @@ int main(int argc, char *argv[])
 			break;
 		case 'q':
 			quiet = 1;
+			options &= ~MEGAHAL_PROGRESS;
+			break;
+		case 'f':
+			options |= MEGAHAL_FROZEN;
+			break;
+		case 'm':
+			options |= MEGAHAL_MAPPED;
+			break;
+		case 'P':
+			argument.word = optarg;
+			argument.length = strlen(optarg);
+			budget = parse_size(argument);
+			if (budget == 0) { usage(argv[0]); exithal(); }
+			kind = 0;
+			break;
+		case 'r':                                         // reply ms//
+			timeout = strtoul(optarg, NULL, 10);
+			if (timeout == 0) { usage(argv[0]); exithal(); }
+			break;
+		case 'k':                                         //patience //
+			patience = strtoul(optarg, NULL, 10);
+			break;
+		case 't':                                         // threads //
+			workers = atoi(optarg);
+			if (workers < 1) { usage(argv[0]); exithal(); }
+#ifndef THREADS
+			workers = 1;
+#endif
 			break;
 		case 'u':
 			debug = 1;
 			break;
+		case 'z':
+			options |= MEGAHAL_COMPACT;
+			break;
 		default:
 			usage(argv[0]);
 			exithal();
@@ -378,8 +590,6 @@ int main(int argc, char *argv[])
 	if ((kind != 0) && (kind != 1)) { usage(argv[0]); exithal(); }
 	if ((debug == 1) && (quiet == 1)) { usage(argv[0]); exithal(); }
 	
-	initialize_error(".megahal/megahal.log");
-	initialize_status(".megahal/megahal.txt");
 	ignore(0);
 #ifdef AMIGA
 	_AmigaLocale=OpenLocale(NULL);
@@ -407,14 +617,28 @@ if (!quiet) fprintf(stdout,
 	 *		version of the user's input.
 	 */
 	words=new_dictionary();
-	greets=new_dictionary();
 
 	/*
-	 *		Load the default MegaHAL personality.
+	 *		Load the default MegaHAL personality, and start a session with it.
+	 */
+	change_personality(NULL, 0, &personality);
+	session=megahal_session(workers);
+	if(session==NULL) error("main", "Unable to start a session");
+	megahal_limit(session, timeout, patience, (float)0.0);
+
+	/*
+	 *		When asked to prune the brain offline, do so, save it and quit.
 	 */
-	change_personality(NULL, 0, &model);
-	make_greeting(greets);
-	output=generate_reply(model, greets);
+	if (budget > 0) {
+		size = megahal_prune(personality, budget);
+		if ((size < 0) || (megahal_save(personality) < 0))
+			error("main", "Unable to prune the brain");
+		megahal_close(personality);
+		if (!quiet) printf("MegaHAL's brain is now %ld bytes.\n", size);
+		exithal();
+	}
+
+	respond(personality, session, NULL, output, sizeof(output));
 
 	if (kind == 1) {
 	  if (!host[0]) { sprintf(host, "192.168.1.1"); }
@@ -572,26 +796,29 @@ if (!quiet) fprintf(stdout,
 			        sprintf(input, "PRIVMSG %s :Exiting now without save the brain...\nQUIT Quit requested.\n", chan);
 			        write(sd, input, strlen(input));
 		 	        close(sd);
+			        megahal_forget(personality);
 			        exithal();
 			case QUIT:
 			        sprintf(tmp, "PRIVMSG %s :Exiting and saving the brain right now...\nQUIT Quit requested.\n", chan);
 			        write(sd, input, strlen(input));
 			        close(sd);
-			        save_model(".megahal/megahal.brn", model);
+			        megahal_save(personality);
+			        megahal_close(personality);
 			        exithal();
 			case SAVE:
-			        sprintf(input, "PRIVMSG %s :Saving the brain...\n", chan);
+			        if (megahal_save(personality) == 0)
+			          sprintf(input, "PRIVMSG %s :Saving the brain...\n", chan);
+			        else
+			          sprintf(input, "PRIVMSG %s :Unable to save the brain.\n", chan);
 			        write(sd, input, strlen(input));
-			        save_model(".megahal/megahal.brn", model);
 			        continue;
 			case RELOAD:
 			        sprintf(input, "PRIVMSG %s :Reloading the brain without save...\n", chan);
 			        write(sd, input, strlen(input));
+				megahal_forget(personality);
 				words=new_dictionary();
-				greets=new_dictionary();
-			        change_personality(NULL, 0, &model);
-			        make_greeting(greets);
-			        output=generate_reply(model, greets);
+			        change_personality(NULL, 0, &personality);
+			        respond(personality, session, NULL, output, sizeof(output));
 			        lower(output);
 			        sprintf(input, "PRIVMSG %s :%s", chan, output);
 			        write(sd, output, strlen(output));
@@ -600,22 +827,35 @@ if (!quiet) fprintf(stdout,
 				help();
 				continue;
 			case BRAIN:
-				change_personality(words, position, &model);
-				make_greeting(greets);
-				output=generate_reply(model, greets);
+				change_personality(words, position, &personality);
+				respond(personality, session, NULL, output, sizeof(output));
 				lower(output);
 				bzero(&input2, sizeof(input2));
 				sprintf(input2, "PRIVMSG %s : %s\n", chan, output);
 				write(sd, input2, strlen(input2));
 				if (!quiet) printf("%s\n> ",output); fflush(stdout);
 				continue;
+			case PRUNE:
+				if ((budget = command_size(words, position)) == 0) {
+					sprintf(input2, "PRIVMSG %s :Usage: #PRUNE <bytes>\n", chan);
+					write(sd, input2, strlen(input2)); bzero(&input2, sizeof(input2));
+					continue;
+				}
+				size = megahal_prune(personality, budget);
+				sprintf(input2, "PRIVMSG %s :The brain is now %ld bytes.\n", chan, size);
+				write(sd, input2, strlen(input2)); bzero(&input2, sizeof(input2));
+				continue;
+			case STATS:
+				megahal_stats(personality, report);
+				continue;
 			default:
 				break;	
 		    }
 
-		  make_words(input,words);
-		  learn(model, words);
-		  output=generate_reply(model, words);
+		  megahal_learn(personality, session, input);
+		  respond(personality, session, input, output, sizeof(output));
+		  megahal_effort(session, &effort);
+		  show_effort(&effort);
 		  lower(output);
 		  bzero(&input2, sizeof(input2));
 		  sprintf(input2, "PRIVMSG %s : %s\n", chan, output);
@@ -633,13 +873,13 @@ if (!quiet) fprintf(stdout,
 	  }
 
 	else if (kind == 0) {
-	write_output(output);
+	write_output(session, output);
 	/*
 	 *		Read input, formulate a reply and display it as output
 	 */
 	while(TRUE) {
 		input=read_input("> ");
-		write_input(input);
+		write_input(session, input);
 		make_words(input,words);
 
 		/*
@@ -647,12 +887,16 @@ if (!quiet) fprintf(stdout,
 		 */
 		switch(execute_command(words, &position)) {
 			case EXIT:
+				megahal_forget(personality);
 				exithal();
 			case QUIT:
-				save_model(".megahal/megahal.brn", model);
+				if(megahal_save(personality)<0)
+					printf("Unable to save MegaHAL's brain.\n");
+				megahal_close(personality);
 				exithal();
 			case SAVE:
-				save_model(".megahal/megahal.brn", model);
+				if(megahal_save(personality)<0)
+					printf("Unable to save MegaHAL's brain.\n");
 				continue;
 			case DELAY:
 				typing_delay=!typing_delay;
@@ -672,20 +916,31 @@ if (!quiet) fprintf(stdout,
 				changevoice(words, position);
 				continue;
 			case BRAIN:
-				change_personality(words, position, &model);
-				make_greeting(greets);
-				output=generate_reply(model, greets);
-				write_output(output);
+				change_personality(words, position, &personality);
+				respond(personality, session, NULL, output, sizeof(output));
+				write_output(session, output);
+				continue;
+			case PRUNE:
+				if((budget=command_size(words, position))==0) {
+					printf("Usage: #PRUNE <bytes>\n");
+					continue;
+				}
+				size=megahal_prune(personality, budget);
+				if(size<0) printf("Unable to prune MegaHAL's brain.\n");
+				else printf("MegaHAL's brain is now %ld bytes.\n", size);
+				continue;
+			case STATS:
+				megahal_stats(personality, report);
 				continue;
 			default:
 				break;	
 		}
 
-		upper(input);
-		make_words(input,words);
-		learn(model, words);
-		output=generate_reply(model, words);
-		write_output(output);
+		megahal_learn(personality, session, input);
+		respond(personality, session, input, output, sizeof(output));
+		write_output(session, output);
+		megahal_effort(session, &effort);
+		show_effort(&effort);
 	}
 	}
 
@@ -695,6 +950,7 @@ if (!quiet) fprintf(stdout,
 
 	return(0);
 }
+#endif
 
 /*---------------------------------------------------------------------------*/
 
@@ -762,14 +1018,21 @@ printf("\n  %s [params]     . Uh, the params are these:", argv);
 printf("\n    -a <address>  that: <address>@127.0.0.1");
 printf("\n    -c <chan>     channel to join");
 printf("\n    -d <passwd>   the password of nickserv");
+printf("\n    -f            freeze the brain and don't learn from input");
 printf("\n    -h <server>   the irc server to connect");
 printf("\n    -i <ircname>  your ircname");
+printf("\n    -k <replies>  stop a reply once <replies> in a row are no better");
+printf("\n    -m            save the brain as an image which is mapped on loading");
 printf("\n    -n <nick>     the irc nick to enter");
 printf("\n    -p <port>     the irc port to connect");
+printf("\n    -P <bytes>    prune the brain to fit in <bytes>, save it and quit");
 printf("\n    -q            turn on quiet mode");
+printf("\n    -r <ms>       spend <ms> milliseconds on each reply (2000)");
 printf("\n    -s <system>   something that you want");
+printf("\n    -t <threads>  generate replies on <threads> threads at once");
 printf("\n    -u            turn on debug mode");
-printf("\n    -w <number>   0 to normal mode, 1 to bot mode\n");
+printf("\n    -w <number>   0 to normal mode, 1 to bot mode");
+printf("\n    -z            save the brain in a compact encoding\n");
 }
 
 /*---------------------------------------------------------------------------*/
@@ -834,10 +1097,12 @@ COMMAND_WORDS execute_command(DICTIONARY *words, int *position)
 
 /*---------------------------------------------------------------------------*/
 
+#ifndef LIBMEGAHAL
 /*
  *		Function:	ExitHAL
  *
- *		Purpose:		Terminate the program.
+ *		Purpose:		Terminate the program.  This is only for the program
+ *						itself; the library never ends the program it is in.
  */
 void exithal(void)
 {
@@ -854,6 +1119,7 @@ void exithal(void)
 
 	exit(0);
 }
+#endif
 
 /*---------------------------------------------------------------------------*/
 
@@ -948,20 +1214,42 @@ char *read_input(char *prompt)
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Initialize_Error
+ *		Function:	Open_Log
  *
- *		Purpose:		Close the current error file pointer, and open a new one.
+ *		Purpose:		Open one of the logs kept in the directory of a
+ *						personality for appending, and head it with the time.
  */
-bool initialize_error(char *filename)
+FILE *open_log(char *home, char *name)
 {
-	if(errorfp!=stderr) fclose(errorfp);
-	if(filename==NULL) return(TRUE);
-	errorfp=fopen(filename, "a");
-	if(errorfp==NULL) {
-		errorfp=stderr;
-		return(FALSE);
-	}
-	return(print_header(errorfp));
+	FILE *file;
+	char *filename;
+
+	filename=(char *)malloc(sizeof(char)*(strlen(home)+strlen(SEP)+strlen(name)+10));
+	if(filename==NULL) return(NULL);
+	sprintf(filename, "%s%s.megahal%s%s", home, SEP, SEP, name);
+	file=fopen(filename, "a");
+	free(filename);
+	if(file==NULL) return(NULL);
+	print_header(file);
+
+	return(file);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Current_Personality
+ *
+ *		Purpose:		Return the personality which the innermost guard of this
+ *						thread is working for, if any, so that messages go to its
+ *						logs.
+ */
+PERSONALITY *current_personality(void)
+{
+	GUARD *guard=top_guard();
+
+	if(guard==NULL) return(NULL);
+	return(guard->personality);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -969,59 +1257,143 @@ bool initialize_error(char *filename)
 /*
  *		Function:	Error
  *
- *		Purpose:		Print the specified message to the error file.
+ *		Purpose:		Print the specified message to the error log of the
+ *						personality being worked for, or to the standard error
+ *						if it keeps none, and give up
+ *						on whatever was being done.  Control goes back to the
+ *						innermost guard of the thread, which every entry to the
+ *						library and every worker thread sets, so that a failure
+ *						is returned to the caller rather than ending the program
+ *						it was linked into.
  */
 void error(char *title, char *fmt, ...)
 {
+	PERSONALITY *personality=current_personality();
+	FILE *file=((personality!=NULL)&&(personality->errors!=NULL))?personality->errors:stderr;
+	GUARD *guard;
 	va_list argp;
 
-	fprintf(errorfp, "%s: ", title);
+	fprintf(file, "%s: ", title);
 	va_start(argp, fmt);
-	vfprintf(errorfp, fmt, argp);
+	vfprintf(file, fmt, argp);
 	va_end(argp);
-	fprintf(errorfp, ".\n");
-	fflush(errorfp);
+	fprintf(file, ".\n");
+	fflush(file);
 
-	fprintf(stderr, "MegaHAL died for some reason; check the error log.\n");
+	guard=top_guard();
+	if(guard!=NULL) longjmp(guard->failed, 1);
 
-	exit(1);
+	/*
+	 *		Nothing is called without a guard, so this can't be reached.
+	 */
+	abort();
 }
 
 /*---------------------------------------------------------------------------*/
 
-bool warn(char *title, char *fmt, ...)
+/*
+ *		Function:	Push_Guard
+ *
+ *		Purpose:		Make a guard the one which error() returns to on this
+ *						thread.  The guard must be pushed before setjmp() is
+ *						called on it, so that nothing in it changes afterwards.
+ *						It works for the same personality as the guard outside
+ *						it, unless it is told otherwise.
+ */
+void push_guard(GUARD *guard)
 {
-	va_list argp;
+	guard->outer=top_guard();
+	guard->personality=(guard->outer!=NULL)?guard->outer->personality:NULL;
+#ifdef THREADS
+	pthread_setspecific(guard_key, guard);
+#else
+	guarded=guard;
+#endif
+}
 
-	fprintf(errorfp, "%s: ", title);
-	va_start(argp, fmt);
-	vfprintf(errorfp, fmt, argp);
-	va_end(argp);
-	fprintf(errorfp, ".\n");
-	fflush(errorfp);
+/*---------------------------------------------------------------------------*/
 
-	fprintf(stderr, "MegaHAL emitted a warning; check the error log.\n");
+/*
+ *		Function:	Pop_Guard
+ *
+ *		Purpose:		Go back to the guard which was in place before this one,
+ *						whether or not anything failed.
+ */
+void pop_guard(GUARD *guard)
+{
+#ifdef THREADS
+	pthread_setspecific(guard_key, guard->outer);
+#else
+	guarded=guard->outer;
+#endif
+}
 
-	return(TRUE);
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Fail_Guard
+ *
+ *		Purpose:		Take down a guard which has caught a failure, and pass the
+ *						failure on to the guard outside it.  This lets a function
+ *						free whatever it was building before it gives up.
+ */
+void fail_guard(GUARD *guard)
+{
+	pop_guard(guard);
+	if(guard->outer!=NULL) longjmp(guard->outer->failed, 1);
+	abort();
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Initialize_Status
+ *		Function:	Top_Guard
  *
- *		Purpose:		Close the current status file pointer, and open a new one.
+ *		Purpose:		Return the innermost guard of this thread, if any.
  */
-bool initialize_status(char *filename)
+GUARD *top_guard(void)
 {
-	if(statusfp!=stdout) fclose(statusfp);
-	if(filename==NULL) return(FALSE);
-	statusfp=fopen(filename, "a");
-	if(statusfp==NULL) {
-		statusfp=stdout;
-		return(FALSE);
-	}
-	return(print_header(statusfp));
+#ifdef THREADS
+	pthread_once(&guard_once, make_guard_key);
+	return((GUARD *)pthread_getspecific(guard_key));
+#else
+	return(guarded);
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Make_Guard_Key
+ *
+ *		Purpose:		Create the key under which each thread keeps its guard.
+ */
+void make_guard_key(void)
+{
+#ifdef THREADS
+	pthread_key_create(&guard_key, NULL);
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool warn(char *title, char *fmt, ...)
+{
+	PERSONALITY *personality=current_personality();
+	FILE *file=((personality!=NULL)&&(personality->errors!=NULL))?personality->errors:stderr;
+	va_list argp;
+
+	fprintf(file, "%s: ", title);
+	va_start(argp, fmt);
+	vfprintf(file, fmt, argp);
+	va_end(argp);
+	fprintf(file, ".\n");
+	fflush(file);
+
+	if(file!=stderr)
+		fprintf(stderr, "MegaHAL emitted a warning; check the error log.\n");
+
+	return(TRUE);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -1029,16 +1401,20 @@ bool initialize_status(char *filename)
 /*
  *		Function:	Status
  *
- *		Purpose:		Print the specified message to the status file.
+ *		Purpose:		Print the specified message to the status log of the
+ *						personality being worked for, or to the standard output
+ *						if it keeps none.
  */
 bool status(char *fmt, ...)
 {
+	PERSONALITY *personality=current_personality();
+	FILE *file=((personality!=NULL)&&(personality->statuses!=NULL))?personality->statuses:stdout;
 	va_list argp;
 
 	va_start(argp, fmt);
-	vfprintf(statusfp, fmt, argp);
+	vfprintf(file, fmt, argp);
 	va_end(argp);
-	fflush(statusfp);
+	fflush(file);
 
 	return(TRUE);
 }
@@ -1075,7 +1451,7 @@ bool print_header(FILE *file)
  *
  *    Purpose:    Display the output string.
  */
-void write_output(char *output)
+void write_output(SESSION *session, char *output)
 {
    char *formatted;
    char *bit;
@@ -1083,11 +1459,9 @@ void write_output(char *output)
 	capitalize(output);
 	speak(output);
 
-	width=75;
-	formatted=format_output(output);
+	formatted=format_output(session, output, 75);
 	delay(formatted);
-	width=64;
-	formatted=format_output(output);
+	formatted=format_output(session, output, 64);
  
 	bit=strtok(formatted, "\n");
 	if(bit==NULL) (void)status("MegaHAL: %s\n", formatted);
@@ -1141,13 +1515,12 @@ void upper(char *string)
  *
  *    Purpose:    Log the user's input
  */
-void write_input(char *input)
+void write_input(SESSION *session, char *input)
 {
    char *formatted;
    char *bit;
  
-	width=64;
-   formatted=format_output(input);
+   formatted=format_output(session, input, 64);
 
    bit=strtok(formatted, "\n");
 	if(bit==NULL) (void)status("User:    %s\n", formatted);
@@ -1163,27 +1536,24 @@ void write_input(char *input)
  *    Function:   Format_Output
  *
  *    Purpose:    Format a string to display nicely on a terminal of a given
- *                width.
+ *                width.  The string is kept by the session until the next
+ *                one is formatted.
  */
-char *format_output(char *output)
+char *format_output(SESSION *session, char *output, int width)
 {
-   static char *formatted=NULL;
+   char *formatted;
+   size_t length=strlen(output)+2;
    register int i,j,c;
    int l;
 
-   if(formatted==NULL) {
-      formatted=(char *)malloc(sizeof(char));
-      if(formatted==NULL) {
-         error("format_output", "Unable to allocate formatted");
-         return("ERROR");
-      }
-   }   
-
-   formatted=(char *)realloc((char *)formatted, sizeof(char)*(strlen(output)+2));
-   if(formatted==NULL) {
-      error("format_output", "Unable to re-allocate formatted");
-      return("ERROR");
+   if(length>session->formatted_room) {
+      formatted=(char *)realloc(session->formatted, sizeof(char)*length);
+      if(formatted==NULL)
+         error("format_output", "Unable to re-allocate formatted");
+      session->formatted=formatted;
+      session->formatted_room=length;
    }
+   formatted=session->formatted;
 
    l=0;
 	j=0;
@@ -1219,81 +1589,101 @@ char *format_output(char *output)
  *						the dictionary, then return its current identifier
  *						without adding it again.
  */
-BYTE2 add_word(DICTIONARY *dictionary, STRING word)
+BYTE4 add_word(DICTIONARY *dictionary, STRING word)
 {
 	register int i;
 	int position;
 	bool found;
+	BYTE4 slot;
+	BYTE4 symbol=0;
+	BYTE4 *index;
+	BYTE4 *prefixes;
+	STRING *entries;
+	STRING entry;
+	STRING key;
+	char buffer[KEY_BUFFER];
+
+	key=fold_word(word, buffer);
+	if(key.word==NULL) return(0);
 
 	/* 
 	 *		If the word's already in the dictionary, there is no need to add it
 	 */
-	position=search_dictionary(dictionary, word, &found);
+	if(dictionary->table!=NULL) {
+		slot=search_table(dictionary, key);
+		if(dictionary->table[slot]!=0) {
+			symbol=dictionary->table[slot]-1;
+			goto done;
+		}
+	}
+	position=search_dictionary(dictionary, key, &found);
 	if(found==TRUE) goto succeed;
 
-	/* 
-	 *		Increase the number of words in the dictionary
+	/*
+	 *		The key which was folded isn't needed any more, as the shared copy
+	 *		of the word carries one of its own, so one which was allocated is
+	 *		freed before anything can fail.
 	 */
-	dictionary->size+=1;
+	if(key.word!=buffer) free(key.word);
+	entry.length=word.length;
+	entry.word=intern_word(dictionary, word);
+	key=word_key(entry);
 
 	/*
-	 *		Allocate one more entry for the word index
+	 *		Allocate one more entry for the word index, the word array and the
+	 *		prefixes of the keys, before the dictionary is changed, so that it
+	 *		is left as it was if any of them fails.
 	 */
-	if(dictionary->index==NULL) {
-		dictionary->index=(BYTE2 *)malloc(sizeof(BYTE2)*
-		(dictionary->size));
-	} else {
-		dictionary->index=(BYTE2 *)realloc((BYTE2 *)
-		(dictionary->index),sizeof(BYTE2)*(dictionary->size));
-	}
-	if(dictionary->index==NULL) {
+	index=(BYTE4 *)realloc(dictionary->index, sizeof(BYTE4)*(dictionary->size+1));
+	if(index==NULL)
 		error("add_word", "Unable to reallocate the index.");
-		goto fail;
+	dictionary->index=index;
+	entries=(STRING *)realloc(dictionary->entry, sizeof(STRING)*(dictionary->size+1));
+	if(entries==NULL)
+		error("add_word", "Unable to reallocate the dictionary to %d elements.", dictionary->size+1);
+	dictionary->entry=entries;
+	if(dictionary->size+1>dictionary->slots/2) {
+		prefixes=(BYTE4 *)realloc(dictionary->prefix, sizeof(BYTE4)*(dictionary->size+1));
+		if(prefixes==NULL)
+			error("add_word", "Unable to reallocate the prefixes.");
+		dictionary->prefix=prefixes;
 	}
 
 	/*
-	 *		Allocate one more entry for the word array
+	 *		Point the new entry at the shared copy of the word
 	 */
-	if(dictionary->entry==NULL) {
-		dictionary->entry=(STRING *)malloc(sizeof(STRING)*(dictionary->size));
-	} else {
-		dictionary->entry=(STRING *)realloc((STRING *)(dictionary->entry),
-		sizeof(STRING)*(dictionary->size));
-	}
-	if(dictionary->entry==NULL) {
-		error("add_word", "Unable to reallocate the dictionary to %d elements.", dictionary->size);
-		goto fail;
-	}
+	dictionary->entry[dictionary->size]=entry;
+	dictionary->size+=1;
+	dictionary->bytes+=word.length;
 
 	/*
-	 *		Copy the new word into the word array
+	 *		Shuffle the word index and the prefixes beside it to keep them
+	 *		sorted alphabetically, and copy the new symbol identifier in.
 	 */
-	dictionary->entry[dictionary->size-1].length=word.length;
-	dictionary->entry[dictionary->size-1].word=(char *)malloc(sizeof(char)*
-	(word.length));
-	if(dictionary->entry[dictionary->size-1].word==NULL) {
-		error("add_word", "Unable to allocate the word.");
-		goto fail;
+	for(i=(dictionary->size-1); i>position; --i) {
+		dictionary->index[i]=dictionary->index[i-1];
+		dictionary->prefix[i]=dictionary->prefix[i-1];
 	}
-	for(i=0; i<word.length; ++i)
-		dictionary->entry[dictionary->size-1].word[i]=word.word[i];
+	dictionary->index[position]=dictionary->size-1;
+	dictionary->prefix[position]=key_prefix(key);
 
 	/*
-	 *		Shuffle the word index to keep it sorted alphabetically
+	 *		Enter the word in the hash table, rebuilding it with more room
+	 *		once it is half full.
 	 */
-	for(i=(dictionary->size-1); i>position; --i)
-		dictionary->index[i]=dictionary->index[i-1];
+	if(dictionary->size*2>dictionary->slots)
+		hash_dictionary(dictionary);
+	else
+		dictionary->table[search_table(dictionary, key)]=dictionary->size;
 
-	/*
-	 *		Copy the new symbol identifier into the word index
-	 */
-	dictionary->index[position]=dictionary->size-1;
+	return(dictionary->size-1);
 
 succeed:
-	return(dictionary->index[position]);
+	symbol=dictionary->index[position];
 
-fail:
-	return(0);
+done:
+	if(key.word!=buffer) free(key.word);
+	return(symbol);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -1301,12 +1691,15 @@ fail:
 /*
  *		Function:	Search_Dictionary
  *
- *		Purpose:		Search the dictionary for the specified word, returning its
- *						position in the index if found, or the position where it
- *						should be inserted otherwise.
+ *		Purpose:		Search the dictionary for the word with the specified
+ *						case-folded key, returning its position in the index if
+ *						found, or the position where it should be inserted
+ *						otherwise.  The prefixes of the keys are compared first,
+ *						so that most steps of the search don't touch the words.
  */
-int search_dictionary(DICTIONARY *dictionary, STRING word, bool *find)
+int search_dictionary(DICTIONARY *dictionary, STRING key, bool *find)
 {
+	BYTE4 prefix;
 	int position;
 	int min;
 	int max;
@@ -1324,6 +1717,7 @@ int search_dictionary(DICTIONARY *dictionary, STRING word, bool *find)
 	/*
 	 *		Initialize the lower and upper bounds of the search
 	 */
+	prefix=key_prefix(key);
 	min=0;
 	max=dictionary->size-1;
 	/*
@@ -1336,7 +1730,12 @@ int search_dictionary(DICTIONARY *dictionary, STRING word, bool *find)
 		 *		than, equal to, or less than the element being searched for.
 		 */
 		middle=(min+max)/2;
-		compar=wordcmp(word, dictionary->entry[dictionary->index[middle]]);
+		if((dictionary->prefix!=NULL)&&(prefix<dictionary->prefix[middle]))
+			compar=-1;
+		else if((dictionary->prefix!=NULL)&&(prefix>dictionary->prefix[middle]))
+			compar=1;
+		else
+			compar=keycmp(key, word_key(dictionary->entry[dictionary->index[middle]]));
 		/*
 		 *		If it is equal then we have found the element.  Otherwise we
 		 *		can halve the search space accordingly.
@@ -1371,1877 +1770,7074 @@ notfound:
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Find_Word
+ *		Function:	Hash_Key
  *
- *		Purpose:		Return the symbol corresponding to the word specified.
- *						We assume that the word with index zero is equal to a
- *						NULL word, indicating an error condition.
+ *		Purpose:		Return a hash of the characters of a string.  Hashing the
+ *						case-folded keys of words means that words which wordcmp()
+ *						considers equal always hash alike.
  */
-BYTE2 find_word(DICTIONARY *dictionary, STRING word)
+BYTE4 hash_key(STRING key)
 {
-	int position;
-	bool found;
+	register BYTE4 hash=0x811C9DC5;
+	register BYTE4 i;
 
-	position=search_dictionary(dictionary, word, &found);
+	for(i=0; i<key.length; ++i) {
+		hash^=(BYTE1)key.word[i];
+		hash*=0x01000193;
+	}
 
-	if(found==TRUE) return(dictionary->index[position]);
-	else return(0);
+	return(hash^(hash>>15));
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Wordcmp
+ *		Function:	Fold_Word
  *
- *		Purpose:		Compare two words, and return an integer indicating whether
- *						the first word is less than, equal to or greater than the
- *						second word.
+ *		Purpose:		Return the case-folded key of a word which isn't known to
+ *						be interned.  The key is written to the buffer, which must
+ *						hold KEY_BUFFER characters, unless the word is too long,
+ *						in which case it is allocated and must be freed.
  */
-int wordcmp(STRING word1, STRING word2)
+STRING fold_word(STRING word, char *buffer)
 {
-	register int i;
-	int bound;
+	STRING key;
+	register BYTE4 i;
+
+	key.length=word.length;
+	if(word.length<=KEY_BUFFER) key.word=buffer;
+	else key.word=(char *)malloc(sizeof(char)*word.length);
+	if(key.word==NULL) {
+		error("fold_word", "Unable to allocate the key.");
+		return(key);
+	}
+	for(i=0; i<word.length; ++i) key.word[i]=(char)toupper(word.word[i]);
 
-	bound=MIN(word1.length,word2.length);
+	return(key);
+}
 
-	for(i=0; i<bound; ++i)
-		if(toupper(word1.word[i])!=toupper(word2.word[i]))
-			return((int)(toupper(word1.word[i])-toupper(word2.word[i])));
+/*---------------------------------------------------------------------------*/
 
-	if(word1.length<word2.length) return(-1);
-	if(word1.length>word2.length) return(1);
+/*
+ *		Function:	Word_Key
+ *
+ *		Purpose:		Return the case-folded key of an interned word, which is
+ *						usually the word itself.
+ */
+STRING word_key(STRING word)
+{
+	STRING key;
 
-	return(0);
+	key.length=word.length;
+	key.word=FOLDED(word);
+
+	return(key);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Free_Dictionary
+ *		Function:	Keycmp
  *
- *		Purpose:		Release the memory consumed by the dictionary.
+ *		Purpose:		Compare two case-folded keys, giving the same answer that
+ *						wordcmp() gives for the words they came from.  Since no
+ *						folding is needed, the common prefix is skipped a machine
+ *						word at a time before the first difference is examined.
  */
-void free_dictionary(DICTIONARY *dictionary)
+int keycmp(STRING key1, STRING key2)
 {
-	if(dictionary==NULL) return;
-	if(dictionary->entry!=NULL) {
-		free(dictionary->entry);
-		dictionary->entry=NULL;
-	}
-	if(dictionary->index!=NULL) {
-		free(dictionary->index);
-		dictionary->index=NULL;
+	register BYTE4 i=0;
+	BYTE4 bound;
+	unsigned long block1;
+	unsigned long block2;
+
+	bound=MIN(key1.length,key2.length);
+
+	for(; i+sizeof(unsigned long)<=bound; i+=sizeof(unsigned long)) {
+		memcpy(&block1, key1.word+i, sizeof(unsigned long));
+		memcpy(&block2, key2.word+i, sizeof(unsigned long));
+		if(block1!=block2) break;
 	}
-	dictionary->size=0;
+	for(; i<bound; ++i)
+		if(key1.word[i]!=key2.word[i])
+			return((int)key1.word[i]-(int)key2.word[i]);
+
+	if(key1.length<key2.length) return(-1);
+	if(key1.length>key2.length) return(1);
+
+	return(0);
 }
 
 /*---------------------------------------------------------------------------*/
 
-void free_model(MODEL *model)
+/*
+ *		Function:	Key_Prefix
+ *
+ *		Purpose:		Pack the first four characters of a case-folded key into a
+ *						number which orders keys as keycmp() does, except that keys
+ *						which begin alike may come out equal and must then be
+ *						compared in full.
+ */
+BYTE4 key_prefix(STRING key)
 {
-	if(model==NULL) return;
-	if(model->forward!=NULL) {
-		free_tree(model->forward);
-	}
-	if(model->backward!=NULL) {
-		free_tree(model->backward);
-	}
-	if(model->context!=NULL) {
-		free(model->context);
-	}
-	if(model->dictionary!=NULL) {
-		free_dictionary(model->dictionary);
-		free(model->dictionary);
+	register BYTE4 prefix=0;
+	register BYTE4 i;
+
+	for(i=0; i<4; ++i) {
+		prefix<<=8;
+		if(i<key.length) prefix|=(BYTE1)((int)key.word[i]-CHAR_MIN);
 	}
-	free(model);
+
+	return(prefix);
 }
 
 /*---------------------------------------------------------------------------*/
 
-void free_tree(TREE *tree)
+/*
+ *		Function:	Hash_Dictionary
+ *
+ *		Purpose:		Rebuild the hash table of a dictionary from its words.
+ *						The table is open-addressed and holds one more than the
+ *						symbol of each word, so that zero marks an empty slot,
+ *						and it has at least four slots for every word, so that it
+ *						can take as many again before it needs rebuilding.  The
+ *						prefixes of the keys in the index are rebuilt alongside,
+ *						with room for as many words.
+ */
+void hash_dictionary(DICTIONARY *dictionary)
 {
-	static int level=0;
-	register int i;
-
-	if(tree==NULL) return;
+	register BYTE4 i;
+	BYTE4 slots;
+	BYTE4 *table;
+	BYTE4 *prefix;
 
-	if(tree->tree!=NULL) {
-		if(level==0) progress("Freeing tree", 0, 1);
-		for(i=0; i<tree->branch; ++i) {
-			++level;
-			free_tree(tree->tree[i]);
-			--level;
-			if(level==0) progress(NULL, i, tree->branch);
-		}
-		if(level==0) progress(NULL, 1, 1);
-		free(tree->tree);
+	/*
+	 *		The old table is kept until the new one has been allocated, so
+	 *		that the dictionary can still be searched if it can't be.
+	 */
+	for(slots=16; slots<4*dictionary->size; slots*=2);
+	if(slots!=dictionary->slots) {
+		prefix=(BYTE4 *)realloc(dictionary->prefix, sizeof(BYTE4)*(slots/2));
+		if(prefix==NULL)
+			error("hash_dictionary", "Unable to allocate the prefixes.");
+		dictionary->prefix=prefix;
+		table=(BYTE4 *)malloc(sizeof(BYTE4)*slots);
+		if(table==NULL)
+			error("hash_dictionary", "Unable to allocate the hash table.");
+		if(dictionary->table!=NULL) free(dictionary->table);
+		dictionary->table=table;
+		dictionary->slots=slots;
 	}
-	free(tree);
+
+	for(i=0; i<dictionary->size; ++i)
+		dictionary->prefix[i]=key_prefix(word_key(dictionary->entry[dictionary->index[i]]));
+	for(i=0; i<slots; ++i) dictionary->table[i]=0;
+	for(i=0; i<dictionary->size; ++i)
+		dictionary->table[search_table(dictionary, word_key(dictionary->entry[i]))]=i+1;
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Initialize_Dictionary
+ *		Function:	Search_Table
  *
- *		Purpose:		Add dummy words to the dictionary.
+ *		Purpose:		Return the slot of the hash table of a dictionary which
+ *						holds the word with the specified case-folded key, or the
+ *						empty slot where it belongs if the dictionary doesn't
+ *						contain it.  Lengths are compared before any characters.
  */
-void initialize_dictionary(DICTIONARY *dictionary)
+BYTE4 search_table(DICTIONARY *dictionary, STRING key)
 {
-	STRING word={ 7, "<ERROR>" };
-	STRING end={ 5, "<FIN>" };
+	register BYTE4 slot;
+	register BYTE4 mask;
+	STRING *entry;
+
+	mask=dictionary->slots-1;
+	for(slot=hash_key(key)&mask; dictionary->table[slot]!=0; slot=(slot+1)&mask) {
+		entry=&(dictionary->entry[dictionary->table[slot]-1]);
+		if((entry->length==key.length)&&
+			(memcmp(FOLDED(*entry), key.word, key.length)==0)) break;
+	}
 
-	(void)add_word(dictionary, word);
-	(void)add_word(dictionary, end);
+	return(slot);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	New_Dictionary
- *
- *		Purpose:		Allocate room for a new dictionary.
+ *		Function:	Intern_Word
+ *
+ *		Purpose:		Return a copy of a word which belongs to the dictionary,
+ *						packed end to end with its other words into chunks which
+ *						are released along with it.  The chunks start small, so
+ *						that short word lists don't pay for much, and double in
+ *						size up to INTERN_CHUNK.  Each copy is preceded by a flag
+ *						which is set if the word isn't its own case-folded key,
+ *						in which case the key follows it.
  */
-DICTIONARY *new_dictionary(void)
+char *intern_word(DICTIONARY *dictionary, STRING word)
 {
-	DICTIONARY *dictionary=NULL;
+	CHUNK *chunk;
+	register BYTE4 i;
+	size_t size;
+	size_t need;
+	bool folded;
+	char *copy;
 
-	dictionary=(DICTIONARY *)malloc(sizeof(DICTIONARY));
-	if(dictionary==NULL) {
-		error("new_dictionary", "Unable to allocate dictionary.");
-		return(NULL);
+	/*
+	 *		Input is converted to upper case before it is learnt, so a word is
+	 *		almost always its own key, and only needs a separate one otherwise.
+	 */
+	folded=TRUE;
+	for(i=0; i<word.length; ++i)
+		if((char)toupper(word.word[i])!=word.word[i]) {
+			folded=FALSE;
+			break;
+		}
+	need=1+(size_t)word.length+((folded==TRUE)?0:(size_t)word.length);
+
+	if((dictionary->chunk==NULL)||(need>dictionary->spare)) {
+		size=(dictionary->arena<256)?256:dictionary->arena;
+		if(size>INTERN_CHUNK) size=INTERN_CHUNK;
+		if(size<need) size=need;
+		chunk=(CHUNK *)malloc(sizeof(CHUNK)+size);
+		if(chunk==NULL) {
+			error("intern_word", "Unable to allocate the word.");
+			return(NULL);
+		}
+		chunk->next=dictionary->chunk;
+		dictionary->chunk=chunk;
+		dictionary->top=(char *)(chunk+1);
+		dictionary->spare=size;
+		dictionary->arena+=sizeof(CHUNK)+size;
 	}
 
-	dictionary->size=0;
-	dictionary->index=NULL;
-	dictionary->entry=NULL;
+	copy=dictionary->top+1;
+	dictionary->top[0]=(folded==TRUE)?0:1;
+	if(word.length>0) memcpy(copy, word.word, word.length);
+	if(folded==FALSE) for(i=0; i<word.length; ++i)
+		copy[word.length+i]=(char)toupper(word.word[i]);
+	dictionary->top+=need;
+	dictionary->spare-=need;
 
-	return(dictionary);
+	return(copy);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Save_Dictionary
+ *		Function:	Pack_Words
  *
- *		Purpose:		Save a dictionary to the specified file.
+ *		Purpose:		Copy the words of a dictionary into a single chunk which
+ *						holds them exactly, and release the chunks they were in,
+ *						so that the words which have been removed from it give
+ *						their memory back.  If the chunk can't be allocated the
+ *						words are left where they are.
  */
-void save_dictionary(FILE *file, DICTIONARY *dictionary)
+void pack_words(DICTIONARY *dictionary)
 {
-	register int i;
+	CHUNK *chunk;
+	char *top;
+	size_t size=0;
+	size_t need;
+	register BYTE4 i;
+
+	for(i=0; i<dictionary->size; ++i)
+		size+=1+(size_t)dictionary->entry[i].length*
+			((dictionary->entry[i].word[-1]==0)?1:2);
+	chunk=(CHUNK *)malloc(sizeof(CHUNK)+size);
+	if(chunk==NULL) return;
 
-	fwrite(&(dictionary->size), sizeof(BYTE4), 1, file);
-	progress("Saving dictionary", 0, 1);
+	top=(char *)(chunk+1);
 	for(i=0; i<dictionary->size; ++i) {
-		save_word(file, dictionary->entry[i]);
-		progress(NULL, i, dictionary->size);
+		need=1+(size_t)dictionary->entry[i].length*
+			((dictionary->entry[i].word[-1]==0)?1:2);
+		memcpy(top, dictionary->entry[i].word-1, need);
+		dictionary->entry[i].word=top+1;
+		top+=need;
 	}
-	progress(NULL, 1, 1);
+
+	release_words(dictionary);
+	chunk->next=NULL;
+	dictionary->chunk=chunk;
+	dictionary->top=top;
+	dictionary->spare=0;
+	dictionary->arena=sizeof(CHUNK)+size;
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Load_Dictionary
+ *		Function:	Release_Words
  *
- *		Purpose:		Load a dictionary from the specified file.
+ *		Purpose:		Release the chunks which hold the words of a dictionary.
  */
-void load_dictionary(FILE *file, DICTIONARY *dictionary)
+void release_words(DICTIONARY *dictionary)
 {
-	register int i;
-	int size;
+	CHUNK *chunk;
+	CHUNK *next;
 
-	fread(&size, sizeof(BYTE4), 1, file);
-	progress("Loading dictionary", 0, 1);
-	for(i=0; i<size; ++i) {
-		load_word(file, dictionary);
-		progress(NULL, i, size);
+	for(chunk=dictionary->chunk; chunk!=NULL; chunk=next) {
+		next=chunk->next;
+		free(chunk);
 	}
-	progress(NULL, 1, 1);
+	dictionary->chunk=NULL;
+	dictionary->top=NULL;
+	dictionary->spare=0;
+	dictionary->arena=0;
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Save_Word
+ *		Function:	Find_Word
  *
- *		Purpose:		Save a dictionary word to a file.
+ *		Purpose:		Return the symbol corresponding to the word specified.
+ *						We assume that the word with index zero is equal to a
+ *						NULL word, indicating an error condition.
  */
-void save_word(FILE *file, STRING word)
+BYTE4 find_word(DICTIONARY *dictionary, STRING word)
 {
-	register int i;
+	int position;
+	bool found;
+	BYTE4 slot;
+	BYTE4 symbol=0;
+	STRING key;
+	char buffer[KEY_BUFFER];
+
+	if(dictionary->size==0) return(0);
+	key=fold_word(word, buffer);
+	if(key.word==NULL) return(0);
+
+	if(dictionary->table!=NULL) {
+		slot=search_table(dictionary, key);
+		if(dictionary->table[slot]!=0) symbol=dictionary->table[slot]-1;
+	} else {
+		position=search_dictionary(dictionary, key, &found);
+		if(found==TRUE) symbol=dictionary->index[position];
+	}
 
-	fwrite(&(word.length), sizeof(BYTE1), 1, file);
-	for(i=0; i<word.length; ++i)
-		fwrite(&(word.word[i]), sizeof(char), 1, file);
+	if(key.word!=buffer) free(key.word);
+	return(symbol);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Load_Word
+ *		Function:	Wordcmp
  *
- *		Purpose:		Load a dictionary word from a file.
+ *		Purpose:		Compare two words, and return an integer indicating whether
+ *						the first word is less than, equal to or greater than the
+ *						second word.
  */
-void load_word(FILE *file, DICTIONARY *dictionary)
+int wordcmp(STRING word1, STRING word2)
 {
 	register int i;
-	STRING word;
+	int bound;
 
-	fread(&(word.length), sizeof(BYTE1), 1, file);
-	word.word=(char *)malloc(sizeof(char)*word.length);
-	if(word.word==NULL) {
-		error("load_word", "Unable to allocate word");
-		return;
-	}
-	for(i=0; i<word.length; ++i)
-		fread(&(word.word[i]), sizeof(char), 1, file);
-	add_word(dictionary, word);
-	free(word.word);
+	bound=MIN(word1.length,word2.length);
+
+	for(i=0; i<bound; ++i)
+		if(toupper(word1.word[i])!=toupper(word2.word[i]))
+			return((int)(toupper(word1.word[i])-toupper(word2.word[i])));
+
+	if(word1.length<word2.length) return(-1);
+	if(word1.length>word2.length) return(1);
+
+	return(0);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	New_Node
+ *		Function:	Free_Dictionary
  *
- *		Purpose:		Allocate a new node for the n-gram tree, and initialise
- *						its contents to sensible values.
+ *		Purpose:		Release the memory consumed by the dictionary.
  */
-TREE *new_node(void)
+void free_dictionary(DICTIONARY *dictionary)
 {
-	TREE *node=NULL;
-
-	/*
-	 *		Allocate memory for the new node
-	 */
-	node=(TREE *)malloc(sizeof(TREE));
-	if(node==NULL) {
-		error("new_node", "Unable to allocate the node.");
-		goto fail;
+	if(dictionary==NULL) return;
+	if(dictionary->entry!=NULL) {
+		free(dictionary->entry);
+		dictionary->entry=NULL;
+	}
+	if(dictionary->index!=NULL) {
+		free(dictionary->index);
+		dictionary->index=NULL;
 	}
+	if(dictionary->pool!=NULL) {
+		free(dictionary->pool);
+		dictionary->pool=NULL;
+	}
+	if(dictionary->table!=NULL) {
+		free(dictionary->table);
+		dictionary->table=NULL;
+	}
+	if(dictionary->prefix!=NULL) {
+		free(dictionary->prefix);
+		dictionary->prefix=NULL;
+	}
+	release_words(dictionary);
+	dictionary->size=0;
+	dictionary->bytes=0;
+	dictionary->pooled=0;
+	dictionary->room=0;
+	dictionary->slots=0;
+}
+
+/*---------------------------------------------------------------------------*/
 
+void free_model(MODEL *model)
+{
+	if(model==NULL) return;
 	/*
-	 *		Initialise the contents of the node
+	 *		Every node of both trees lives in the model's pool, so there is
+	 *		no need to walk the trees to release them.
 	 */
-	node->symbol=0;
-	node->usage=0;
-	node->count=0;
-	node->branch=0;
-	node->tree=NULL;
-
-	return(node);
-
-fail:
-	if(node!=NULL) free(node);
-	return(NULL);
+	if(model->pool!=NULL) {
+		free_pool(model->pool);
+	}
+	if(model->context!=NULL) {
+		free(model->context);
+	}
+	if(model->frozen_context!=NULL) {
+		free(model->frozen_context);
+	}
+	if(model->census.nodes!=NULL) {
+		free(model->census.nodes);
+	}
+	if(model->merged!=NULL) {
+		free(model->merged);
+	}
+	free_frozen(model->frozen_forward);
+	free_frozen(model->frozen_backward);
+	if(model->dictionary!=NULL) {
+		free_dictionary(model->dictionary);
+		free(model->dictionary);
+	}
+	free_image(model);
+	free(model);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	New_Model
+ *		Function:	Free_Tree
  *
- *		Purpose:		Create and initialise a new ngram model.
+ *		Purpose:		Return a sub-tree to the free list of the pool it was
+ *						allocated from, so that its nodes may be reused.
  */
-MODEL *new_model(int order)
+void free_tree(NODEPOOL *pool, TREE *tree)
 {
-	MODEL *model=NULL;
+	register int i;
 
-	model=(MODEL *)malloc(sizeof(MODEL));
-	if(model==NULL) {
-		error("new_model", "Unable to allocate model.");
-		goto fail;
-	}
+	if(tree==NULL) return;
 
-	model->order=order;
-	model->forward=new_node();
-	model->backward=new_node();
-	model->context=(TREE **)malloc(sizeof(TREE *)*(order+2));
-	if(model->context==NULL) {
-		error("new_model", "Unable to allocate context array.");
-		goto fail;
+	if(tree->tree!=NULL) {
+		for(i=0; i<tree->branch; ++i) free_tree(pool, tree->tree[i]);
+		free_branch(pool, tree->tree, tree->capacity);
 	}
-	initialize_context(model);
-	model->dictionary=new_dictionary();
-	initialize_dictionary(model->dictionary);
-
-	return(model);
 
-fail:
-	return(NULL);
+	/*
+	 *		Free nodes are chained through their subtree pointer.
+	 */
+	tree->branch=0;
+	tree->capacity=0;
+	tree->tree=(TREE **)pool->free;
+	pool->free=tree;
+	pool->bytes-=sizeof(TREE);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Update_Model
+ *		Function:	Free_Pool
  *
- *		Purpose:		Update the model with the specified symbol.
+ *		Purpose:		Release a node pool, and every node and subtree array
+ *						allocated from it.  This costs one free() per block or
+ *						chunk, no matter how many nodes the trees contain.
  */
-void update_model(MODEL *model, int symbol)
+void free_pool(NODEPOOL *pool)
 {
-	register int i;
+	BLOCK *block;
+	CHUNK *chunk;
 
-	/*
-	 *		Update all of the models in the current context with the specified
-	 *		symbol.
-	 */
-	for(i=(model->order+1); i>0; --i)
-		if(model->context[i-1]!=NULL)
-			model->context[i]=add_symbol(model->context[i-1], (BYTE2)symbol);
+	if(pool==NULL) return;
 
-	return;
+	while(pool->block!=NULL) {
+		block=pool->block;
+		pool->block=block->next;
+		free(block);
+	}
+	while(pool->chunk!=NULL) {
+		chunk=pool->chunk;
+		pool->chunk=chunk->next;
+		free(chunk);
+	}
+	free(pool);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Update_Context
+ *		Function:	Merge_Pool
  *
- *		Purpose:		Update the context of the model without adding the symbol.
+ *		Purpose:		Hand everything allocated from one pool over to another,
+ *						and release the first.  The blocks and chunks which were
+ *						being carved up by the first pool are not used again, so
+ *						the second pool carries on from where it was.
  */
-void update_context(MODEL *model, int symbol)
+void merge_pool(NODEPOOL *pool, NODEPOOL *from)
 {
+	BLOCK *block;
+	CHUNK *chunk;
+	TREE *node;
+	TREE **branch;
 	register int i;
 
-	for(i=(model->order+1); i>0; --i)
-		if(model->context[i-1]!=NULL)
-			model->context[i]=find_symbol(model->context[i-1], symbol);
+	while(from->block!=NULL) {
+		block=from->block;
+		from->block=block->next;
+		if(pool->block==NULL) {
+			block->next=NULL;
+			pool->block=block;
+		} else {
+			block->next=pool->block->next;
+			pool->block->next=block;
+		}
+	}
+	while(from->chunk!=NULL) {
+		chunk=from->chunk;
+		from->chunk=chunk->next;
+		if(pool->chunk==NULL) {
+			chunk->next=NULL;
+			pool->chunk=chunk;
+		} else {
+			chunk->next=pool->chunk->next;
+			pool->chunk->next=chunk;
+		}
+	}
+	while(from->free!=NULL) {
+		node=from->free;
+		from->free=(TREE *)node->tree;
+		node->tree=(TREE **)pool->free;
+		pool->free=node;
+	}
+	for(i=0; i<BRANCH_CLASSES; ++i) while(from->spare[i]!=NULL) {
+		branch=from->spare[i];
+		from->spare[i]=(TREE **)branch[0];
+		branch[0]=(TREE *)pool->spare[i];
+		pool->spare[i]=branch;
+	}
+	pool->bytes+=from->bytes;
+	pool->reserved+=from->reserved;
+
+	free(from);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Add_Symbol
+ *		Function:	Free_Branch
  *
- *		Purpose:		Update the statistics of the specified tree with the
- *						specified symbol, which may mean growing the tree if the
- *						symbol hasn't been seen in this context before.
+ *		Purpose:		Return a subtree array to the pool, where it is kept on
+ *						the spare list for its size until another node needs it.
  */
-TREE *add_symbol(TREE *tree, BYTE2 symbol)
+void free_branch(NODEPOOL *pool, TREE **branch, BYTE4 capacity)
 {
-	TREE *node=NULL;
-
-	/*
-	 *		Search for the symbol in the subtree of the tree node.
-	 */
-	node=find_symbol_add(tree, symbol);
+	register int class;
 
-	/*
-	 *		Increment the symbol counts
-	 */
-	if((node->count<65535)) {
-		node->count+=1;
-		tree->usage+=1;
-	}
+	for(class=0; ((BYTE4)1<<class)<capacity; ++class);
 
-	return(node);
+	branch[0]=(TREE *)pool->spare[class];
+	pool->spare[class]=branch;
+	pool->bytes-=branch_size((BYTE4)1<<class);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Find_Symbol
+ *		Function:	Initialize_Dictionary
  *
- *		Purpose:		Return a pointer to the child node, if one exists, which
- *						contains the specified symbol.
+ *		Purpose:		Add dummy words to the dictionary.
  */
-TREE *find_symbol(TREE *node, int symbol)
+void initialize_dictionary(DICTIONARY *dictionary)
 {
-	register int i;
-	TREE *found=NULL;
-	bool found_symbol=FALSE;
-
-	/* 
-	 *		Perform a binary search for the symbol.
-	 */
-	i=search_node(node, symbol, &found_symbol);
-	if(found_symbol==TRUE) found=node->tree[i];
+	STRING word={ 7, "<ERROR>" };
+	STRING end={ 5, "<FIN>" };
 
-	return(found);
+	(void)add_word(dictionary, word);
+	(void)add_word(dictionary, end);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Find_Symbol_Add
+ *		Function:	New_Dictionary
  *
- *		Purpose:		This function is conceptually similar to find_symbol,
- *						apart from the fact that if the symbol is not found,
- *						a new node is automatically allocated and added to the
- *						tree.
+ *		Purpose:		Allocate room for a new dictionary.
  */
-TREE *find_symbol_add(TREE *node, int symbol)
+DICTIONARY *new_dictionary(void)
 {
-	register int i;
-	TREE *found=NULL;
-	bool found_symbol=FALSE;
+	DICTIONARY *dictionary=NULL;
 
-	/* 
-	 *		Perform a binary search for the symbol.  If the symbol isn't found,
-	 *		attach a new sub-node to the tree node so that it remains sorted.
-	 */
-	i=search_node(node, symbol, &found_symbol);
-	if(found_symbol==TRUE) {
-		found=node->tree[i];
-	} else {
-		found=new_node();
-		found->symbol=symbol;
-		add_node(node, found, i);
+	dictionary=(DICTIONARY *)malloc(sizeof(DICTIONARY));
+	if(dictionary==NULL) {
+		error("new_dictionary", "Unable to allocate dictionary.");
+		return(NULL);
 	}
 
-	return(found);
+	dictionary->size=0;
+	dictionary->index=NULL;
+	dictionary->entry=NULL;
+	dictionary->bytes=0;
+	dictionary->pool=NULL;
+	dictionary->pooled=0;
+	dictionary->room=0;
+	dictionary->table=NULL;
+	dictionary->slots=0;
+	dictionary->prefix=NULL;
+	dictionary->chunk=NULL;
+	dictionary->top=NULL;
+	dictionary->spare=0;
+	dictionary->arena=0;
+
+	return(dictionary);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Add_Node
- *
- *		Purpose:		Attach a new child node to the sub-tree of the tree
- *						specified.
+ *		Function:	Pool_Word
+ *
+ *		Purpose:		Add an entry for a word of the given length to the end
+ *						of a dictionary which is being built in bulk, and return
+ *						where in the pool of the dictionary its text should be
+ *						copied.  The entries and the pool grow by doubling, and
+ *						the words aren't pointed into the pool or indexed until
+ *						index_dictionary() is called, as the pool may move.  The
+ *						pool is only needed until then.
  */
-void add_node(TREE *tree, TREE *node, int position)
+char *pool_word(DICTIONARY *dictionary, BYTE4 length)
 {
-	register int i;
-
-	/*
-	 *		Allocate room for one more child node, which may mean allocating
-	 *		the sub-tree from scratch.
-	 */
-	if(tree->tree==NULL) {
-		tree->tree=(TREE **)malloc(sizeof(TREE *)*(tree->branch+1));
-	} else {
-		tree->tree=(TREE **)realloc((TREE **)(tree->tree),sizeof(TREE *)*
-		(tree->branch+1));
+	STRING *entry;
+	char *word;
+	char *pool;
+	unsigned long room;
+
+	if((dictionary->size&(dictionary->size-1))==0) {
+		entry=(STRING *)realloc(dictionary->entry, sizeof(STRING)*
+			((dictionary->size==0)?1:2*(unsigned long)dictionary->size));
+		if(entry==NULL)
+			error("pool_word", "Unable to allocate the dictionary.");
+		dictionary->entry=entry;
 	}
-	if(tree->tree==NULL) {
-		error("add_node", "Unable to reallocate subtree.");
-		return;
+	if(dictionary->pooled+length>dictionary->room) {
+		room=(dictionary->room==0)?4096:2*dictionary->room;
+		if(room<dictionary->pooled+length) room=dictionary->pooled+length;
+		pool=(char *)realloc(dictionary->pool, sizeof(char)*room);
+		if(pool==NULL)
+			error("pool_word", "Unable to allocate the word pool.");
+		dictionary->pool=pool;
+		dictionary->room=room;
 	}
 
-	/*
-	 *		Shuffle the nodes down so that we can insert the new node at the
-	 *		subtree index given by position.
-	 */
-	for(i=tree->branch; i>position; --i)
-		tree->tree[i]=tree->tree[i-1];
+	word=dictionary->pool+dictionary->pooled;
+	dictionary->entry[dictionary->size].length=length;
+	dictionary->entry[dictionary->size].word=NULL;
+	dictionary->size+=1;
+	dictionary->pooled+=length;
+	dictionary->bytes+=length;
 
-	/*
-	 *		Add the new node to the sub-tree.
-	 */
-	tree->tree[position]=node;
-	tree->branch+=1;
+	return(word);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Search_Node
- *
- *		Purpose:		Perform a binary search for the specified symbol on the
- *						subtree of the given node.  Return the position of the
- *						child node in the subtree if the symbol was found, or the
- *						position where it should be inserted to keep the subtree
- *						sorted if it wasn't.
+ *		Function:	Index_Dictionary
+ *
+ *		Purpose:		Finish a dictionary built by pool_word(), pointing its
+ *						words into the pool and sorting its index in one go.  If
+ *						merging, only the first of any repeated words is kept,
+ *						as add_word() would have done, but otherwise FALSE is
+ *						returned if any word repeats.  The words are swapped for
+ *						their interned copies first, so that they are sorted by
+ *						their keys, and the pool is released.
  */
-int search_node(TREE *node, int symbol, bool *found_symbol)
+bool index_dictionary(DICTIONARY *dictionary, bool merge)
 {
-	register int position;
-	int min;
-	int max;
-	int middle;
-	int compar;
+	STRING **order;
+	STRING *first;
+	BYTE4 *index;
+	BYTE4 *map;
+	char *word;
+	unsigned long offset=0;
+	register BYTE4 i;
+	register BYTE4 j;
+	register BYTE4 k;
+	register BYTE4 l;
+
+	if(dictionary->size==0) return(TRUE);
 
-	/*
-	 *		Handle the special case where the subtree is empty.
-	 */ 
-	if(node->branch==0) {
-		position=0;
-		goto notfound;
+	for(i=0; i<dictionary->size; ++i) {
+		dictionary->entry[i].word=dictionary->pool+offset;
+		offset+=dictionary->entry[i].length;
+		word=intern_word(dictionary, dictionary->entry[i]);
+		if(word==NULL) return(FALSE);
+		dictionary->entry[i].word=word;
 	}
-
-	/*
-	 *		Perform a binary search on the subtree.
-	 */
-	min=0;
-	max=node->branch-1;
-	while(TRUE) {
-		middle=(min+max)/2;
-		compar=symbol-node->tree[middle]->symbol;
-		if(compar==0) {
-			position=middle;
-			goto found;
-		} else if(compar>0) {
-			if(max==middle) {
-				position=middle+1;
-				goto notfound;
-			}
-			min=middle+1;
-		} else {
-			if(min==middle) {
-				position=middle;
-				goto notfound;
+	free(dictionary->pool);
+	dictionary->pool=NULL;
+	dictionary->pooled=0;
+	dictionary->room=0;
+
+	index=(BYTE4 *)realloc(dictionary->index, sizeof(BYTE4)*dictionary->size);
+	if(index==NULL)
+		error("index_dictionary", "Unable to allocate the index.");
+	dictionary->index=index;
+	order=(STRING **)malloc(sizeof(STRING *)*dictionary->size);
+	if(order==NULL)
+		error("index_dictionary", "Unable to allocate the order.");
+	for(i=0; i<dictionary->size; ++i) order[i]=&(dictionary->entry[i]);
+	qsort(order, dictionary->size, sizeof(STRING *), compare_words);
+
+	if(merge==TRUE) {
+		/*
+		 *		Mark every repeat of a word, keeping whichever came first,
+		 *		then close up the entries and renumber the index to match.
+		 */
+		map=(BYTE4 *)malloc(sizeof(BYTE4)*dictionary->size);
+		if(map==NULL) {
+			free(order);
+			error("index_dictionary", "Unable to allocate the symbol map.");
+		}
+		for(i=0; i<dictionary->size; ++i) map[i]=0;
+		for(i=0, k=0; i<dictionary->size; i=j) {
+			first=order[i];
+			for(j=i+1; (j<dictionary->size)&&(compare_words(&order[i], &order[j])==0); ++j)
+				if(order[j]<first) first=order[j];
+			for(l=i; l<j; ++l)
+				if(order[l]!=first) map[order[l]-dictionary->entry]=dictionary->size;
+			dictionary->index[k++]=first-dictionary->entry;
+		}
+		for(i=0, j=0; i<dictionary->size; ++i) {
+			if(map[i]==dictionary->size) continue;
+			dictionary->entry[j]=dictionary->entry[i];
+			map[i]=j++;
+		}
+		for(i=0; i<k; ++i) dictionary->index[i]=map[dictionary->index[i]];
+		dictionary->size=j;
+		free(map);
+	} else {
+		for(i=0; i<dictionary->size; ++i) {
+			if((i>0)&&(compare_words(&order[i-1], &order[i])==0)) {
+				free(order);
+				return(FALSE);
 			}
-			max=middle-1;
+			dictionary->index[i]=order[i]-dictionary->entry;
 		}
 	}
 
-found:
-	*found_symbol=TRUE;
-	return(position);
+	free(order);
+	hash_dictionary(dictionary);
 
-notfound:
-	*found_symbol=FALSE;
-	return(position);
+	return(TRUE);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Initialize_Context
+ *		Function:	Compare_Words
  *
- *		Purpose:		Set the context of the model to a default value.
+ *		Purpose:		Compare the keys of two interned dictionary entries for
+ *						qsort().
  */
-void initialize_context(MODEL *model)
+int compare_words(const void *first, const void *second)
 {
-	register int i;
-
-	for(i=0; i<=model->order; ++i) model->context[i]=NULL;
+	return(keycmp(word_key(**(STRING **)first), word_key(**(STRING **)second)));
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Learn
+ *		Function:	Save_Dictionary
  *
- *		Purpose:		Learn from the user's input.
+ *		Purpose:		Save a dictionary to the specified stream.
  */
-void learn(MODEL *model, DICTIONARY *words)
+void save_dictionary(STREAM *stream, DICTIONARY *dictionary, int version)
 {
 	register int i;
-	BYTE2 symbol;
 
-	/*
-	 *		We only learn from inputs which are long enough
-	 */
-	if(words->size<=(model->order)) return;
+	if(version==11) put_varint(stream, dictionary->size);
+	else put_byte4(stream, dictionary->size);
+	for(i=0; i<dictionary->size; ++i)
+		save_word(stream, dictionary->entry[i], version);
+}
 
-	/*
-	 *		Train the model in the forwards direction.  Start by initializing
-	 *		the context of the model.
-	 */
-	initialize_context(model);
-	model->context[0]=model->forward;
-	for(i=0; i<words->size; ++i) {
-		/*
-		 *		Add the symbol to the model's dictionary if necessary, and then
-		 *		update the forward model accordingly.
-		 */
-		symbol=add_word(model->dictionary, words->entry[i]);
-		update_model(model, symbol);
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Load_Dictionary
+ *
+ *		Purpose:		Load a dictionary from the specified stream, replacing
+ *						whatever it held.  The words are read straight into the
+ *						pool of the dictionary, and indexed with a single sort
+ *						once they are all in, rather than being added one at a
+ *						time.  A brain with the same word twice is damaged.
+ */
+void load_dictionary(STREAM *stream, DICTIONARY *dictionary, int version)
+{
+	register BYTE4 i;
+	BYTE4 size;
+	BYTE4 length;
+	BYTE1 short_length;
+	unsigned long long_value;
+	char *word;
+
+	if(version==8) {
+		get_bytes(stream, &long_value, sizeof(unsigned long));
+		size=(BYTE4)long_value;
+	} else if(version==11) {
+		size=get_varint(stream);
+	} else {
+		size=get_byte4(stream);
 	}
-	/*
-	 *		Add the sentence-terminating symbol.
-	 */
-	update_model(model, 1);
 
-	/*
-	 *		Train the model in the backwards direction.  Start by initializing
-	 *		the context of the model.
-	 */
-	initialize_context(model);
-	model->context[0]=model->backward;
-	for(i=words->size-1; i>=0; --i) {
-		/*
-		 *		Find the symbol in the model's dictionary, and then update
-		 *		the backward model accordingly.
-		 */
-		symbol=find_word(model->dictionary, words->entry[i]);
-		update_model(model, symbol);
+	free_dictionary(dictionary);
+	for(i=0; (i<size)&&(stream->failed==FALSE); ++i) {
+		if(version==8) {
+			get_bytes(stream, &short_length, sizeof(BYTE1));
+			length=short_length;
+		} else if(version==11) {
+			length=get_varint(stream);
+		} else {
+			length=get_byte4(stream);
+		}
+		if(stream->failed==TRUE) break;
+		word=pool_word(dictionary, length);
+		if(word==NULL) break;
+		get_bytes(stream, word, length);
 	}
-	/*
-	 *		Add the sentence-terminating symbol.
-	 */
-	update_model(model, 1);
 
-	return;
+	if(index_dictionary(dictionary, FALSE)==FALSE) stream->failed=TRUE;
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Train
+ *		Function:	Save_Word
  *
- *		Purpose:	 	Infer a MegaHAL brain from the contents of a text file.
+ *		Purpose:		Save a dictionary word to a stream.
  */
-void train(MODEL *model, char *filename)
+void save_word(STREAM *stream, STRING word, int version)
 {
-	FILE *file;
-	char buffer[1024];
-	DICTIONARY *words=NULL;
-	int length;
+	if(version==11) put_varint(stream, word.length);
+	else put_byte4(stream, word.length);
+	put_bytes(stream, word.word, word.length);
+}
 
-	if(filename==NULL) return;
+/*---------------------------------------------------------------------------*/
 
-	file=fopen(filename, "r");
-	if(file==NULL) {
-		printf("Unable to find the personality %s\n", filename);
-		return;
-	}
+/*
+ *		Function:	Save_Byte4
+ *
+ *		Purpose:		Write a 32-bit value to a file in little-endian order, so
+ *						that the brain doesn't depend on the word size or byte
+ *						order of the machine which saved it.
+ */
+void save_byte4(FILE *file, BYTE4 value)
+{
+	BYTE1 buffer[4];
 
-	fseek(file, 0, 2);
-   length=ftell(file);
-   rewind(file);
+	buffer[0]=(BYTE1)(value&0xFF);
+	buffer[1]=(BYTE1)((value>>8)&0xFF);
+	buffer[2]=(BYTE1)((value>>16)&0xFF);
+	buffer[3]=(BYTE1)((value>>24)&0xFF);
+	fwrite(buffer, sizeof(BYTE1), 4, file);
+}
 
-	words=new_dictionary();
+/*---------------------------------------------------------------------------*/
 
-	progress("Training from file", 0, 1);
-	while(!feof(file)) {
+/*
+ *		Function:	Load_Byte4
+ *
+ *		Purpose:		Read a 32-bit little-endian value from a file.
+ */
+BYTE4 load_byte4(FILE *file)
+{
+	BYTE1 buffer[4];
 
-		if(fgets(buffer, 1024, file)==NULL) break;
-		if(buffer[0]=='#') continue;
+	if(fread(buffer, sizeof(BYTE1), 4, file)!=4) return(0);
 
-		buffer[strlen(buffer)-1]='\0';
+	return((BYTE4)buffer[0]|((BYTE4)buffer[1]<<8)|
+		((BYTE4)buffer[2]<<16)|((BYTE4)buffer[3]<<24));
+}
 
-		upper(buffer);
-		make_words(buffer, words);
-		learn(model, words);
+/*---------------------------------------------------------------------------*/
 
-		progress(NULL, ftell(file), length);
+/*
+ *		Function:	New_Stream
+ *
+ *		Purpose:		Wrap a file in a buffer big enough for the number of bytes
+ *						expected, up to STREAM_BUFFER, so that a brain can be
+ *						read or written in a few big chunks rather than a handful
+ *						of bytes at a time.  Return NULL if there isn't room for
+ *						the buffer, which every caller checks for.
+ */
+STREAM *new_stream(FILE *file, unsigned long expected)
+{
+	STREAM *stream;
 
+	stream=(STREAM *)malloc(sizeof(STREAM));
+	if(stream==NULL) {
+		warn("new_stream", "Unable to allocate stream");
+		return(NULL);
 	}
-	progress(NULL, 1, 1);
+	stream->size=STREAM_BUFFER;
+	if(expected<STREAM_BUFFER)
+		stream->size=(expected>STREAM_MINIMUM)?(size_t)expected:STREAM_MINIMUM;
+	stream->buffer=(BYTE1 *)malloc(sizeof(BYTE1)*stream->size);
+	if(stream->buffer==NULL) {
+		warn("new_stream", "Unable to allocate stream buffer");
+		free(stream);
+		return(NULL);
+	}
+	stream->file=file;
+	stream->length=0;
+	stream->position=0;
+	stream->failed=FALSE;
 
-	free_dictionary(words);
-	fclose(file);
+	return(stream);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Show_Dictionary
+ *		Function:	Free_Stream
  *
- *		Purpose:		Display the dictionary for training purposes.
+ *		Purpose:		Release a stream, returning FALSE if any read or write
+ *						failed.  A stream being written must be flushed first,
+ *						and the file itself is left open.
  */
-void show_dictionary(DICTIONARY *dictionary)
+bool free_stream(STREAM *stream)
 {
-	register int i;
-	register int j;
-	FILE *file;
+	bool failed;
 
-	file=fopen(".megahal/megahal.dic", "w");
-	if(file==NULL) {
-		warn("show_dictionary", "Unable to open file");
-		return;
-	}
+	if(stream==NULL) return(FALSE);
 
-	for(i=0; i<dictionary->size; ++i) {
-		for(j=0; j<dictionary->entry[i].length; ++j)
-			fprintf(file, "%c", dictionary->entry[i].word[j]);
-		fprintf(file, "\n");
-	}
+	failed=stream->failed;
+	free(stream->buffer);
+	free(stream);
 
-	fclose(file);
+	return((failed==TRUE)?FALSE:TRUE);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Save_Model
+ *		Function:	Flush_Stream
  *
- *		Purpose:		Save the current state to a MegaHAL brain file.
+ *		Purpose:		Write the buffer of a stream to its file.
  */
-void save_model(char *modelname, MODEL *model)
+void flush_stream(STREAM *stream)
 {
-	FILE *file;
-	static char *filename=NULL;
-	
-	if(filename==NULL) filename=(char *)malloc(sizeof(char)*1);
+	if(stream->length==0) return;
 
-	/*
-	 *    Allocate memory for the filename
-	 */
-	filename=(char *)realloc(filename,
-		sizeof(char)*(strlen(directory)+strlen(SEP)+12));
-	if(filename==NULL) error("save_model","Unable to allocate filename");
+	if(fwrite(stream->buffer, sizeof(BYTE1), stream->length, stream->file)!=
+		stream->length) stream->failed=TRUE;
+	stream->length=0;
+}
 
-	show_dictionary(model->dictionary);
-	if(filename==NULL) return;
+/*---------------------------------------------------------------------------*/
 
-	sprintf(filename, "%s%s.megahal/megahal.brn", directory, SEP);
-	file=fopen(filename, "wb");
-	if(file==NULL) {
-		warn("save_model", "Unable to open file `%s'", filename);
-		return;
-	}
+/*
+ *		Function:	Put_Byte4
+ *
+ *		Purpose:		Append a 32-bit value to a stream in little-endian order.
+ */
+void put_byte4(STREAM *stream, BYTE4 value)
+{
+	register BYTE1 *buffer;
 
-	fwrite(COOKIE, sizeof(char), strlen(COOKIE), file);
-	fwrite(&(model->order), sizeof(BYTE1), 1, file);
-	save_tree(file, model->forward);
-	save_tree(file, model->backward);
-	save_dictionary(file, model->dictionary);
+	if(stream->length+4>stream->size) flush_stream(stream);
 
-	fclose(file);
+	buffer=stream->buffer+stream->length;
+	buffer[0]=(BYTE1)(value&0xFF);
+	buffer[1]=(BYTE1)((value>>8)&0xFF);
+	buffer[2]=(BYTE1)((value>>16)&0xFF);
+	buffer[3]=(BYTE1)((value>>24)&0xFF);
+	stream->length+=4;
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Save_Tree
+ *		Function:	Put_Bytes
  *
- *		Purpose:		Save a tree structure to the specified file.
+ *		Purpose:		Append a block of bytes to a stream.  Anything too big to
+ *						fit in the buffer is written straight to the file.
  */
-void save_tree(FILE *file, TREE *node)
+void put_bytes(STREAM *stream, void *data, size_t size)
 {
-	static int level=0;
-	register int i;
+	if(stream->length+size>stream->size) flush_stream(stream);
 
-	fwrite(&(node->symbol), sizeof(BYTE2), 1, file);
-	fwrite(&(node->usage), sizeof(BYTE4), 1, file);
-	fwrite(&(node->count), sizeof(BYTE2), 1, file);
-	fwrite(&(node->branch), sizeof(BYTE2), 1, file);
-
-	if(level==0) progress("Saving tree", 0, 1);
-	for(i=0; i<node->branch; ++i) {
-		++level;
-		save_tree(file, node->tree[i]);
-		--level;
-		if(level==0) progress(NULL, i, node->branch);
+	if(size>stream->size) {
+		if(fwrite(data, sizeof(BYTE1), size, stream->file)!=size)
+			stream->failed=TRUE;
+		return;
 	}
-	if(level==0) progress(NULL, 1, 1);
+	memcpy(stream->buffer+stream->length, data, size);
+	stream->length+=size;
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Load_Tree
+ *		Function:	Get_Bytes
  *
- *		Purpose:		Load a tree structure from the specified file.
+ *		Purpose:		Take a block of bytes from a stream, refilling its buffer
+ *						from the file as needed.  A stream which runs dry is
+ *						marked as failed, and what it couldn't supply is zeroed.
  */
-void load_tree(FILE *file, TREE *node)
+bool get_bytes(STREAM *stream, void *data, size_t size)
 {
-	static int level=0;
-	register int i;
+	BYTE1 *to=(BYTE1 *)data;
+	size_t length;
+
+	while(size>0) {
+		if(stream->position==stream->length) {
+			stream->position=0;
+			stream->length=0;
+			if(stream->failed==FALSE)
+				stream->length=fread(stream->buffer, sizeof(BYTE1),
+					stream->size, stream->file);
+			if(stream->length==0) {
+				stream->failed=TRUE;
+				memset(to, 0, size);
+				return(FALSE);
+			}
+		}
+		length=MIN(size, stream->length-stream->position);
+		memcpy(to, stream->buffer+stream->position, length);
+		stream->position+=length;
+		to+=length;
+		size-=length;
+	}
 
-	fread(&(node->symbol), sizeof(BYTE2), 1, file);
-	fread(&(node->usage), sizeof(BYTE4), 1, file);
-	fread(&(node->count), sizeof(BYTE2), 1, file);
-	fread(&(node->branch), sizeof(BYTE2), 1, file);
+	return(TRUE);
+}
 
-	if(node->branch==0) return;
+/*---------------------------------------------------------------------------*/
 
-	node->tree=(TREE **)malloc(sizeof(TREE *)*(node->branch));
-	if(node->tree==NULL) {
-		error("load_tree", "Unable to allocate subtree");
-		return;
-	}
+/*
+ *		Function:	Get_Byte4
+ *
+ *		Purpose:		Take a 32-bit little-endian value from a stream.
+ */
+BYTE4 get_byte4(STREAM *stream)
+{
+	register BYTE1 *buffer;
+	BYTE1 bytes[4];
 
-	if(level==0) progress("Loading tree", 0, 1);
-	for(i=0; i<node->branch; ++i) {
-		node->tree[i]=new_node();
-		++level;
-		load_tree(file, node->tree[i]);
-		--level;
-		if(level==0) progress(NULL, i, node->branch);
+	if(stream->position+4<=stream->length) {
+		buffer=stream->buffer+stream->position;
+		stream->position+=4;
+	} else {
+		get_bytes(stream, bytes, 4);
+		buffer=bytes;
 	}
-	if(level==0) progress(NULL, 1, 1);
+
+	return((BYTE4)buffer[0]|((BYTE4)buffer[1]<<8)|
+		((BYTE4)buffer[2]<<16)|((BYTE4)buffer[3]<<24));
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Load_Model
+ *		Function:	Put_Varint
  *
- *		Purpose:		Load a model into memory.
+ *		Purpose:		Append a value to a stream seven bits at a time, least
+ *						significant first, with the top bit of each byte set if
+ *						more follow.  Small values take a single byte.
  */
-bool load_model(char *filename, MODEL *model)
+void put_varint(STREAM *stream, BYTE4 value)
 {
-	FILE *file;
-	char cookie[16];
+	register BYTE1 *buffer;
 
-	if(filename==NULL) return(FALSE);
+	if(stream->length+5>stream->size) flush_stream(stream);
 
-	file=fopen(filename, "rb");
-	if(file==NULL) {
-		warn("load_model", "Unable to open file `%s'", filename);
-		return(FALSE);
+	buffer=stream->buffer+stream->length;
+	while(value>=0x80) {
+		*buffer++=(BYTE1)((value&0x7F)|0x80);
+		value>>=7;
 	}
+	*buffer++=(BYTE1)value;
+	stream->length=buffer-stream->buffer;
+}
 
-	fread(cookie, sizeof(char), strlen(COOKIE), file);
-	if(strncmp(cookie, COOKIE, strlen(COOKIE))!=0) {
-		warn("load_model", "File `%s' is not a MegaHAL brain", filename);
-		goto fail;
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Get_Varint
+ *
+ *		Purpose:		Take a value written by put_varint() from a stream.
+ */
+BYTE4 get_varint(STREAM *stream)
+{
+	BYTE4 value=0;
+	BYTE1 byte;
+	register int shift;
+
+	for(shift=0; shift<35; shift+=7) {
+		if(stream->position<stream->length) byte=stream->buffer[stream->position++];
+		else if(get_bytes(stream, &byte, 1)==FALSE) return(0);
+		value|=(BYTE4)(byte&0x7F)<<shift;
+		if((byte&0x80)==0) return(value);
 	}
+	stream->failed=TRUE;
 
-	fread(&(model->order), sizeof(BYTE1), 1, file);
-	load_tree(file, model->forward);
-	load_tree(file, model->backward);
-	load_dictionary(file, model->dictionary);
+	return(0);
+}
 
-	return(TRUE);
-fail:
-	fclose(file);
+/*---------------------------------------------------------------------------*/
 
-	return(FALSE);
+/*
+ *		Function:	Varint_Size
+ *
+ *		Purpose:		Return the number of bytes put_varint() takes to write a
+ *						value.
+ */
+int varint_size(BYTE4 value)
+{
+	register int size=1;
+
+	while(value>=0x80) {
+		value>>=7;
+		++size;
+	}
+
+	return(size);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *    Function:   Make_Words
+ *		Function:	New_Node
  *
- *    Purpose:    Break a string into an array of words.
+ *		Purpose:		Allocate a new node for the n-gram tree, and initialise
+ *						its contents to sensible values.
  */
-void make_words(char *input, DICTIONARY *words)
+TREE *new_node(NODEPOOL *pool)
 {
-	int offset=0;
+	TREE *node=NULL;
+	BLOCK *block;
 
 	/*
-	 *		Clear the entries in the dictionary
+	 *		Reuse a released node if there is one, otherwise take the next
+	 *		node from the current block, allocating a new block if it is full
 	 */
-	free_dictionary(words);
+	if(pool->free!=NULL) {
+		node=pool->free;
+		pool->free=(TREE *)node->tree;
+	} else {
+		if((pool->block==NULL)||(pool->block->used==NODE_BLOCK)) {
+			block=(BLOCK *)malloc(sizeof(BLOCK));
+			if(block==NULL) {
+				error("new_node", "Unable to allocate the node block.");
+				goto fail;
+			}
+			block->used=0;
+			block->next=pool->block;
+			pool->block=block;
+			pool->reserved+=sizeof(BLOCK);
+		}
+		node=&(pool->block->node[pool->block->used++]);
+	}
+	pool->bytes+=sizeof(TREE);
 
 	/*
-	 *		If the string is empty then do nothing, for it contains no words.
+	 *		Initialise the contents of the node
 	 */
-	if(strlen(input)==0) return;
+	node->symbol=0;
+	node->usage=0;
+	node->count=0;
+	node->branch=0;
+	node->capacity=0;
+	node->tree=NULL;
 
-	/*
-	 *		Loop forever.
-	 */
-	while(1) {
+	return(node);
 
-		/*
-		 *		If the current character is of the same type as the previous
-		 *		character, then include it in the word.  Otherwise, terminate
-		 *		the current word.
-		 */
-		if(boundary(input, offset)) {
-			/*
-			 *		Add the word to the dictionary
-			 */
-			if(words->entry==NULL)
-				words->entry=(STRING *)malloc((words->size+1)*sizeof(STRING));
-			else
-				words->entry=(STRING *)realloc(words->entry, (words->size+1)*sizeof(STRING));
+fail:
+	return(NULL);
+}
 
-			if(words->entry==NULL) {
-				error("make_words", "Unable to reallocate dictionary");
-				return;
-			}
+/*---------------------------------------------------------------------------*/
 
-			words->entry[words->size].length=offset;
-			words->entry[words->size].word=input;
-			words->size+=1;
+/*
+ *		Function:	New_Pool
+ *
+ *		Purpose:		Allocate an empty pool from which the nodes of a model's
+ *						n-gram trees will be taken.
+ */
+NODEPOOL *new_pool(void)
+{
+	NODEPOOL *pool=NULL;
+	register int i;
 
-			if(offset==(int)strlen(input)) break;
-			input+=offset;
-			offset=0;
-		} else {
-			++offset;
-		}
+	pool=(NODEPOOL *)malloc(sizeof(NODEPOOL));
+	if(pool==NULL) {
+		error("new_pool", "Unable to allocate the node pool.");
+		return(NULL);
 	}
 
+	pool->block=NULL;
+	pool->free=NULL;
+	pool->chunk=NULL;
+	pool->top=NULL;
+	pool->room=0;
+	for(i=0; i<BRANCH_CLASSES; ++i) pool->spare[i]=NULL;
+	pool->bytes=0;
+	pool->reserved=0;
+
+	return(pool);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Branch_Size
+ *
+ *		Purpose:		Return the number of bytes taken by a subtree array with
+ *						the given power of two capacity, including its symbol
+ *						array, hash table and running totals.
+ */
+size_t branch_size(BYTE4 capacity)
+{
+	size_t size;
+
+	size=(sizeof(TREE *)+sizeof(BYTE4))*(size_t)capacity;
+	if(capacity>=HASH_FANOUT)
+		size+=sizeof(TREE *)*2*(size_t)capacity+sizeof(BYTE4)*((size_t)capacity+1);
+
+	return((size+sizeof(TREE *)-1)&~(sizeof(TREE *)-1));
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	New_Branch
+ *
+ *		Purpose:		Allocate a subtree array with room for the given number
+ *						of children, rounded up to a power of two.  Small arrays
+ *						are carved out of a shared chunk, so that the one and two
+ *						child arrays which make up most of the tree don't each
+ *						pay for a separate malloc().  Each array of child
+ *						pointers is followed by an array of their symbols, and
+ *						arrays with a capacity of at least HASH_FANOUT are then
+ *						followed by a hash table with twice as many slots and
+ *						by room for the running totals of their counts.
+ */
+TREE **new_branch(NODEPOOL *pool, BYTE4 capacity)
+{
+	CHUNK *chunk;
+	TREE **branch;
+	size_t size;
+	register int class;
+
+	for(class=0; ((BYTE4)1<<class)<capacity; ++class);
+
 	/*
-	 *		If the last word isn't punctuation, then replace it with a
-	 *		full-stop character.
+	 *		Reuse an array of the same size if one has been released
 	 */
-	if(isalnum(words->entry[words->size-1].word[0])) {
-		if(words->entry==NULL)
-			words->entry=(STRING *)malloc((words->size+1)*sizeof(STRING));
-		else
-			words->entry=(STRING *)realloc(words->entry, (words->size+1)*sizeof(STRING));
-		if(words->entry==NULL) {
-			error("make_words", "Unable to reallocate dictionary");
-			return;
-		}
+	size=branch_size((BYTE4)1<<class);
+	pool->bytes+=size;
 
-		words->entry[words->size].length=1;
-		words->entry[words->size].word=".";
-		++words->size;
+	if(pool->spare[class]!=NULL) {
+		branch=pool->spare[class];
+		pool->spare[class]=(TREE **)branch[0];
+		return(branch);
 	}
-	else if(strchr("!.?", words->entry[words->size-1].word[words->entry[words->size-1].length-1])==NULL) {
-		words->entry[words->size-1].length=1;
-		words->entry[words->size-1].word=".";
+
+	/*
+	 *		Large arrays get a chunk to themselves, so that they don't waste
+	 *		the remainder of the current chunk.
+	 */
+	if(size>BRANCH_CHUNK/4) {
+		chunk=(CHUNK *)malloc(sizeof(CHUNK)+size);
+		if(chunk==NULL) {
+			error("new_branch", "Unable to allocate subtree of %d nodes", capacity);
+			return(NULL);
+		}
+		chunk->next=pool->chunk;
+		pool->chunk=chunk;
+		pool->reserved+=sizeof(CHUNK)+size;
+		return((TREE **)(chunk+1));
 	}
 
-   return;
+	if(size>pool->room) {
+		chunk=(CHUNK *)malloc(sizeof(CHUNK)+BRANCH_CHUNK);
+		if(chunk==NULL) {
+			error("new_branch", "Unable to allocate subtree chunk");
+			return(NULL);
+		}
+		chunk->next=pool->chunk;
+		pool->chunk=chunk;
+		pool->top=(char *)(chunk+1);
+		pool->room=BRANCH_CHUNK;
+		pool->reserved+=sizeof(CHUNK)+BRANCH_CHUNK;
+	}
+
+	branch=(TREE **)pool->top;
+	pool->top+=size;
+	pool->room-=size;
+
+	return(branch);
 }
- 
-/*---------------------------------------------------------------------------*/ 
+
+/*---------------------------------------------------------------------------*/
+
 /*
- *		Function:	Boundary
+ *		Function:	New_Model
  *
- *		Purpose:		Return whether or not a word boundary exists in a string
- *						at the specified location.
+ *		Purpose:		Create and initialise a new ngram model.
  */
-bool boundary(char *string, int position)
+MODEL *new_model(int order)
 {
-	if(position==0)
-		return(FALSE);
+	MODEL *model=NULL;
+	GUARD guard;
 
-	if(position==(int)strlen(string))
-		return(TRUE);
+	model=(MODEL *)malloc(sizeof(MODEL));
+	if(model==NULL)
+		error("new_model", "Unable to allocate model.");
 
-	if(
-		(string[position]=='\'')&&
-		(isalpha(string[position-1])!=0)&&
-		(isalpha(string[position+1])!=0)
-	)
-		return(FALSE);
+	model->order=order;
+	model->pool=NULL;
+	model->forward=NULL;
+	model->backward=NULL;
+	model->context=NULL;
+	model->frozen_forward=NULL;
+	model->frozen_backward=NULL;
+	model->frozen=NULL;
+	model->frozen_context=NULL;
+	model->image=NULL;
+	model->image_size=0;
+	model->dictionary=NULL;
+	model->census.nodes=NULL;
+	model->random=NULL;
+	model->merged=NULL;
+	model->merged_room=0;
 
-	if(
-		(position>1)&&
-		(string[position-1]=='\'')&&
-		(isalpha(string[position-2])!=0)&&
-		(isalpha(string[position])!=0)
-	)
-		return(FALSE);
+	/*
+	 *		Whatever has been allocated is freed if the rest can't be.
+	 */
+	push_guard(&guard);
+	if(setjmp(guard.failed)!=0) {
+		free_model(model);
+		fail_guard(&guard);
+	}
 
-	if(
-		(isalpha(string[position])!=0)&&
-		(isalpha(string[position-1])==0)
-	)
-		return(TRUE);
-	
-	if(
-		(isalpha(string[position])==0)&&
-		(isalpha(string[position-1])!=0)
-	)
-		return(TRUE);
-	
-	if(isdigit(string[position])!=isdigit(string[position-1]))
-		return(TRUE);
+	model->pool=new_pool();
+	model->forward=new_node(model->pool);
+	model->backward=new_node(model->pool);
+	model->context=(TREE **)malloc(sizeof(TREE *)*(order+2));
+	if(model->context==NULL)
+		error("new_model", "Unable to allocate context array.");
+	model->frozen_context=(BYTE4 *)malloc(sizeof(BYTE4)*(order+2));
+	if(model->frozen_context==NULL)
+		error("new_model", "Unable to allocate frozen context array.");
+	initialize_context(model);
+	model->dictionary=new_dictionary();
+	initialize_dictionary(model->dictionary);
+	census_model(model);
 
-	return(FALSE);
+	pop_guard(&guard);
+	return(model);
 }
- 
-/*---------------------------------------------------------------------------*/ 
+
+/*---------------------------------------------------------------------------*/
+
 /*
- *		Function:	Make_Greeting
+ *		Function:	Update_Model
  *
- *		Purpose:		Put some special words into the dictionary so that the
- *						program will respond as if to a new judge.
+ *		Purpose:		Update the model with the specified symbol.
  */
-void make_greeting(DICTIONARY *words)
+void update_model(MODEL *model, int symbol)
 {
 	register int i;
+	register BYTE4 j;
+	TREE *parent;
+	BYTE4 branch;
+	BYTE4 usage;
+	BYTE4 frozen;
+	BYTE4 count;
+	BYTE4 total;
+	BYTE4 width;
+	BYTE4 fanout;
+	unsigned long *nodes;
 
-	for(i=0; i<words->size; ++i) free(words->entry[i].word);
-	free_dictionary(words);
-	if(grt->size>0) (void)add_word(words, grt->entry[rnd(grt->size)]);
+	/*
+	 *		The census keeps the node counts of the backward tree after those
+	 *		of the forward tree.
+	 */
+	nodes=model->census.nodes;
+	if(model->context[0]==model->backward) nodes+=model->order+2;
+
+	/*
+	 *		Update all of the models in the current context with the specified
+	 *		symbol, and keep the census up to date as we go.  If the model is
+	 *		frozen, the symbol is learnt in the trees on top of it, and the
+	 *		frozen context is followed so that the counts and the census
+	 *		describe the two combined.
+	 */
+	for(i=(model->order+1); i>0; --i)
+		if(model->context[i-1]!=NULL) {
+			parent=model->context[i-1];
+			frozen=0;
+			count=0;
+			total=0;
+			width=0;
+			if(model->frozen_context[i-1]!=0) {
+				frozen=find_frozen(model->frozen, model->frozen_context[i-1], symbol);
+				count=model->frozen->count[frozen];
+				total=model->frozen->usage[model->frozen_context[i-1]];
+				width=model->frozen->child[model->frozen_context[i-1]+1]-
+					model->frozen->child[model->frozen_context[i-1]];
+			}
+			model->frozen_context[i]=frozen;
+			branch=parent->branch;
+			usage=parent->usage;
+			model->context[i]=add_symbol(model->pool, parent, (BYTE4)symbol,
+				count, total);
+			if((parent->branch!=branch)&&(frozen==0)) {
+				++nodes[i];
+				if((branch==0)&&(width==0)) ++model->census.parents;
+				if(width+parent->branch>model->census.widest) {
+					fanout=parent->branch;
+					if(width>0) for(fanout=width, j=0; j<parent->branch; ++j)
+						if(find_frozen(model->frozen, model->frozen_context[i-1],
+							parent->tree[j]->symbol)==0) ++fanout;
+					if(fanout>model->census.widest) model->census.widest=fanout;
+				}
+			}
+			if((parent->usage!=usage)&&(count+model->context[i]->count==MAX_COUNT))
+				++model->census.saturated;
+		}
+
+	return;
 }
- 
-/*---------------------------------------------------------------------------*/ 
+
+/*---------------------------------------------------------------------------*/
+
 /*
- *    Function:   Generate_Reply
+ *		Function:	Update_Context
  *
- *    Purpose:    Take a string of user input and return a string of output
- *                which may vaguely be construed as containing a reply to
- *                whatever is in the input string.
+ *		Purpose:		Update the context of the model without adding the symbol.
  */
-char *generate_reply(MODEL *model, DICTIONARY *words)
+void update_context(MODEL *model, int symbol)
 {
-	static DICTIONARY *dummy=NULL;
-	DICTIONARY *replywords;
-	DICTIONARY *keywords;
-	float surprise;
-	float max_surprise;
-	char *output;
-	static char *output_none=NULL;
-	int count;
-	int basetime;
-
-	/*
-	 *		Create an array of keywords from the words in the user's input
-	 */
-	keywords=make_keywords(model, words);
+	register int i;
 
 	/*
-	 *		Make sure some sort of reply exists
+	 *		A frozen model is followed in both its frozen form and the trees
+	 *		learnt on top of it.
 	 */
-	if(output_none==NULL) {
-		output_none=malloc(40);
-		if(output_none!=NULL)
-			strcpy(output_none, "I don't know enough to answer you yet!");
+	for(i=(model->order+1); i>0; --i) {
+		if(model->frozen_context[i-1]!=0)
+			model->frozen_context[i]=find_frozen(model->frozen,
+				model->frozen_context[i-1], symbol);
+		if(model->context[i-1]!=NULL)
+			model->context[i]=find_symbol(model->context[i-1], symbol);
 	}
-	output=output_none;
-	if(dummy==NULL) dummy=new_dictionary();
-	replywords=reply(model, dummy);
-	if(dissimilar(words, replywords)==TRUE) output=make_output(replywords);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Add_Symbol
+ *
+ *		Purpose:		Update the statistics of the specified tree with the
+ *						specified symbol, which may mean growing the tree if the
+ *						symbol hasn't been seen in this context before.  The
+ *						count and usage are those already held by a frozen model
+ *						underneath the tree, which saturate along with its own.
+ */
+TREE *add_symbol(NODEPOOL *pool, TREE *tree, BYTE4 symbol, BYTE4 count, BYTE4 usage)
+{
+	TREE *node=NULL;
 
 	/*
-	 *		Loop for the specified waiting period, generating and evaluating
-	 *		replies
+	 *		Search for the symbol in the subtree of the tree node.
 	 */
-	max_surprise=(float)-1.0;
-	count=0;
-	basetime=time(NULL);
-	progress("Generating reply", 0, 1);
-	do {
-		replywords=reply(model, keywords);
-		surprise=evaluate_reply(model, keywords, replywords);
-		++count;
-		if((surprise>max_surprise)&&(dissimilar(words, replywords)==TRUE)) {
-			max_surprise=surprise;
-			output=make_output(replywords);
-		}
-		progress(NULL, (time(NULL)-basetime),timeout);
-	} while((time(NULL)-basetime)<timeout);
-	progress(NULL, 1, 1);
+	node=find_symbol_add(pool, tree, symbol);
+	if(tree->capacity>=HASH_FANOUT) TOTALS(tree)[0]=0;
 
 	/*
-	 *		Return the best answer we generated
+	 *		Increment the symbol counts, which saturate at a value that still
+	 *		fits in the int that rnd() is given.  The running totals of a
+	 *		wide node are rebuilt when babble() next needs them.
 	 */
-	return(output);
+	if((count+node->count<MAX_COUNT)&&(usage+tree->usage<MAX_COUNT)) {
+		node->count+=1;
+		tree->usage+=1;
+	}
+
+	return(node);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Dissimilar
+ *		Function:	Find_Symbol
  *
- *		Purpose:		Return TRUE or FALSE depending on whether the dictionaries
- *						are the same or not.
+ *		Purpose:		Return a pointer to the child node, if one exists, which
+ *						contains the specified symbol.
  */
-bool dissimilar(DICTIONARY *words1, DICTIONARY *words2)
+TREE *find_symbol(TREE *node, int symbol)
 {
 	register int i;
+	TREE *found=NULL;
+	bool found_symbol=FALSE;
 
-	if(words1->size!=words2->size) return(TRUE);
-	for(i=0; i<words1->size; ++i)
-		if(wordcmp(words1->entry[i], words2->entry[i])!=0) return(TRUE);
-	return(FALSE);
+	/*
+	 *		Nodes with many children are looked up through their hash table.
+	 */
+	if(node->capacity>=HASH_FANOUT) return(find_hashed(node, symbol));
+
+	/* 
+	 *		Perform a binary search for the symbol.
+	 */
+	i=search_node(node, symbol, &found_symbol);
+	if(found_symbol==TRUE) found=node->tree[i];
+
+	return(found);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Make_Keywords
+ *		Function:	Hash_Symbol
  *
- *		Purpose:		Put all the interesting words from the user's input into
- *						a keywords dictionary, which will be used when generating
- *						a reply.
+ *		Purpose:		Scramble a symbol so that neighbouring symbols land in
+ *						different slots of a node's hash table.
  */
-DICTIONARY *make_keywords(MODEL *model, DICTIONARY *words)
+BYTE4 hash_symbol(BYTE4 symbol)
 {
-	static DICTIONARY *keys=NULL;
-	register int i;
-	register int j;
-	int c;
+	symbol*=0x9E3779B1;
+	return(symbol^(symbol>>16));
+}
 
-	if(keys==NULL) keys=new_dictionary();
-	for(i=0; i<keys->size; ++i) free(keys->entry[i].word);
-	free_dictionary(keys);
+/*---------------------------------------------------------------------------*/
 
-	for(i=0; i<words->size; ++i) {
-		/*
-		 *		Find the symbol ID of the word.  If it doesn't exist in
-		 *		the model, or if it begins with a non-alphanumeric
-		 *		character, or if it is in the exclusion array, then
-		 *		skip over it.
-		 */
-		c=0;
-		for(j=0; j<swp->size; ++j)
-			if(wordcmp(swp->from[j], words->entry[i])==0) {
-				add_key(model, keys, swp->to[j]);
-				++c;
-			}
-		if(c==0) add_key(model, keys, words->entry[i]);
+/*
+ *		Function:	Hash_Node
+ *
+ *		Purpose:		Rebuild the hash table of a node with a large capacity
+ *						from its symbol array.  The table is open-addressed, with
+ *						twice as many slots as the subtree has room for, and it
+ *						holds pointers to the children so that it stays valid
+ *						while the sorted subtree array is shuffled.  The running
+ *						totals of the counts are marked as stale at the same time.
+ */
+void hash_node(TREE *node)
+{
+	TREE **table;
+	BYTE4 *keys;
+	register BYTE4 i;
+	register BYTE4 slot;
+	BYTE4 mask;
+
+	if(node->capacity<HASH_FANOUT) return;
+
+	keys=KEYS(node);
+	table=TABLE(node);
+	mask=node->capacity*2-1;
+	TOTALS(node)[0]=0;
+	for(i=0; i<=mask; ++i) table[i]=NULL;
+	for(i=0; i<node->branch; ++i) {
+		slot=hash_symbol(keys[i])&mask;
+		while(table[slot]!=NULL) slot=(slot+1)&mask;
+		table[slot]=node->tree[i];
 	}
+}
 
-	if(keys->size>0) for(i=0; i<words->size; ++i) {
+/*---------------------------------------------------------------------------*/
 
-		c=0;
-		for(j=0; j<swp->size; ++j)
-			if(wordcmp(swp->from[j], words->entry[i])==0) {
-				add_aux(model, keys, swp->to[j]);
-				++c;
-			}
-		if(c==0) add_aux(model, keys, words->entry[i]);
-	}
+/*
+ *		Function:	Index_Node
+ *
+ *		Purpose:		Fill in the symbol array and the hash table of a node
+ *						whose children have been attached in bulk, as they are
+ *						when a brain is loaded or thawed.
+ */
+void index_node(TREE *node)
+{
+	BYTE4 *keys;
+	register BYTE4 i;
 
-	return(keys);
+	if(node->capacity==0) return;
+
+	keys=KEYS(node);
+	for(i=0; i<node->branch; ++i) keys[i]=node->tree[i]->symbol;
+	hash_node(node);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Add_Key
+ *		Function:	Find_Hashed
  *
- *		Purpose:		Add a word to the keyword dictionary.
+ *		Purpose:		Look up the child of a node with a large capacity which
+ *						contains the specified symbol, using the node's hash table
+ *						rather than a binary search.
  */
-void add_key(MODEL *model, DICTIONARY *keys, STRING word)
+TREE *find_hashed(TREE *node, int symbol)
 {
-	int symbol;
-
-	symbol=find_word(model->dictionary, word);
-	if(symbol==0) return;
-	if(isalnum(word.word[0])==0) return;
-	symbol=find_word(ban, word);
-	if(symbol!=0) return;
-	symbol=find_word(aux, word);
-	if(symbol!=0) return;
+	TREE **table;
+	register BYTE4 slot;
+	BYTE4 mask;
+
+	table=TABLE(node);
+	mask=node->capacity*2-1;
+	slot=hash_symbol((BYTE4)symbol)&mask;
+	while(table[slot]!=NULL) {
+		if(table[slot]->symbol==(BYTE4)symbol) return(table[slot]);
+		slot=(slot+1)&mask;
+	}
 
-	add_word(keys, word);
+	return(NULL);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Add_Aux
+ *		Function:	Find_Frozen
  *
- *		Purpose:		Add an auxilliary keyword to the keyword dictionary.
+ *		Purpose:		Return the index of the child of a frozen node which
+ *						contains the specified symbol, or zero if there isn't one.
+ *						The symbols of the children are adjacent, so they can be
+ *						searched in the same way as the symbol array of a node.
  */
-void add_aux(MODEL *model, DICTIONARY *keys, STRING word)
+BYTE4 find_frozen(FROZEN *frozen, BYTE4 node, int symbol)
 {
-	int symbol;
+	register BYTE4 min;
+	register BYTE4 max;
 
-	symbol=find_word(model->dictionary, word);
-	if(symbol==0) return;
-	if(isalnum(word.word[0])==0) return;
-	symbol=find_word(aux, word);
-	if(symbol==0) return;
+	min=frozen->child[node];
+	max=frozen->child[node+1];
+	min+=search_keys(frozen->symbol+min, max-min, (BYTE4)symbol);
+
+	if((min<max)&&(frozen->symbol[min]==(BYTE4)symbol)) return(min);
 
-	add_word(keys, word);
+	return(0);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Reply
+ *		Function:	Find_Symbol_Add
  *
- *		Purpose:		Generate a dictionary of reply words appropriate to the
- *						given dictionary of keywords.
+ *		Purpose:		This function is conceptually similar to find_symbol,
+ *						apart from the fact that if the symbol is not found,
+ *						a new node is automatically allocated and added to the
+ *						tree.
  */
-DICTIONARY *reply(MODEL *model, DICTIONARY *keys)
+TREE *find_symbol_add(NODEPOOL *pool, TREE *node, int symbol)
 {
-	static DICTIONARY *replies=NULL;
 	register int i;
-	int symbol;
-	bool start=TRUE;
-
-	if(replies==NULL) replies=new_dictionary();
-	free_dictionary(replies);
+	TREE *found=NULL;
+	bool found_symbol=FALSE;
 
 	/*
-	 *		Start off by making sure that the model's context is empty.
+	 *		Check the hash table of a node with many children first, since
+	 *		the symbol is usually there.
 	 */
-	initialize_context(model);
-	model->context[0]=model->forward;
-	used_key=FALSE;
+	if(node->capacity>=HASH_FANOUT) {
+		found=find_hashed(node, symbol);
+		if(found!=NULL) return(found);
+	}
 
-	/*
-	 *		Generate the reply in the forward direction.
+	/* 
+	 *		Perform a binary search for the symbol.  If the symbol isn't found,
+	 *		attach a new sub-node to the tree node so that it remains sorted.
 	 */
-	while(TRUE) {
-		/*
-		 *		Get a random symbol from the current context.
-		 */
-		if(start==TRUE) symbol=seed(model, keys);
-		else symbol=babble(model, keys, replies);
-		if((symbol==0)||(symbol==1)) break;
-		start=FALSE;
+	i=search_node(node, symbol, &found_symbol);
+	if(found_symbol==TRUE) {
+		found=node->tree[i];
+	} else {
+		found=new_node(pool);
+		found->symbol=symbol;
+		add_node(pool, node, found, i);
+	}
 
-		/*
-		 *		Append the symbol to the reply dictionary.
-		 */
-		if(replies->entry==NULL)
-			replies->entry=(STRING *)malloc((replies->size+1)*sizeof(STRING));
-		else
-			replies->entry=(STRING *)realloc(replies->entry, (replies->size+1)*sizeof(STRING));
-		if(replies->entry==NULL) {
-			error("reply", "Unable to reallocate dictionary");
-			return(NULL);
-		}
+	return(found);
+}
 
-		replies->entry[replies->size].length=
-			model->dictionary->entry[symbol].length;
-		replies->entry[replies->size].word=
-			model->dictionary->entry[symbol].word;
-		replies->size+=1;
+/*---------------------------------------------------------------------------*/
 
-		/*
-		 *		Extend the current context of the model with the current symbol.
-		 */
-		update_context(model, symbol);
-	}
+/*
+ *		Function:	Add_Node
+ *
+ *		Purpose:		Attach a new child node to the sub-tree of the tree
+ *						specified.
+ */
+void add_node(NODEPOOL *pool, TREE *tree, TREE *node, int position)
+{
+	TREE **subtree;
+	TREE **table;
+	BYTE4 *keys;
+	BYTE4 capacity;
+	BYTE4 slot;
+	bool grown=FALSE;
 
 	/*
-	 *		Start off by making sure that the model's context is empty.
+	 *		If the sub-tree is full, move it to an array twice the size, which
+	 *		may mean allocating the sub-tree from scratch.  Doubling keeps the
+	 *		cost of growing the root and order-one contexts, which have very
+	 *		many children, constant per child on average.
 	 */
-	initialize_context(model);
-	model->context[0]=model->backward;
+	if(tree->branch==tree->capacity) {
+		capacity=(tree->capacity==0)?1:tree->capacity*2;
+		subtree=new_branch(pool, capacity);
+		if(subtree==NULL) {
+			error("add_node", "Unable to reallocate subtree.");
+			return;
+		}
+		if(tree->tree!=NULL) {
+			memcpy(subtree, tree->tree, sizeof(TREE *)*tree->branch);
+			memcpy(subtree+capacity, KEYS(tree), sizeof(BYTE4)*tree->branch);
+			free_branch(pool, tree->tree, tree->capacity);
+		}
+		tree->tree=subtree;
+		tree->capacity=capacity;
+		grown=TRUE;
+	}
 
 	/*
-	 *		Re-create the context of the model from the current reply
-	 *		dictionary so that we can generate backwards to reach the
-	 *		beginning of the string.
+	 *		Shuffle the nodes and their symbols down so that we can insert the
+	 *		new node at the subtree index given by position.
 	 */
-	if(replies->size>0) for(i=MIN(replies->size-1, model->order); i>=0; --i) {
-		symbol=find_word(model->dictionary, replies->entry[i]);
-		update_context(model, symbol);
-	}
+	keys=KEYS(tree);
+	memmove(&(tree->tree[position+1]), &(tree->tree[position]),
+		sizeof(TREE *)*(tree->branch-position));
+	memmove(&(keys[position+1]), &(keys[position]),
+		sizeof(BYTE4)*(tree->branch-position));
 
 	/*
-	 *		Generate the reply in the backward direction.
+	 *		Add the new node to the sub-tree.
 	 */
-	while(TRUE) {
-		/*
-		 *		Get a random symbol from the current context.
-		 */
-		symbol=babble(model, keys, replies);
-		if((symbol==0)||(symbol==1)) break;
+	tree->tree[position]=node;
+	keys[position]=node->symbol;
+	tree->branch+=1;
 
-		/*
-		 *		Prepend the symbol to the reply dictionary.
-		 */
-		if(replies->entry==NULL)
-			replies->entry=(STRING *)malloc((replies->size+1)*sizeof(STRING));
-		else
-			replies->entry=(STRING *)realloc(replies->entry, (replies->size+1)*sizeof(STRING));
-		if(replies->entry==NULL) {
-			error("reply", "Unable to reallocate dictionary");
-			return(NULL);
-		}
+	/*
+	 *		Keep the hash table up to date.  A table that has just been moved
+	 *		to a bigger array has to be built from scratch.
+	 */
+	if(tree->capacity<HASH_FANOUT) return;
+	if(grown==TRUE) {
+		hash_node(tree);
+		return;
+	}
+	table=TABLE(tree);
+	slot=hash_symbol(node->symbol)&(tree->capacity*2-1);
+	while(table[slot]!=NULL) slot=(slot+1)&(tree->capacity*2-1);
+	table[slot]=node;
+}
 
-		/*
-		 *		Shuffle everything up for the prepend.
-		 */
-		for(i=replies->size; i>0; --i) {
-			replies->entry[i].length=replies->entry[i-1].length;
-			replies->entry[i].word=replies->entry[i-1].word;
-		}
+/*---------------------------------------------------------------------------*/
 
-		replies->entry[0].length=model->dictionary->entry[symbol].length;
-		replies->entry[0].word=model->dictionary->entry[symbol].word;
-		replies->size+=1;
+/*
+ *		Function:	Search_Node
+ *
+ *		Purpose:		Search for the specified symbol on the subtree of the
+ *						given node.  Return the position of the child node in the
+ *						subtree if the symbol was found, or the position where it
+ *						should be inserted to keep the subtree sorted if it wasn't.
+ *						Only the symbol array of the node is examined, so the
+ *						children themselves are never touched.
+ */
+int search_node(TREE *node, int symbol, bool *found_symbol)
+{
+	register BYTE4 position;
+	BYTE4 *keys;
 
-		/*
-		 *		Extend the current context of the model with the current symbol.
-		 */
-		update_context(model, symbol);
+	/*
+	 *		Handle the special case where the subtree is empty.
+	 */ 
+	if(node->branch==0) {
+		*found_symbol=FALSE;
+		return(0);
 	}
 
-	return(replies);
+	keys=KEYS(node);
+	position=search_keys(keys, node->branch, (BYTE4)symbol);
+	*found_symbol=((position<node->branch)&&(keys[position]==(BYTE4)symbol))?TRUE:FALSE;
+
+	return((int)position);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Evaluate_Reply
- *
- *		Purpose:		Measure the average surprise of keywords relative to the
- *						language model.
+ *		Function:	Search_Keys
+ *
+ *		Purpose:		Return the number of symbols in a sorted array which are
+ *						less than the specified symbol, which is the position of
+ *						the symbol if it is present.  Arrays of up to SCAN_FANOUT
+ *						symbols are scanned, which avoids mispredicted branches,
+ *						using vector instructions unless the array is so short
+ *						that setting them up would cost more than the scan.
+ *						Longer arrays are bisected.
  */
-float evaluate_reply(MODEL *model, DICTIONARY *keys, DICTIONARY *words)
+BYTE4 search_keys(BYTE4 *keys, BYTE4 size, BYTE4 symbol)
 {
-	register int i;
-	register int j;
-	int symbol;
-	float probability;
-	int count;
-	float entropy=(float)0.0;
-	TREE *node;
-	int num=0;
+	if(size<SCAN_SHORT) return(scan_scalar(keys, size, symbol));
+	if(size<SCAN_FANOUT) return(scan_keys(keys, size, symbol));
+	return(bisect_keys(keys, size, symbol));
+}
 
-	if(words->size<=0) return((float)0.0);
-	initialize_context(model);
-	model->context[0]=model->forward;
-	for(i=0; i<words->size; ++i) {
-		symbol=find_word(model->dictionary, words->entry[i]);
+/*---------------------------------------------------------------------------*/
 
-		if(find_word(keys, words->entry[i])!=0) {
-			probability=(float)0.0;
-			count=0;
-			++num;
-			for(j=0; j<model->order; ++j) if(model->context[j]!=NULL) {
-	
-				node=find_symbol(model->context[j], symbol);
-				probability+=(float)(node->count)/
-					(float)(model->context[j]->usage);
-				++count;
-	
-			}
+/*
+ *		Function:	Bisect_Keys
+ *
+ *		Purpose:		Binary search of a sorted symbol array, written so that
+ *						the compiler can use a conditional move rather than a
+ *						branch at each step.
+ */
+BYTE4 bisect_keys(BYTE4 *keys, BYTE4 size, BYTE4 symbol)
+{
+	register BYTE4 *base=keys;
+	register BYTE4 half;
 
-			if(count>0.0) entropy-=(float)log(probability/(float)count);
-		}
+	if(size==0) return(0);
 
-		update_context(model, symbol);
+	while(size>1) {
+		half=size/2;
+		base=(base[half-1]<symbol)?base+half:base;
+		size-=half;
 	}
 
-	initialize_context(model);
-	model->context[0]=model->backward;
-	for(i=words->size-1; i>=0; --i) {
-		symbol=find_word(model->dictionary, words->entry[i]);
-
-		if(find_word(keys, words->entry[i])!=0) {
-			probability=(float)0.0;
-			count=0;
-			++num;
-			for(j=0; j<model->order; ++j) if(model->context[j]!=NULL) {
-	
-				node=find_symbol(model->context[j], symbol);
-				probability+=(float)(node->count)/
-					(float)(model->context[j]->usage);
-				++count;
-	
-			}
+	return((BYTE4)(base-keys)+((*base<symbol)?1:0));
+}
 
-			if(count>0.0) entropy-=(float)log(probability/(float)count);
-		}
+/*---------------------------------------------------------------------------*/
 
-		update_context(model, symbol);
-	}
+/*
+ *		Function:	Scan_Scalar
+ *
+ *		Purpose:		Count the symbols which are less than the given symbol,
+ *						one at a time.  This is used where no vector instructions
+ *						are available.
+ */
+BYTE4 scan_scalar(BYTE4 *keys, BYTE4 size, BYTE4 symbol)
+{
+	register BYTE4 i;
+	register BYTE4 less=0;
 
-	if(num>=8) entropy/=(float)sqrt(num-1);
-	if(num>=16) entropy/=(float)num;
+	for(i=0; i<size; ++i) less+=(keys[i]<symbol)?1:0;
 
-	return(entropy);
+	return(less);
 }
 
 /*---------------------------------------------------------------------------*/
 
+#ifdef SIMD_SCAN
 /*
- *		Function:	Make_Output
+ *		Function:	Scan_SSE2
  *
- *		Purpose:		Generate a string from the dictionary of reply words.
+ *		Purpose:		Count the symbols which are less than the given symbol,
+ *						four at a time.  SSE2 only has a signed comparison, so
+ *						both sides are biased by 0x80000000 first.
  */
-char *make_output(DICTIONARY *words)
+__attribute__((target("sse2")))
+BYTE4 scan_sse2(BYTE4 *keys, BYTE4 size, BYTE4 symbol)
 {
-	static char *output=NULL;
-	register int i;
-	register int j;
-	int length;
-	static char *output_none=NULL;
-	
-	if(output_none==NULL) output_none=malloc(40);
-
-	if(output==NULL) {
-		output=(char *)malloc(sizeof(char));
-		if(output==NULL) {
-			error("make_output", "Unable to allocate output");
-			return(output_none);
-		}
-	}
+	__m128i bias=_mm_set1_epi32((int)0x80000000);
+	__m128i key=_mm_xor_si128(_mm_set1_epi32((int)symbol), bias);
+	__m128i less=_mm_setzero_si128();
+	register BYTE4 i;
+	BYTE4 lane[4];
+	BYTE4 count;
+
+	for(i=0; i+4<=size; i+=4)
+		less=_mm_sub_epi32(less, _mm_cmpgt_epi32(key,
+			_mm_xor_si128(_mm_loadu_si128((__m128i *)(keys+i)), bias)));
+
+	_mm_storeu_si128((__m128i *)lane, less);
+	count=lane[0]+lane[1]+lane[2]+lane[3];
+	for(; i<size; ++i) count+=(keys[i]<symbol)?1:0;
+
+	return(count);
+}
 
-	if(words->size==0) {
-		if(output_none!=NULL)
-			strcpy(output_none, "I am utterly speechless!");
-		return(output_none);
-	}
+/*---------------------------------------------------------------------------*/
 
-	length=1;
-	for(i=0; i<words->size; ++i) length+=words->entry[i].length;
+/*
+ *		Function:	Scan_AVX2
+ *
+ *		Purpose:		Count the symbols which are less than the given symbol,
+ *						eight at a time.
+ */
+__attribute__((target("avx2")))
+BYTE4 scan_avx2(BYTE4 *keys, BYTE4 size, BYTE4 symbol)
+{
+	__m256i bias=_mm256_set1_epi32((int)0x80000000);
+	__m256i key=_mm256_xor_si256(_mm256_set1_epi32((int)symbol), bias);
+	__m256i less=_mm256_setzero_si256();
+	register BYTE4 i;
+	BYTE4 lane[8];
+	BYTE4 count;
+
+	for(i=0; i+8<=size; i+=8)
+		less=_mm256_sub_epi32(less, _mm256_cmpgt_epi32(key,
+			_mm256_xor_si256(_mm256_loadu_si256((__m256i *)(keys+i)), bias)));
+
+	_mm256_storeu_si256((__m256i *)lane, less);
+	count=lane[0]+lane[1]+lane[2]+lane[3]+lane[4]+lane[5]+lane[6]+lane[7];
+	for(; i<size; ++i) count+=(keys[i]<symbol)?1:0;
+
+	return(count);
+}
 
-	output=(char *)realloc(output, sizeof(char)*length);
-	if(output==NULL) {
-		error("make_output", "Unable to reallocate output.");
-		if(output_none!=NULL)
-			strcpy(output_none, "I forgot what I was going to say!");
-		return(output_none);
-	}
+/*---------------------------------------------------------------------------*/
+#endif
 
-	length=0;
-	for(i=0; i<words->size; ++i)
-		for(j=0; j<words->entry[i].length; ++j)
-			output[length++]=words->entry[i].word[j];
-			
-	output[length]='\0';
+/*
+ *		Function:	Scan_Select
+ *
+ *		Purpose:		Pick the fastest scan that the processor supports the
+ *						first time one is needed, and use it from then on.
+ */
+BYTE4 scan_select(BYTE4 *keys, BYTE4 size, BYTE4 symbol)
+{
+	select_scan();
 
-	return(output);
+	return(scan_keys(keys, size, symbol));
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Babble
+ *		Function:	Select_Scan
  *
- *		Purpose:		Return a random symbol from the current context, or a
- *						zero symbol identifier if we've reached either the
- *						start or end of the sentence.  Select the symbol based
- *						on probabilities, favouring keywords.  In all cases,
- *						use the longest available context to choose the symbol.
+ *		Purpose:		Pick the fastest scan that the processor supports.
  */
-int babble(MODEL *model, DICTIONARY *keys, DICTIONARY *words)
+void select_scan(void)
 {
-	TREE *node;
-	register int i;
-	int count;
-	int symbol;
+	scan_keys=scan_scalar;
+#ifdef SIMD_SCAN
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) scan_keys=scan_avx2;
+	else if(__builtin_cpu_supports("sse2")) scan_keys=scan_sse2;
+#endif
+}
 
-	/*
-	 *		Select the longest available context.
-	 */
-	for(i=0; i<=model->order; ++i)
-		if(model->context[i]!=NULL)
-			node=model->context[i];
+/*---------------------------------------------------------------------------*/
 
-	if(node->branch==0) return(0);
+/*
+ *		Function:	Initialize_Context
+ *
+ *		Purpose:		Set the context of the model to a default value.
+ */
+void initialize_context(MODEL *model)
+{
+	register int i;
 
-	/*
-	 *		Choose a symbol at random from this context.
-	 */
-	i=rnd(node->branch);
-	count=rnd(node->usage);
-	while(count>=0) {
-		/*
-		 *		If the symbol occurs as a keyword, then use it.  Only use an
-		 *		auxilliary keyword if a normal keyword has already been used.
-		 */
-		symbol=node->tree[i]->symbol;
+	for(i=0; i<=model->order; ++i) model->context[i]=NULL;
+	for(i=0; i<=model->order; ++i) model->frozen_context[i]=0;
+}
 
-		if(
-			(find_word(keys, model->dictionary->entry[symbol])!=0)&&
-			((used_key==TRUE)||
-			(find_word(aux, model->dictionary->entry[symbol])==0))&&
-			(word_exists(words, model->dictionary->entry[symbol])==FALSE)
-		) {
-			used_key=TRUE;
-			break;
-		}
-		count-=node->tree[i]->count;
-		i=(i>=(node->branch-1))?0:i+1;
-	}
+/*---------------------------------------------------------------------------*/
 
-	return(symbol);
+/*
+ *		Function:	Start_Context
+ *
+ *		Purpose:		Set the context of the model to the root of the given
+ *						tree, and to the root of its frozen form if there is one.
+ */
+void start_context(MODEL *model, TREE *tree, FROZEN *frozen)
+{
+	initialize_context(model);
+	model->frozen=frozen;
+	model->context[0]=tree;
+	if(frozen!=NULL) model->frozen_context[0]=1;
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Word_Exists
+ *		Function:	Count_Nodes
  *
- *		Purpose:		A silly brute-force searcher for the reply string.
+ *		Purpose:		Return the number of nodes in a tree.
  */
-bool word_exists(DICTIONARY *dictionary, STRING word)
+BYTE4 count_nodes(TREE *node)
 {
 	register int i;
+	BYTE4 count=1;
 
-	for(i=0; i<dictionary->size; ++i)
-		if(wordcmp(dictionary->entry[i], word)==0)
-			return(TRUE);
-	return(FALSE);
+	for(i=0; i<node->branch; ++i) count+=count_nodes(node->tree[i]);
+
+	return(count);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Seed
- *
- *		Purpose:		Seed the reply by guaranteeing that it contains a
- *						keyword, if one exists.
+ *		Function:	Freeze_Tree
+ *
+ *		Purpose:		Flatten a tree into parallel arrays laid out breadth-first,
+ *						so that the children of every node are stored next to each
+ *						other.  Index zero is left unused, so that it can stand for
+ *						a missing node, and the root is stored at index one.  The
+ *						children of node i are found at child[i] to child[i+1]-1.
+ *						If the tree was learnt on top of a frozen one, the two are
+ *						merged, with the counts of matching nodes added together.
  */
-int seed(MODEL *model, DICTIONARY *keys)
+FROZEN *freeze_tree(FROZEN *base, TREE *root)
 {
-	register int i;
-	int symbol;
-	int stop;
+	FROZEN *frozen=NULL;
+	TREE **queue=NULL;
+	BYTE4 *from=NULL;
+	TREE *node;
+	BYTE4 limit;
+	BYTE4 tail;
+	BYTE4 first;
+	BYTE4 last;
+	BYTE4 value;
+	register BYTE4 i;
+	register BYTE4 j;
+
+	frozen=(FROZEN *)malloc(sizeof(FROZEN));
+	if(frozen==NULL) {
+		error("freeze_tree", "Unable to allocate frozen tree");
+		return(NULL);
+	}
 
 	/*
-	 *		Fix, thanks to Mark Tarrabain
+	 *		The merged tree can't have more nodes than the two put together.
 	 */
-	if(model->context[0]->branch==0) symbol=0;
-	else symbol=model->context[0]->tree[rnd(model->context[0]->branch)]->symbol;
+	limit=count_nodes(root)+1;
+	if(base!=NULL) limit+=base->size-1;
+	frozen->mapped=FALSE;
+	frozen->symbol=(BYTE4 *)malloc(sizeof(BYTE4)*limit);
+	frozen->count=(BYTE4 *)malloc(sizeof(BYTE4)*limit);
+	frozen->usage=(BYTE4 *)malloc(sizeof(BYTE4)*limit);
+	frozen->child=(BYTE4 *)malloc(sizeof(BYTE4)*(limit+1));
+	frozen->totals=(BYTE4 *)malloc(sizeof(BYTE4)*limit);
+	queue=(TREE **)malloc(sizeof(TREE *)*limit);
+	from=(BYTE4 *)malloc(sizeof(BYTE4)*limit);
+	if((frozen->symbol==NULL)||(frozen->count==NULL)||(frozen->usage==NULL)||
+		(frozen->child==NULL)||(frozen->totals==NULL)||(queue==NULL)||(from==NULL)) {
+		free_frozen(frozen);
+		if(queue!=NULL) free(queue);
+		if(from!=NULL) free(from);
+		error("freeze_tree", "Unable to allocate %d frozen nodes", limit);
+		return(NULL);
+	}
 
-	if(keys->size>0) {
-		i=rnd(keys->size);
-		stop=i;
-		while(TRUE) {
-			if(
-				(find_word(model->dictionary, keys->entry[i])!=0)&&
-				(find_word(aux, keys->entry[i])==0)
-			) {
-				symbol=find_word(model->dictionary, keys->entry[i]);
-				return(symbol);
+	frozen->symbol[0]=0;
+	frozen->count[0]=0;
+	frozen->usage[0]=0;
+	frozen->child[0]=1;
+
+	/*
+	 *		Each node in the queue is made of a node of the tree, a node of
+	 *		the frozen base, or both when they stand for the same context.
+	 */
+	queue[1]=root;
+	from[1]=(base!=NULL)?1:0;
+	tail=2;
+	for(i=1; i<tail; ++i) {
+		node=queue[i];
+		frozen->symbol[i]=(node!=NULL)?node->symbol:base->symbol[from[i]];
+		value=(node!=NULL)?node->count:0;
+		if(from[i]!=0) value+=base->count[from[i]];
+		frozen->count[i]=(value<MAX_COUNT)?value:MAX_COUNT;
+		value=(node!=NULL)?node->usage:0;
+		if(from[i]!=0) value+=base->usage[from[i]];
+		frozen->usage[i]=(value<MAX_COUNT)?value:MAX_COUNT;
+		frozen->child[i]=tail;
+
+		first=(from[i]!=0)?base->child[from[i]]:0;
+		last=(from[i]!=0)?base->child[from[i]+1]:0;
+		j=0;
+		while((first<last)||((node!=NULL)&&(j<node->branch))) {
+			if((node==NULL)||(j>=node->branch)||
+				((first<last)&&(base->symbol[first]<node->tree[j]->symbol))) {
+				queue[tail]=NULL;
+				from[tail++]=first++;
+			} else if((first>=last)||(node->tree[j]->symbol<base->symbol[first])) {
+				queue[tail]=node->tree[j++];
+				from[tail++]=0;
+			} else {
+				queue[tail]=node->tree[j++];
+				from[tail++]=first++;
 			}
-			++i;
-			if(i==keys->size) i=0;
-			if(i==stop) return(symbol);
 		}
 	}
+	frozen->size=tail;
+	frozen->child[frozen->size]=tail;
 
-	return(symbol);
+	free(queue);
+	free(from);
+
+	/*
+	 *		Give back whatever was reserved for nodes which both trees share.
+	 *		Should shrinking an array fail, it is simply kept as it is.
+	 */
+	if(frozen->size<limit) {
+		frozen->symbol=shrink_nodes(frozen->symbol, frozen->size);
+		frozen->count=shrink_nodes(frozen->count, frozen->size);
+		frozen->usage=shrink_nodes(frozen->usage, frozen->size);
+		frozen->child=shrink_nodes(frozen->child, frozen->size+1);
+		frozen->totals=shrink_nodes(frozen->totals, frozen->size);
+	}
+	total_frozen(frozen);
+
+	return(frozen);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	New_Swap
+ *		Function:	Shrink_Nodes
  *
- *		Purpose:		Allocate a new swap structure.
+ *		Purpose:		Shrink an array of a frozen tree to the number of entries
+ *						given, and return it.  The array is returned as it was if
+ *						it can't be shrunk.
  */
-SWAP *new_swap(void)
+BYTE4 *shrink_nodes(BYTE4 *array, BYTE4 size)
 {
-	SWAP *list;
+	BYTE4 *shrunk;
 
-	list=(SWAP *)malloc(sizeof(SWAP));
-	if(list==NULL) {
-		error("new_swap", "Unable to allocate swap");
-		return(NULL);
-	}
-	list->size=0;
-	list->from=NULL;
-	list->to=NULL;
+	shrunk=(BYTE4 *)realloc(array, sizeof(BYTE4)*size);
+	if(shrunk==NULL) return(array);
 
-	return(list);
+	return(shrunk);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Add_Swap
+ *		Function:	Merge_Branch
  *
- *		Purpose:		Add a new entry to the swap structure.
+ *		Purpose:		Combine the children of a node of the frozen tree which
+ *						the model is following with those of the node learnt on
+ *						top of it, in order of symbol, and return how many there
+ *						are.  The symbols and their counts are left in an array
+ *						of the model which the next call reuses.
  */
-void add_swap(SWAP *list, char *s, char *d)
+BYTE4 merge_branch(MODEL *model, BYTE4 parent, TREE *node, BYTE4 **symbols, BYTE4 **counts)
 {
-	list->size+=1;
-
-	if(list->from==NULL) {
-		list->from=(STRING *)malloc(sizeof(STRING));
-		if(list->from==NULL) {
-			error("add_swap", "Unable to allocate list->from");
-			return;
+	FROZEN *frozen=model->frozen;
+	BYTE4 *symbol;
+	BYTE4 *count;
+	BYTE4 first;
+	BYTE4 last;
+	BYTE4 size=0;
+	register BYTE4 j=0;
+
+	first=frozen->child[parent];
+	last=frozen->child[parent+1];
+	if(last-first+node->branch>model->merged_room) {
+		model->merged_room=last-first+node->branch;
+		model->merged=(BYTE4 *)realloc(model->merged, sizeof(BYTE4)*2*model->merged_room);
+		if(model->merged==NULL) {
+			error("merge_branch", "Unable to allocate %d children", model->merged_room);
+			model->merged_room=0;
+			return(0);
 		}
 	}
-
-	if(list->to==NULL) {
-		list->to=(STRING *)malloc(sizeof(STRING));
-		if(list->to==NULL) {
-			error("add_swap", "Unable to allocate list->to");
-			return;
+	symbol=model->merged;
+	count=model->merged+model->merged_room;
+
+	while((first<last)||(j<node->branch)) {
+		if((j>=node->branch)||
+			((first<last)&&(frozen->symbol[first]<node->tree[j]->symbol))) {
+			symbol[size]=frozen->symbol[first];
+			count[size++]=frozen->count[first++];
+		} else if((first>=last)||(node->tree[j]->symbol<frozen->symbol[first])) {
+			symbol[size]=node->tree[j]->symbol;
+			count[size++]=node->tree[j++]->count;
+		} else {
+			symbol[size]=frozen->symbol[first];
+			count[size++]=frozen->count[first++]+node->tree[j++]->count;
 		}
 	}
 
-	list->from=(STRING *)realloc(list->from, sizeof(STRING)*(list->size));
-	if(list->from==NULL) {
-		error("add_swap", "Unable to reallocate from");
-		return;
-	}
-
-	list->to=(STRING *)realloc(list->to, sizeof(STRING)*(list->size));
-	if(list->to==NULL) {
-		error("add_swap", "Unable to reallocate to");
-		return;
-	}
+	*symbols=symbol;
+	*counts=count;
 
-	list->from[list->size-1].length=strlen(s);
-	list->from[list->size-1].word=strdup(s);
-	list->to[list->size-1].length=strlen(d);
-	list->to[list->size-1].word=strdup(d);
+	return(size);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Initialize_Swap
- *
- *		Purpose:		Read a swap structure from a file.
+ *		Function:	Node_Totals
+ *
+ *		Purpose:		Return the running totals of the counts of the children
+ *						of a node with a large capacity, so that the first entry
+ *						is the count of the first child and the last entry is the
+ *						sum of them all.  The totals are kept in the subtree array
+ *						after a word which is cleared whenever the node changes,
+ *						so that they are only rebuilt when they have gone stale.
+ *						The threads generating replies share the model, so the
+ *						word is read with acquire and set with release ordering,
+ *						and only a thread which finds the totals stale takes the
+ *						lock to rebuild them.
  */
-SWAP *initialize_swap(char *filename)
+BYTE4 *node_totals(TREE *node)
 {
-	SWAP *list;
-	FILE *file=NULL;
-	char buffer[1024];
-	char *from;
-	char *to;
-
-	list=new_swap();
+	BYTE4 *totals;
+	BYTE4 sum=0;
+	register BYTE4 i;
+
+	totals=TOTALS(node);
+#ifdef THREADS
+	if(__atomic_load_n(&totals[0], __ATOMIC_ACQUIRE)!=0) return(totals+1);
+	pthread_mutex_lock(&totals_lock);
+	if(__atomic_load_n(&totals[0], __ATOMIC_RELAXED)==0) {
+		for(i=0; i<node->branch; ++i) {
+			sum+=node->tree[i]->count;
+			totals[i+1]=sum;
+		}
+		__atomic_store_n(&totals[0], 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&totals_lock);
+#else
+	if(totals[0]==0) {
+		for(i=0; i<node->branch; ++i) {
+			sum+=node->tree[i]->count;
+			totals[i+1]=sum;
+		}
+		totals[0]=1;
+	}
+#endif
 
-	if(filename==NULL) return(list);
+	return(totals+1);
+}
 
-	file=fopen(filename, "r");
-	if(file==NULL) return(list);
+/*---------------------------------------------------------------------------*/
 
-	while(!feof(file)) {
+/*
+ *		Function:	Frozen_Totals
+ *
+ *		Purpose:		Return the running totals of the counts of the children
+ *						of a node of a frozen tree.
+ */
+BYTE4 *frozen_totals(FROZEN *frozen, BYTE4 parent)
+{
+	return(frozen->totals+frozen->child[parent]);
+}
 
-		if(fgets(buffer, 1024, file)==NULL) break;
-		if(buffer[0]=='#') continue;
-		from=strtok(buffer, "\t ");
-		to=strtok(NULL, "\t \n#");
+/*---------------------------------------------------------------------------*/
 
-		add_swap(list, from, to);
+/*
+ *		Function:	Total_Frozen
+ *
+ *		Purpose:		Work out the running totals of the counts of the children
+ *						of every node of a frozen tree when it is made.  A frozen
+ *						tree never changes, so its totals never go stale, and the
+ *						threads generating replies read them without a lock.
+ */
+void total_frozen(FROZEN *frozen)
+{
+	BYTE4 sum;
+	register BYTE4 i;
+	register BYTE4 j;
+
+	frozen->totals[0]=0;
+	for(i=0; i<frozen->size; ++i) {
+		sum=0;
+		for(j=frozen->child[i]; (j<frozen->child[i+1])&&(j<frozen->size); ++j) {
+			sum+=frozen->count[j];
+			frozen->totals[j]=sum;
+		}
 	}
-
-	fclose(file);
-	return(list);
 }
 
 /*---------------------------------------------------------------------------*/
 
-void free_swap(SWAP *swap)
+/*
+ *		Function:	Sample_Branch
+ *
+ *		Purpose:		Find where the walk through the children of a context
+ *						which babble() makes would stop, without taking it.  The
+ *						walk starts at the given child and goes round the
+ *						children in order, spending the count of each until the
+ *						random count is used up, so it stops at the first child
+ *						whose running total from the start exceeds that count.
+ *						The number of children the walk passes over before it
+ *						stops is left in reach, or the size of the branch if it
+ *						goes all the way round, so that the caller can tell
+ *						whether it would have met a keyword first.
+ */
+BYTE4 sample_branch(BYTE4 *totals, BYTE4 branch, BYTE4 start, BYTE4 count, BYTE4 *reach)
 {
-	register int i;
-
-	if(swap==NULL) return;
-
-	for(i=0; i<swap->size; ++i) {
-		free_word(swap->from[i]);
-		free_word(swap->to[i]);
-	}
-	free(swap->from);
-	free(swap->to);
-	free(swap);
+	BYTE4 total;
+	BYTE4 stop;
+
+	total=totals[branch-1];
+	*reach=(count>=total)?branch:0;
+	count%=total;
+	if(start>0) count+=totals[start-1];
+	if(count>=total) count-=total;
+	stop=bisect_keys(totals, branch, count+1);
+	if(*reach==0) *reach=(stop>=start)?stop-start:stop+branch-start;
+
+	return(stop);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Initialize_List
+ *		Function:	Thaw_Tree
  *
- *		Purpose:		Read a dictionary from a file.
+ *		Purpose:		Rebuild a tree from its frozen form.
  */
-DICTIONARY *initialize_list(char *filename)
+TREE *thaw_tree(NODEPOOL *pool, FROZEN *frozen)
 {
-	DICTIONARY *list;
-	FILE *file=NULL;
-	STRING word;
-	char *string;
-	char buffer[1024];
+	TREE **nodes=NULL;
+	TREE *node;
+	TREE *root;
+	register BYTE4 i;
+	register int j;
 
-	list=new_dictionary();
+	nodes=(TREE **)malloc(sizeof(TREE *)*frozen->size);
+	if(nodes==NULL) {
+		error("thaw_tree", "Unable to allocate %d nodes", frozen->size);
+		return(NULL);
+	}
 
-	if(filename==NULL) return(list);
+	for(i=1; i<frozen->size; ++i) nodes[i]=new_node(pool);
+
+	for(i=1; i<frozen->size; ++i) {
+		node=nodes[i];
+		node->symbol=frozen->symbol[i];
+		node->count=frozen->count[i];
+		node->usage=frozen->usage[i];
+		node->branch=frozen->child[i+1]-frozen->child[i];
+		if(node->branch==0) continue;
+		for(node->capacity=1; node->capacity<node->branch; node->capacity*=2);
+		node->tree=new_branch(pool, node->capacity);
+		if(node->tree==NULL) {
+			error("thaw_tree", "Unable to allocate subtree");
+			return(NULL);
+		}
+		for(j=0; j<node->branch; ++j) node->tree[j]=nodes[frozen->child[i]+j];
+	}
 
-	file=fopen(filename, "r");
-	if(file==NULL) return(list);
+	/*
+	 *		The hash tables can only be built once the children are filled in.
+	 */
+	for(i=1; i<frozen->size; ++i) index_node(nodes[i]);
 
-	while(!feof(file)) {
+	root=nodes[1];
+	free(nodes);
 
-		if(fgets(buffer, 1024, file)==NULL) break;
-		if(buffer[0]=='#') continue;
-		string=strtok(buffer, "\t \n#");
+	return(root);
+}
 
-		if((string!=NULL)&&(strlen(string)>0)) {
-			word.length=strlen(string);
-			word.word=strdup(buffer);
-			add_word(list, word);
-		}
-	}
+/*---------------------------------------------------------------------------*/
 
-	fclose(file);
-	return(list);
+/*
+ *		Function:	Free_Frozen
+ *
+ *		Purpose:		Release the memory consumed by a frozen tree.
+ */
+void free_frozen(FROZEN *frozen)
+{
+	if(frozen==NULL) return;
+	if(frozen->mapped==FALSE) {
+		free(frozen->symbol);
+		free(frozen->count);
+		free(frozen->usage);
+		free(frozen->child);
+	}
+	free(frozen->totals);
+	free(frozen);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Delay
+ *		Function:	Freeze_Model
  *
- *		Purpose:		Display the string to stdout as if it was typed by a human.
+ *		Purpose:		Replace both trees of the model with their frozen form.
+ *						A frozen model keeps whatever it learns in trees on top
+ *						of the frozen ones, and freezing it again merges them in.
  */
-void delay(char *string)
+void freeze_model(MODEL *model)
 {
-	register int i;
-	
-	/*
-	 *		Don't simulate typing if the feature is turned off
-	 */
-	if(typing_delay==FALSE)	{
-		fprintf(stdout, string);
-		return;
-	}
+	FROZEN *forward;
+	FROZEN *backward;
+
+	if((model->frozen_forward!=NULL)&&(model->forward->branch==0)&&
+		(model->backward->branch==0)) return;
+
+	forward=freeze_tree(model->frozen_forward, model->forward);
+	backward=freeze_tree(model->frozen_backward, model->backward);
+	free_frozen(model->frozen_forward);
+	free_frozen(model->frozen_backward);
+	model->frozen_forward=forward;
+	model->frozen_backward=backward;
 
 	/*
-	 *		Display the entire string, one character at a time
+	 *		The trees are no longer needed, so release them and leave empty
+	 *		roots in their place.
 	 */
-	for(i=0; i<(int)strlen(string)-1; ++i) typein(string[i]);
-	usleep((D_THINK+rnd(V_THINK)-rnd(V_THINK))/2);
-	typein(string[i]);
+	free_pool(model->pool);
+	model->pool=new_pool();
+	model->forward=new_node(model->pool);
+	model->backward=new_node(model->pool);
+	initialize_context(model);
+	model->frozen=NULL;
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Typein
+ *		Function:	Thaw_Model
  *
- *		Purpose:		Display a character to stdout as if it was typed by a human.
+ *		Purpose:		Rebuild the trees of a frozen model, so that they hold
+ *						the whole of it once more.
  */
-void typein(char c)
+void thaw_model(MODEL *model)
 {
-	/*
-	 *		Standard keyboard delay
-	 */
-	usleep(D_KEY+rnd(V_KEY)-rnd(V_KEY));
-	fprintf(stdout, "%c", c);
-	fflush(stdout);
-	
-	/*
-	 *		A random thinking delay
-	 */
-	if((!isalnum(c))&&((rnd(100))<P_THINK))
-		usleep(D_THINK+rnd(V_THINK)-rnd(V_THINK));
+	if(model->frozen_forward==NULL) return;
+
+	freeze_model(model);
+	free_pool(model->pool);
+	model->pool=new_pool();
+	model->forward=thaw_tree(model->pool, model->frozen_forward);
+	model->backward=thaw_tree(model->pool, model->frozen_backward);
+
+	free_frozen(model->frozen_forward);
+	free_frozen(model->frozen_backward);
+	model->frozen_forward=NULL;
+	model->frozen_backward=NULL;
+	initialize_context(model);
+	model->frozen=NULL;
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Ignore
+ *		Function:	Frozen_Size
  *
- *		Purpose:		Log the occurrence of a signal, but ignore it.
+ *		Purpose:		Return the number of bytes taken by a frozen tree.
  */
-void ignore(int sig)
+unsigned long frozen_size(FROZEN *frozen)
 {
-	if(sig!=0) warn("ignore", "MegaHAL received signal %d", sig);
+	if(frozen==NULL) return(0);
 
-#if !defined(DOS)
-	signal(SIGINT, ignore);
-	signal(SIGILL, die);
-	signal(SIGSEGV, die);
-#endif
-	signal(SIGFPE, die);
+	return(sizeof(FROZEN)+sizeof(BYTE4)*(5*(unsigned long)frozen->size+1));
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Die
+ *		Function:	Model_Size
  *
- *		Purpose:		Log the occurrence of a signal, and exit.
+ *		Purpose:		Return the number of bytes taken by the trees and the
+ *						dictionary of a model.  The pool and the dictionary keep
+ *						running totals, so this doesn't have to walk anything.
  */
-void die(int sig)
+unsigned long model_size(MODEL *model)
 {
-	error("die", "MegaHAL received signal %d", sig);
-	exithal();
+	unsigned long size;
+
+	size=model->pool->bytes;
+	size+=frozen_size(model->frozen_forward)+frozen_size(model->frozen_backward);
+	size+=(sizeof(STRING)+sizeof(BYTE4))*(unsigned long)model->dictionary->size;
+	size+=model->dictionary->arena;
+
+	return(size);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Rnd
- *
- *		Purpose:		Return a random integer between 0 and range-1.
+ *		Function:	Pruned_Size
+ *
+ *		Purpose:		Return the number of bytes a model which is being pruned
+ *						will take once it is done.  The trees are packed when the
+ *						pruning is over, so their subtree arrays are counted as no
+ *						bigger than they need to be.  A frozen model is pruned in
+ *						its frozen trees, which are compacted afterwards, so they
+ *						are counted without the given number of nodes which have
+ *						been forgotten from them.
  */
-int rnd(int range)
+unsigned long pruned_size(MODEL *model, unsigned long forgotten)
 {
-	static bool flag=FALSE;
+	unsigned long size;
+	unsigned long nodes;
 
-	if(flag==FALSE) {
-#if defined(__mac_os) || defined(DOS)
-		srand(time(NULL));
-#else
-		srand48(time(NULL));
-#endif
-	}
-	flag=TRUE;
-#if defined(__mac_os) || defined(DOS)
-	return(rand()%range);
-#else
-	return(floor(drand48()*(double)(range)));
-#endif
+	size=model_size(model)-model->pool->bytes;
+	if(model->frozen_forward==NULL)
+		return(size+packed_size(model->forward)+packed_size(model->backward));
+
+	size-=frozen_size(model->frozen_forward)+frozen_size(model->frozen_backward);
+	nodes=(unsigned long)model->frozen_forward->size+model->frozen_backward->size-forgotten;
+	return(size+2*sizeof(FROZEN)+sizeof(BYTE4)*(5*nodes+2));
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Usleep
+ *		Function:	Packed_Size
  *
- *		Purpose:		Simulate the Un*x function usleep.  Necessary because
- *						Microsoft provide no similar function.  Performed via
- *						a busy loop, which unnecessarily chews up the CPU.
- *						But Windows '95 isn't properly multitasking anyway, so
- *						no-one will notice.  Modified from a real Microsoft
- *						example, believe it or not!
+ *		Purpose:		Return the number of bytes a tree takes once each of its
+ *						subtree arrays has the smallest capacity which holds its
+ *						children, as it does when the tree is thawed.
  */
-#if defined(DOS) || defined(__mac_os)
-void usleep(int period)
+unsigned long packed_size(TREE *node)
 {
-	clock_t goal;
+	unsigned long size=sizeof(TREE);
+	BYTE4 capacity;
+	register int i;
 
-	goal=(clock_t)(period*CLOCKS_PER_SEC)/(clock_t)1000000+clock();
-	while(goal>clock());
+	if(node->branch==0) return(size);
+
+	for(capacity=1; capacity<node->branch; capacity*=2);
+	size+=branch_size(capacity);
+	for(i=0; i<node->branch; ++i) size+=packed_size(node->tree[i]);
+
+	return(size);
 }
-#endif
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Strdup
+ *		Function:	Census_Model
+ *
+ *		Purpose:		Count the nodes of both trees by depth, along with the
+ *						nodes which have children, the widest of them and the
+ *						saturated counts.  This walks both trees, so it is only
+ *						done when they have been rebuilt wholesale; otherwise
+ *						update_model() keeps the census up to date.  A frozen
+ *						model is counted from its frozen trees, so whatever it
+ *						has learnt on top of them must be merged in first.
+ */
+void census_model(MODEL *model)
+{
+	register int i;
+	unsigned long *nodes;
+
+	nodes=(unsigned long *)realloc(model->census.nodes,
+		sizeof(unsigned long)*2*(model->order+2));
+	if(nodes==NULL)
+		error("census_model", "Unable to allocate census");
+	model->census.nodes=nodes;
+	for(i=0; i<2*(model->order+2); ++i) model->census.nodes[i]=0;
+	model->census.parents=0;
+	model->census.saturated=0;
+	model->census.widest=0;
+
+	if(model->frozen_forward!=NULL) {
+		census_frozen(model, model->frozen_forward, model->census.nodes);
+		census_frozen(model, model->frozen_backward, model->census.nodes+model->order+2);
+		return;
+	}
+	census_tree(model, model->forward, model->census.nodes, 0);
+	census_tree(model, model->backward, model->census.nodes+model->order+2, 0);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Census_Tree
  *
- *		Purpose:		Provide the strdup() function for Macintosh.
+ *		Purpose:		Add the nodes of a tree to the census of the model.
  */
-#ifdef __mac_os
-char *strdup(const char *str)
+void census_tree(MODEL *model, TREE *node, unsigned long *nodes, int depth)
 {
-	char *rval=(char *)malloc(strlen(str)+1);
+	register int i;
 
-	if(rval!=NULL) strcpy(rval, str);
+	if(depth<=model->order+1) ++nodes[depth];
+	if(node->count==MAX_COUNT) ++model->census.saturated;
+	if(node->branch>0) ++model->census.parents;
+	if(node->branch>model->census.widest) model->census.widest=node->branch;
 
-	return(rval);
+	for(i=0; i<node->branch; ++i)
+		census_tree(model, node->tree[i], nodes, depth+1);
 }
-#endif
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Initialize_Speech
+ *		Function:	Census_Frozen
  *
- *		Purpose:		Initialize speech output.
+ *		Purpose:		Add the nodes of a frozen tree to the census of the
+ *						model.  The nodes are laid out breadth-first, so the
+ *						depth goes up by one at the first child of the first
+ *						node of each depth.
  */
-#ifdef __mac_os
-bool initialize_speech(void)
+void census_frozen(MODEL *model, FROZEN *frozen, unsigned long *nodes)
 {
-	bool speechExists = false;
-	long response;
-	OSErr err;
-
-	err = Gestalt(gestaltSpeechAttr, &response);
-        
-	if(!err) {
-		if(response & (1L << gestaltSpeechMgrPresent)) {
-			speechExists = true;
+	BYTE4 next;
+	BYTE4 branch;
+	int depth=0;
+	register BYTE4 i;
+
+	next=frozen->child[1];
+	for(i=1; i<frozen->size; ++i) {
+		if(i==next) {
+			++depth;
+			next=frozen->child[i];
 		}
+		if(depth<=model->order+1) ++nodes[depth];
+		if(frozen->count[i]==MAX_COUNT) ++model->census.saturated;
+		branch=frozen->child[i+1]-frozen->child[i];
+		if(branch>0) ++model->census.parents;
+		if(branch>model->census.widest) model->census.widest=branch;
 	}
-	return speechExists;
 }
-#endif
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	changevoice
+ *		Function:	Show_Stats
  *
- *		Purpose:		change voice of speech output.
+ *		Purpose:		Report the size and shape of the model a line at a time,
+ *						using only the running totals so that it is cheap enough
+ *						to ask for at any time.
  */
-void changevoice(DICTIONARY* words, int position)
+void show_stats(MODEL *model, void (*report)(char *))
 {
-#ifdef __mac_os
-	register int i, index;
-	STRING word={ 1, "#" };
-	char buffer[80];
-	VoiceSpec voiceSpec;
-	VoiceDescription info;
-	short count, voiceCount;
-	unsigned char* temp;
-	OSErr err;
-	/*
-	 *		If there is less than 4 words, no voice specified.
-	 */
-	if(words->size<=4) return;
+	char line[256];
+	unsigned long *backward;
+	unsigned long nodes=0;
+	unsigned long size;
+	unsigned long words;
+	char *state="";
+	register int i;
 
-	for(i=0; i<words->size-4; ++i)
-		if(wordcmp(word, words->entry[i])==0) {
+	backward=model->census.nodes+model->order+2;
 
-		err = CountVoices(&voiceCount);
-		if (!err && voiceCount) {
-			for (count = 1; count <= voiceCount; count++) {
-				err = GetIndVoice(count, &voiceSpec);
-				if (err) continue;
-				err = GetVoiceDescription(&voiceSpec, &info, 
-sizeof(VoiceDescription));
-				if (err) continue;
+	sprintf(line, "Depth    Forward   Backward");
+	report(line);
+	for(i=0; i<=model->order+1; ++i) {
+		sprintf(line, "%5d %10lu %10lu", i, model->census.nodes[i], backward[i]);
+		report(line);
+		nodes+=model->census.nodes[i]+backward[i];
+	}
 
+	words=(sizeof(STRING)+sizeof(BYTE4))*(unsigned long)model->dictionary->size
+		+model->dictionary->arena;
+	size=model_size(model);
+	if(model->frozen_forward!=NULL)
+		state=(model->frozen_forward->mapped==TRUE)?" (mapped)":" (frozen)";
+	sprintf(line, "Memory: %lu bytes, of which the trees take %lu%s",
+		size, size-words, state);
+	report(line);
+	sprintf(line, "Pool: %lu bytes allocated", model->pool->reserved);
+	report(line);
+
+	sprintf(line, "Fanout: %.2f average, %lu maximum",
+		(model->census.parents>0)?(double)(nodes-2)/(double)model->census.parents:0.0,
+		(unsigned long)model->census.widest);
+	report(line);
+
+	sprintf(line, "Dictionary: %lu words, %lu bytes",
+		(unsigned long)model->dictionary->size, words);
+	report(line);
+
+	sprintf(line, "Saturated counts: %lu", model->census.saturated);
+	report(line);
+}
 
-				for (temp= info.name; *temp; temp++) {
-					if (*temp == ' ')
-						*temp = '_';
-				}
+/*---------------------------------------------------------------------------*/
 
-				/*
-				 *		skip command and get voice name
+/*
+ *		Function:	Parse_Size
+ *
+ *		Purpose:		Convert a string such as "4000000" or "200M" into a
+ *						number of bytes, returning zero if it isn't one.
+ */
+unsigned long parse_size(STRING word)
+{
+	unsigned long size=0;
+	register BYTE4 i;
+
+	for(i=0; (i<word.length)&&(isdigit((int)word.word[i])!=0); ++i)
+		size=size*10+(unsigned long)(word.word[i]-'0');
+	if(i==0) return(0);
+	if(i==word.length) return(size);
+	if(i+1<word.length) return(0);
+
+	return(scale_size(size, word.word[i]));
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Scale_Size
+ *
+ *		Purpose:		Multiply a number of bytes by the unit given by the
+ *						letter K, M or G, returning zero for any other letter.
+ */
+unsigned long scale_size(unsigned long size, char unit)
+{
+	switch(toupper((int)unit)) {
+		case 'G':
+			size*=1024;
+		case 'M':
+			size*=1024;
+		case 'K':
+			size*=1024;
+			return(size);
+		default:
+			return(0);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Command_Size
+ *
+ *		Purpose:		Return the number of bytes given as the argument of a
+ *						command, or zero if there isn't a valid one.  The number
+ *						and its unit are separate words, since make_words()
+ *						splits letters from digits.  Any other word after the
+ *						number makes the argument invalid, so that a typing
+ *						mistake can't be taken for a tiny budget.
+ */
+unsigned long command_size(DICTIONARY *words, int position)
+{
+	unsigned long size;
+	register int i;
+
+	if(position+2>=words->size) return(0);
+	size=parse_size(words->entry[position+2]);
+
+	for(i=position+3; (size>0)&&(i<words->size); ++i) {
+		if(isalnum((int)words->entry[i].word[0])==0) continue;
+		if((i>position+3)||(words->entry[i].length!=1)) return(0);
+		size=scale_size(size, words->entry[i].word[0]);
+	}
+
+	return(size);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Prune_Tree
+ *
+ *		Purpose:		Forget the rare continuations of the contexts below a
+ *						node, which are the leaves at or below the given depth
+ *						that have been seen no more than the threshold number of
+ *						times, and return how many were forgotten.  Each context
+ *						keeps its other continuations, and its usage drops by the
+ *						counts of those it forgets so that the rest still add up.
+ *						Symbols flagged to be kept, such as punctuation and the
+ *						end of the sentence, are only forgotten along with every
+ *						other continuation of their context, as a context which
+ *						kept words without them would run words together or
+ *						babble on forever.  A context with nothing left to follow
+ *						it is skipped by babble() in favour of a shorter one, and
+ *						may itself be forgotten once it is rare enough.  The
+ *						count of a context is never more than that of the shorter
+ *						context it extends, so an n-gram is always forgotten
+ *						before the shorter ones within it.
+ */
+unsigned long prune_tree(NODEPOOL *pool, TREE *node, int depth, int floor,
+	BYTE4 threshold, BYTE1 *keep)
+{
+	unsigned long forgotten=0;
+	TREE *child;
+	bool rare=TRUE;
+	register int i;
+	register int j;
+
+	if(node->branch==0) return(0);
+
+	for(i=0, j=0; i<node->branch; ++i) {
+		child=node->tree[i];
+		forgotten+=prune_tree(pool, child, depth+1, floor, threshold, keep);
+		if((child->branch>0)||(depth+1<floor)||(child->count>threshold)) {
+			rare=FALSE;
+		} else if(keep[child->symbol]==0) {
+			node->usage-=child->count;
+			free_tree(pool, child);
+			++forgotten;
+			continue;
+		}
+		node->tree[j++]=child;
+	}
+
+	/*
+	 *		Whatever is left may go too, if all of it is as rare.
+	 */
+	if(rare==TRUE) {
+		for(i=0; i<j; ++i) {
+			node->usage-=node->tree[i]->count;
+			free_tree(pool, node->tree[i]);
+			++forgotten;
+		}
+		j=0;
+	}
+	if(j==node->branch) return(forgotten);
+
+	node->branch=j;
+	if(j==0) {
+		free_branch(pool, node->tree, node->capacity);
+		node->tree=NULL;
+		node->capacity=0;
+	}
+	index_node(node);
+
+	return(forgotten);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Frozen_Level
+ *
+ *		Purpose:		Return the index of the first node of a frozen tree at
+ *						the given depth, or its size if it isn't that deep.  The
+ *						nodes are laid out breadth-first, so the first child of
+ *						the first node at one depth is the first node at the
+ *						next, and every node before it is shallower.
+ */
+BYTE4 frozen_level(FROZEN *frozen, int depth)
+{
+	BYTE4 first=1;
+
+	while((depth-->0)&&(first<frozen->size)) first=frozen->child[first];
+
+	return(first);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Mark_Nodes
+ *
+ *		Purpose:		Flag every node of a frozen tree which is about to be
+ *						pruned as being kept, and those with children as having
+ *						them.  The unused node at index zero is left unflagged.
+ */
+void mark_nodes(FROZEN *frozen, BYTE1 *state)
+{
+	register BYTE4 i;
+
+	state[0]=0;
+	for(i=1; i<frozen->size; ++i)
+		state[i]=(frozen->child[i+1]>frozen->child[i])?PRUNE_LIVE|PRUNE_PARENT:PRUNE_LIVE;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Prune_Frozen
+ *
+ *		Purpose:		Forget the rare continuations of a frozen tree in the same
+ *						way as prune_tree(), by clearing the flags of the nodes
+ *						which are forgotten rather than freeing them, and return
+ *						how many were forgotten.  Every child comes after its
+ *						parent, so going through the nodes backwards deals with
+ *						the children of a node before the node itself, as the
+ *						recursion of prune_tree() does.  The image of a mapped
+ *						brain is never written to, and the counts are left as
+ *						they are until the tree is compacted.
+ */
+unsigned long prune_frozen(FROZEN *frozen, BYTE1 *state, int floor,
+	BYTE4 threshold, BYTE1 *keep)
+{
+	unsigned long forgotten=0;
+	BYTE4 deep;
+	BYTE4 kept;
+	bool rare;
+	register BYTE4 i;
+	register BYTE4 j;
+
+	deep=frozen_level(frozen, floor);
+	for(i=frozen->size-1; i>0; --i) {
+		if((state[i]&PRUNE_PARENT)==0) continue;
+
+		rare=TRUE;
+		kept=0;
+		for(j=frozen->child[i]; j<frozen->child[i+1]; ++j) {
+			if(state[j]==0) continue;
+			if(((state[j]&PRUNE_PARENT)!=0)||(j<deep)||(frozen->count[j]>threshold)) {
+				rare=FALSE;
+			} else if(keep[frozen->symbol[j]]==0) {
+				state[j]=0;
+				++forgotten;
+				continue;
+			}
+			++kept;
+		}
+
+		/*
+		 *		Whatever is left may go too, if all of it is as rare.
+		 */
+		if(rare==TRUE) {
+			for(j=frozen->child[i]; j<frozen->child[i+1]; ++j) {
+				if(state[j]==0) continue;
+				state[j]=0;
+				++forgotten;
+			}
+			kept=0;
+		}
+		if(kept==0) state[i]&=~PRUNE_PARENT;
+	}
+
+	return(forgotten);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Mark_Symbols
+ *
+ *		Purpose:		Flag every symbol which appears in a tree.
+ */
+void mark_symbols(TREE *node, BYTE1 *used)
+{
+	register int i;
+
+	used[node->symbol]=1;
+	for(i=0; i<node->branch; ++i) mark_symbols(node->tree[i], used);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Mark_Frozen
+ *
+ *		Purpose:		Flag every symbol which appears in a frozen tree, if the
+ *						model has one.
+ */
+void mark_frozen(FROZEN *frozen, BYTE1 *used)
+{
+	register BYTE4 i;
+
+	if(frozen==NULL) return;
+
+	for(i=1; i<frozen->size; ++i) used[frozen->symbol[i]]=1;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Renumber_Tree
+ *
+ *		Purpose:		Give every node of a tree its new symbol.  The mapping
+ *						preserves the order of symbols, so the subtrees stay
+ *						sorted, but their symbol arrays and hash tables have to
+ *						be rebuilt.
+ */
+void renumber_tree(TREE *node, BYTE4 *map)
+{
+	register int i;
+
+	node->symbol=map[node->symbol];
+	for(i=0; i<node->branch; ++i) renumber_tree(node->tree[i], map);
+	index_node(node);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Renumber_Frozen
+ *
+ *		Purpose:		Give every node of a frozen tree, if the model has one,
+ *						its new symbol.  The mapping preserves the order of
+ *						symbols, so the children stay sorted.  The tree must not
+ *						be mapped from an image, which is only read.
+ */
+void renumber_frozen(FROZEN *frozen, BYTE4 *map)
+{
+	register BYTE4 i;
+
+	if(frozen==NULL) return;
+
+	for(i=1; i<frozen->size; ++i) frozen->symbol[i]=map[frozen->symbol[i]];
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Prune_Dictionary
+ *
+ *		Purpose:		Remove the words which no longer appear in either tree
+ *						from the dictionary of the model, and close up the gaps
+ *						they leave in the symbol numbering.  The arrays of the
+ *						dictionary shrink to fit, and its hash table is rebuilt to
+ *						suit the words which are left, and the words themselves
+ *						are packed together, which releases the memory of those
+ *						which were removed.  The error and end of sentence
+ *						symbols are always kept.  The frozen trees of a model
+ *						are renumbered along with its trees, so they must have
+ *						been compacted rather than mapped from an image.
+ */
+void prune_dictionary(MODEL *model)
+{
+	DICTIONARY *dictionary=model->dictionary;
+	STRING *entry;
+	BYTE1 *used;
+	BYTE4 *index;
+	BYTE4 *map;
+	register BYTE4 i;
+	register BYTE4 j;
+
+	used=(BYTE1 *)calloc(dictionary->size, sizeof(BYTE1));
+	map=(BYTE4 *)malloc(sizeof(BYTE4)*dictionary->size);
+	if((used==NULL)||(map==NULL)) {
+		if(used!=NULL) free(used);
+		if(map!=NULL) free(map);
+		error("prune_dictionary", "Unable to allocate symbol map");
+	}
+
+	used[0]=1;
+	used[1]=1;
+	mark_symbols(model->forward, used);
+	mark_symbols(model->backward, used);
+	mark_frozen(model->frozen_forward, used);
+	mark_frozen(model->frozen_backward, used);
+
+	for(i=0, j=0; i<dictionary->size; ++i) {
+		if(used[i]==0) {
+			dictionary->bytes-=dictionary->entry[i].length;
+			continue;
+		}
+		map[i]=j;
+		dictionary->entry[j++]=dictionary->entry[i];
+	}
+
+	if(j<dictionary->size) {
+		for(i=0, j=0; i<dictionary->size; ++i)
+			if(used[dictionary->index[i]]==1)
+				dictionary->index[j++]=map[dictionary->index[i]];
+		dictionary->size=j;
+		entry=(STRING *)realloc(dictionary->entry, sizeof(STRING)*j);
+		if(entry!=NULL) dictionary->entry=entry;
+		index=(BYTE4 *)realloc(dictionary->index, sizeof(BYTE4)*j);
+		if(index!=NULL) dictionary->index=index;
+		renumber_tree(model->forward, map);
+		renumber_tree(model->backward, map);
+		renumber_frozen(model->frozen_forward, map);
+		renumber_frozen(model->frozen_backward, map);
+		hash_dictionary(dictionary);
+		pack_words(dictionary);
+	}
+
+	free(used);
+	free(map);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Compare_Counts
+ *
+ *		Purpose:		Compare two nodes by their counts for qsort(), breaking
+ *						ties by their symbols so that the order is always the
+ *						same.
+ */
+int compare_counts(const void *first, const void *second)
+{
+	TREE *one=*(TREE **)first;
+	TREE *two=*(TREE **)second;
+
+	if(one->count!=two->count) return((one->count<two->count)?-1:1);
+	if(one->symbol!=two->symbol) return((one->symbol<two->symbol)?-1:1);
+
+	return(0);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Forget_Symbols
+ *
+ *		Purpose:		Forget every context below a node which contains one of
+ *						the flagged symbols, taking its count from the usage of
+ *						the context it extends, and return how many contexts were
+ *						forgotten.
+ */
+unsigned long forget_symbols(NODEPOOL *pool, TREE *node, BYTE1 *rare)
+{
+	unsigned long forgotten=0;
+	TREE *child;
+	register int i;
+	register int j;
+
+	if(node->branch==0) return(0);
+
+	for(i=0, j=0; i<node->branch; ++i) {
+		child=node->tree[i];
+		if(rare[child->symbol]!=0) {
+			node->usage-=child->count;
+			free_tree(pool, child);
+			++forgotten;
+			continue;
+		}
+		forgotten+=forget_symbols(pool, child, rare);
+		node->tree[j++]=child;
+	}
+	if(j==node->branch) return(forgotten);
+
+	node->branch=j;
+	if(j==0) {
+		free_branch(pool, node->tree, node->capacity);
+		node->tree=NULL;
+		node->capacity=0;
+	}
+	index_node(node);
+
+	return(forgotten);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Forget_Frozen
+ *
+ *		Purpose:		Forget every context of a frozen tree which contains one
+ *						of the flagged symbols, by clearing the flags of its
+ *						node and of every node below it, and return how many
+ *						nodes were forgotten.  Every parent comes before its
+ *						children, so going through the nodes in order finds out
+ *						whether a node is forgotten before its children are.
+ */
+unsigned long forget_frozen(FROZEN *frozen, BYTE1 *state, BYTE1 *rare)
+{
+	unsigned long forgotten=0;
+	BYTE4 kept;
+	register BYTE4 i;
+	register BYTE4 j;
+
+	for(i=1; i<frozen->size; ++i) {
+		kept=0;
+		for(j=frozen->child[i]; j<frozen->child[i+1]; ++j) {
+			if(state[j]==0) continue;
+			if((state[i]==0)||(rare[frozen->symbol[j]]!=0)) {
+				state[j]=0;
+				++forgotten;
+				continue;
+			}
+			++kept;
+		}
+		if(kept==0) state[i]&=~PRUNE_PARENT;
+	}
+
+	return(forgotten);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Compact_Frozen
+ *
+ *		Purpose:		Make a new frozen tree of the nodes of one which are still
+ *						flagged after pruning, and return it, or NULL if there
+ *						isn't the memory for it.  The nodes which are kept stay in
+ *						the same order, which is the breadth-first order of the
+ *						tree they make, and the usage of each drops by the counts
+ *						of the children it has forgotten, so that the rest still
+ *						add up.
+ */
+FROZEN *compact_frozen(FROZEN *frozen, BYTE1 *state)
+{
+	FROZEN *compact;
+	BYTE4 size=1;
+	BYTE4 tail=2;
+	register BYTE4 i;
+	register BYTE4 j;
+	register BYTE4 k;
+
+	for(i=1; i<frozen->size; ++i) if(state[i]!=0) ++size;
+
+	compact=(FROZEN *)malloc(sizeof(FROZEN));
+	if(compact==NULL) return(NULL);
+	compact->size=size;
+	compact->mapped=FALSE;
+	compact->symbol=(BYTE4 *)malloc(sizeof(BYTE4)*size);
+	compact->count=(BYTE4 *)malloc(sizeof(BYTE4)*size);
+	compact->usage=(BYTE4 *)malloc(sizeof(BYTE4)*size);
+	compact->child=(BYTE4 *)malloc(sizeof(BYTE4)*(size+1));
+	compact->totals=(BYTE4 *)malloc(sizeof(BYTE4)*size);
+	if((compact->symbol==NULL)||(compact->count==NULL)||(compact->usage==NULL)||
+		(compact->child==NULL)||(compact->totals==NULL)) {
+		free_frozen(compact);
+		return(NULL);
+	}
+
+	compact->symbol[0]=0;
+	compact->count[0]=0;
+	compact->usage[0]=0;
+	compact->child[0]=1;
+
+	for(i=1, j=1; i<frozen->size; ++i) {
+		if(state[i]==0) continue;
+		compact->symbol[j]=frozen->symbol[i];
+		compact->count[j]=frozen->count[i];
+		compact->usage[j]=frozen->usage[i];
+		compact->child[j]=tail;
+		for(k=frozen->child[i]; k<frozen->child[i+1]; ++k)
+			if(state[k]==0) compact->usage[j]-=frozen->count[k];
+			else ++tail;
+		++j;
+	}
+	compact->child[size]=size;
+	total_frozen(compact);
+
+	return(compact);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Prune_Model
+ *
+ *		Purpose:		Forget rare n-grams until the model takes no more than
+ *						the given number of bytes, and return the size it ends
+ *						up with.  Each round forgets the continuations seen no
+ *						more than a threshold number of times, starting with the
+ *						longest contexts and working towards the shortest, and
+ *						the threshold is doubled after every round.  What follows
+ *						each word on its own is kept, so if that isn't enough the
+ *						rarest words are forgotten altogether, along with every
+ *						context they appear in, and they then leave the
+ *						dictionary.  Punctuation and the end of the sentence are
+ *						never forgotten in this way, so the budget may not be
+ *						reached.  A frozen or mapped model is pruned in its
+ *						frozen trees, with a byte for each node to flag what is
+ *						kept, and they are then compacted into new arrays, so
+ *						that the model is never thawed and the image of a mapped
+ *						one is released.  Otherwise the trees are frozen and
+ *						thawed, which copies them out of the pool and rebuilds
+ *						them packed into a new one, so that the memory they no
+ *						longer need is released rather than kept on the free
+ *						lists of the pool.
+ */
+unsigned long prune_model(MODEL *model, unsigned long budget)
+{
+	DICTIONARY *dictionary=model->dictionary;
+	FROZEN *forward;
+	FROZEN *backward;
+	unsigned long size;
+	unsigned long forgotten=0;
+	unsigned long lost;
+	BYTE1 *state=NULL;
+	BYTE1 *keep;
+	BYTE1 *rare;
+	TREE **words;
+	TREE *roots=NULL;
+	TREE *node;
+	BYTE4 threshold;
+	BYTE4 branch;
+	BYTE4 first=0;
+	BYTE4 step;
+	bool frozen=FALSE;
+	int floor;
+	register BYTE4 i;
+	register BYTE4 j;
+	register BYTE4 k;
+
+	/*
+	 *		Anything learnt on top of the frozen trees is merged into them
+	 *		first, so that there is only one copy of each tree to prune.
+	 */
+	if(model->frozen_forward!=NULL) {
+		frozen=TRUE;
+		freeze_model(model);
+	}
+
+	keep=(BYTE1 *)malloc(sizeof(BYTE1)*2*dictionary->size);
+	if(keep==NULL)
+		error("prune_model", "Unable to allocate the symbols to keep");
+	rare=keep+dictionary->size;
+	for(i=0; i<dictionary->size; ++i)
+		keep[i]=((i<2)||(dictionary->entry[i].length==0)||
+			(isalnum((int)dictionary->entry[i].word[0])==0))?1:0;
+
+	if(frozen==TRUE) {
+		state=(BYTE1 *)malloc(sizeof(BYTE1)*
+			((unsigned long)model->frozen_forward->size+model->frozen_backward->size));
+		if(state==NULL) {
+			free(keep);
+			error("prune_model", "Unable to allocate the nodes to keep");
+		}
+		mark_nodes(model->frozen_forward, state);
+		mark_nodes(model->frozen_backward, state+model->frozen_forward->size);
+	}
+
+	size=pruned_size(model, forgotten);
+	for(threshold=1; (size>budget)&&(threshold<MAX_COUNT); threshold*=2)
+		for(floor=model->order+1; (floor>=3)&&(size>budget); --floor) {
+			if(frozen==TRUE)
+				lost=prune_frozen(model->frozen_forward, state, floor, threshold, keep)+
+					prune_frozen(model->frozen_backward, state+model->frozen_forward->size,
+					floor, threshold, keep);
+			else
+				lost=prune_tree(model->pool, model->forward, 0, floor, threshold, keep)+
+					prune_tree(model->pool, model->backward, 0, floor, threshold, keep);
+			if(lost==0) continue;
+			forgotten+=lost;
+			size=pruned_size(model, forgotten);
+		}
+
+	/*
+	 *		A word is as rare as the context made of it alone.  The rarest
+	 *		words go first, a sixteenth of them at a time, so as not to
+	 *		forget many more than the budget needs.  The children of the
+	 *		frozen root are copied into nodes so that they sort the same way.
+	 */
+	if(size>budget) {
+		if(frozen==TRUE) {
+			first=model->frozen_forward->child[1];
+			branch=model->frozen_forward->child[2]-first;
+			roots=(TREE *)malloc(sizeof(TREE)*(branch+1));
+		} else {
+			branch=model->forward->branch;
+		}
+		words=(TREE **)malloc(sizeof(TREE *)*(branch+1));
+		if((words==NULL)||((frozen==TRUE)&&(roots==NULL))) {
+			if(words!=NULL) free(words);
+			if(roots!=NULL) free(roots);
+			if(state!=NULL) free(state);
+			free(keep);
+			error("prune_model", "Unable to allocate the words to forget");
+		}
+		for(i=0, j=0; i<branch; ++i) {
+			if(frozen==TRUE) {
+				if(state[first+i]==0) continue;
+				node=roots+i;
+				node->symbol=model->frozen_forward->symbol[first+i];
+				node->count=model->frozen_forward->count[first+i];
+			} else {
+				node=model->forward->tree[i];
+			}
+			if(keep[node->symbol]==0) words[j++]=node;
+		}
+		qsort(words, j, sizeof(TREE *), compare_counts);
+		for(i=0; i<dictionary->size; ++i) rare[i]=0;
+		for(i=0, step=j/16+1; (size>budget)&&(i<j); i=k) {
+			for(k=i; (k<j)&&(k<i+step); ++k) rare[words[k]->symbol]=1;
+			if(frozen==TRUE) {
+				forgotten+=forget_frozen(model->frozen_forward, state, rare);
+				forgotten+=forget_frozen(model->frozen_backward,
+					state+model->frozen_forward->size, rare);
+			} else {
+				forget_symbols(model->pool, model->forward, rare);
+				forget_symbols(model->pool, model->backward, rare);
+			}
+			size=pruned_size(model, forgotten);
+		}
+		free(words);
+		if(roots!=NULL) free(roots);
+	}
+	free(keep);
+
+	/*
+	 *		The frozen trees are replaced by what is left of them, and a
+	 *		mapped image is no longer needed once nothing points into it.
+	 */
+	if(frozen==TRUE) {
+		forward=compact_frozen(model->frozen_forward, state);
+		backward=compact_frozen(model->frozen_backward, state+model->frozen_forward->size);
+		free(state);
+		if((forward==NULL)||(backward==NULL)) {
+			free_frozen(forward);
+			free_frozen(backward);
+			error("prune_model", "Unable to allocate the pruned trees");
+		}
+		free_frozen(model->frozen_forward);
+		free_frozen(model->frozen_backward);
+		model->frozen_forward=forward;
+		model->frozen_backward=backward;
+		free_image(model);
+		initialize_context(model);
+		model->frozen=NULL;
+	}
+
+	prune_dictionary(model);
+	census_model(model);
+
+	if(frozen==FALSE) {
+		freeze_model(model);
+		thaw_model(model);
+	}
+
+	return(model_size(model));
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Learn
+ *
+ *		Purpose:		Learn from the user's input.
+ */
+void learn(MODEL *model, DICTIONARY *words)
+{
+	register int i;
+	BYTE4 symbol;
+
+	/*
+	 *		We only learn from inputs which are long enough
+	 */
+	if(words->size<=(model->order)) return;
+
+	/*
+	 *		Train the model in the forwards direction.  Start by initializing
+	 *		the context of the model.
+	 */
+	start_context(model, model->forward, model->frozen_forward);
+	for(i=0; i<words->size; ++i) {
+		/*
+		 *		Add the symbol to the model's dictionary if necessary, and then
+		 *		update the forward model accordingly.
+		 */
+		symbol=add_word(model->dictionary, words->entry[i]);
+		update_model(model, symbol);
+	}
+	/*
+	 *		Add the sentence-terminating symbol.
+	 */
+	update_model(model, 1);
+
+	/*
+	 *		Train the model in the backwards direction.  Start by initializing
+	 *		the context of the model.
+	 */
+	start_context(model, model->backward, model->frozen_backward);
+	for(i=words->size-1; i>=0; --i) {
+		/*
+		 *		Find the symbol in the model's dictionary, and then update
+		 *		the backward model accordingly.
+		 */
+		symbol=find_word(model->dictionary, words->entry[i]);
+		update_model(model, symbol);
+	}
+	/*
+	 *		Add the sentence-terminating symbol.
+	 */
+	update_model(model, 1);
+
+	return;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Train
+ *
+ *		Purpose:	 	Infer a MegaHAL brain from the contents of a text file.
+ */
+void train(MODEL *model, char *filename)
+{
+	FILE *file;
+	char buffer[1024];
+	DICTIONARY *words=NULL;
+	int length;
+	GUARD guard;
+
+	if(filename==NULL) return;
+
+	file=fopen(filename, "r");
+	if(file==NULL) {
+		printf("Unable to find the personality %s\n", filename);
+		return;
+	}
+
+	fseek(file, 0, 2);
+   length=ftell(file);
+   rewind(file);
+
+	words=new_dictionary();
+
+	push_guard(&guard);
+	if(setjmp(guard.failed)!=0) {
+		fclose(file);
+		free_dictionary(words);
+		free(words);
+		fail_guard(&guard);
+	}
+
+	progress("Training from file", 0, 1);
+	while(!feof(file)) {
+
+		if(fgets(buffer, 1024, file)==NULL) break;
+		if(buffer[0]=='#') continue;
+
+		buffer[strlen(buffer)-1]='\0';
+
+		upper(buffer);
+		make_words(buffer, words);
+		learn(model, words);
+
+		progress(NULL, ftell(file), length);
+
+	}
+	progress(NULL, 1, 1);
+
+	pop_guard(&guard);
+	free_dictionary(words);
+	free(words);
+	fclose(file);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Show_Dictionary
+ *
+ *		Purpose:		Display the dictionary of a personality for training
+ *						purposes, in its directory.
+ */
+void show_dictionary(PERSONALITY *personality)
+{
+	DICTIONARY *dictionary=personality->model->dictionary;
+	char *filename;
+	register int i;
+	register int j;
+	FILE *file;
+
+	filename=(char *)malloc(sizeof(char)*(strlen(personality->directory)+strlen(SEP)+21));
+	if(filename==NULL) {
+		warn("show_dictionary", "Unable to allocate filename");
+		return;
+	}
+	sprintf(filename, "%s%s.megahal/megahal.dic", personality->directory, SEP);
+	file=fopen(filename, "w");
+	if(file==NULL) {
+		warn("show_dictionary", "Unable to open file `%s'", filename);
+		free(filename);
+		return;
+	}
+	free(filename);
+
+	for(i=0; i<dictionary->size; ++i) {
+		for(j=0; j<dictionary->entry[i].length; ++j)
+			fprintf(file, "%c", dictionary->entry[i].word[j]);
+		fprintf(file, "\n");
+	}
+
+	fclose(file);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Save_Model
+ *
+ *		Purpose:		Save the current state to the MegaHAL brain file in the
+ *						directory of a personality.
+ */
+bool save_model(PERSONALITY *personality)
+{
+	MODEL *model=personality->model;
+	char *home=personality->directory;
+	FILE *file;
+	char *filename;
+	char *temporary;
+	bool frozen;
+	bool saved;
+	GUARD guard;
+
+	/*
+	 *    Allocate memory for the filename
+	 */
+	filename=(char *)malloc(sizeof(char)*(strlen(home)+strlen(SEP)+21));
+	temporary=(char *)malloc(sizeof(char)*(strlen(home)+strlen(SEP)+25));
+	if((filename==NULL)||(temporary==NULL)) {
+		free(filename);
+		free(temporary);
+		error("save_model","Unable to allocate filename");
+	}
+
+	show_dictionary(personality);
+
+	/*
+	 *		Write the brain to a temporary file and then rename it, so that
+	 *		the old brain survives intact if anything goes wrong.
+	 */
+	sprintf(filename, "%s%s.megahal/megahal.brn", home, SEP);
+	sprintf(temporary, "%s.tmp", filename);
+	file=fopen(temporary, "wb");
+	if(file==NULL) {
+		warn("save_model", "Unable to open file `%s'", temporary);
+		free(filename);
+		free(temporary);
+		return(FALSE);
+	}
+
+	/*
+	 *		The temporary file is removed if the save fails part way.
+	 */
+	push_guard(&guard);
+	if(setjmp(guard.failed)!=0) {
+		fclose(file);
+		remove(temporary);
+		free(filename);
+		free(temporary);
+		fail_guard(&guard);
+	}
+
+	/*
+	 *		A brain which was mapped is saved as an image again.  Otherwise
+	 *		the brain is written from the trees, so a frozen model is thawed
+	 *		for the duration of the save.
+	 */
+	if((personality->mapping==TRUE)||(model->image!=NULL)) {
+		saved=save_image(file, model);
+	} else {
+		frozen=(model->frozen_forward!=NULL);
+		if(frozen==TRUE) thaw_model(model);
+
+		saved=save_sections(file, temporary, model, (personality->compact==TRUE)?11:10);
+
+		if(frozen==TRUE) freeze_model(model);
+	}
+	pop_guard(&guard);
+
+	if(ferror(file)!=0) saved=FALSE;
+	if(fclose(file)!=0) saved=FALSE;
+
+	if(saved==FALSE) {
+		warn("save_model", "Unable to write file `%s'", temporary);
+		remove(temporary);
+		free(filename);
+		free(temporary);
+		return(FALSE);
+	}
+
+#if defined(DOS) || defined(__mac_os)
+	remove(filename);
+#endif
+	if(rename(temporary, filename)!=0) {
+		warn("save_model", "Unable to rename `%s' to `%s'", temporary, filename);
+		free(filename);
+		free(temporary);
+		return(FALSE);
+	}
+	free(filename);
+	free(temporary);
+
+	/*
+	 *		Whatever was rotated out of the journal is now in the brain, as
+	 *		long as this is the personality which keeps the journal.
+	 */
+	if(personality->journal_old!=NULL) remove(personality->journal_old);
+
+	return(TRUE);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Save_Foreground
+ *
+ *		Purpose:		Save the model and wait for it to be written.  Any save
+ *						still running in the background is allowed to finish
+ *						first, and the journal is rotated so that the brain
+ *						covers everything it holds.
+ */
+bool save_foreground(PERSONALITY *personality)
+{
+	reap_save(personality, TRUE);
+	rotate_journal(personality);
+
+	return(save_model(personality));
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Save_Background
+ *
+ *		Purpose:		Save the model without holding up the conversation.  A
+ *						child process is forked to write the brain, and since it
+ *						sees a copy-on-write snapshot of the model, the parent
+ *						can carry on learning while it does so.  Return FALSE if
+ *						the previous save is still being written.  Where there is
+ *						no fork(), or the personality wasn't opened to save in
+ *						the background, the model is simply saved there and then.
+ *						This is also how the journal is compacted.
+ */
+bool save_background(PERSONALITY *personality)
+{
+#if defined(DOS) || defined(__mac_os)
+	save_foreground(personality);
+	return(TRUE);
+#else
+	GUARD guard;
+	pid_t pid;
+
+	if(personality->background==FALSE) {
+		save_foreground(personality);
+		return(TRUE);
+	}
+	if(reap_save(personality, FALSE)==FALSE) return(FALSE);
+
+	/*
+	 *		The snapshot will hold everything in the journal so far, so move
+	 *		it aside; the child removes it once the brain is safely written.
+	 */
+	rotate_journal(personality);
+
+	pid=fork();
+	if(pid<0) {
+		warn("save_background", "Unable to fork, saving in the foreground");
+		save_model(personality);
+		return(TRUE);
+	}
+
+	if(pid==0) {
+		/*
+		 *		The child mustn't draw progress bars over the parent's output,
+		 *		and leaves with _exit() so that it doesn't flush the stdio
+		 *		buffers it inherited, even if it fails.
+		 */
+		personality->shown=FALSE;
+		push_guard(&guard);
+		guard.personality=personality;
+		if(setjmp(guard.failed)!=0) _exit(1);
+		if(save_model(personality)==FALSE) _exit(1);
+		status("Saved the brain in the background.\n");
+		_exit(0);
+	}
+
+	personality->saver=pid;
+	return(TRUE);
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Reap_Save
+ *
+ *		Purpose:		Collect the process started by save_background() for a
+ *						personality if it has finished, or wait for it to finish
+ *						if asked to.  Return TRUE if there is no save in progress.
+ */
+bool reap_save(PERSONALITY *personality, bool wait)
+{
+#if defined(DOS) || defined(__mac_os)
+	return(TRUE);
+#else
+	pid_t pid;
+	int result;
+
+	if(personality->saver==0) return(TRUE);
+
+	pid=waitpid(personality->saver, &result, (wait==TRUE)?0:WNOHANG);
+	if(pid==0) return(FALSE);
+
+	if((pid==personality->saver)&&(WIFEXITED(result)==0))
+		warn("reap_save", "The background save was interrupted");
+	personality->saver=0;
+
+	return(TRUE);
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Journal_Words
+ *
+ *		Purpose:		Append an input that the model has just learnt from to
+ *						the journal, so that it survives until the next save
+ *						without the whole brain having to be written.  Once the
+ *						journal grows past JOURNAL_LIMIT it is folded into a
+ *						fresh brain in the background.
+ */
+void journal_words(PERSONALITY *personality, DICTIONARY *words)
+{
+	FILE *journal=personality->journal;
+	register BYTE4 i;
+
+	if(journal==NULL) return;
+	if(words->size<=(personality->model->order)) return;
+
+	save_byte4(journal, words->size);
+	for(i=0; i<words->size; ++i) {
+		save_byte4(journal, words->entry[i].length);
+		fwrite(words->entry[i].word, sizeof(char), words->entry[i].length, journal);
+	}
+	fflush(journal);
+
+	if(ftell(journal)>JOURNAL_LIMIT) save_background(personality);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Replay_Journal
+ *
+ *		Purpose:		Learn from the inputs journalled since the brain of a
+ *						personality which keeps the journal was saved, starting
+ *						with any journal which was rotated out for a save that
+ *						never finished.  The journal is then reopened for
+ *						appending, unless the brain won't be learning.  A record
+ *						torn by a crash is dropped from the end of the journal.
+ */
+void replay_journal(PERSONALITY *personality)
+{
+	char *journal_name=personality->journal_name;
+	FILE *file;
+	char *buffer=NULL;
+	long length;
+	long good;
+
+	replay_file(personality->model, personality->journal_old);
+	good=replay_file(personality->model, journal_name);
+
+	if(personality->learning==FALSE) return;
+
+	/*
+	 *		Keep only the intact part of the journal, which is small enough
+	 *		to be copied through memory.
+	 */
+	file=fopen(journal_name, "rb");
+	if(file!=NULL) {
+		fseek(file, 0, SEEK_END);
+		length=ftell(file);
+		if((good>0)&&(length>good)) {
+			buffer=(char *)malloc(sizeof(char)*good);
+			if(buffer!=NULL) {
+				fseek(file, 0, SEEK_SET);
+				if(fread(buffer, sizeof(char), good, file)!=(size_t)good) {
+					free(buffer);
+					buffer=NULL;
+				}
+			}
+		}
+		fclose(file);
+		if((good>0)&&(length>good)&&(buffer!=NULL)) {
+			file=fopen(journal_name, "wb");
+			if(file!=NULL) {
+				fwrite(buffer, sizeof(char), good, file);
+				fclose(file);
+			}
+		}
+		if(buffer!=NULL) free(buffer);
+		if(good==0) remove(journal_name);
+	}
+
+	personality->journal=fopen(journal_name, "ab");
+	if(personality->journal==NULL) {
+		warn("replay_journal", "Unable to open file `%s'", journal_name);
+		return;
+	}
+	if(ftell(personality->journal)==0) {
+		fwrite(JOURNAL_COOKIE, sizeof(char), strlen(JOURNAL_COOKIE),
+			personality->journal);
+		fflush(personality->journal);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Replay_File
+ *
+ *		Purpose:		Learn from every intact record of a journal file, and
+ *						return the offset just past the last of them, or zero if
+ *						the file isn't a journal.
+ */
+long replay_file(MODEL *model, char *filename)
+{
+	FILE *file;
+	DICTIONARY *words;
+	STRING *entry;
+	char cookie[16];
+	long good;
+	BYTE4 size;
+	register BYTE4 i;
+	bool intact;
+	GUARD guard;
+
+	file=fopen(filename, "rb");
+	if(file==NULL) return(0);
+
+	if((fread(cookie, sizeof(char), strlen(JOURNAL_COOKIE), file)!=strlen(JOURNAL_COOKIE))||
+		(strncmp(cookie, JOURNAL_COOKIE, strlen(JOURNAL_COOKIE))!=0)) {
+		warn("replay_file", "File `%s' is not a MegaHAL journal", filename);
+		fclose(file);
+		return(0);
+	}
+	good=ftell(file);
+
+	words=new_dictionary();
+
+	/*
+	 *		The words read so far are freed if learning them fails.
+	 */
+	push_guard(&guard);
+	if(setjmp(guard.failed)!=0) {
+		for(i=0; i<words->size; ++i) free_word(words->entry[i]);
+		free(words->entry);
+		free(words);
+		fclose(file);
+		fail_guard(&guard);
+	}
+
+	while(TRUE) {
+		size=load_byte4(file);
+		if((feof(file)!=0)||(size==0)||(size>65536)) break;
+
+		entry=(STRING *)realloc(words->entry, sizeof(STRING)*size);
+		if(entry==NULL)
+			error("replay_file", "Unable to allocate words");
+		words->entry=entry;
+		words->size=0;
+
+		intact=TRUE;
+		for(words->size=0; words->size<size; ++words->size) {
+			words->entry[words->size].length=load_byte4(file);
+			words->entry[words->size].word=NULL;
+			if((feof(file)!=0)||(words->entry[words->size].length>65536)) {
+				intact=FALSE;
+				break;
+			}
+			words->entry[words->size].word=(char *)malloc(sizeof(char)*
+				(words->entry[words->size].length+1));
+			if((words->entry[words->size].word==NULL)||
+				(fread(words->entry[words->size].word, sizeof(char),
+				words->entry[words->size].length, file)!=words->entry[words->size].length)) {
+				if(words->entry[words->size].word!=NULL) ++words->size;
+				intact=FALSE;
+				break;
+			}
+		}
+
+		if(intact==TRUE) {
+			learn(model, words);
+			good=ftell(file);
+		}
+		for(i=0; i<words->size; ++i) free_word(words->entry[i]);
+		words->size=0;
+		if(intact==FALSE) break;
+	}
+
+	pop_guard(&guard);
+	free(words->entry);
+	free(words);
+	fclose(file);
+
+	return(good);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Rotate_Journal
+ *
+ *		Purpose:		Move the journal aside before the brain is saved, and
+ *						start a new one for anything learnt while the save is in
+ *						progress.  If an earlier rotated journal was never folded
+ *						into a brain, the journal is added to the end of it.
+ */
+void rotate_journal(PERSONALITY *personality)
+{
+	char *journal_name=personality->journal_name;
+	char *journal_old=personality->journal_old;
+	FILE *from;
+	FILE *to;
+	char buffer[4096];
+	size_t length;
+	bool open;
+
+	if(journal_name==NULL) return;
+
+	open=(personality->journal!=NULL)?TRUE:FALSE;
+	close_journal(personality);
+
+	to=fopen(journal_old, "rb");
+	if(to==NULL) {
+		rename(journal_name, journal_old);
+	} else {
+		fclose(to);
+		from=fopen(journal_name, "rb");
+		to=fopen(journal_old, "ab");
+		if((from!=NULL)&&(to!=NULL)) {
+			fseek(from, (long)strlen(JOURNAL_COOKIE), SEEK_SET);
+			while((length=fread(buffer, sizeof(char), sizeof(buffer), from))>0)
+				fwrite(buffer, sizeof(char), length, to);
+		}
+		if(from!=NULL) fclose(from);
+		if(to!=NULL) fclose(to);
+		remove(journal_name);
+	}
+
+	if(open==TRUE) start_journal(personality);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Start_Journal
+ *
+ *		Purpose:		Open a new, empty journal for a personality, ready for
+ *						whatever it learns next.
+ */
+void start_journal(PERSONALITY *personality)
+{
+	personality->journal=fopen(personality->journal_name, "wb");
+	if(personality->journal==NULL) {
+		warn("start_journal", "Unable to open file `%s'", personality->journal_name);
+		return;
+	}
+	fwrite(JOURNAL_COOKIE, sizeof(char), strlen(JOURNAL_COOKIE),
+		personality->journal);
+	fflush(personality->journal);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Discard_Journal
+ *
+ *		Purpose:		Forget everything learnt since the last save, as EXIT
+ *						and RELOAD promise to.  A rotated journal which a save in
+ *						progress is still folding into the brain is left to it.
+ *						If the personality was journalling, it goes on doing so
+ *						in a new journal.
+ */
+void discard_journal(PERSONALITY *personality)
+{
+	bool open;
+
+	if(personality->journal_name==NULL) return;
+
+	open=(personality->journal!=NULL)?TRUE:FALSE;
+	close_journal(personality);
+	remove(personality->journal_name);
+	if(reap_save(personality, FALSE)==TRUE) remove(personality->journal_old);
+	if(open==TRUE) start_journal(personality);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Close_Journal
+ *
+ *		Purpose:		Stop journalling a personality.
+ */
+void close_journal(PERSONALITY *personality)
+{
+	if(personality->journal==NULL) return;
+
+	fclose(personality->journal);
+	personality->journal=NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Save_Tree
+ *
+ *		Purpose:		Save a tree structure to the specified stream, writing
+ *						each node before its children.  The tree is walked with
+ *						a stack of its own, holding the next child to visit at
+ *						each level, so that the depth of a tree is never limited
+ *						by the depth of the C stack.
+ */
+void save_tree(STREAM *stream, TREE *root, int version)
+{
+	TREE **stack=NULL;
+	TREE **grown;
+	BYTE4 *next=NULL;
+	BYTE4 *after;
+	TREE *node=root;
+	BYTE4 previous=0;
+	int depth=0;
+	int size=0;
+
+	for(;;) {
+		if(node!=NULL) {
+			save_node(stream, node, previous, version);
+			if(node->branch>0) {
+				if(depth==size) {
+					size=(size==0)?64:size*2;
+					grown=(TREE **)realloc(stack, sizeof(TREE *)*size);
+					if(grown!=NULL) stack=grown;
+					after=(BYTE4 *)realloc(next, sizeof(BYTE4)*size);
+					if(after!=NULL) next=after;
+					if((grown==NULL)||(after==NULL)) {
+						free(stack);
+						free(next);
+						error("save_tree", "Unable to allocate stack");
+					}
+				}
+				stack[depth]=node;
+				next[depth]=0;
+				++depth;
+			}
+		}
+		if(depth==0) break;
+		if(next[depth-1]<stack[depth-1]->branch) {
+			previous=(next[depth-1]==0)?0:
+				stack[depth-1]->tree[next[depth-1]-1]->symbol;
+			node=stack[depth-1]->tree[next[depth-1]++];
+		} else {
+			node=NULL;
+			--depth;
+		}
+	}
+
+	free(stack);
+	free(next);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Save_Node
+ *
+ *		Purpose:		Save the fields of a single tree node to a stream.  The
+ *						compact encoding of version 11 writes the symbol as the
+ *						difference from that of the previous sibling, and writes
+ *						the usage only when it isn't the sum of the counts of
+ *						the children, which is flagged in the bottom bit of the
+ *						branch.  Every field is written as a varint.
+ */
+void save_node(STREAM *stream, TREE *node, BYTE4 previous, int version)
+{
+	unsigned long usage=0;
+	register BYTE4 i;
+
+	if(version!=11) {
+		put_byte4(stream, node->symbol);
+		put_byte4(stream, node->usage);
+		put_byte4(stream, node->count);
+		put_byte4(stream, node->branch);
+		return;
+	}
+
+	for(i=0; i<node->branch; ++i) usage+=node->tree[i]->count;
+	put_varint(stream, node->symbol-previous);
+	put_varint(stream, node->count);
+	if(usage==node->usage) {
+		put_varint(stream, node->branch<<1);
+	} else {
+		put_varint(stream, (node->branch<<1)|1);
+		put_varint(stream, node->usage);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Compact_Length
+ *
+ *		Purpose:		Return the number of bytes which save_tree() takes to
+ *						write a tree in the compact encoding.
+ */
+unsigned long compact_length(TREE *node, BYTE4 previous)
+{
+	unsigned long length;
+	unsigned long usage=0;
+	register BYTE4 i;
+
+	length=varint_size(node->symbol-previous)+varint_size(node->count);
+	for(i=0; i<node->branch; ++i) {
+		usage+=node->tree[i]->count;
+		length+=compact_length(node->tree[i], (i==0)?0:node->tree[i-1]->symbol);
+	}
+	if(usage==node->usage) length+=varint_size(node->branch<<1);
+	else length+=varint_size((node->branch<<1)|1)+varint_size(node->usage);
+
+	return(length);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Load_Node
+ *
+ *		Purpose:		Load the fields of a single tree node from a stream, and
+ *						allocate the children which follow it.  A node whose
+ *						usage was left out is flagged, so that it can be worked
+ *						out once its children have been read.
+ */
+bool load_node(STREAM *stream, NODEPOOL *pool, TREE *node, BYTE4 previous,
+	int version, bool *summed)
+{
+	register int i;
+	BYTE2 short_value;
+	unsigned long long_value;
+	BYTE4 branch;
+
+	*summed=FALSE;
+	if(version==8) {
+		/*
+		 *		Version 8 brains were written with the native sizes of the
+		 *		machine that saved them, using an unsigned long for the usage.
+		 */
+		get_bytes(stream, &short_value, sizeof(BYTE2));
+		node->symbol=short_value;
+		get_bytes(stream, &long_value, sizeof(unsigned long));
+		node->usage=(BYTE4)long_value;
+		get_bytes(stream, &short_value, sizeof(BYTE2));
+		node->count=short_value;
+		get_bytes(stream, &short_value, sizeof(BYTE2));
+		node->branch=short_value;
+	} else if(version==11) {
+		node->symbol=previous+get_varint(stream);
+		node->count=get_varint(stream);
+		branch=get_varint(stream);
+		node->branch=branch>>1;
+		node->usage=0;
+		if((branch&1)!=0) node->usage=get_varint(stream);
+		else *summed=TRUE;
+	} else {
+		node->symbol=get_byte4(stream);
+		node->usage=get_byte4(stream);
+		node->count=get_byte4(stream);
+		node->branch=get_byte4(stream);
+	}
+
+	/*
+	 *		A brain which ends early leaves the node it stopped in without
+	 *		children, so that loading always comes to an end.
+	 */
+	if(stream->failed==TRUE) node->branch=0;
+	if(node->branch==0) return(FALSE);
+
+	for(node->capacity=1; node->capacity<node->branch; node->capacity*=2);
+	node->tree=new_branch(pool, node->capacity);
+	if(node->tree==NULL) {
+		error("load_node", "Unable to allocate subtree");
+		return(FALSE);
+	}
+
+	/*
+	 *		Allocate the children together, so that siblings sit next to
+	 *		each other in the pool and are cheap to walk during babble().
+	 */
+	for(i=0; i<node->branch; ++i) node->tree[i]=new_node(pool);
+
+	return(TRUE);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Load_Tree
+ *
+ *		Purpose:		Load a tree structure from the specified stream.  Like
+ *						save_tree(), it keeps a stack of its own rather than
+ *						recursing, and indexes each node once all of its
+ *						children have been read.  A model never grows a tree
+ *						deeper than one more than its order, so a brain which
+ *						claims to is treated as damaged and read no further.
+ */
+void load_tree(STREAM *stream, NODEPOOL *pool, TREE *root, int order, int version)
+{
+	TREE **stack=NULL;
+	BYTE4 *next=NULL;
+	bool *sum=NULL;
+	TREE *node=root;
+	BYTE4 previous=0;
+	register BYTE4 i;
+	bool summed;
+	int depth=0;
+	GUARD guard;
+
+	/*
+	 *		Nothing is read below a depth of one more than the order, so the
+	 *		stack never needs to grow, and can be freed if loading fails.
+	 */
+	stack=(TREE **)malloc(sizeof(TREE *)*(order+2));
+	next=(BYTE4 *)malloc(sizeof(BYTE4)*(order+2));
+	sum=(bool *)malloc(sizeof(bool)*(order+2));
+	if((stack==NULL)||(next==NULL)||(sum==NULL)) {
+		free(stack);
+		free(next);
+		free(sum);
+		error("load_tree", "Unable to allocate stack");
+	}
+
+	push_guard(&guard);
+	if(setjmp(guard.failed)!=0) {
+		free(stack);
+		free(next);
+		free(sum);
+		fail_guard(&guard);
+	}
+
+	for(;;) {
+		if(depth>order+1) stream->failed=TRUE;
+		if((node!=NULL)&&
+			(load_node(stream, pool, node, previous, version, &summed)==TRUE)) {
+			stack[depth]=node;
+			next[depth]=0;
+			sum[depth]=summed;
+			++depth;
+		}
+		if(depth==0) break;
+		if(next[depth-1]<stack[depth-1]->branch) {
+			previous=(next[depth-1]==0)?0:
+				stack[depth-1]->tree[next[depth-1]-1]->symbol;
+			node=stack[depth-1]->tree[next[depth-1]++];
+		} else {
+			node=NULL;
+			--depth;
+			if(sum[depth]==TRUE)
+				for(i=0; i<stack[depth]->branch; ++i)
+					stack[depth]->usage+=stack[depth]->tree[i]->count;
+			index_node(stack[depth]);
+		}
+	}
+
+	pop_guard(&guard);
+	free(stack);
+	free(next);
+	free(sum);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Load_Model
+ *
+ *		Purpose:		Load a model into memory.
+ */
+bool load_model(char *filename, MODEL *model)
+{
+	FILE *file;
+	STREAM *stream;
+	long start;
+	long length;
+	char cookie[16];
+	int version;
+	bool loaded;
+	GUARD guard;
+
+	if(filename==NULL) return(FALSE);
+
+	file=fopen(filename, "rb");
+	if(file==NULL) {
+		warn("load_model", "Unable to open file `%s'", filename);
+		return(FALSE);
+	}
+
+	/*
+	 *		All versions of the cookie have the same length.  Older brains
+	 *		are still read, but they are always saved in the current format.
+	 */
+	fread(cookie, sizeof(char), strlen(COOKIE), file);
+	if(strncmp(cookie, COOKIE, strlen(COOKIE))==0) {
+		version=10;
+	} else if(strncmp(cookie, COOKIE_COMPACT, strlen(COOKIE_COMPACT))==0) {
+		version=11;
+	} else if(strncmp(cookie, COOKIE_V9, strlen(COOKIE_V9))==0) {
+		version=9;
+	} else if(strncmp(cookie, COOKIE_V8, strlen(COOKIE_V8))==0) {
+		version=8;
+	} else if(strncmp(cookie, COOKIE_IMAGE, strlen(COOKIE_IMAGE))==0) {
+		fclose(file);
+		return(load_image(filename, model));
+	} else {
+		warn("load_model", "File `%s' is not a MegaHAL brain", filename);
+		goto fail;
+	}
+
+	fread(&(model->order), sizeof(BYTE1), 1, file);
+	start=ftell(file);
+	fseek(file, 0, SEEK_END);
+	length=ftell(file)-start;
+	fseek(file, start, SEEK_SET);
+	stream=new_stream(file, (length>0)?(unsigned long)length:0);
+	if(stream==NULL) {
+		fclose(file);
+		error("load_model", "Unable to read file `%s'", filename);
+	}
+
+	push_guard(&guard);
+	if(setjmp(guard.failed)!=0) {
+		(void)free_stream(stream);
+		fclose(file);
+		fail_guard(&guard);
+	}
+	if(version>=10) {
+		loaded=load_sections(stream, filename, model, version);
+	} else {
+		load_tree(stream, model->pool, model->forward, model->order, version);
+		load_tree(stream, model->pool, model->backward, model->order, version);
+		load_dictionary(stream, model->dictionary, version);
+		loaded=TRUE;
+	}
+	pop_guard(&guard);
+	if(free_stream(stream)==FALSE) loaded=FALSE;
+	if(loaded==FALSE) {
+		warn("load_model", "File `%s' is damaged", filename);
+		goto fail;
+	}
+	census_model(model);
+
+	fclose(file);
+
+	return(TRUE);
+fail:
+	fclose(file);
+
+	return(FALSE);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Split_Tree
+ *
+ *		Purpose:		Divide the subtrees of the root of a tree between a
+ *						number of sections, keeping them in order and giving
+ *						each section about the same number of bytes in the brain
+ *						file.  The length of each section is filled in too.
+ */
+void split_tree(TREE *root, SECTION *section, int count, int version)
+{
+	unsigned long *length;
+	unsigned long total=0;
+	unsigned long done=0;
+	register BYTE4 i;
+	register int j;
+
+	for(j=0; j<count; ++j) {
+		section[j].root=root;
+		section[j].first=0;
+		section[j].size=0;
+		section[j].length=0;
+	}
+	if(root->branch==0) return;
+
+	length=(unsigned long *)malloc(sizeof(unsigned long)*root->branch);
+	if(length==NULL) {
+		error("split_tree", "Unable to allocate subtree lengths");
+		return;
+	}
+	for(i=0; i<root->branch; ++i) {
+		if(version==11) length[i]=compact_length(root->tree[i], 0);
+		else length[i]=16*(unsigned long)count_nodes(root->tree[i]);
+		total+=length[i];
+	}
+
+	/*
+	 *		Move on to the next section once this one has its share of the
+	 *		bytes, so that later sections are left empty rather than any of
+	 *		them getting more than it should.
+	 */
+	for(i=0, j=0; i<root->branch; ++i) {
+		if((j<count-1)&&(section[j].size>0)&&
+			(done>=total/count*(unsigned long)(j+1))) {
+			section[j+1].first=i;
+			++j;
+		}
+		section[j].size+=1;
+		section[j].length+=length[i];
+		done+=length[i];
+	}
+	for(++j; j<count; ++j) section[j].first=root->branch;
+
+	free(length);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Save_Sections
+ *
+ *		Purpose:		Save a model as a header and a table of sections, which
+ *						are then written in parallel.  The subtrees of the root
+ *						of each tree are divided between TREE_SECTIONS sections,
+ *						and the dictionary takes one more.  Each section is laid
+ *						out as it was in a version 9 brain, or in the compact
+ *						encoding of version 11, but the roots of the trees are
+ *						written in the header.  Each subtree of a root starts
+ *						the differences between sibling symbols afresh, so that
+ *						its length doesn't depend on where the sections fall.
+ */
+bool save_sections(FILE *file, char *filename, MODEL *model, int version)
+{
+	SECTION section[2*TREE_SECTIONS+1];
+	STREAM *stream;
+	unsigned long header;
+	unsigned long offset;
+	register int i;
+	int count=2*TREE_SECTIONS+1;
+	bool saved=TRUE;
+
+	split_tree(model->forward, section, TREE_SECTIONS, version);
+	split_tree(model->backward, section+TREE_SECTIONS, TREE_SECTIONS, version);
+	section[count-1].root=NULL;
+	section[count-1].first=0;
+	section[count-1].size=0;
+	if(version==11) {
+		section[count-1].length=varint_size(model->dictionary->size);
+		for(i=0; i<model->dictionary->size; ++i)
+			section[count-1].length+=
+				varint_size(model->dictionary->entry[i].length)+
+				model->dictionary->entry[i].length;
+	} else {
+		section[count-1].length=4;
+		for(i=0; i<model->dictionary->size; ++i)
+			section[count-1].length+=4+model->dictionary->entry[i].length;
+	}
+
+	header=strlen(COOKIE)+1+4+2*16+count*16;
+	offset=header;
+	for(i=0; i<count; ++i) {
+		section[i].filename=filename;
+		section[i].personality=current_personality();
+		section[i].offset=offset;
+		section[i].version=version;
+		section[i].dictionary=model->dictionary;
+		section[i].pool=NULL;
+		section[i].failed=FALSE;
+		section[i].aborted=FALSE;
+		offset+=section[i].length;
+	}
+
+	stream=new_stream(file, header);
+	if(stream==NULL)
+		error("save_sections", "Unable to write file `%s'", filename);
+	put_bytes(stream, (version==11)?COOKIE_COMPACT:COOKIE, strlen(COOKIE));
+	put_bytes(stream, &(model->order), sizeof(BYTE1));
+	put_byte4(stream, count);
+	put_byte4(stream, model->forward->symbol);
+	put_byte4(stream, model->forward->usage);
+	put_byte4(stream, model->forward->count);
+	put_byte4(stream, model->forward->branch);
+	put_byte4(stream, model->backward->symbol);
+	put_byte4(stream, model->backward->usage);
+	put_byte4(stream, model->backward->count);
+	put_byte4(stream, model->backward->branch);
+	for(i=0; i<count; ++i) {
+		put_byte4(stream, (BYTE4)(section[i].offset&0xFFFFFFFF));
+		put_byte4(stream, (BYTE4)((section[i].offset>>16)>>16));
+		put_byte4(stream, (i<TREE_SECTIONS)?0:(i<count-1)?1:2);
+		put_byte4(stream, section[i].size);
+	}
+	flush_stream(stream);
+	if(free_stream(stream)==FALSE) return(FALSE);
+	if(fflush(file)!=0) return(FALSE);
+
+	run_sections(section, count, save_section);
+	for(i=0; i<count; ++i) {
+		if(section[i].aborted==TRUE)
+			error("save_sections", "Section %d was unable to be written", i);
+		if(section[i].failed==TRUE) saved=FALSE;
+	}
+
+	return(saved);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Save_Section
+ *
+ *		Purpose:		Write one section of a brain, through a file of its own
+ *						which is positioned at the offset of the section.  The
+ *						section may be written on a thread of its own, so it has
+ *						a guard of its own too, and a section which gives up is
+ *						marked as aborted for the caller to report.
+ */
+void *save_section(void *data)
+{
+	SECTION *section=(SECTION *)data;
+	GUARD guard;
+	FILE *file;
+	STREAM *stream;
+	register BYTE4 i;
+
+	section->failed=TRUE;
+	section->aborted=FALSE;
+	file=fopen(section->filename, "r+b");
+	if(file==NULL) return(NULL);
+	stream=new_stream(file, section->length);
+	if(stream==NULL) {
+		section->aborted=TRUE;
+		fclose(file);
+		return(NULL);
+	}
+
+	push_guard(&guard);
+	guard.personality=section->personality;
+	if(setjmp(guard.failed)!=0) {
+		pop_guard(&guard);
+		section->aborted=TRUE;
+		(void)free_stream(stream);
+		fclose(file);
+		return(NULL);
+	}
+	if(fseek(file, (long)section->offset, SEEK_SET)==0) {
+		if(section->root!=NULL) {
+			for(i=section->first; i<section->first+section->size; ++i)
+				save_tree(stream, section->root->tree[i], section->version);
+		} else {
+			save_dictionary(stream, section->dictionary, section->version);
+		}
+		flush_stream(stream);
+		if((unsigned long)ftell(file)==section->offset+section->length)
+			section->failed=FALSE;
+	}
+	pop_guard(&guard);
+	if(free_stream(stream)==FALSE) section->failed=TRUE;
+	if(fclose(file)!=0) section->failed=TRUE;
+
+	return(NULL);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Load_Sections
+ *
+ *		Purpose:		Load a model saved by save_sections(), reading each of
+ *						its sections in parallel.  The subtrees in each section
+ *						are taken from a pool of its own, and the pools are
+ *						added to the pool of the model once they are complete.
+ */
+bool load_sections(STREAM *stream, char *filename, MODEL *model, int version)
+{
+	SECTION *section;
+	TREE *root[2];
+	BYTE4 offset;
+	BYTE4 kind;
+	BYTE4 first[3]={ 0, 0, 0 };
+	unsigned long next;
+	unsigned long end;
+	int count;
+	register int i;
+	register int j;
+	bool loaded=TRUE;
+	bool aborted;
+	GUARD guard;
+
+	count=get_byte4(stream);
+	root[0]=model->forward;
+	root[1]=model->backward;
+	for(j=0; j<2; ++j) {
+		root[j]->symbol=get_byte4(stream);
+		root[j]->usage=get_byte4(stream);
+		root[j]->count=get_byte4(stream);
+		root[j]->branch=get_byte4(stream);
+	}
+	if((stream->failed==TRUE)||(count<=0)||(count>65536)) return(FALSE);
+
+	section=(SECTION *)malloc(sizeof(SECTION)*count);
+	if(section==NULL)
+		error("load_sections", "Unable to allocate sections");
+	for(i=0; i<count; ++i) section[i].pool=NULL;
+
+	/*
+	 *		The pools of the sections are freed if they can't all be made.
+	 */
+	push_guard(&guard);
+	if(setjmp(guard.failed)!=0) {
+		for(i=0; i<count; ++i)
+			if(section[i].pool!=NULL) free_pool(section[i].pool);
+		free(section);
+		fail_guard(&guard);
+	}
+
+	for(j=0; j<2; ++j) {
+		root[j]->capacity=0;
+		root[j]->tree=NULL;
+		if(root[j]->branch==0) continue;
+		for(root[j]->capacity=1; root[j]->capacity<root[j]->branch;
+			root[j]->capacity*=2);
+		root[j]->tree=new_branch(model->pool, root[j]->capacity);
+		for(i=0; i<root[j]->branch; ++i) root[j]->tree[i]=NULL;
+	}
+
+	/*
+	 *		Each tree section must take up where the last one of the same
+	 *		tree left off, and between them they must hold every subtree.
+	 */
+	for(i=0; i<count; ++i) {
+		offset=get_byte4(stream);
+		section[i].offset=(unsigned long)offset|
+			(((unsigned long)get_byte4(stream)<<16)<<16);
+		kind=get_byte4(stream);
+		section[i].size=get_byte4(stream);
+		section[i].filename=filename;
+		section[i].personality=current_personality();
+		section[i].version=version;
+		section[i].order=model->order;
+		section[i].dictionary=model->dictionary;
+		section[i].failed=FALSE;
+		section[i].aborted=FALSE;
+		section[i].pool=NULL;
+		section[i].root=NULL;
+		if(kind>2) loaded=FALSE;
+		if(kind<2) {
+			section[i].root=root[kind];
+			section[i].first=first[kind];
+			if(section[i].size>root[kind]->branch-first[kind]) loaded=FALSE;
+			else first[kind]+=section[i].size;
+			section[i].pool=new_pool();
+			if(section[i].pool==NULL) loaded=FALSE;
+		} else {
+			++first[2];
+		}
+	}
+	if((stream->failed==TRUE)||(first[0]!=root[0]->branch)||
+		(first[1]!=root[1]->branch)||(first[2]!=1)) loaded=FALSE;
+	pop_guard(&guard);
+
+	/*
+	 *		Sections follow each other in the file, so the length of each
+	 *		runs up to the next, and that of the last to the end.
+	 */
+	fseek(stream->file, 0, SEEK_END);
+	end=(unsigned long)ftell(stream->file);
+	for(i=0; i<count; ++i) {
+		next=(i+1<count)?section[i+1].offset:end;
+		section[i].length=(next>section[i].offset)?next-section[i].offset:0;
+	}
+
+	if(loaded==TRUE) run_sections(section, count, load_section);
+
+	aborted=FALSE;
+	for(i=0; i<count; ++i) {
+		if(section[i].pool!=NULL) merge_pool(model->pool, section[i].pool);
+		if(section[i].failed==TRUE) loaded=FALSE;
+		if(section[i].aborted==TRUE) aborted=TRUE;
+	}
+	free(section);
+
+	/*
+	 *		A section which gave up part way may have left a subtree half
+	 *		built, so the model can only be freed as a whole, not walked.
+	 */
+	if(aborted==TRUE) error("load_sections", "A section was unable to be read");
+
+	/*
+	 *		A tree which wasn't read in full is left without children, so
+	 *		that the model can be freed safely.
+	 */
+	for(j=0; j<2; ++j) {
+		if(root[j]->branch==0) continue;
+		if(loaded==FALSE) {
+			for(i=0; i<root[j]->branch; ++i)
+				if(root[j]->tree[i]!=NULL) free_tree(model->pool, root[j]->tree[i]);
+			free_branch(model->pool, root[j]->tree, root[j]->capacity);
+			root[j]->tree=NULL;
+			root[j]->capacity=0;
+			root[j]->branch=0;
+		} else {
+			index_node(root[j]);
+		}
+	}
+
+	return(loaded);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Load_Section
+ *
+ *		Purpose:		Read one section of a brain, through a file of its own
+ *						which is positioned at the offset of the section.  Like
+ *						save_section(), it has a guard of its own.
+ */
+void *load_section(void *data)
+{
+	SECTION *section=(SECTION *)data;
+	GUARD guard;
+	FILE *file;
+	STREAM *stream;
+	register BYTE4 i;
+
+	section->failed=TRUE;
+	section->aborted=FALSE;
+	file=fopen(section->filename, "rb");
+	if(file==NULL) return(NULL);
+	stream=new_stream(file, section->length);
+	if(stream==NULL) {
+		section->aborted=TRUE;
+		fclose(file);
+		return(NULL);
+	}
+
+	push_guard(&guard);
+	guard.personality=section->personality;
+	if(setjmp(guard.failed)!=0) {
+		pop_guard(&guard);
+		section->aborted=TRUE;
+		(void)free_stream(stream);
+		fclose(file);
+		return(NULL);
+	}
+	if(fseek(file, (long)section->offset, SEEK_SET)==0) {
+		if(section->root!=NULL) {
+			for(i=section->first; i<section->first+section->size; ++i) {
+				section->root->tree[i]=new_node(section->pool);
+				if(section->root->tree[i]==NULL) break;
+				load_tree(stream, section->pool, section->root->tree[i],
+					section->order-1, section->version);
+			}
+		} else {
+			load_dictionary(stream, section->dictionary, section->version);
+		}
+		section->failed=FALSE;
+	}
+	pop_guard(&guard);
+	if(free_stream(stream)==FALSE) section->failed=TRUE;
+	fclose(file);
+
+	return(NULL);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Run_Sections
+ *
+ *		Purpose:		Call a function for each section of a brain, each on a
+ *						thread of its own where threads are available.  Any
+ *						section which can't be given a thread is done on this
+ *						one instead, as they all are on a single processor.
+ */
+void run_sections(SECTION *section, int count, void *(*function)(void *))
+{
+	register int i;
+#ifdef THREADS
+	pthread_t *thread=NULL;
+	bool *started=NULL;
+	int threads;
+	int first;
+	int last;
+
+	/*
+	 *		The sections are run a batch at a time, with no more threads
+	 *		than there are processors to run them.
+	 */
+	threads=(int)sysconf(_SC_NPROCESSORS_ONLN);
+	if(threads>count) threads=count;
+	if(threads>1) {
+		thread=(pthread_t *)malloc(sizeof(pthread_t)*threads);
+		started=(bool *)malloc(sizeof(bool)*threads);
+	}
+	if((thread!=NULL)&&(started!=NULL)) {
+		for(first=0; first<count; first=last) {
+			last=(first+threads<count)?first+threads:count;
+			for(i=first; i<last; ++i)
+				started[i-first]=(pthread_create(&thread[i-first], NULL,
+					function, &section[i])==0)?TRUE:FALSE;
+			for(i=first; i<last; ++i)
+				if(started[i-first]==TRUE) pthread_join(thread[i-first], NULL);
+				else function(&section[i]);
+		}
+		free(thread);
+		free(started);
+		return;
+	}
+	if(thread!=NULL) free(thread);
+	if(started!=NULL) free(started);
+#endif
+
+	for(i=0; i<count; ++i) function(&section[i]);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Save_Image
+ *
+ *		Purpose:		Write the model as an image which can be mapped into
+ *						memory and used as it is, without being parsed.  After a
+ *						header holding the order, the sizes and the census, come
+ *						the arrays of the frozen forward and backward trees, the
+ *						offset of every word in a pool of their text, the sorted
+ *						word index and the pool itself.  The image is written in
+ *						the byte order of the machine, which is checked on loading.
+ */
+bool save_image(FILE *file, MODEL *model)
+{
+	DICTIONARY *dictionary=model->dictionary;
+	FROZEN *forward;
+	FROZEN *backward;
+	BYTE4 *header;
+	BYTE4 offset;
+	BYTE1 pad[2]={ 0, 0 };
+	int length;
+	register BYTE4 i;
+
+	/*
+	 *		Anything learnt on top of a frozen model is merged in, but a
+	 *		frozen model without such learning is written as it stands.
+	 */
+	forward=model->frozen_forward;
+	if((forward==NULL)||(model->forward->branch>0))
+		forward=freeze_tree(model->frozen_forward, model->forward);
+	backward=model->frozen_backward;
+	if((backward==NULL)||(model->backward->branch>0))
+		backward=freeze_tree(model->frozen_backward, model->backward);
+
+	length=5+2*(model->order+2)+3;
+	header=(BYTE4 *)malloc(sizeof(BYTE4)*length);
+	if((forward==NULL)||(backward==NULL)||(header==NULL)) {
+		error("save_image", "Unable to allocate image header");
+		return(FALSE);
+	}
+
+	header[0]=0x01020304;
+	header[1]=forward->size;
+	header[2]=backward->size;
+	header[3]=dictionary->size;
+	header[4]=0;
+	for(i=0; i<dictionary->size; ++i) header[4]+=dictionary->entry[i].length;
+	for(i=0; i<2*(model->order+2); ++i) header[5+i]=(BYTE4)model->census.nodes[i];
+	header[length-3]=(BYTE4)model->census.parents;
+	header[length-2]=(BYTE4)model->census.saturated;
+	header[length-1]=model->census.widest;
+
+	fwrite(COOKIE_IMAGE, sizeof(char), strlen(COOKIE_IMAGE), file);
+	fwrite(&(model->order), sizeof(BYTE1), 1, file);
+	fwrite(pad, sizeof(BYTE1), 2, file);
+	fwrite(header, sizeof(BYTE4), length, file);
+	free(header);
+
+	fwrite(forward->symbol, sizeof(BYTE4), forward->size, file);
+	fwrite(forward->count, sizeof(BYTE4), forward->size, file);
+	fwrite(forward->usage, sizeof(BYTE4), forward->size, file);
+	fwrite(forward->child, sizeof(BYTE4), forward->size+1, file);
+	fwrite(backward->symbol, sizeof(BYTE4), backward->size, file);
+	fwrite(backward->count, sizeof(BYTE4), backward->size, file);
+	fwrite(backward->usage, sizeof(BYTE4), backward->size, file);
+	fwrite(backward->child, sizeof(BYTE4), backward->size+1, file);
+
+	if(forward!=model->frozen_forward) free_frozen(forward);
+	if(backward!=model->frozen_backward) free_frozen(backward);
+
+	for(offset=0, i=0; i<dictionary->size; ++i) {
+		fwrite(&offset, sizeof(BYTE4), 1, file);
+		offset+=dictionary->entry[i].length;
+	}
+	fwrite(&offset, sizeof(BYTE4), 1, file);
+	fwrite(dictionary->index, sizeof(BYTE4), dictionary->size, file);
+	for(i=0; i<dictionary->size; ++i)
+		fwrite(dictionary->entry[i].word, sizeof(char),
+			dictionary->entry[i].length, file);
+
+	return(TRUE);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Load_Image
+ *
+ *		Purpose:		Map a brain saved by save_image() into memory, and use
+ *						its arrays as the frozen form of the model, which learns
+ *						in trees on top of them.  Nothing is read until replies
+ *						touch it, other than the word offsets, but the kernel is
+ *						told that the whole image will be wanted soon.  Where
+ *						there is no mmap(), the image is read in one go instead.
+ */
+bool load_image(char *filename, MODEL *model)
+{
+	DICTIONARY *dictionary=model->dictionary;
+	BYTE4 *header;
+	BYTE4 *data;
+	BYTE4 *offset;
+	BYTE4 *index;
+	char *image;
+	char *failure=NULL;
+	unsigned long expected;
+	size_t size;
+	int length;
+	register BYTE4 i;
+	unsigned long *nodes;
+#if !defined(DOS) && !defined(__mac_os)
+	struct stat info;
+	int fd;
+
+	fd=open(filename, O_RDONLY);
+	if(fd<0) {
+		warn("load_image", "Unable to open file `%s'", filename);
+		return(FALSE);
+	}
+	if(fstat(fd, &info)!=0) {
+		warn("load_image", "Unable to examine file `%s'", filename);
+		close(fd);
+		return(FALSE);
+	}
+	size=(size_t)info.st_size;
+	image=(char *)mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(image==(char *)MAP_FAILED) {
+		warn("load_image", "Unable to map file `%s'", filename);
+		return(FALSE);
+	}
+#ifdef MADV_WILLNEED
+	madvise(image, size, MADV_WILLNEED);
+#endif
+#else
+	FILE *file;
+
+	file=fopen(filename, "rb");
+	if(file==NULL) {
+		warn("load_image", "Unable to open file `%s'", filename);
+		return(FALSE);
+	}
+	fseek(file, 0, 2);
+	size=(size_t)ftell(file);
+	rewind(file);
+	image=(char *)malloc(size);
+	if(image==NULL) {
+		fclose(file);
+		error("load_image", "Unable to allocate %lu bytes", (unsigned long)size);
+	}
+	if(fread(image, sizeof(char), size, file)!=size) {
+		warn("load_image", "Unable to read file `%s'", filename);
+		free(image);
+		fclose(file);
+		return(FALSE);
+	}
+	fclose(file);
+#endif
+	model->image=image;
+	model->image_size=size;
+
+	/*
+	 *		Make sure that the sizes in the header account for the image
+	 */
+	header=(BYTE4 *)(image+strlen(COOKIE_IMAGE)+3);
+	if(size<strlen(COOKIE_IMAGE)+3+sizeof(BYTE4)*5) {
+		warn("load_image", "Brain `%s' is damaged", filename);
+		goto fail;
+	}
+	if(header[0]!=0x01020304) {
+		warn("load_image", "Brain `%s' was saved on a different machine", filename);
+		goto fail;
+	}
+	length=5+2*(image[strlen(COOKIE_IMAGE)]+2)+3;
+	expected=strlen(COOKIE_IMAGE)+3+sizeof(BYTE4)*(unsigned long)length;
+	expected+=sizeof(BYTE4)*(4*(unsigned long)header[1]+1);
+	expected+=sizeof(BYTE4)*(4*(unsigned long)header[2]+1);
+	expected+=sizeof(BYTE4)*(2*(unsigned long)header[3]+1);
+	expected+=header[4];
+	if((expected!=(unsigned long)size)||(header[1]<2)||(header[2]<2)) {
+		warn("load_image", "Brain `%s' is damaged", filename);
+		goto fail;
+	}
+
+	data=header+length;
+	model->frozen_forward=map_tree(&data, header[1], header[3]);
+	model->frozen_backward=map_tree(&data, header[2], header[3]);
+	if((model->frozen_forward==NULL)||(model->frozen_backward==NULL)) {
+		warn("load_image", "Brain `%s' is damaged", filename);
+		goto fail;
+	}
+
+	/*
+	 *		The words must follow one another without overlapping and fill
+	 *		the space given to them, and the index may only name them.
+	 */
+	offset=data;
+	index=offset+header[3]+1;
+	if((offset[0]!=0)||(offset[header[3]]!=header[4])) {
+		warn("load_image", "Brain `%s' is damaged", filename);
+		goto fail;
+	}
+	for(i=0; i<header[3]; ++i)
+		if((offset[i+1]<offset[i])||(index[i]>=header[3])) {
+			warn("load_image", "Brain `%s' is damaged", filename);
+			goto fail;
+		}
+
+	model->order=image[strlen(COOKIE_IMAGE)];
+	nodes=(unsigned long *)realloc(model->census.nodes,
+		sizeof(unsigned long)*2*(model->order+2));
+	if(nodes==NULL)
+		error("load_image", "Unable to allocate census");
+	model->census.nodes=nodes;
+	for(i=0; i<2*(model->order+2); ++i) model->census.nodes[i]=header[5+i];
+	model->census.parents=header[length-3];
+	model->census.saturated=header[length-2];
+	model->census.widest=header[length-1];
+
+	/*
+	 *		The index is copied from the image so that it can grow, and the
+	 *		words are interned from it so that they carry their keys.
+	 */
+	free_dictionary(dictionary);
+	dictionary->entry=(STRING *)malloc(sizeof(STRING)*header[3]);
+	dictionary->index=(BYTE4 *)malloc(sizeof(BYTE4)*header[3]);
+	if((dictionary->entry==NULL)||(dictionary->index==NULL)) {
+		failure="Unable to allocate dictionary";
+		goto fail;
+	}
+	memcpy(dictionary->index, index, sizeof(BYTE4)*header[3]);
+	image=(char *)(offset+2*header[3]+1);
+	for(i=0; i<header[3]; ++i) {
+		dictionary->entry[i].length=offset[i+1]-offset[i];
+		dictionary->entry[i].word=image+offset[i];
+		dictionary->entry[i].word=intern_word(dictionary, dictionary->entry[i]);
+		if(dictionary->entry[i].word==NULL) return(FALSE);
+	}
+	dictionary->size=header[3];
+	dictionary->bytes=header[4];
+	hash_dictionary(dictionary);
+
+	return(TRUE);
+fail:
+	free_frozen(model->frozen_forward);
+	free_frozen(model->frozen_backward);
+	model->frozen_forward=NULL;
+	model->frozen_backward=NULL;
+	free_image(model);
+	if(failure!=NULL) error("load_image", "%s", failure);
+
+	return(FALSE);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Map_Tree
+ *
+ *		Purpose:		Point a frozen tree at its arrays in a brain image, and
+ *						move past them.  The child array must never decrease and
+ *						must end with the number of nodes, as it does in any
+ *						frozen tree, and every symbol must be in the dictionary
+ *						of the given size, or NULL is returned.
+ */
+FROZEN *map_tree(BYTE4 **data, BYTE4 size, BYTE4 words)
+{
+	FROZEN *frozen;
+	register BYTE4 i;
+
+	frozen=(FROZEN *)malloc(sizeof(FROZEN));
+	if(frozen==NULL) {
+		error("map_tree", "Unable to allocate frozen tree");
+		return(NULL);
+	}
+
+	frozen->size=size;
+	frozen->mapped=TRUE;
+	frozen->symbol=*data;
+	frozen->count=frozen->symbol+size;
+	frozen->usage=frozen->count+size;
+	frozen->child=frozen->usage+size;
+	*data=frozen->child+size+1;
+
+	if((frozen->child[0]<1)||(frozen->child[size]!=size)) {
+		free(frozen);
+		return(NULL);
+	}
+	for(i=0; i<size; ++i)
+		if((frozen->child[i+1]<frozen->child[i])||(frozen->symbol[i]>=words)) {
+			free(frozen);
+			return(NULL);
+		}
+
+	/*
+	 *		The image is only read, so the totals are kept beside it.
+	 */
+	frozen->totals=(BYTE4 *)calloc(size, sizeof(BYTE4));
+	if(frozen->totals==NULL) {
+		free(frozen);
+		error("map_tree", "Unable to allocate %d totals", size);
+		return(NULL);
+	}
+	total_frozen(frozen);
+
+	return(frozen);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Free_Image
+ *
+ *		Purpose:		Release the brain image which a model was loaded from.
+ */
+void free_image(MODEL *model)
+{
+	if(model->image==NULL) return;
+
+#if !defined(DOS) && !defined(__mac_os)
+	munmap(model->image, model->image_size);
+#else
+	free(model->image);
+#endif
+	model->image=NULL;
+	model->image_size=0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *    Function:   Make_Words
+ *
+ *    Purpose:    Break a string into an array of words.
+ */
+void make_words(char *input, DICTIONARY *words)
+{
+	STRING *entry;
+	int offset=0;
+
+	/*
+	 *		Clear the entries in the dictionary
+	 */
+	free_dictionary(words);
+
+	/*
+	 *		If the string is empty then do nothing, for it contains no words.
+	 */
+	if(strlen(input)==0) return;
+
+	/*
+	 *		Loop forever.
+	 */
+	while(1) {
+
+		/*
+		 *		If the current character is of the same type as the previous
+		 *		character, then include it in the word.  Otherwise, terminate
+		 *		the current word.
+		 */
+		if(boundary(input, offset)) {
+			/*
+			 *		Add the word to the dictionary
+			 */
+			entry=(STRING *)realloc(words->entry, (words->size+1)*sizeof(STRING));
+			if(entry==NULL)
+				error("make_words", "Unable to reallocate dictionary");
+			words->entry=entry;
+
+			words->entry[words->size].length=offset;
+			words->entry[words->size].word=input;
+			words->size+=1;
+
+			if(offset==(int)strlen(input)) break;
+			input+=offset;
+			offset=0;
+		} else {
+			++offset;
+		}
+	}
+
+	/*
+	 *		If the last word isn't punctuation, then replace it with a
+	 *		full-stop character.
+	 */
+	if(isalnum(words->entry[words->size-1].word[0])) {
+		entry=(STRING *)realloc(words->entry, (words->size+1)*sizeof(STRING));
+		if(entry==NULL)
+			error("make_words", "Unable to reallocate dictionary");
+		words->entry=entry;
+
+		words->entry[words->size].length=1;
+		words->entry[words->size].word=".";
+		++words->size;
+	}
+	else if(strchr("!.?", words->entry[words->size-1].word[words->entry[words->size-1].length-1])==NULL) {
+		words->entry[words->size-1].length=1;
+		words->entry[words->size-1].word=".";
+	}
+
+   return;
+}
+ 
+/*---------------------------------------------------------------------------*/ 
+/*
+ *		Function:	Boundary
+ *
+ *		Purpose:		Return whether or not a word boundary exists in a string
+ *						at the specified location.
+ */
+bool boundary(char *string, int position)
+{
+	if(position==0)
+		return(FALSE);
+
+	if(position==(int)strlen(string))
+		return(TRUE);
+
+	if(
+		(string[position]=='\'')&&
+		(isalpha(string[position-1])!=0)&&
+		(isalpha(string[position+1])!=0)
+	)
+		return(FALSE);
+
+	if(
+		(position>1)&&
+		(string[position-1]=='\'')&&
+		(isalpha(string[position-2])!=0)&&
+		(isalpha(string[position])!=0)
+	)
+		return(FALSE);
+
+	if(
+		(isalpha(string[position])!=0)&&
+		(isalpha(string[position-1])==0)
+	)
+		return(TRUE);
+	
+	if(
+		(isalpha(string[position])==0)&&
+		(isalpha(string[position-1])!=0)
+	)
+		return(TRUE);
+	
+	if(isdigit(string[position])!=isdigit(string[position-1]))
+		return(TRUE);
+
+	return(FALSE);
+}
+ 
+/*---------------------------------------------------------------------------*/ 
+/*
+ *		Function:	Make_Greeting
+ *
+ *		Purpose:		Put some special words into the dictionary of a session
+ *						so that the program will respond as if to a new judge.
+ */
+void make_greeting(PERSONALITY *personality, SESSION *session)
+{
+	DICTIONARY *grt=personality->grt;
+
+	free_dictionary(session->words);
+	if(grt->size>0)
+		(void)add_word(session->words, grt->entry[choose(session->random, grt->size)]);
+}
+ 
+/*---------------------------------------------------------------------------*/ 
+/*
+ *    Function:   Generate_Reply
+ *
+ *    Purpose:    Take a string of user input and return a string of output
+ *                which may vaguely be construed as containing a reply to
+ *                whatever is in the input string.  The replies are generated
+ *                and evaluated by the workers of the session, and the best
+ *                of each worker's replies compared.  The model is only read,
+ *                so that sessions on different threads may share it.
+ */
+char *generate_reply(PERSONALITY *personality, SESSION *session, DICTIONARY *words)
+{
+	MODEL *model=personality->model;
+	WORKER *worker=session->worker;
+	REPLY *input=session->input;
+	WORKER *best;
+	REPLY *replywords;
+	KEYSET *keywords;
+	char *output;
+	register int i;
+	unsigned long start;
+
+	/*
+	 *		Give each worker a copy of the model of its own, and the limits
+	 *		of the session on how long to spend
+	 */
+	start=milliseconds();
+	session->stop=FALSE;
+	for(i=0; i<session->workers; ++i) {
+		prepare_worker(&worker[i], model, session->random);
+		worker[i].input=input;
+		worker[i].personality=personality;
+		worker[i].shown=(i==0)?TRUE:FALSE;
+		worker[i].stop=&session->stop;
+		worker[i].start=start;
+		worker[i].limit=session->limit;
+		worker[i].patience=session->patience;
+		worker[i].target=session->target;
+		worker[i].found_at=0;
+	}
+
+	/*
+	 *		Create an array of keywords from the words in the user's input
+	 */
+	keywords=make_keywords(personality, worker[0].model, session->keys, words);
+	for(i=0; i<session->workers; ++i)
+		prepare_keys(&worker[i], keywords, (i==0)?TRUE:FALSE);
+
+	/*
+	 *		Replies are compared with the input as symbols, so look its words
+	 *		up once.  A word the model hasn't seen can't match any reply.
+	 */
+	input->size=0;
+	input->first=0;
+	for(i=0; i<words->size; ++i)
+		append_reply(input, find_word(model->dictionary, words->entry[i]));
+
+	/*
+	 *		Make sure some sort of reply exists
+	 */
+	output=copy_output(session, "I don't know enough to answer you yet!");
+	replywords=reply(worker[0].model, NULL, worker[0].replies);
+	if(dissimilar(input, replywords)==TRUE) {
+		copy_reply(worker[0].best, replywords);
+		worker[0].found=TRUE;
+	}
+
+	/*
+	 *		Let the workers generate and evaluate replies until the session
+	 *		has spent long enough, and then take the best reply any of them
+	 *		found.
+	 */
+	progress("Generating reply", 0, 1);
+	run_workers(worker, session->workers);
+	progress(NULL, 1, 1);
+	for(i=0; i<session->workers; ++i)
+		if(worker[i].failed==TRUE)
+			error("generate_reply", "Worker %d was unable to generate replies", i);
+
+	best=&worker[0];
+	session->effort.tried=worker[0].count;
+	for(i=1; i<session->workers; ++i) {
+		session->effort.tried+=worker[i].count;
+		if((worker[i].found==TRUE)&&(worker[i].surprise>best->surprise)) best=&worker[i];
+	}
+	session->effort.best=best->found_at;
+	session->effort.taken=milliseconds()-start;
+	session->effort.surprise=best->surprise;
+	if(best->found==TRUE) output=make_output(session, model->dictionary, best->best);
+
+	/*
+	 *		Return the best answer we generated
+	 */
+	return(output);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Prepare_Worker
+ *
+ *		Purpose:		Get a worker ready to generate replies from the model.
+ *						It gets a copy of the model with a context of its own, and
+ *						random numbers of its own seeded from those of the session,
+ *						so that it shares nothing which changes.
+ */
+void prepare_worker(WORKER *worker, MODEL *model, unsigned short *random)
+{
+	TREE **context;
+	BYTE4 *frozen_context;
+	BYTE4 *merged;
+	BYTE4 room;
+	register int i;
+
+	worker->surprise=(float)-1.0;
+	worker->found=FALSE;
+	worker->failed=FALSE;
+	worker->count=0;
+
+	if(worker->model==NULL) {
+		worker->model=(MODEL *)malloc(sizeof(MODEL));
+		if(worker->model==NULL) {
+			error("prepare_worker", "Unable to allocate worker.");
+			return;
+		}
+		worker->model->context=NULL;
+		worker->model->frozen_context=NULL;
+		worker->model->merged=NULL;
+		worker->model->merged_room=0;
+	}
+	context=(TREE **)realloc(worker->model->context, sizeof(TREE *)*(model->order+2));
+	if(context==NULL) error("prepare_worker", "Unable to allocate context array.");
+	worker->model->context=context;
+	frozen_context=(BYTE4 *)realloc(worker->model->frozen_context,
+		sizeof(BYTE4)*(model->order+2));
+	if(frozen_context==NULL) error("prepare_worker", "Unable to allocate context array.");
+	worker->model->frozen_context=frozen_context;
+	merged=worker->model->merged;
+	room=worker->model->merged_room;
+	*worker->model=*model;
+	worker->model->context=context;
+	worker->model->frozen_context=frozen_context;
+	worker->model->merged=merged;
+	worker->model->merged_room=room;
+	worker->model->random=worker->random;
+	for(i=0; i<3; ++i) worker->random[i]=(unsigned short)nrand48(random);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Prepare_Keys
+ *
+ *		Purpose:		Give a worker the keywords to generate replies to.  The
+ *						first worker uses them as they are, and the others get a
+ *						copy with a record of the keywords used of their own.
+ */
+void prepare_keys(WORKER *worker, KEYSET *keys, bool first)
+{
+	if(first==TRUE) {
+		worker->keys=keys;
+		return;
+	}
+
+	if(worker->keys==NULL) {
+		worker->keys=(KEYSET *)malloc(sizeof(KEYSET));
+		if(worker->keys==NULL) {
+			error("prepare_keys", "Unable to allocate worker.");
+			return;
+		}
+	}
+	if(keys->room>worker->room) {
+		if(worker->used!=NULL) free(worker->used);
+		worker->used=(BYTE4 *)calloc(keys->room, sizeof(BYTE4));
+		if(worker->used==NULL) {
+			error("prepare_keys", "Unable to allocate the keyword bitsets.");
+			worker->room=0;
+			return;
+		}
+		worker->room=keys->room;
+	}
+	*worker->keys=*keys;
+	worker->keys->used=worker->used;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Generate_Worker
+ *
+ *		Purpose:		Run a worker, on a thread of its own or on the calling
+ *						thread.  A worker which fails stops the others, and leaves
+ *						it to the caller to report once they have all finished.
+ */
+void *generate_worker(void *argument)
+{
+	WORKER *worker=(WORKER *)argument;
+	GUARD guard;
+
+	push_guard(&guard);
+	guard.personality=worker->personality;
+	if(setjmp(guard.failed)!=0) {
+		pop_guard(&guard);
+		worker->failed=TRUE;
+		worker->found=FALSE;
+		(void)stop_workers(worker, TRUE);
+		return(NULL);
+	}
+	generate_replies(worker);
+	pop_guard(&guard);
+
+	return(NULL);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Generate_Replies
+ *
+ *		Purpose:		Generate and evaluate replies until the time limit is up,
+ *						keeping the best one.  The worker gives up early if it
+ *						runs out of patience, and all the workers stop once any
+ *						of them reaches the target.  Only the first worker may
+ *						show its progress, since it runs on the calling thread.
+ */
+void generate_replies(WORKER *worker)
+{
+	REPLY *replywords;
+	float surprise;
+	unsigned long count=0;
+	unsigned long better=0;
+	unsigned long stride=1;
+	unsigned long check=1;
+	unsigned long now=worker->start;
+	unsigned long then;
+
+	while(TRUE) {
+		replywords=reply(worker->model, worker->keys, worker->replies);
+		surprise=evaluate_reply(worker->model, worker->keys, replywords, worker->surprise);
+		++count;
+		if((surprise>worker->surprise)&&(dissimilar(worker->input, replywords)==TRUE)) {
+			worker->surprise=surprise;
+			copy_reply(worker->best, replywords);
+			worker->found=TRUE;
+			worker->found_at=milliseconds()-worker->start;
+			better=count;
+			if((worker->target>(float)0.0)&&(surprise>=worker->target)) {
+				(void)stop_workers(worker, TRUE);
+				break;
+			}
+		}
+		if((worker->patience>0)&&(count-better>=worker->patience)) break;
+
+		/*
+		 *		A reply may take anything from microseconds to milliseconds,
+		 *		so the clock is read after a stride of replies which grows
+		 *		while they are quick and shrinks when they are slow.
+		 */
+		if(--check>0) continue;
+		then=now;
+		now=milliseconds();
+		if(now-worker->start>=worker->limit) break;
+		if(stop_workers(worker, FALSE)==TRUE) break;
+		if(worker->shown==TRUE)
+			progress(NULL, (int)(now-worker->start), (int)worker->limit);
+		if((now==then)&&(stride<CLOCK_STRIDE)) stride*=2;
+		else if((now-then>1)&&(stride>1)) stride/=2;
+		check=stride;
+	}
+	worker->count=count;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Stop_Workers
+ *
+ *		Purpose:		Tell the other workers of a session to stop, or find out
+ *						whether one of them has told this one to.
+ */
+bool stop_workers(WORKER *worker, bool stop)
+{
+#ifdef THREADS
+	pthread_mutex_lock(&stop_lock);
+#endif
+	if(stop==TRUE) *worker->stop=TRUE;
+	else stop=*worker->stop;
+#ifdef THREADS
+	pthread_mutex_unlock(&stop_lock);
+#endif
+
+	return(stop);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Milliseconds
+ *
+ *		Purpose:		Return the time in milliseconds from a clock which never
+ *						goes backwards.  Only the difference between two times is
+ *						of any use, and it is right even if the count wraps.
+ */
+unsigned long milliseconds(void)
+{
+#if !defined(DOS) && !defined(__mac_os)
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return((unsigned long)now.tv_sec*1000+(unsigned long)now.tv_nsec/1000000);
+#else
+	return((unsigned long)time(NULL)*1000);
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Run_Workers
+ *
+ *		Purpose:		Start every worker but the first on a thread of its own,
+ *						run the first on this thread, and wait for them all.  Any
+ *						worker which can't be given a thread is left out.
+ */
+void run_workers(WORKER *worker, int count)
+{
+	register int i;
+#ifdef THREADS
+	pthread_t *thread=NULL;
+	bool *started=NULL;
+
+	if(count>1) {
+		thread=(pthread_t *)malloc(sizeof(pthread_t)*count);
+		started=(bool *)malloc(sizeof(bool)*count);
+	}
+	if((thread!=NULL)&&(started!=NULL)) {
+		for(i=1; i<count; ++i)
+			started[i]=(pthread_create(&thread[i], NULL, generate_worker,
+				&worker[i])==0)?TRUE:FALSE;
+		generate_worker(&worker[0]);
+		for(i=1; i<count; ++i)
+			if(started[i]==TRUE) pthread_join(thread[i], NULL);
+			else worker[i].found=FALSE;
+		free(thread);
+		free(started);
+		return;
+	}
+	if(thread!=NULL) free(thread);
+	if(started!=NULL) free(started);
+#endif
+
+	generate_worker(&worker[0]);
+	for(i=1; i<count; ++i) worker[i].found=FALSE;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Dissimilar
+ *
+ *		Purpose:		Return TRUE or FALSE depending on whether the replies
+ *						are the same or not.  No two symbols of the dictionary
+ *						spell the same word, so comparing symbols is enough.
+ */
+bool dissimilar(REPLY *words1, REPLY *words2)
+{
+	if(words1->size!=words2->size) return(TRUE);
+	if(words1->size==0) return(FALSE);
+	if(memcmp(words1->symbol+words1->first, words2->symbol+words2->first,
+		sizeof(BYTE4)*words1->size)!=0) return(TRUE);
+	return(FALSE);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Make_Keywords
+ *
+ *		Purpose:		Put all the interesting words from the user's input into
+ *						a set of keywords, which will be used when generating
+ *						a reply.  The sets of banned and auxiliary words which
+ *						go with it are marked first.  The context of the model
+ *						given, which is a copy of the personality's own, is used
+ *						to bound the surprise of the keywords.
+ */
+KEYSET *make_keywords(PERSONALITY *personality, MODEL *model, KEYSET *keys, DICTIONARY *words)
+{
+	SWAP *swp=personality->swp;
+	register int i;
+	register int j;
+	int c;
+
+	clear_keyset(personality, keys);
+
+	for(i=0; i<words->size; ++i) {
+		/*
+		 *		Find the symbol ID of the word.  If it doesn't exist in
+		 *		the model, or if it begins with a non-alphanumeric
+		 *		character, or if it is in the exclusion array, then
+		 *		skip over it.
+		 */
+		c=0;
+		for(j=0; j<swp->size; ++j)
+			if((swp->from[j].length==words->entry[i].length)&&
+				(wordcmp(swp->from[j], words->entry[i])==0)) {
+				add_key(model, keys, swp->to[j]);
+				++c;
+			}
+		if(c==0) add_key(model, keys, words->entry[i]);
+	}
+
+	if(keys->count>0) for(i=0; i<words->size; ++i) {
+
+		c=0;
+		for(j=0; j<swp->size; ++j)
+			if((swp->from[j].length==words->entry[i].length)&&
+				(wordcmp(swp->from[j], words->entry[i])==0)) {
+				add_aux(model, keys, swp->to[j]);
+				++c;
+			}
+		if(c==0) add_aux(model, keys, words->entry[i]);
+	}
+
+	bound_surprise(model, keys);
+
+	return(keys);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Bound_Surprise
+ *
+ *		Purpose:		Work out the most surprise that any one keyword can add
+ *						to the score of a reply, in each direction.  The surprise
+ *						of a keyword comes from its average probability over the
+ *						contexts it follows, and the shortest of them is always
+ *						there, so the average can't fall below the probability of
+ *						the keyword in that context shared out between them all.
+ *						A bound is negative if there is none.
+ */
+void bound_surprise(MODEL *model, KEYSET *keys)
+{
+	register int i;
+	register int j;
+	float probability;
+	float surprise;
+
+	for(i=0; i<2; ++i) {
+		if(i==0) start_context(model, model->forward, model->frozen_forward);
+		else start_context(model, model->backward, model->frozen_backward);
+		keys->bound[i]=(float)0.0;
+		for(j=0; j<keys->count; ++j) {
+			probability=predict_symbol(model, 0, keys->symbol[j]);
+			if(probability<=(float)0.0) {
+				keys->bound[i]=(float)-1.0;
+				break;
+			}
+			surprise=(float)log((float)model->order/probability);
+			if(surprise>keys->bound[i]) keys->bound[i]=surprise;
+		}
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Add_Key
+ *
+ *		Purpose:		Add a word to the set of keywords.
+ */
+void add_key(MODEL *model, KEYSET *keys, STRING word)
+{
+	int symbol;
+
+	symbol=find_word(model->dictionary, word);
+	if(symbol==0) return;
+	if(isalnum(word.word[0])==0) return;
+	if(TEST_BIT(keys->ban, symbol)!=0) return;
+	if(TEST_BIT(keys->aux, symbol)!=0) return;
+
+	add_keyword(keys, symbol);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Add_Aux
+ *
+ *		Purpose:		Add an auxilliary keyword to the set of keywords.
+ */
+void add_aux(MODEL *model, KEYSET *keys, STRING word)
+{
+	int symbol;
+
+	symbol=find_word(model->dictionary, word);
+	if(symbol==0) return;
+	if(isalnum(word.word[0])==0) return;
+	if(TEST_BIT(keys->aux, symbol)==0) return;
+
+	add_keyword(keys, symbol);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Add_Keyword
+ *
+ *		Purpose:		Add the symbol of a keyword to a set of keywords, keeping
+ *						a list of the keywords in the order they were added, as
+ *						seed() chooses between them by position.
+ */
+void add_keyword(KEYSET *keys, BYTE4 symbol)
+{
+	if(TEST_BIT(keys->key, symbol)!=0) return;
+
+	keys->symbol=(BYTE4 *)realloc(keys->symbol, sizeof(BYTE4)*(keys->count+1));
+	if(keys->symbol==NULL) {
+		error("add_keyword", "Unable to reallocate the keywords.");
+		return;
+	}
+	SET_BIT(keys->key, symbol);
+	keys->symbol[keys->count]=symbol;
+	keys->count+=1;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	New_Keyset
+ *
+ *		Purpose:		Allocate an empty set of keywords.
+ */
+KEYSET *new_keyset(void)
+{
+	KEYSET *keys=NULL;
+
+	keys=(KEYSET *)malloc(sizeof(KEYSET));
+	if(keys==NULL) {
+		error("new_keyset", "Unable to allocate the keywords.");
+		return(NULL);
+	}
+
+	keys->size=0;
+	keys->room=0;
+	keys->ban=NULL;
+	keys->aux=NULL;
+	keys->key=NULL;
+	keys->used=NULL;
+	keys->count=0;
+	keys->symbol=NULL;
+	keys->bound[0]=(float)-1.0;
+	keys->bound[1]=(float)-1.0;
+	keys->used_key=FALSE;
+
+	return(keys);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Free_Keyset
+ *
+ *		Purpose:		Free a set of keywords and its bitsets.
+ */
+void free_keyset(KEYSET *keys)
+{
+	if(keys==NULL) return;
+
+	if(keys->ban!=NULL) free(keys->ban);
+	if(keys->symbol!=NULL) free(keys->symbol);
+	free(keys);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Clear_Keyset
+ *
+ *		Purpose:		Empty a set of keywords, making room in each of its bitsets
+ *						for every symbol of the model, and mark which symbols are
+ *						banned or auxiliary words of the personality.  Words are matched to symbols
+ *						once here, so that generating a reply only tests bits.
+ */
+void clear_keyset(PERSONALITY *personality, KEYSET *keys)
+{
+	MODEL *model=personality->model;
+	DICTIONARY *ban=personality->ban;
+	DICTIONARY *aux=personality->aux;
+	register BYTE4 i;
+	BYTE4 words;
+	BYTE4 symbol;
+
+	words=(model->dictionary->size+31)/32;
+	if(words>keys->room) {
+		if(keys->ban!=NULL) free(keys->ban);
+		keys->ban=(BYTE4 *)malloc(sizeof(BYTE4)*4*words);
+		if(keys->ban==NULL) {
+			error("clear_keyset", "Unable to allocate the keyword bitsets.");
+			keys->room=0;
+			return;
+		}
+		keys->room=words;
+	}
+	keys->size=model->dictionary->size;
+	keys->aux=keys->ban+words;
+	keys->key=keys->aux+words;
+	keys->used=keys->key+words;
+	memset(keys->ban, 0, sizeof(BYTE4)*4*words);
+	keys->count=0;
+
+	for(i=0; i<ban->size; ++i) {
+		symbol=find_word(model->dictionary, ban->entry[i]);
+		if(symbol!=0) SET_BIT(keys->ban, symbol);
+	}
+	for(i=0; i<aux->size; ++i) {
+		symbol=find_word(model->dictionary, aux->entry[i]);
+		if(symbol!=0) SET_BIT(keys->aux, symbol);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Reply
+ *
+ *		Purpose:		Generate a reply appropriate to the given set of keywords,
+ *						which may be NULL, as a sequence of symbols.  The reply is
+ *						grown from its middle in both directions, so it is kept in
+ *						a buffer with room at either end which the caller reuses.
+ */
+REPLY *reply(MODEL *model, KEYSET *keys, REPLY *replies)
+{
+	register int i;
+	int symbol;
+	bool start=TRUE;
+
+	replies->size=0;
+	replies->first=replies->room/2;
+	replies->keywords=0;
+
+	/*
+	 *		Forget which keywords the last reply used.
+	 */
+	if(keys!=NULL) for(i=0; i<keys->count; ++i) CLEAR_BIT(keys->used, keys->symbol[i]);
+
+	/*
+	 *		Start off by making sure that the model's context is empty.
+	 */
+	start_context(model, model->forward, model->frozen_forward);
+	if(keys!=NULL) keys->used_key=FALSE;
+
+	/*
+	 *		Generate the reply in the forward direction.
+	 */
+	while(TRUE) {
+		/*
+		 *		Get a random symbol from the current context.
+		 */
+		if(start==TRUE) symbol=seed(model, keys);
+		else symbol=babble(model, keys);
+		if((symbol==0)||(symbol==1)) break;
+		start=FALSE;
+
+		/*
+		 *		Append the symbol to the reply.  The surprise of a keyword is
+		 *		measured while its context is at hand, although it is only of
+		 *		use if nothing is added in front of the context later on.
+		 */
+		append_reply(replies, symbol);
+		if((keys!=NULL)&&(TEST_BIT(keys->key, symbol)!=0)) {
+			SET_BIT(keys->used, symbol);
+			replies->forward[replies->first+replies->size-1]=log_predict(model, symbol);
+			replies->keywords+=1;
+		}
+
+		/*
+		 *		Extend the current context of the model with the current symbol.
+		 */
+		update_context(model, symbol);
+	}
+	replies->tail=replies->size;
+
+	/*
+	 *		Start off by making sure that the model's context is empty.
+	 */
+	start_context(model, model->backward, model->frozen_backward);
+
+	/*
+	 *		Re-create the context of the model from the start of the reply
+	 *		so that we can generate backwards to reach the beginning of the
+	 *		string.
+	 */
+	if(replies->size>0) for(i=MIN(replies->size-1, model->order); i>=0; --i)
+		update_context(model, replies->symbol[replies->first+i]);
+
+	/*
+	 *		Generate the reply in the backward direction.
+	 */
+	while(TRUE) {
+		/*
+		 *		Get a random symbol from the current context.
+		 */
+		symbol=babble(model, keys);
+		if((symbol==0)||(symbol==1)) break;
+
+		/*
+		 *		Prepend the symbol to the reply.  The context of a keyword
+		 *		here is the one evaluate_reply() would see going backwards.
+		 */
+		prepend_reply(replies, symbol);
+		if((keys!=NULL)&&(TEST_BIT(keys->key, symbol)!=0)) {
+			SET_BIT(keys->used, symbol);
+			replies->backward[replies->first]=log_predict(model, symbol);
+			replies->keywords+=1;
+		}
+
+		/*
+		 *		Extend the current context of the model with the current symbol.
+		 */
+		update_context(model, symbol);
+	}
+
+	return(replies);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	New_Reply
+ *
+ *		Purpose:		Allocate an empty reply with room for REPLY_ROOM symbols.
+ */
+REPLY *new_reply(void)
+{
+	REPLY *reply=NULL;
+
+	reply=(REPLY *)malloc(sizeof(REPLY));
+	if(reply==NULL)
+		error("new_reply", "Unable to allocate reply.");
+
+	reply->symbol=(BYTE4 *)malloc(sizeof(BYTE4)*REPLY_ROOM);
+	reply->forward=(float *)malloc(sizeof(float)*REPLY_ROOM);
+	reply->backward=(float *)malloc(sizeof(float)*REPLY_ROOM);
+	if((reply->symbol==NULL)||(reply->forward==NULL)||(reply->backward==NULL)) {
+		free_reply(reply);
+		error("new_reply", "Unable to allocate reply.");
+	}
+	reply->room=REPLY_ROOM;
+	reply->first=REPLY_ROOM/2;
+	reply->size=0;
+	reply->tail=0;
+	reply->keywords=0;
+
+	return(reply);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Free_Reply
+ *
+ *		Purpose:		Free a reply and its buffers.
+ */
+void free_reply(REPLY *reply)
+{
+	if(reply==NULL) return;
+
+	free(reply->symbol);
+	free(reply->forward);
+	free(reply->backward);
+	free(reply);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Grow_Reply
+ *
+ *		Purpose:		Double the room of a reply which has run into one end of
+ *						its buffer, and move its symbols and the surprise of its
+ *						keywords back to the middle.
+ */
+void grow_reply(REPLY *reply)
+{
+	BYTE4 *symbol;
+	float *forward;
+	float *backward;
+	BYTE4 first;
+
+	symbol=(BYTE4 *)malloc(sizeof(BYTE4)*reply->room*2);
+	forward=(float *)malloc(sizeof(float)*reply->room*2);
+	backward=(float *)malloc(sizeof(float)*reply->room*2);
+	if((symbol==NULL)||(forward==NULL)||(backward==NULL)) {
+		error("grow_reply", "Unable to reallocate reply.");
+		return;
+	}
+	first=(reply->room*2-reply->size)/2;
+	memcpy(symbol+first, reply->symbol+reply->first, sizeof(BYTE4)*reply->size);
+	memcpy(forward+first, reply->forward+reply->first, sizeof(float)*reply->size);
+	memcpy(backward+first, reply->backward+reply->first, sizeof(float)*reply->size);
+	free(reply->symbol);
+	free(reply->forward);
+	free(reply->backward);
+	reply->symbol=symbol;
+	reply->forward=forward;
+	reply->backward=backward;
+	reply->first=first;
+	reply->room*=2;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Append_Reply
+ *
+ *		Purpose:		Add a symbol to the end of a reply.
+ */
+void append_reply(REPLY *reply, BYTE4 symbol)
+{
+	if(reply->first+reply->size>=reply->room) grow_reply(reply);
+	reply->symbol[reply->first+reply->size]=symbol;
+	reply->size+=1;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Prepend_Reply
+ *
+ *		Purpose:		Add a symbol to the start of a reply.
+ */
+void prepend_reply(REPLY *reply, BYTE4 symbol)
+{
+	if(reply->first==0) grow_reply(reply);
+	reply->first-=1;
+	reply->symbol[reply->first]=symbol;
+	reply->size+=1;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Copy_Reply
+ *
+ *		Purpose:		Make one reply hold the same symbols as another.
+ */
+void copy_reply(REPLY *to, REPLY *from)
+{
+	while(to->room<from->size) grow_reply(to);
+	to->first=0;
+	to->size=from->size;
+	memcpy(to->symbol, from->symbol+from->first, sizeof(BYTE4)*from->size);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Evaluate_Reply
+ *
+ *		Purpose:		Measure the average surprise of keywords relative to the
+ *						language model.  Most of it has already been measured by
+ *						reply(), which leaves only the keywords going forwards
+ *						near the front of the reply, where it added words after
+ *						their context was used, and those going backwards that
+ *						it generated going forwards.  A reply which can't score
+ *						more than the best so far is given up on as soon as that
+ *						is clear, and scores -1.
+ */
+float evaluate_reply(MODEL *model, KEYSET *keys, REPLY *words, float best)
+{
+	register int i;
+	BYTE4 *symbol;
+	float *forward;
+	float *backward;
+	float entropy=(float)0.0;
+	double known=0.0;
+	int head;
+	int tail;
+	int ahead=0;
+	int behind=0;
+	int num;
+
+	if(words->size<=0) return((float)0.0);
+	num=words->keywords*2;
+	if(num==0) return((float)0.0);
+
+	symbol=words->symbol+words->first;
+	forward=words->forward+words->first;
+	backward=words->backward+words->first;
+
+	/*
+	 *		The words before head need their forward surprise measured, and
+	 *		those from tail onwards their backward surprise.
+	 */
+	tail=words->size-words->tail;
+	head=(tail==0)?0:tail+model->order-1;
+	if(head>words->size) head=words->size;
+	for(i=0; i<words->size; ++i) {
+		if(TEST_BIT(keys->key, symbol[i])==0) continue;
+		if(i<head) ++ahead;
+		else known-=forward[i];
+		if(i>=tail) ++behind;
+		else known-=backward[i];
+	}
+
+	if(hopeless(keys, known, ahead, behind, num, best)==TRUE) return((float)-1.0);
+
+	if(ahead>0) {
+		start_context(model, model->forward, model->frozen_forward);
+		for(i=0; ahead>0; ++i) {
+			if(TEST_BIT(keys->key, symbol[i])!=0) {
+				forward[i]=log_predict(model, symbol[i]);
+				known-=forward[i];
+				--ahead;
+				if(hopeless(keys, known, ahead, behind, num, best)==TRUE) return((float)-1.0);
+			}
+			update_context(model, symbol[i]);
+		}
+	}
+
+	if(behind>0) {
+		start_context(model, model->backward, model->frozen_backward);
+		for(i=words->size-1; behind>0; --i) {
+			if(TEST_BIT(keys->key, symbol[i])!=0) {
+				backward[i]=log_predict(model, symbol[i]);
+				known-=backward[i];
+				--behind;
+				if(hopeless(keys, known, ahead, behind, num, best)==TRUE) return((float)-1.0);
+			}
+			update_context(model, symbol[i]);
+		}
+	}
+
+	/*
+	 *		Add up the surprise in the same order as it would be measured
+	 *		from scratch, so that the score doesn't depend on which of the
+	 *		keywords reply() was able to measure.
+	 */
+	for(i=0; i<words->size; ++i)
+		if(TEST_BIT(keys->key, symbol[i])!=0) entropy-=forward[i];
+	for(i=words->size-1; i>=0; --i)
+		if(TEST_BIT(keys->key, symbol[i])!=0) entropy-=backward[i];
+
+	if(num>=8) entropy/=(float)sqrt(num-1);
+	if(num>=16) entropy/=(float)num;
+
+	return(entropy);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Log_Predict
+ *
+ *		Purpose:		Return the log of the average probability of a symbol
+ *						over the contexts of the model which are available, or
+ *						zero if there are none.  The surprise of a keyword is the
+ *						negative of this.
+ */
+float log_predict(MODEL *model, int symbol)
+{
+	register int j;
+	float probability=(float)0.0;
+	float weight;
+	int count=0;
+
+	for(j=0; j<model->order; ++j) {
+		weight=predict_symbol(model, j, symbol);
+		if(weight<(float)0.0) continue;
+		probability+=weight;
+		++count;
+	}
+
+	if(count>0) return((float)log(probability/(float)count));
+
+	return((float)0.0);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Hopeless
+ *
+ *		Purpose:		Return TRUE if a reply can't score more than the best so
+ *						far, given the surprise measured so far and how many
+ *						keywords are left to measure in each direction.  The
+ *						bound allows a little for the rounding of the score.
+ */
+bool hopeless(KEYSET *keys, double known, int ahead, int behind, int num, float best)
+{
+	double limit;
+
+	if(best<(float)0.0) return(FALSE);
+	if((ahead>0)&&(keys->bound[0]<(float)0.0)) return(FALSE);
+	if((behind>0)&&(keys->bound[1]<(float)0.0)) return(FALSE);
+
+	limit=known+(double)ahead*keys->bound[0]+(double)behind*keys->bound[1];
+	if(num>=8) limit/=sqrt(num-1);
+	if(num>=16) limit/=(double)num;
+
+	return((limit*1.001<=(double)best)?TRUE:FALSE);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Predict_Symbol
+ *
+ *		Purpose:		Return the probability of a symbol in one of the contexts
+ *						of the model, adding the counts of a frozen model to those
+ *						learnt on top of it, or a negative value if there is no
+ *						such context.
+ */
+float predict_symbol(MODEL *model, int context, int symbol)
+{
+	TREE *node;
+	BYTE4 parent;
+	BYTE4 count=0;
+	BYTE4 usage=0;
+
+	parent=model->frozen_context[context];
+	if(parent!=0) {
+		count=model->frozen->count[find_frozen(model->frozen, parent, symbol)];
+		usage=model->frozen->usage[parent];
+	}
+	if(model->context[context]!=NULL) {
+		node=find_symbol(model->context[context], symbol);
+		if(node!=NULL) count+=node->count;
+		usage+=model->context[context]->usage;
+	}
+	if(usage==0) return((float)-1.0);
+
+	return((float)count/(float)usage);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Make_Output
+ *
+ *		Purpose:		Generate a string from the symbols of a reply, spelling
+ *						them with the words of the dictionary.  The string is kept
+ *						by the session until its next reply.
+ */
+char *make_output(SESSION *session, DICTIONARY *dictionary, REPLY *words)
+{
+	register int i;
+	register int j;
+	size_t length;
+	STRING word;
+	char *output;
+
+	if(words->size==0) return(copy_output(session, "I am utterly speechless!"));
+
+	length=1;
+	for(i=0; i<words->size; ++i)
+		length+=dictionary->entry[words->symbol[words->first+i]].length;
+
+	if(length>session->room) {
+		output=(char *)realloc(session->output, sizeof(char)*length);
+		if(output==NULL)
+			error("make_output", "Unable to reallocate output.");
+		session->output=output;
+		session->room=length;
+	}
+
+	length=0;
+	for(i=0; i<words->size; ++i) {
+		word=dictionary->entry[words->symbol[words->first+i]];
+		for(j=0; j<word.length; ++j) session->output[length++]=word.word[j];
+	}
+			
+	session->output[length]='\0';
+
+	return(session->output);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Copy_Output
+ *
+ *		Purpose:		Give a session a copy of a canned reply, which the caller
+ *						is then free to change like any other.
+ */
+char *copy_output(SESSION *session, char *string)
+{
+	size_t length=strlen(string)+1;
+	char *output;
+
+	if(length>session->room) {
+		output=(char *)realloc(session->output, sizeof(char)*length);
+		if(output==NULL)
+			error("copy_output", "Unable to reallocate output.");
+		session->output=output;
+		session->room=length;
+	}
+	strcpy(session->output, string);
+
+	return(session->output);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Babble
+ *
+ *		Purpose:		Return a random symbol from the current context, or a
+ *						zero symbol identifier if we've reached either the
+ *						start or end of the sentence.  Select the symbol based
+ *						on probabilities, favouring keywords which the reply
+ *						hasn't used yet.  In all cases, use the longest available
+ *						context to choose the symbol.  Contexts with many children
+ *						are sampled through the running totals of their counts,
+ *						which gives the same symbol as walking through them.
+ */
+int babble(MODEL *model, KEYSET *keys)
+{
+	TREE *node=NULL;
+	FROZEN *frozen;
+	BYTE4 *symbols=NULL;
+	BYTE4 *weights=NULL;
+	BYTE4 *totals=NULL;
+	BYTE4 parent=0;
+	BYTE4 first=0;
+	BYTE4 reach;
+	BYTE4 position;
+	BYTE4 step;
+	bool found;
+	bool keyword=FALSE;
+	register int i;
+	register BYTE4 j;
+	int branch=0;
+	int count=0;
+	int weight;
+	int symbol;
+
+	/*
+	 *		Select the longest available context which has something to
+	 *		follow it, either in a frozen model, in the tree learnt on top
+	 *		of it, or in both, as a pruned brain may have forgotten what
+	 *		follows some of its rarer contexts.
+	 */
+	frozen=model->frozen;
+	for(i=0; i<=model->order; ++i) {
+		if((model->context[i]==NULL)&&(model->frozen_context[i]==0)) continue;
+		if(((node!=NULL)||(parent!=0))&&
+			((model->context[i]==NULL)||(model->context[i]->branch==0))&&
+			((model->frozen_context[i]==0)||
+			(frozen->child[model->frozen_context[i]+1]==
+			frozen->child[model->frozen_context[i]]))) continue;
+		node=model->context[i];
+		parent=model->frozen_context[i];
+	}
+	if(parent!=0) {
+		first=frozen->child[parent];
+		branch=frozen->child[parent+1]-first;
+		count=frozen->usage[parent];
+		symbols=frozen->symbol+first;
+		weights=frozen->count+first;
+		if(branch>=SCAN_FANOUT) totals=frozen_totals(frozen, parent);
+	}
+	if((node!=NULL)&&(node->branch>0)) {
+		totals=NULL;
+		if(branch>0) {
+			branch=merge_branch(model, parent, node, &symbols, &weights);
+		} else {
+			branch=node->branch;
+			symbols=NULL;
+			if(node->capacity>=HASH_FANOUT) totals=node_totals(node);
+		}
+		count+=node->usage;
+	}
+
+	if(branch==0) return(0);
+
+	/*
+	 *		Choose a symbol at random from this context.
+	 */
+	i=choose(model->random, branch);
+	count=choose(model->random, count);
+
+	/*
+	 *		Find where the walk below would stop, and then whether it would
+	 *		meet a keyword on the way.  Only keywords can cut the walk short,
+	 *		so the one nearest the start wins if it comes soon enough.
+	 */
+	if((totals!=NULL)&&(totals[branch-1]>0)) {
+		position=sample_branch(totals, (BYTE4)branch, (BYTE4)i, (BYTE4)count, &reach);
+		symbol=(symbols!=NULL)?symbols[position]:node->tree[position]->symbol;
+		if(keys==NULL) return(symbol);
+		for(j=0; j<keys->count; ++j) {
+			if(
+				(TEST_BIT(keys->key, keys->symbol[j])==0)||
+				((keys->used_key==FALSE)&&(TEST_BIT(keys->aux, keys->symbol[j])!=0))||
+				(TEST_BIT(keys->used, keys->symbol[j])!=0)
+			) continue;
+			if(symbols!=NULL) {
+				position=find_frozen(frozen, parent, keys->symbol[j]);
+				if(position==0) continue;
+				position-=first;
+			} else {
+				found=FALSE;
+				position=search_node(node, keys->symbol[j], &found);
+				if(found==FALSE) continue;
+			}
+			step=(position>=(BYTE4)i)?position-i:position+branch-i;
+			if(step>reach) continue;
+			reach=step;
+			symbol=keys->symbol[j];
+			keyword=TRUE;
+		}
+		if(keyword==TRUE) keys->used_key=TRUE;
+		return(symbol);
+	}
+
+	while(count>=0) {
+		/*
+		 *		If the symbol occurs as a keyword, then use it.  Only use an
+		 *		auxilliary keyword if a normal keyword has already been used.
+		 */
+		if(symbols!=NULL) {
+			symbol=symbols[i];
+			weight=weights[i];
+		} else {
+			symbol=node->tree[i]->symbol;
+			weight=node->tree[i]->count;
+		}
+
+		if(
+			(keys!=NULL)&&
+			(TEST_BIT(keys->key, symbol)!=0)&&
+			((keys->used_key==TRUE)||(TEST_BIT(keys->aux, symbol)==0))&&
+			(TEST_BIT(keys->used, symbol)==0)
+		) {
+			keys->used_key=TRUE;
+			break;
+		}
+		count-=weight;
+		i=(i>=(branch-1))?0:i+1;
+	}
+
+	return(symbol);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Seed
+ *
+ *		Purpose:		Seed the reply by guaranteeing that it contains a
+ *						keyword, if one exists.
+ */
+int seed(MODEL *model, KEYSET *keys)
+{
+	register int i;
+	int symbol=0;
+	int stop;
+	BYTE4 first=0;
+	int branch=0;
+	TREE *node;
+
+	/*
+	 *		Fix, thanks to Mark Tarrabain.  The symbol is chosen from the
+	 *		children of a frozen root and the root learnt on top of it, and a
+	 *		child of the latter which is also one of the former is passed
+	 *		over, so that every symbol is equally likely.
+	 */
+	node=model->context[0];
+	if(model->frozen!=NULL) {
+		first=model->frozen->child[model->frozen_context[0]];
+		branch=model->frozen->child[model->frozen_context[0]+1]-first;
+	}
+	if(branch+node->branch>0) while(TRUE) {
+		i=choose(model->random, branch+node->branch);
+		if(i<branch) {
+			symbol=model->frozen->symbol[first+i];
+			break;
+		}
+		symbol=node->tree[i-branch]->symbol;
+		if((branch==0)||
+			(find_frozen(model->frozen, model->frozen_context[0], symbol)==0)) break;
+	}
+
+	if((keys!=NULL)&&(keys->count>0)) {
+		i=choose(model->random, keys->count);
+		stop=i;
+		while(TRUE) {
+			if(TEST_BIT(keys->aux, keys->symbol[i])==0) {
+				symbol=keys->symbol[i];
+				return(symbol);
+			}
+			++i;
+			if(i==keys->count) i=0;
+			if(i==stop) return(symbol);
+		}
+	}
+
+	return(symbol);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	New_Swap
+ *
+ *		Purpose:		Allocate a new swap structure.
+ */
+SWAP *new_swap(void)
+{
+	SWAP *list;
+
+	list=(SWAP *)malloc(sizeof(SWAP));
+	if(list==NULL) {
+		error("new_swap", "Unable to allocate swap");
+		return(NULL);
+	}
+	list->size=0;
+	list->from=NULL;
+	list->to=NULL;
+
+	return(list);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Add_Swap
+ *
+ *		Purpose:		Add a new entry to the swap structure.
+ */
+void add_swap(SWAP *list, char *s, char *d)
+{
+	STRING *from;
+	STRING *to;
+	char *word;
+
+	/*
+	 *		Both lists are grown before the new entry is counted, so that the
+	 *		swap structure can still be freed if either can't be.
+	 */
+	from=(STRING *)realloc(list->from, sizeof(STRING)*(list->size+1));
+	if(from==NULL)
+		error("add_swap", "Unable to reallocate from");
+	list->from=from;
+	to=(STRING *)realloc(list->to, sizeof(STRING)*(list->size+1));
+	if(to==NULL)
+		error("add_swap", "Unable to reallocate to");
+	list->to=to;
+
+	word=strdup(s);
+	if(word==NULL)
+		error("add_swap", "Unable to allocate the word");
+	list->from[list->size].length=strlen(s);
+	list->from[list->size].word=word;
+	list->to[list->size].length=0;
+	list->to[list->size].word=NULL;
+	list->size+=1;
+	word=strdup(d);
+	if(word==NULL)
+		error("add_swap", "Unable to allocate the word");
+	list->to[list->size-1].length=strlen(d);
+	list->to[list->size-1].word=word;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Initialize_Swap
+ *
+ *		Purpose:		Read a swap structure from a file.
+ */
+SWAP *initialize_swap(char *filename)
+{
+	SWAP *list;
+	FILE *file=NULL;
+	char buffer[1024];
+	char *from;
+	char *to;
+	GUARD guard;
+
+	list=new_swap();
+
+	if(filename==NULL) return(list);
+
+	file=fopen(filename, "r");
+	if(file==NULL) return(list);
+
+	push_guard(&guard);
+	if(setjmp(guard.failed)!=0) {
+		fclose(file);
+		free_swap(list);
+		fail_guard(&guard);
+	}
+
+	while(!feof(file)) {
+
+		if(fgets(buffer, 1024, file)==NULL) break;
+		if(buffer[0]=='#') continue;
+		from=strtok(buffer, "\t ");
+		to=strtok(NULL, "\t \n#");
+
+		add_swap(list, from, to);
+	}
+
+	pop_guard(&guard);
+	fclose(file);
+	return(list);
+}
+
+/*---------------------------------------------------------------------------*/
+
+void free_swap(SWAP *swap)
+{
+	register int i;
+
+	if(swap==NULL) return;
+
+	for(i=0; i<swap->size; ++i) {
+		free_word(swap->from[i]);
+		free_word(swap->to[i]);
+	}
+	free(swap->from);
+	free(swap->to);
+	free(swap);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Initialize_List
+ *
+ *		Purpose:		Read a dictionary from a file.  The words are gathered
+ *						into the pool of the dictionary and sorted in one go.
+ */
+DICTIONARY *initialize_list(char *filename)
+{
+	DICTIONARY *list;
+	FILE *file=NULL;
+	char *string;
+	char *word;
+	char buffer[1024];
+	GUARD guard;
+
+	list=new_dictionary();
+
+	if(filename==NULL) return(list);
+
+	file=fopen(filename, "r");
+	if(file==NULL) return(list);
+
+	push_guard(&guard);
+	if(setjmp(guard.failed)!=0) {
+		fclose(file);
+		free_dictionary(list);
+		free(list);
+		fail_guard(&guard);
+	}
+
+	while(!feof(file)) {
+
+		if(fgets(buffer, 1024, file)==NULL) break;
+		if(buffer[0]=='#') continue;
+		string=strtok(buffer, "\t \n#");
+
+		if((string!=NULL)&&(strlen(string)>0)) {
+			word=pool_word(list, strlen(string));
+			memcpy(word, string, strlen(string));
+		}
+	}
+
+	index_dictionary(list, TRUE);
+	pop_guard(&guard);
+	fclose(file);
+	return(list);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Delay
+ *
+ *		Purpose:		Display the string to stdout as if it was typed by a human.
+ */
+void delay(char *string)
+{
+	register int i;
+	
+	/*
+	 *		Don't simulate typing if the feature is turned off
+	 */
+	if(typing_delay==FALSE)	{
+		fprintf(stdout, string);
+		return;
+	}
+
+	/*
+	 *		Display the entire string, one character at a time
+	 */
+	for(i=0; i<(int)strlen(string)-1; ++i) typein(string[i]);
+	usleep((D_THINK+rnd(V_THINK)-rnd(V_THINK))/2);
+	typein(string[i]);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Typein
+ *
+ *		Purpose:		Display a character to stdout as if it was typed by a human.
+ */
+void typein(char c)
+{
+	/*
+	 *		Standard keyboard delay
+	 */
+	usleep(D_KEY+rnd(V_KEY)-rnd(V_KEY));
+	fprintf(stdout, "%c", c);
+	fflush(stdout);
+	
+	/*
+	 *		A random thinking delay
+	 */
+	if((!isalnum(c))&&((rnd(100))<P_THINK))
+		usleep(D_THINK+rnd(V_THINK)-rnd(V_THINK));
+}
+
+/*---------------------------------------------------------------------------*/
+
+#ifndef LIBMEGAHAL
+/*
+ *		Function:	Ignore
+ *
+ *		Purpose:		Log the occurrence of a signal, but ignore it.
+ */
+void ignore(int sig)
+{
+	if(sig!=0) warn("ignore", "MegaHAL received signal %d", sig);
+
+#if !defined(DOS)
+	signal(SIGINT, ignore);
+	signal(SIGILL, die);
+	signal(SIGSEGV, die);
+#endif
+	signal(SIGFPE, die);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Die
+ *
+ *		Purpose:		Log the occurrence of a signal, and exit.  The signal may
+ *						arrive on any thread, so it doesn't go through error(),
+ *						which would only return to the guard of that thread.
+ */
+void die(int sig)
+{
+	PERSONALITY *personality=current_personality();
+	FILE *file=((personality!=NULL)&&(personality->errors!=NULL))?personality->errors:stderr;
+
+	fprintf(file, "die: MegaHAL received signal %d.\n", sig);
+	fflush(file);
+	fprintf(stderr, "MegaHAL died for some reason; check the error log.\n");
+	exit(1);
+}
+#endif
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Choose
+ *
+ *		Purpose:		Return a random integer between 0 and range-1, drawn from
+ *						the random numbers of a session or of one of its workers
+ *						so that threads don't share them, or from the usual ones
+ *						if there are none.
+ */
+int choose(unsigned short *random, int range)
+{
+#ifdef THREADS
+	if(random!=NULL)
+		return(floor(erand48(random)*(double)(range)));
+#endif
+	return(rnd(range));
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Rnd
+ *
+ *		Purpose:		Return a random integer between 0 and range-1.
+ */
+int rnd(int range)
+{
+	static bool flag=FALSE;
+
+	if(flag==FALSE) {
+#if defined(__mac_os) || defined(DOS)
+		srand(time(NULL));
+#else
+		srand48(time(NULL));
+#endif
+	}
+	flag=TRUE;
+#if defined(__mac_os) || defined(DOS)
+	return(rand()%range);
+#else
+	return(floor(drand48()*(double)(range)));
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Usleep
+ *
+ *		Purpose:		Simulate the Un*x function usleep.  Necessary because
+ *						Microsoft provide no similar function.  Performed via
+ *						a busy loop, which unnecessarily chews up the CPU.
+ *						But Windows '95 isn't properly multitasking anyway, so
+ *						no-one will notice.  Modified from a real Microsoft
+ *						example, believe it or not!
+ */
+#if defined(DOS) || defined(__mac_os)
+void usleep(int period)
+{
+	clock_t goal;
+
+	goal=(clock_t)(period*CLOCKS_PER_SEC)/(clock_t)1000000+clock();
+	while(goal>clock());
+}
+#endif
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Strdup
+ *
+ *		Purpose:		Provide the strdup() function for Macintosh.
+ */
+#ifdef __mac_os
+char *strdup(const char *str)
+{
+	char *rval=(char *)malloc(strlen(str)+1);
+
+	if(rval!=NULL) strcpy(rval, str);
+
+	return(rval);
+}
+#endif
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Initialize_Speech
+ *
+ *		Purpose:		Initialize speech output.
+ */
+#ifdef __mac_os
+bool initialize_speech(void)
+{
+	bool speechExists = false;
+	long response;
+	OSErr err;
+
+	err = Gestalt(gestaltSpeechAttr, &response);
+        
+	if(!err) {
+		if(response & (1L << gestaltSpeechMgrPresent)) {
+			speechExists = true;
+		}
+	}
+	return speechExists;
+}
+#endif
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	changevoice
+ *
+ *		Purpose:		change voice of speech output.
+ */
+void changevoice(DICTIONARY* words, int position)
+{
+#ifdef __mac_os
+	register int i, index;
+	STRING word={ 1, "#" };
+	char buffer[80];
+	VoiceSpec voiceSpec;
+	VoiceDescription info;
+	short count, voiceCount;
+	unsigned char* temp;
+	OSErr err;
+	/*
+	 *		If there is less than 4 words, no voice specified.
+	 */
+	if(words->size<=4) return;
+
+	for(i=0; i<words->size-4; ++i)
+		if(wordcmp(word, words->entry[i])==0) {
+
+		err = CountVoices(&voiceCount);
+		if (!err && voiceCount) {
+			for (count = 1; count <= voiceCount; count++) {
+				err = GetIndVoice(count, &voiceSpec);
+				if (err) continue;
+				err = GetVoiceDescription(&voiceSpec, &info, 
+sizeof(VoiceDescription));
+				if (err) continue;
+
+
+				for (temp= info.name; *temp; temp++) {
+					if (*temp == ' ')
+						*temp = '_';
+				}
+
+				/*
+				 *		skip command and get voice name
 				 */
 				index = i + 3;
 				strcpy(buffer, words->entry[index].word);
@@ -3264,254 +8860,956 @@ sizeof(VoiceDescription));
 			}
 		}
 	}
-#endif
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	listvoices
+ *
+ *		Purpose:		Display the names of voices for speech output.
+ */
+void listvoices(void)
+{
+#ifdef __mac_os
+	VoiceSpec voiceSpec;
+	VoiceDescription info;
+	short count, voiceCount;
+	unsigned char* temp;
+	OSErr err;
+
+	if(gSpeechExists) {
+		err = CountVoices(&voiceCount);
+		if (!err && voiceCount) {
+			for (count = 1; count <= voiceCount; count++) {
+				err = GetIndVoice(count, &voiceSpec);
+				if (err) continue;
+
+				err = GetVoiceDescription(&voiceSpec, &info, 
+sizeof(VoiceDescription));
+				if (err) continue;
+
+				p2cstr(info.name);
+				for (temp= info.name; *temp; temp++)
+				if (*temp == ' ')
+					*temp = '_';
+				printf("%s\n",info.name);
+			}
+		}
+	}
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Speak
+ */
+void speak(char *output)
+{
+	if(speech==FALSE) return;
+#ifdef __mac_os
+	if(gSpeechExists) {
+		OSErr err;
+
+		if (gSpeechChannel)
+			err = SpeakText(gSpeechChannel, output, strlen(output));
+		else {
+			c2pstr(output);
+			SpeakString((StringPtr)output);
+			p2cstr((StringPtr)output);
+		}
+	}
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Progress
+ *
+ *		Purpose:		Display a progress indicator as a percentage, for the
+ *						personalities which show their progress.  Each of them
+ *						keeps the percentage it last showed, so that one doesn't
+ *						disturb the indicator of another.
+ */
+bool progress(char *message, int done, int total)
+{
+	PERSONALITY *personality=current_personality();
+
+	if((personality==NULL)||(personality->shown==FALSE)) return(TRUE);
+ 
+	/*
+	 *    We have already hit 100%, and a newline has been printed, so nothing
+	 *    needs to be done.
+	 */
+	if((done*100/total==100)&&(personality->showing==FALSE)) return(TRUE);
+
+	/*
+	 *    Nothing has changed since the last time this function was called,
+	 *    so do nothing, unless it's the first time!
+	 */
+	if(done*100/total==personality->percent) {
+		if((done==0)&&(personality->showing==FALSE)) {
+			fprintf(stderr, "%s: %3d%%", message, done*100/total);
+			personality->showing=TRUE;
+		}
+		return(TRUE);
+	}
+
+	/*
+	 *    Erase what we printed last time, and print the new percentage.
+	 */
+	personality->percent=done*100/total;
+
+	if(done>0) fprintf(stderr, "%c%c%c%c", 8, 8, 8, 8);
+	fprintf(stderr, "%3d%%", done*100/total);
+
+	/*
+	 *    We have hit 100%, so start again and print a newline.
+	 */
+	if(personality->percent==100) {
+		personality->showing=FALSE;
+		personality->percent=0;
+		fprintf(stderr, "\n");
+	}
+
+	return(TRUE);
+}
+
+/*---------------------------------------------------------------------------*/
+
+void help(void)
+{
+	int j;
+
+	if ((connected) && (sd)) {
+	   for(j=0; j<COMMAND_SIZE2; ++j) {
+        	   sprintf(tmp, "PRIVMSG %s :#%-7s: %s\n", chan, command_net[j].word.word, command_net[j].helpstring);
+	           write(sd, tmp, strlen(tmp));
+        	   }
+	   }
+	else {
+	   for(j=0; j<COMMAND_SIZE; ++j) {
+	           printf("#%-7s: %s\n", command[j].word.word, command[j].helpstring);
+	           }
+	   }
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Report
+ *
+ *		Purpose:		Show a line of information to the user, either on the
+ *						console or on the channel when running as a bot.
+ */
+void report(char *line)
+{
+	char message[320];
+
+	if ((connected) && (sd)) {
+		sprintf(message, "PRIVMSG %s :%s\n", chan, line);
+		write(sd, message, strlen(message));
+	}
+	else printf("%s\n", line);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Respond
+ *
+ *		Purpose:		Reply to the user's input, or greet the user if there is
+ *						none, filling the buffer given.  The console can't carry
+ *						on without a reply, so it gives up if there isn't one.
+ */
+void respond(PERSONALITY *personality, SESSION *session, char *input, char *output, int size)
+{
+	int length;
+
+	if(input==NULL) length=megahal_greet(personality, session, output, size);
+	else length=megahal_reply(personality, session, input, output, size);
+	if(length<0) error("converse", "Unable to reply");
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Load_Personality
+ *
+ *		Purpose:		Replace the personality of the console or the bot with
+ *						the one kept in the current directory, opened with the
+ *						options given on the command line.  If it doesn't exist,
+ *						the last directory is used again instead.  The console
+ *						logs to whichever personality it is talking to.
+ */
+void load_personality(PERSONALITY **personality)
+{
+	GUARD *guard=top_guard();
+	FILE *file;
+	char *filename;
+
+	/*
+	 *		Check to see if the brain exists
+	 */
+	if(strcmp(directory, DEFAULT)!=0) {
+	filename=(char *)malloc(sizeof(char)*(strlen(directory)+strlen(SEP)+21));
+	if(filename==NULL) error("load_personality","Unable to allocate filename");
+	sprintf(filename, "%s%s.megahal/megahal.brn", directory, SEP);
+	file=fopen(filename, "r");
+	if(file==NULL) {
+		sprintf(filename, "%s%s.megahal/megahal.trn", directory, SEP);
+		file=fopen(filename, "r");
+		if(file==NULL) {
+			fprintf(stdout, "Unable to change MegaHAL personality to \"%s\".\n"
+				"Reverting to MegaHAL personality \"%s\".\n", directory, last);
+			free(directory);
+			directory=strdup(last);
+			free(filename);
+			return;
+		}
+	}
+	fclose(file);
+	free(filename);
+	fprintf(stdout, "Changing to MegaHAL personality \"%s\".\n", directory);
+	}
+
+	/*
+	 *		Free the current personality, and load the new one
+	 */
+	guard->personality=NULL;
+	megahal_close(*personality);
+	*personality=megahal_open(directory, options);
+	if(*personality==NULL)
+		error("load_personality", "Unable to open personality \"%s\"", directory);
+	guard->personality=*personality;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void change_personality(DICTIONARY *command, int position, PERSONALITY **personality)
+{
+	if(last!=NULL) { free(last); last=NULL; }
+	if(directory!=NULL) last=strdup(directory);
+	else directory=(char *)malloc(sizeof(char)*1);
+	if(directory==NULL)
+		error("change_personality", "Unable to allocate directory");
+	if((command==NULL)||((position+2)>=command->size)) {
+		directory=(char *)realloc(directory, sizeof(char)*(strlen(DEFAULT)+1));
+		if(directory==NULL)
+			error("change_personality", "Unable to allocate directory");
+		strcpy(directory, DEFAULT);
+		if(last==NULL) last=strdup(directory);
+	} else {
+		directory=(char *)realloc(directory,
+			sizeof(char)*(command->entry[position+2].length+1));
+		if(directory==NULL)
+			error("change_personality", "Unable to allocate directory");
+		strncpy(directory, command->entry[position+2].word,
+			command->entry[position+2].length);
+		directory[command->entry[position+2].length]='\0';
+	}
+
+	load_personality(personality);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	New_Personality
+ *
+ *		Purpose:		Allocate a personality for the directory given, without
+ *						a brain or word lists as yet, which behaves as the flags
+ *						given ask.  Everything it writes, from its logs to its
+ *						journal, goes in its own directory.  This is done before
+ *						there is a guard to return to, so NULL is returned on
+ *						failure.
+ */
+PERSONALITY *new_personality(char *home, int flags)
+{
+	PERSONALITY *personality;
+
+	personality=(PERSONALITY *)malloc(sizeof(PERSONALITY));
+	if(personality==NULL) {
+		warn("new_personality", "Unable to allocate personality");
+		return(NULL);
+	}
+	personality->model=NULL;
+	personality->ban=NULL;
+	personality->aux=NULL;
+	personality->grt=NULL;
+	personality->swp=NULL;
+	personality->learning=(flags&MEGAHAL_FROZEN)?FALSE:TRUE;
+	personality->mapping=(flags&MEGAHAL_MAPPED)?TRUE:FALSE;
+	personality->compact=(flags&MEGAHAL_COMPACT)?TRUE:FALSE;
+	personality->journalled=(flags&MEGAHAL_JOURNAL)?TRUE:FALSE;
+	personality->background=(flags&MEGAHAL_BACKGROUND)?TRUE:FALSE;
+	personality->shown=(flags&MEGAHAL_PROGRESS)?TRUE:FALSE;
+	personality->showing=FALSE;
+	personality->percent=0;
+	personality->errors=NULL;
+	personality->statuses=NULL;
+	personality->journal=NULL;
+	personality->journal_name=NULL;
+	personality->journal_old=NULL;
+#if !defined(DOS) && !defined(__mac_os)
+	personality->saver=0;
+#endif
+	personality->directory=strdup(home);
+	if(personality->directory==NULL) {
+		warn("new_personality", "Unable to allocate directory");
+		free_personality(personality);
+		return(NULL);
+	}
+
+	if(personality->journalled==TRUE) {
+		personality->journal_name=(char *)malloc(sizeof(char)*
+			(strlen(home)+strlen(SEP)+21));
+		personality->journal_old=(char *)malloc(sizeof(char)*
+			(strlen(home)+strlen(SEP)+25));
+		if((personality->journal_name==NULL)||(personality->journal_old==NULL)) {
+			warn("new_personality", "Unable to allocate filename");
+			free_personality(personality);
+			return(NULL);
+		}
+		sprintf(personality->journal_name, "%s%s.megahal/megahal.jnl", home, SEP);
+		sprintf(personality->journal_old, "%s.old", personality->journal_name);
+	}
+
+	/*
+	 *		A log which can't be opened is no reason not to talk.
+	 */
+	if(flags&MEGAHAL_LOG) {
+		personality->errors=open_log(home, "megahal.log");
+		personality->statuses=open_log(home, "megahal.txt");
+	}
+
+	return(personality);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Open_Personality
+ *
+ *		Purpose:		Load the personality kept in its directory: its brain, or
+ *						a brain trained on its text if it has none, and its lists
+ *						of banned, auxiliary, greeting and swap words.  The brain
+ *						catches up with whatever was journalled since it was
+ *						saved.  Only one personality in a directory should go on
+ *						to keep the journal, so any other just reads it.
+ */
+void open_personality(PERSONALITY *personality)
+{
+	char *home=personality->directory;
+	char *filename;
+	GUARD guard;
+
+	filename=(char *)malloc(sizeof(char)*(strlen(home)+strlen(SEP)+25));
+	if(filename==NULL)
+		error("open_personality", "Unable to allocate filename");
+
+	/*
+	 *		Whatever has been loaded belongs to the personality, which is
+	 *		freed by the caller if anything fails.
+	 */
+	push_guard(&guard);
+	if(setjmp(guard.failed)!=0) {
+		free(filename);
+		fail_guard(&guard);
+	}
+
+	/*
+	 *		Create a language model.
+	 */
+	personality->model=new_model(order);
+
+	/*
+	 *		Train the model on a text if one exists
+	 */
+	sprintf(filename, "%s%s.megahal/megahal.brn", home, SEP);
+	if(load_model(filename, personality->model)==FALSE) {
+		/*
+		 *		A damaged brain may have been partly read, so start again
+		 *		with an empty model before training it.
+		 */
+		free_model(personality->model);
+		personality->model=NULL;
+		personality->model=new_model(order);
+		sprintf(filename, "%s%s.megahal/megahal.trn", home, SEP);
+		train(personality->model, filename);
+	}
+
+	/*
+	 *		Catch up with whatever was learnt after the brain was saved
+	 */
+	if(personality->journalled==TRUE) {
+		replay_journal(personality);
+	} else {
+		sprintf(filename, "%s%s.megahal/megahal.jnl.old", home, SEP);
+		replay_file(personality->model, filename);
+		sprintf(filename, "%s%s.megahal/megahal.jnl", home, SEP);
+		replay_file(personality->model, filename);
+	}
+
+	/*
+	 *		Read a dictionary containing banned keywords, auxiliary keywords,
+	 *		greeting keywords and swap keywords
+	 */
+	sprintf(filename, "%s%smegahal.ban", home, SEP);
+	personality->ban=initialize_list(filename);
+	sprintf(filename, "%s%smegahal.aux", home, SEP);
+	personality->aux=initialize_list(filename);
+	sprintf(filename, "%s%smegahal.grt", home, SEP);
+	personality->grt=initialize_list(filename);
+	sprintf(filename, "%s%smegahal.swp", home, SEP);
+	personality->swp=initialize_swap(filename);
+	pop_guard(&guard);
+	free(filename);
+
+	/*
+	 *		A brain which won't learn can be frozen for faster replies, which
+	 *		a mapped brain is already
+	 */
+	if((personality->learning==FALSE)&&(personality->model->image==NULL))
+		freeze_model(personality->model);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Free_Personality
+ *
+ *		Purpose:		Free a personality, along with its brain and word lists,
+ *						once any save of it in the background has finished.  Its
+ *						journal and logs are closed.
+ */
+void free_personality(PERSONALITY *personality)
+{
+	if(personality==NULL) return;
+
+	reap_save(personality, TRUE);
+	close_journal(personality);
+	if(personality->errors!=NULL) fclose(personality->errors);
+	if(personality->statuses!=NULL) fclose(personality->statuses);
+	if(personality->journal_name!=NULL) free(personality->journal_name);
+	if(personality->journal_old!=NULL) free(personality->journal_old);
+	free_model(personality->model);
+	free_dictionary(personality->ban);
+	free(personality->ban);
+	free_dictionary(personality->aux);
+	free(personality->aux);
+	free_dictionary(personality->grt);
+	free(personality->grt);
+	free_swap(personality->swp);
+	if(personality->directory!=NULL) free(personality->directory);
+	free(personality);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Session_Words
+ *
+ *		Purpose:		Keep a copy of some text in a session, in upper case as
+ *						the brain keeps its words, and break it into words.
+ */
+DICTIONARY *session_words(SESSION *session, char *text)
+{
+	size_t length=strlen(text)+1;
+	char *copy;
+
+	if(length>session->text_room) {
+		copy=(char *)realloc(session->text, sizeof(char)*length);
+		if(copy==NULL)
+			error("session_words", "Unable to reallocate text.");
+		session->text=copy;
+		session->text_room=length;
+	}
+	strcpy(session->text, text);
+	upper(session->text);
+	make_words(session->text, session->words);
+
+	return(session->words);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Reply_Text
+ *
+ *		Purpose:		Reply to some text, returning a string which the session
+ *						keeps until its next reply.
+ */
+char *reply_text(PERSONALITY *personality, SESSION *session, char *text)
+{
+	return(generate_reply(personality, session, session_words(session, text)));
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Greet_Text
+ *
+ *		Purpose:		Greet a new judge, returning a string which the session
+ *						keeps until its next reply.
+ */
+char *greet_text(PERSONALITY *personality, SESSION *session)
+{
+	make_greeting(personality, session);
+
+	return(generate_reply(personality, session, session->words));
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Fill_Buffer
+ *
+ *		Purpose:		Copy as much of a reply as fits into the caller's buffer,
+ *						and return its whole length, so that the caller can tell
+ *						if it was cut short.
+ */
+int fill_buffer(char *output, char *buffer, int size)
+{
+	int length;
+
+	if(output==NULL) output="";
+	length=strlen(output);
+	if(size<=0) return(length);
+	if(length<size) {
+		strcpy(buffer, output);
+	} else {
+		memcpy(buffer, output, size-1);
+		buffer[size-1]='\0';
+	}
+
+	return(length);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	listvoices
+ *		Function:	Megahal_Open
  *
- *		Purpose:		Display the names of voices for speech output.
+ *		Purpose:		Load the personality kept in a directory, for use as a
+ *						library, which behaves as the flags given ask.  Unless
+ *						it is asked to keep the journal of the personality, it
+ *						only reads it.  Return NULL if it can't be loaded.
  */
-void listvoices(void)
+PERSONALITY *megahal_open(char *home, int flags)
 {
-#ifdef __mac_os
-	VoiceSpec voiceSpec;
-	VoiceDescription info;
-	short count, voiceCount;
-	unsigned char* temp;
-	OSErr err;
+	PERSONALITY *personality;
+	GUARD guard;
 
-	if(gSpeechExists) {
-		err = CountVoices(&voiceCount);
-		if (!err && voiceCount) {
-			for (count = 1; count <= voiceCount; count++) {
-				err = GetIndVoice(count, &voiceSpec);
-				if (err) continue;
+	personality=new_personality(home, flags);
+	if(personality==NULL) return(NULL);
 
-				err = GetVoiceDescription(&voiceSpec, &info, 
-sizeof(VoiceDescription));
-				if (err) continue;
+	push_guard(&guard);
+	guard.personality=personality;
+	if(setjmp(guard.failed)!=0) {
+		pop_guard(&guard);
+		free_personality(personality);
+		return(NULL);
+	}
+	open_personality(personality);
+	pop_guard(&guard);
 
-				p2cstr(info.name);
-				for (temp= info.name; *temp; temp++)
-				if (*temp == ' ')
-					*temp = '_';
-				printf("%s\n",info.name);
-			}
-		}
+	return(personality);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Megahal_Close
+ *
+ *		Purpose:		Free a personality opened with megahal_open().
+ */
+void megahal_close(PERSONALITY *personality)
+{
+	free_personality(personality);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	New_Session
+ *
+ *		Purpose:		Allocate a session with as many workers as given, with
+ *						everything it owns empty, so that a session which fails
+ *						half way through being opened can still be freed.  This
+ *						is done before there is a guard to return to, so NULL is
+ *						returned on failure.
+ */
+SESSION *new_session(int threads)
+{
+	SESSION *session;
+	register int i;
+
+	session=(SESSION *)malloc(sizeof(SESSION));
+	if(session==NULL) {
+		warn("new_session", "Unable to allocate session");
+		return(NULL);
+	}
+	session->worker=(WORKER *)malloc(sizeof(WORKER)*threads);
+	if(session->worker==NULL) {
+		warn("new_session", "Unable to allocate %d workers", threads);
+		free(session);
+		return(NULL);
+	}
+	session->workers=threads;
+	session->words=NULL;
+	session->keys=NULL;
+	session->input=NULL;
+	for(i=0; i<threads; ++i) {
+		session->worker[i].model=NULL;
+		session->worker[i].keys=NULL;
+		session->worker[i].replies=NULL;
+		session->worker[i].best=NULL;
+		session->worker[i].used=NULL;
+		session->worker[i].room=0;
 	}
+	session->text=NULL;
+	session->text_room=0;
+	session->output=NULL;
+	session->room=0;
+	session->formatted=NULL;
+	session->formatted_room=0;
+	session->limit=REPLY_LIMIT;
+	session->patience=0;
+	session->target=(float)0.0;
+	session->stop=FALSE;
+	session->effort.tried=0;
+	session->effort.best=0;
+	session->effort.taken=0;
+	session->effort.surprise=(float)-1.0;
+	/*
+	 *		The random numbers of the session are seeded from the usual ones,
+	 *		and since workers share the scan, it is picked before any of them
+	 *		start.  Sessions may be created on different threads, so both are
+	 *		done under a lock.
+	 */
+#ifdef THREADS
+	pthread_mutex_lock(&session_lock);
 #endif
+	for(i=0; i<3; ++i) session->random[i]=(unsigned short)rnd(65536);
+	if(scan_keys==scan_select) select_scan();
+#ifdef THREADS
+	pthread_mutex_unlock(&session_lock);
+#endif
+
+	return(session);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Speak
+ *		Function:	Open_Session
+ *
+ *		Purpose:		Give a session the dictionary, keywords and replies that
+ *						it and its workers keep from one reply to the next.
  */
-void speak(char *output)
+void open_session(SESSION *session)
 {
-	if(speech==FALSE) return;
-#ifdef __mac_os
-	if(gSpeechExists) {
-		OSErr err;
+	register int i;
 
-		if (gSpeechChannel)
-			err = SpeakText(gSpeechChannel, output, strlen(output));
-		else {
-			c2pstr(output);
-			SpeakString((StringPtr)output);
-			p2cstr((StringPtr)output);
-		}
+	session->words=new_dictionary();
+	session->keys=new_keyset();
+	session->input=new_reply();
+	for(i=0; i<session->workers; ++i) {
+		session->worker[i].replies=new_reply();
+		session->worker[i].best=new_reply();
 	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Megahal_Session
+ *
+ *		Purpose:		Create a session for replying to one input at a time,
+ *						whose replies are generated on as many threads as given.
+ *						It keeps its own buffers, keywords and random numbers, so
+ *						that it can be used on a thread of its own.  Return NULL
+ *						if it can't be created.
+ */
+SESSION *megahal_session(int threads)
+{
+	SESSION *session;
+	GUARD guard;
+
+	if(threads<1) threads=1;
+#ifndef THREADS
+	threads=1;
 #endif
+
+	session=new_session(threads);
+	if(session==NULL) return(NULL);
+
+	push_guard(&guard);
+	if(setjmp(guard.failed)!=0) {
+		pop_guard(&guard);
+		megahal_end(session);
+		return(NULL);
+	}
+	open_session(session);
+	pop_guard(&guard);
+
+	return(session);
 }
 
 /*---------------------------------------------------------------------------*/
 
 /*
- *		Function:	Progress
+ *		Function:	Megahal_End
  *
- *		Purpose:		Display a progress indicator as a percentage.
+ *		Purpose:		Free a session and the copies of the model its workers
+ *						were using.
  */
-bool progress(char *message, int done, int total)
+void megahal_end(SESSION *session)
 {
-	static int last=0;
-	static bool first=FALSE;
- 
-	/*
-	 *    We have already hit 100%, and a newline has been printed, so nothing
-	 *    needs to be done.
-	 */
-	if((done*100/total==100)&&(first==FALSE)) return(TRUE);
+	WORKER *worker;
+	register int i;
 
-	/*
-	 *    Nothing has changed since the last time this function was called,
-	 *    so do nothing, unless it's the first time!
-	 */
-	if(done*100/total==last) {
-		if((done==0)&&(first==FALSE)) {
-			if (!quiet) fprintf(stderr, "%s: %3d%%", message, done*100/total);
-			first=TRUE;
+	if(session==NULL) return;
+
+	for(i=0; i<session->workers; ++i) {
+		worker=&session->worker[i];
+		if(worker->model!=NULL) {
+			if(worker->model->context!=NULL) free(worker->model->context);
+			if(worker->model->frozen_context!=NULL) free(worker->model->frozen_context);
+			if(worker->model->merged!=NULL) free(worker->model->merged);
+			free(worker->model);
 		}
-		return(TRUE);
+		if((i>0)&&(worker->keys!=NULL)) free(worker->keys);
+		if(worker->used!=NULL) free(worker->used);
+		free_reply(worker->replies);
+		free_reply(worker->best);
+	}
+	free(session->worker);
+	if(session->words!=NULL) {
+		free_dictionary(session->words);
+		free(session->words);
 	}
+	free_keyset(session->keys);
+	free_reply(session->input);
+	if(session->text!=NULL) free(session->text);
+	if(session->output!=NULL) free(session->output);
+	if(session->formatted!=NULL) free(session->formatted);
+	free(session);
+}
 
-	/*
-	 *    Erase what we printed last time, and print the new percentage.
-	 */
-	last=done*100/total;
+/*---------------------------------------------------------------------------*/
 
-	if((done>0) && (!quiet)) fprintf(stderr, "%c%c%c%c", 8, 8, 8, 8);
-	if (!quiet) fprintf(stderr, "%3d%%", done*100/total);
+/*
+ *		Function:	Megahal_Learn
+ *
+ *		Purpose:		Learn from some text, unless the personality is frozen.
+ *						A personality which keeps the journal writes what it
+ *						learns to it.  If this fails, the brain may have learnt
+ *						part of the text.
+ */
+int megahal_learn(PERSONALITY *personality, SESSION *session, char *text)
+{
+	DICTIONARY *words;
+	GUARD guard;
 
-	/*
-	 *    We have hit 100%, so reset static variables and print a newline.
-	 */
-	if(last==100) {
-		first=FALSE;
-		last=0;
-		if (!quiet) fprintf(stderr, "\n");
+	if(personality->learning==FALSE) return(0);
+
+	push_guard(&guard);
+	guard.personality=personality;
+	if(setjmp(guard.failed)!=0) {
+		pop_guard(&guard);
+		return(-1);
 	}
+	words=session_words(session, text);
+	learn(personality->model, words);
+	journal_words(personality, words);
+	pop_guard(&guard);
 
-	return(TRUE);
+	return(0);
 }
 
 /*---------------------------------------------------------------------------*/
 
-void help(void)
+/*
+ *		Function:	Megahal_Reply
+ *
+ *		Purpose:		Reply to some text, filling the buffer given with as much
+ *						of the reply as fits.  The whole length of the reply is
+ *						returned.
+ */
+int megahal_reply(PERSONALITY *personality, SESSION *session, char *text, char *buffer, int size)
 {
-	int j;
+	char *output;
+	GUARD guard;
 
-	if ((connected) && (sd)) {
-	   for(j=0; j<COMMAND_SIZE2; ++j) {
-        	   sprintf(tmp, "PRIVMSG %s :#%-7s: %s\n", chan, command_net[j].word.word, command_net[j].helpstring);
-	           write(sd, tmp, strlen(tmp));
-        	   }
-	   }
-	else {
-	   for(j=0; j<COMMAND_SIZE; ++j) {
-	           printf("#%-7s: %s\n", command[j].word.word, command[j].helpstring);
-	           }
-	   }
+	push_guard(&guard);
+	guard.personality=personality;
+	if(setjmp(guard.failed)!=0) {
+		pop_guard(&guard);
+		return(-1);
+	}
+	output=reply_text(personality, session, text);
+	pop_guard(&guard);
+
+	return(fill_buffer(output, buffer, size));
 }
 
 /*---------------------------------------------------------------------------*/
 
-void load_personality(MODEL **model)
+/*
+ *		Function:	Megahal_Greet
+ *
+ *		Purpose:		Greet a new judge, filling the buffer given with as much
+ *						of the greeting as fits.  The whole length of the greeting
+ *						is returned.
+ */
+int megahal_greet(PERSONALITY *personality, SESSION *session, char *buffer, int size)
 {
-	FILE *file;
-	static char *filename=NULL;
+	char *output;
+	GUARD guard;
 
-	if(filename==NULL) filename=(char *)malloc(sizeof(char)*1);
+	push_guard(&guard);
+	guard.personality=personality;
+	if(setjmp(guard.failed)!=0) {
+		pop_guard(&guard);
+		return(-1);
+	}
+	output=greet_text(personality, session);
+	pop_guard(&guard);
 
-	/*
-	 *		Allocate memory for the filename
-	 */
-	filename=(char *)realloc(filename,
-		sizeof(char)*(strlen(directory)+strlen(SEP)+12));
-	if(filename==NULL) error("load_personality","Unable to allocate filename");
+	return(fill_buffer(output, buffer, size));
+}
 
-	/*
-	 *		Check to see if the brain exists
-	 */
-	if(strcmp(directory, DEFAULT)!=0) {
-	sprintf(filename, "%s%s.megahal/megahal.brn", directory, SEP);
-	file=fopen(filename, "r");
-	if(file==NULL) {
-		sprintf(filename, "%s%s.megahal/megahal.trn", directory, SEP);
-		file=fopen(filename, "r");
-		if(file==NULL) {
-			fprintf(stdout, "Unable to change MegaHAL personality to \"%s\".\n"
-				"Reverting to MegaHAL personality \"%s\".\n", directory, last);
-			free(directory);
-			directory=strdup(last);
-			return;
-		}
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Megahal_Save
+ *
+ *		Purpose:		Save the brain of a personality in its directory, in the
+ *						background if it was opened to, once any save which is
+ *						still being written has finished.
+ */
+int megahal_save(PERSONALITY *personality)
+{
+	GUARD guard;
+	bool saved;
+
+	push_guard(&guard);
+	guard.personality=personality;
+	if(setjmp(guard.failed)!=0) {
+		pop_guard(&guard);
+		return(-1);
 	}
-	fclose(file);
-	fprintf(stdout, "Changing to MegaHAL personality \"%s\".\n", directory);
+	if(personality->background==TRUE) {
+		reap_save(personality, TRUE);
+		saved=save_background(personality);
+	} else {
+		saved=save_foreground(personality);
 	}
+	pop_guard(&guard);
 
-	/*
-	 *		Free the current personality
-	 */
-	free_model(*model);
-	free_words(ban);
-	free_dictionary(ban);
-	free_words(aux);
-	free_dictionary(aux);
-	free_words(grt);
-	free_dictionary(grt);
-	free_swap(swp);
+	return((saved==TRUE)?0:-1);
+}
 
-	/*
-	 *		Create a language model.
-	 */
-	*model=new_model(order);
+/*---------------------------------------------------------------------------*/
 
-	/*
-	 *		Train the model on a text if one exists
-	 */
-	sprintf(filename, "%s%s.megahal/megahal.brn", directory, SEP);
-	if(load_model(filename, *model)==FALSE) {
-		sprintf(filename, "%s%s.megahal/megahal.trn", directory, SEP);
-		train(*model, filename);
+/*
+ *		Function:	Megahal_Forget
+ *
+ *		Purpose:		Forget what a personality which keeps the journal has
+ *						learnt since its brain was last saved, so that it isn't
+ *						learnt again when the personality is next opened.
+ */
+void megahal_forget(PERSONALITY *personality)
+{
+	discard_journal(personality);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Megahal_Prune
+ *
+ *		Purpose:		Forget rare phrases until the brain of a personality takes
+ *						no more than the number of bytes given, and return the
+ *						size it ends up with.
+ */
+long megahal_prune(PERSONALITY *personality, unsigned long budget)
+{
+	unsigned long size;
+	GUARD guard;
+
+	push_guard(&guard);
+	guard.personality=personality;
+	if(setjmp(guard.failed)!=0) {
+		pop_guard(&guard);
+		return(-1);
 	}
+	size=prune_model(personality->model, budget);
+	pop_guard(&guard);
 
-	/*
-	 *		Read a dictionary containing banned keywords, auxiliary keywords,
-	 *		greeting keywords and swap keywords
-	 */
-	sprintf(filename, "%s%smegahal.ban", directory, SEP);
-	ban=initialize_list(filename);
-	sprintf(filename, "%s%smegahal.aux", directory, SEP);
-	aux=initialize_list(filename);
-	sprintf(filename, "%s%smegahal.grt", directory, SEP);
-	grt=initialize_list(filename);
-	sprintf(filename, "%s%smegahal.swp", directory, SEP);
-	swp=initialize_swap(filename);
+	return((long)size);
 }
 
 /*---------------------------------------------------------------------------*/
 
-void change_personality(DICTIONARY *command, int position, MODEL **model)
+/*
+ *		Function:	Megahal_Stats
+ *
+ *		Purpose:		Report the size and shape of the brain of a personality,
+ *						by calling the function given with each line of it.
+ */
+void megahal_stats(PERSONALITY *personality, void (*report)(char *))
 {
-	if(last!=NULL) { free(last); last=NULL; }
-	if(directory!=NULL) last=strdup(directory);
-	else directory=(char *)malloc(sizeof(char)*1);
-	if(directory==NULL)
-		error("change_personality", "Unable to allocate directory");
-	if((command==NULL)||((position+2)>=command->size)) {
-		directory=(char *)realloc(directory, sizeof(char)*(strlen(DEFAULT)+1));
-		if(directory==NULL)
-			error("change_personality", "Unable to allocate directory");
-		strcpy(directory, DEFAULT);
-		if(last==NULL) last=strdup(directory);
-	} else {
-		directory=(char *)realloc(directory,
-			sizeof(char)*(command->entry[position+2].length+1));
-		if(directory==NULL)
-			error("change_personality", "Unable to allocate directory");
-		strncpy(directory, command->entry[position+2].word,
-			command->entry[position+2].length);
-		directory[command->entry[position+2].length]='\0';
-	}
+	show_stats(personality->model, report);
+}
+
+/*---------------------------------------------------------------------------*/
 
-	load_personality(model);
+/*
+ *		Function:	Megahal_Limit
+ *
+ *		Purpose:		Set how many milliseconds a session spends on each reply,
+ *						how many replies in a row may fail to beat the best so far
+ *						before it gives up, and the surprise at which the best is
+ *						good enough.  A patience or target of zero is no limit.
+ */
+void megahal_limit(SESSION *session, unsigned long limit, unsigned long patience, float target)
+{
+	session->limit=limit;
+	session->patience=patience;
+	session->target=target;
 }
 
 /*---------------------------------------------------------------------------*/
 
-void free_words(DICTIONARY *words)
+/*
+ *		Function:	Megahal_Effort
+ *
+ *		Purpose:		Tell how much effort the last reply of a session took.
+ */
+void megahal_effort(SESSION *session, EFFORT *effort)
 {
-	register int i;
+	*effort=session->effort;
+}
 
-	if(words==NULL) return;
+/*---------------------------------------------------------------------------*/
 
-	if(words->entry!=NULL)
-		for(i=0; i<words->size; ++i) free_word(words->entry[i]);
+/*
+ *		Function:	Show_Effort
+ *
+ *		Purpose:		Show how much effort the last reply took, in debug mode.
+ */
+void show_effort(EFFORT *effort)
+{
+	if(debug==0) return;
+	printf("[%lu replies in %lums, the best after %lums]\n",
+		effort->tried, effort->taken, effort->best);
+	fflush(stdout);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -28,13 +28,9 @@
  *
  *		Program:		MegaHAL v8r5
  *
- *		Purpose:		To simulate a natural language conversation with a psychotic
- *						computer.  This is achieved by learning from the user's
- *						input using a third-order Markov model on the word level.
- *						Words are considered to be sequences of characters separated
- *						by whitespace and punctuation.  Replies are generated
- *						randomly based on a keyword, and they are scored using
- *						measures of surprise.
+ *		Purpose:		The interface to the MegaHAL library, for programs which
+ *						want to hold a conversation of their own.  Everything
+ *						else MegaHAL is made of lives in megahal_private.h.
  *
  *		Author:		Mr. Jason L. Hutchens
  *
@@ -56,104 +52,110 @@
 
 /*===========================================================================*/
 
-#define P_THINK 40
-#define D_KEY 100000
-#define V_KEY 50000
-#define D_THINK 500000
-#define V_THINK 250000
+#ifndef MEGAHAL_H
+#define MEGAHAL_H
 
-#define MIN(a,b) ((a)<(b))?(a):(b)
+#include <stddef.h>
 
-#define COOKIE "MegaHALv8"
-
-#define DEFAULT "."
+/*
+ *		Only the functions below are exported from the shared library.
+ */
+#if defined(__GNUC__) && (__GNUC__>=4)
+#define MEGAHAL_API __attribute__((visibility("default")))
+#else
+#define MEGAHAL_API
+#endif
 
-#define COMMAND_SIZE (sizeof(command)/sizeof(command[0]))
-#define COMMAND_SIZE2 (sizeof(command_net)/sizeof(command_net[0]))
+/*===========================================================================*/
 
-#define BYTE1 unsigned char
-#define BYTE2 unsigned short
-#define BYTE4 unsigned long
+/*
+ *		Both handles are opaque; a PERSONALITY holds a brain and the word
+ *		lists which go with it, and a SESSION holds everything needed to
+ *		reply to one input at a time.
+ */
+typedef struct personality PERSONALITY;
+typedef struct session SESSION;
 
-#ifdef __mac_os
-#define bool Boolean
-#endif
+typedef struct effort {
+	unsigned long tried;
+	unsigned long best;
+	unsigned long taken;
+	float surprise;
+} EFFORT;
 
-#ifdef DOS
-#define SEP "\\"
-#else
-#define SEP "/"
-#endif
+/*===========================================================================*/
 
-#ifdef AMIGA
-#undef toupper
-#define toupper(x) ToUpper(x)
-#undef tolower
-#define tolower(x) ToLower(x)
-#undef isalpha
-#define isalpha(x) IsAlpha(_AmigaLocale,x)
-#undef isalnum
-#define isalnum(x) IsAlNum(_AmigaLocale,x)
-#undef isdigit
-#define isdigit(x) IsDigit(_AmigaLocale,x)
-#undef isspace
-#define isspace(x) IsSpace(_AmigaLocale,x)
-#endif
+/*
+ *		The flags a personality is opened with.  Everything a personality
+ *		writes goes in its own directory, so personalities kept in different
+ *		directories don't get in each other's way.
+ *
+ *		MEGAHAL_FROZEN      it doesn't learn, and is frozen for faster replies
+ *		MEGAHAL_MAPPED      its brain is saved as an image to be mapped
+ *		MEGAHAL_COMPACT     its brain is saved in the compact encoding
+ *		MEGAHAL_JOURNAL     it keeps the journal of what it learns between
+ *		                    saves, which only one personality in a directory
+ *		                    should do
+ *		MEGAHAL_LOG         errors and the conversation are logged in its
+ *		                    directory, rather than to stderr and stdout
+ *		MEGAHAL_BACKGROUND  it is saved by a child process, which is only
+ *		                    safe in a program without other threads
+ *		MEGAHAL_PROGRESS    the progress of training and replies is shown
+ */
+#define MEGAHAL_FROZEN 1
+#define MEGAHAL_MAPPED 2
+#define MEGAHAL_COMPACT 4
+#define MEGAHAL_JOURNAL 8
+#define MEGAHAL_LOG 16
+#define MEGAHAL_BACKGROUND 32
+#define MEGAHAL_PROGRESS 64
 
 /*===========================================================================*/
 
-#ifndef __mac_os
-#undef FALSE
-#undef TRUE
-typedef enum { FALSE, TRUE } bool;
-#endif
-
-typedef struct {
-	BYTE1 length;
-	char *word;
-} STRING;
-
-typedef struct {
-	BYTE4 size;
-	STRING *entry;
-	BYTE2 *index;
-} DICTIONARY;
-
-typedef struct {
-	BYTE2 size;
-	STRING *from;
-	STRING *to;
-} SWAP;
-
-typedef struct NODE {
-	BYTE2 symbol;
-	BYTE4 usage;
-	BYTE2 count;
-	BYTE2 branch;
-	struct NODE **tree;
-} TREE;
-
-typedef struct {
-	BYTE1 order;
-	TREE *forward;
-	TREE *backward;
-	TREE **context;
-	DICTIONARY *dictionary;
-} MODEL;
-
-typedef enum { UNKNOWN, QUIT, EXIT, SAVE, DELAY, HELP, SPEECH, VOICELIST, VOICE, BRAIN, RELOAD } COMMAND_WORDS;
-
-typedef struct {
-	STRING word;
-	char *helpstring;
-	COMMAND_WORDS command;
-} COMMAND;
+/*
+ *		The library interface.  Compiling megahal.c with LIBMEGAHAL defined
+ *		leaves out main(), so that the program can be linked into another as
+ *		a library.  Personalities and sessions are created and freed only
+ *		through the functions below.
+ *
+ *		Different sessions may reply on different threads at once, even to
+ *		the same personality, but a personality mustn't be learning or saved
+ *		while anything else is using it.  Personalities should be opened and
+ *		closed on one thread.  Text is put into upper case before it is used,
+ *		as the brain keeps its words that way.
+ *
+ *		A session spends as many milliseconds on each reply as it is given
+ *		by megahal_limit(), unless it runs out of patience first, when that
+ *		many replies in a row have been no better than the best so far, or
+ *		the best reaches the target surprise.  Either is left out if zero.
+ *		megahal_effort() tells how many replies were tried the last time,
+ *		and how many milliseconds it took to find the best of them.
+ *
+ *		megahal_forget() throws away what a personality has journalled since
+ *		its brain was saved.  megahal_prune() forgets rare phrases until the
+ *		brain fits in the bytes given, or until nothing is left but what it
+ *		needs to hold its sentences together, and returns its new size.
+ *		megahal_stats() hands the function given each line of a report on
+ *		the size and shape of the brain.
+ *
+ *		Functions which return a number give -1 when they fail.
+ */
+MEGAHAL_API PERSONALITY *megahal_open(char *, int);
+MEGAHAL_API void megahal_close(PERSONALITY *);
+MEGAHAL_API SESSION *megahal_session(int);
+MEGAHAL_API void megahal_end(SESSION *);
+MEGAHAL_API int megahal_learn(PERSONALITY *, SESSION *, char *);
+MEGAHAL_API int megahal_reply(PERSONALITY *, SESSION *, char *, char *, int);
+MEGAHAL_API int megahal_greet(PERSONALITY *, SESSION *, char *, int);
+MEGAHAL_API int megahal_save(PERSONALITY *);
+MEGAHAL_API void megahal_forget(PERSONALITY *);
+MEGAHAL_API long megahal_prune(PERSONALITY *, unsigned long);
+MEGAHAL_API void megahal_stats(PERSONALITY *, void (*)(char *));
+MEGAHAL_API void megahal_limit(SESSION *, unsigned long, unsigned long, float);
+MEGAHAL_API void megahal_effort(SESSION *, EFFORT *);
 
 /*===========================================================================*/
 
-#ifdef SUNOS
-extern double drand48(void);
-extern void srand48(long);
 #endif
 
 /*===========================================================================*/
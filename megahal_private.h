@@ -0,0 +1,409 @@
+
+/*===========================================================================*/
+
+/*
+ *  Copyright (C) 1998 Jason Hutchens
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the license or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE.  See the Gnu Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*===========================================================================*/
+
+/*
+ *		$Id: megahal.h,v 1.2 1998/04/21 10:10:56 hutch Exp hutch $
+ *
+ *		File:			megahal_private.h
+ *
+ *		Program:		MegaHAL v8r5
+ *
+ *		Purpose:		The structures, constants and macros MegaHAL is built from,
+ *						which programs linked with the library needn't see.  The
+ *						interface they use is in megahal.h.
+ *
+ *		Author:		Mr. Jason L. Hutchens
+ *
+ *		WWW:			http://ciips.ee.uwa.edu.au/~hutch/hal/
+ *
+ *		E-Mail:		hutch@ciips.ee.uwa.edu.au
+ *
+ *		Contact:		The Centre for Intelligent Information Processing Systems
+ *						Department of Electrical and Electronic Engineering
+ *						The University of Western Australia
+ *						AUSTRALIA 6907
+ *
+ *		Phone:		+61-8-9380-3856
+ *
+ *		Facsimile:	+61-8-9380-1168
+ *
+ *		Notes:		This file is best viewed with tabstops set to three spaces.
+ */
+
+/*===========================================================================*/
+
+#ifndef MEGAHAL_PRIVATE_H
+#define MEGAHAL_PRIVATE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <limits.h>
+#include <setjmp.h>
+#include "megahal.h"
+
+/*===========================================================================*/
+
+#define P_THINK 40
+#define D_KEY 100000
+#define V_KEY 50000
+#define D_THINK 500000
+#define V_THINK 250000
+
+#define MIN(a,b) ((a)<(b))?(a):(b)
+
+#define COOKIE "MegaHALs1"
+#define COOKIE_COMPACT "MegaHALc1"
+#define COOKIE_V9 "MegaHALv9"
+#define COOKIE_V8 "MegaHALv8"
+#define COOKIE_IMAGE "MegaHALm1"
+#define JOURNAL_COOKIE "MegaHALj1"
+
+#define JOURNAL_LIMIT 1048576
+#define REPLY_LIMIT 2000
+
+#define STREAM_BUFFER 4194304
+#define STREAM_MINIMUM 4096
+#define TREE_SECTIONS 8
+
+#define MAX_COUNT 0x7FFFFFFF
+
+#define PRUNE_LIVE 1
+#define PRUNE_PARENT 2
+
+#define NODE_BLOCK 4096
+#define BRANCH_CHUNK 262144
+#define BRANCH_CLASSES 32
+#ifndef HASH_FANOUT
+#define HASH_FANOUT 64
+#endif
+#define INTERN_CHUNK 65536
+#define KEY_BUFFER 256
+#define REPLY_ROOM 256
+#define CLOCK_STRIDE 64
+#define SCAN_SHORT 8
+#define SCAN_FANOUT 64
+
+#define KEYS(node) ((BYTE4 *)((node)->tree+(node)->capacity))
+#define TABLE(node) ((TREE **)(KEYS(node)+(node)->capacity))
+#define TOTALS(node) ((BYTE4 *)(TABLE(node)+(node)->capacity*2))
+#define FOLDED(string) (((string).word[-1]==0)?(string).word:(string).word+(string).length)
+
+#define SET_BIT(set,bit) ((set)[(bit)>>5]|=(BYTE4)1<<((bit)&31))
+#define CLEAR_BIT(set,bit) ((set)[(bit)>>5]&=~((BYTE4)1<<((bit)&31)))
+#define TEST_BIT(set,bit) (((set)[(bit)>>5]>>((bit)&31))&1)
+
+#define DEFAULT "."
+
+#define COMMAND_SIZE (sizeof(command)/sizeof(command[0]))
+#define COMMAND_SIZE2 (sizeof(command_net)/sizeof(command_net[0]))
+
+#define BYTE1 unsigned char
+#define BYTE2 unsigned short
+#if UINT_MAX>=0xFFFFFFFF
+#define BYTE4 unsigned int
+#else
+#define BYTE4 unsigned long
+#endif
+
+#ifdef __mac_os
+#define bool Boolean
+#endif
+
+#ifdef DOS
+#define SEP "\\"
+#else
+#define SEP "/"
+#endif
+
+#ifdef AMIGA
+#undef toupper
+#define toupper(x) ToUpper(x)
+#undef tolower
+#define tolower(x) ToLower(x)
+#undef isalpha
+#define isalpha(x) IsAlpha(_AmigaLocale,x)
+#undef isalnum
+#define isalnum(x) IsAlNum(_AmigaLocale,x)
+#undef isdigit
+#define isdigit(x) IsDigit(_AmigaLocale,x)
+#undef isspace
+#define isspace(x) IsSpace(_AmigaLocale,x)
+#endif
+
+/*===========================================================================*/
+
+#ifndef __mac_os
+#undef FALSE
+#undef TRUE
+typedef enum { FALSE, TRUE } bool;
+#endif
+
+typedef struct {
+	BYTE4 length;
+	char *word;
+} STRING;
+
+typedef struct CHUNK {
+	struct CHUNK *next;
+} CHUNK;
+
+typedef struct {
+	BYTE4 size;
+	STRING *entry;
+	BYTE4 *index;
+	unsigned long bytes;
+	char *pool;
+	unsigned long pooled;
+	unsigned long room;
+	BYTE4 *table;
+	BYTE4 slots;
+	BYTE4 *prefix;
+	CHUNK *chunk;
+	char *top;
+	size_t spare;
+	unsigned long arena;
+} DICTIONARY;
+
+typedef struct {
+	BYTE4 size;
+	STRING *from;
+	STRING *to;
+} SWAP;
+
+typedef struct {
+	BYTE4 size;
+	BYTE4 room;
+	BYTE4 *ban;
+	BYTE4 *aux;
+	BYTE4 *key;
+	BYTE4 *used;
+	BYTE4 count;
+	BYTE4 *symbol;
+	float bound[2];
+	bool used_key;
+} KEYSET;
+
+typedef struct {
+	BYTE4 size;
+	BYTE4 first;
+	BYTE4 room;
+	BYTE4 *symbol;
+	float *forward;
+	float *backward;
+	BYTE4 tail;
+	BYTE4 keywords;
+} REPLY;
+
+typedef struct NODE {
+	BYTE4 symbol;
+	BYTE4 count;
+	BYTE4 branch;
+	BYTE4 usage;
+	BYTE4 capacity;
+	struct NODE **tree;
+} TREE;
+
+typedef struct BLOCK {
+	struct BLOCK *next;
+	int used;
+	TREE node[NODE_BLOCK];
+} BLOCK;
+
+typedef struct {
+	BLOCK *block;
+	TREE *free;
+	CHUNK *chunk;
+	char *top;
+	size_t room;
+	TREE **spare[BRANCH_CLASSES];
+	unsigned long bytes;
+	unsigned long reserved;
+} NODEPOOL;
+
+typedef struct {
+	BYTE4 size;
+	BYTE4 *symbol;
+	BYTE4 *count;
+	BYTE4 *usage;
+	BYTE4 *child;
+	BYTE4 *totals;
+	bool mapped;
+} FROZEN;
+
+typedef struct {
+	unsigned long *nodes;
+	unsigned long parents;
+	unsigned long saturated;
+	BYTE4 widest;
+} CENSUS;
+
+typedef struct {
+	BYTE1 order;
+	NODEPOOL *pool;
+	TREE *forward;
+	TREE *backward;
+	TREE **context;
+	FROZEN *frozen_forward;
+	FROZEN *frozen_backward;
+	FROZEN *frozen;
+	BYTE4 *frozen_context;
+	char *image;
+	size_t image_size;
+	DICTIONARY *dictionary;
+	CENSUS census;
+	unsigned short *random;
+	BYTE4 *merged;
+	BYTE4 merged_room;
+} MODEL;
+
+typedef struct {
+	MODEL *model;
+	KEYSET *keys;
+	REPLY *input;
+	REPLY *replies;
+	REPLY *best;
+	float surprise;
+	PERSONALITY *personality;
+	bool found;
+	bool shown;
+	bool failed;
+	bool *stop;
+	unsigned long start;
+	unsigned long limit;
+	unsigned long patience;
+	float target;
+	unsigned long found_at;
+	unsigned long count;
+	BYTE4 *used;
+	BYTE4 room;
+	unsigned short random[3];
+} WORKER;
+
+struct personality {
+	MODEL *model;
+	DICTIONARY *ban;
+	DICTIONARY *aux;
+	DICTIONARY *grt;
+	SWAP *swp;
+	char *directory;
+	bool learning;
+	bool mapping;
+	bool compact;
+	bool journalled;
+	bool background;
+	bool shown;
+	bool showing;
+	int percent;
+	FILE *errors;
+	FILE *statuses;
+	FILE *journal;
+	char *journal_name;
+	char *journal_old;
+#if !defined(DOS) && !defined(__mac_os)
+	pid_t saver;
+#endif
+};
+
+struct session {
+	DICTIONARY *words;
+	KEYSET *keys;
+	REPLY *input;
+	WORKER *worker;
+	int workers;
+	char *text;
+	size_t text_room;
+	char *output;
+	size_t room;
+	char *formatted;
+	size_t formatted_room;
+	unsigned short random[3];
+	unsigned long limit;
+	unsigned long patience;
+	float target;
+	bool stop;
+	EFFORT effort;
+};
+
+typedef struct GUARD {
+	jmp_buf failed;
+	struct GUARD *outer;
+	PERSONALITY *personality;
+} GUARD;
+
+typedef struct {
+	FILE *file;
+	BYTE1 *buffer;
+	size_t size;
+	size_t length;
+	size_t position;
+	bool failed;
+} STREAM;
+
+typedef struct {
+	char *filename;
+	unsigned long offset;
+	unsigned long length;
+	TREE *root;
+	BYTE4 first;
+	BYTE4 size;
+	int order;
+	int version;
+	NODEPOOL *pool;
+	DICTIONARY *dictionary;
+	PERSONALITY *personality;
+	bool failed;
+	bool aborted;
+} SECTION;
+
+typedef enum { UNKNOWN, QUIT, EXIT, SAVE, DELAY, HELP, SPEECH, VOICELIST, VOICE, BRAIN, RELOAD, PRUNE, STATS } COMMAND_WORDS;
+
+typedef struct {
+	STRING word;
+	char *helpstring;
+	COMMAND_WORDS command;
+} COMMAND;
+
+/*===========================================================================*/
+
+#ifdef SUNOS
+extern double drand48(void);
+extern void srand48(long);
+#endif
+
+/*===========================================================================*/
+
+#endif
+
+/*===========================================================================*/
+
+/*
+ *		$Log: megahal.h,v $
+ *		Revision 1.2  1998/04/21 10:10:56  hutch
+ *		Fixed a few little errors.
+ *
+ *		Revision 1.1  1998/04/06 08:02:01  hutch
+ *		Initial revision
+ */
+
+/*===========================================================================*/
+
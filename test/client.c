@@ -0,0 +1,570 @@
+
+/*===========================================================================*/
+
+/*
+ *  Copyright (C) 1998 Jason Hutchens
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the license or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE.  See the Gnu Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*===========================================================================*/
+
+/*
+ *		File:			client.c
+ *
+ *		Purpose:		Use the MegaHAL library the way another program would,
+ *						through nothing but megahal.h.  A personality is opened
+ *						from the directory given, a short conversation is held
+ *						with it, and its brain is saved and opened again, and
+ *						then opened with the journal and closed without being
+ *						saved, to check what is replayed.  If another directory
+ *						is given, a personality is opened from it alongside the
+ *						first, and each is checked to keep its logs and the files
+ *						it saves in its own directory.  Finally the brain is
+ *						saved in the compact encoding and as an image, and each
+ *						is checked to read back in the same.  The program exits
+ *						with a failure if anything goes wrong.
+ *
+ *		Usage:		client <directory> [<other directory>]
+ */
+
+/*===========================================================================*/
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include "megahal.h"
+
+/*===========================================================================*/
+
+int failures=0;
+int lines=0;
+unsigned long pooled=0;
+unsigned long words=0;
+char census[4096];
+
+void check(int, char *);
+void converse(PERSONALITY *, SESSION *, char *);
+void alongside(char *, char *);
+void forget(char *);
+void replay(char *);
+void round_trip(char *, int, char *, char *);
+void census_line(char *);
+int has_cookie(char *, char *);
+long file_size(char *, char *);
+void remove_file(char *, char *);
+void move_file(char *, char *, char *);
+void count_line(char *);
+int separate(char *);
+
+/*===========================================================================*/
+
+int main(int argc, char *argv[])
+{
+	PERSONALITY *personality;
+	SESSION *session;
+	EFFORT effort;
+	char buffer[1024];
+	char small[8];
+	int length;
+	unsigned long before;
+	long size;
+	int spaced=0;
+	int i;
+
+	if((argc!=2)&&(argc!=3)) {
+		fprintf(stderr, "Usage: %s <directory> [<other directory>]\n", argv[0]);
+		return(2);
+	}
+
+	/*
+	 *		Open the personality, and start a session which replies on two
+	 *		threads for a fifth of a second.
+	 */
+	personality=megahal_open(argv[1], 0);
+	check(personality!=NULL, "megahal_open() opens the personality");
+	if(personality==NULL) return(1);
+	session=megahal_session(2);
+	check(session!=NULL, "megahal_session() starts a session");
+	if(session==NULL) return(1);
+	megahal_limit(session, 200, 0, (float)0.0);
+
+	length=megahal_greet(personality, session, buffer, sizeof(buffer));
+	check(length>0, "megahal_greet() greets");
+	printf("%s\n", buffer);
+
+	megahal_learn(personality, session, "The quick brown fox jumps over the lazy dog.");
+	converse(personality, session, "Tell me about the fox.");
+	converse(personality, session, "What is your name?");
+
+	megahal_effort(session, &effort);
+	check(effort.tried>0, "megahal_effort() counts the replies tried");
+	check(effort.best<=effort.taken, "the best reply is found within the time taken");
+
+	/*
+	 *		A reply which doesn't fit is cut short, but its whole length is
+	 *		still returned.
+	 */
+	length=megahal_reply(personality, session, "Tell me a long story.", small, sizeof(small));
+	check(length>=0, "megahal_reply() replies into a small buffer");
+	check(strlen(small)==((length<(int)sizeof(small))?length:sizeof(small)-1),
+		"a reply is cut short to fit the buffer");
+
+	megahal_stats(personality, count_line);
+	check(lines>0, "megahal_stats() reports on the brain");
+	size=megahal_prune(personality, 1UL<<30);
+	check(size>0, "megahal_prune() leaves a brain which already fits alone");
+
+	/*
+	 *		A brain pruned to half its size must fit, and give back the memory
+	 *		it no longer needs, and one pruned to a tenth of its size must
+	 *		still keep its words apart.
+	 */
+	before=pooled;
+	check(megahal_prune(personality, size/2)<=size/2,
+		"megahal_prune() fits the brain in the bytes given");
+	megahal_stats(personality, count_line);
+	check(pooled<before, "megahal_prune() releases the memory it frees");
+	check(megahal_prune(personality, size/10)<=size/10,
+		"megahal_prune() forgets rare words to fit a smaller brain");
+	for(i=0; i<3; ++i) {
+		length=megahal_reply(personality, session, "Tell me about the weather.",
+			buffer, sizeof(buffer));
+		check(length>0, "a pruned brain replies");
+		check(separate(buffer), "a pruned brain keeps its words apart");
+		if(strchr(buffer, ' ')!=NULL) spaced=1;
+		printf("%s\n", buffer);
+	}
+	check(spaced, "a pruned brain puts spaces between its words");
+
+	check(megahal_save(personality)==0, "megahal_save() saves the brain");
+	megahal_end(session);
+	megahal_close(personality);
+
+	/*
+	 *		The saved brain is read back in and should remember the fox.
+	 */
+	personality=megahal_open(argv[1], 0);
+	check(personality!=NULL, "megahal_open() opens the saved brain");
+	if(personality==NULL) return(1);
+	session=megahal_session(1);
+	check(session!=NULL, "megahal_session() starts a second session");
+	if(session==NULL) return(1);
+	megahal_limit(session, 200, 0, (float)0.0);
+	converse(personality, session, "The lazy dog.");
+	megahal_end(session);
+	megahal_close(personality);
+
+	forget(argv[1]);
+	replay(argv[1]);
+	if(argc==3) alongside(argv[1], argv[2]);
+	round_trip(argv[1], MEGAHAL_COMPACT, "MegaHALc1", "compact");
+	round_trip(argv[1], MEGAHAL_MAPPED, "MegaHALm1", "image");
+
+	if(failures>0) {
+		printf("%d checks failed\n", failures);
+		return(1);
+	}
+	printf("All checks passed\n");
+	return(0);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Check
+ *
+ *		Purpose:		Count a check which failed.
+ */
+void check(int passed, char *description)
+{
+	if(passed!=0) return;
+	printf("FAILED: %s\n", description);
+	++failures;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Count_Line
+ *
+ *		Purpose:		Count a line of the report on a brain, and keep the
+ *						number of bytes its pool has allocated and the number of
+ *						words in its dictionary.
+ */
+void count_line(char *line)
+{
+	if(strlen(line)>0) ++lines;
+	sscanf(line, "Pool: %lu bytes allocated", &pooled);
+	sscanf(line, "Dictionary: %lu words", &words);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Census_Line
+ *
+ *		Purpose:		Keep the lines of the report on a brain which describe
+ *						the shape of its trees, leaving out those which give
+ *						sizes in bytes, as they depend on how the brain was
+ *						loaded.  The number of words is kept by count_line().
+ */
+void census_line(char *line)
+{
+	count_line(line);
+	if((strncmp(line, "Memory", 6)==0)||(strncmp(line, "Pool", 4)==0)||
+		(strncmp(line, "Dictionary", 10)==0)) return;
+	if(strlen(census)+strlen(line)+2>sizeof(census)) return;
+	strcat(census, line);
+	strcat(census, "\n");
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Round_Trip
+ *
+ *		Purpose:		Save the brain in the directory given in the format the
+ *						flags ask for, and check that it is written in that
+ *						format and reads back in with the same census of nodes
+ *						and the same number of words as it was saved with.
+ */
+void round_trip(char *directory, int flags, char *cookie, char *format)
+{
+	PERSONALITY *personality;
+	char before[4096];
+	char description[256];
+	unsigned long known;
+
+	personality=megahal_open(directory, flags);
+	sprintf(description, "megahal_open() opens a personality to save as a %s brain", format);
+	check(personality!=NULL, description);
+	if(personality==NULL) return;
+	census[0]='\0';
+	megahal_stats(personality, census_line);
+	strcpy(before, census);
+	known=words;
+	sprintf(description, "megahal_save() saves a %s brain", format);
+	check(megahal_save(personality)==0, description);
+	megahal_close(personality);
+	sprintf(description, "a %s brain is saved with its own cookie", format);
+	check(has_cookie(directory, cookie), description);
+
+	personality=megahal_open(directory, flags);
+	sprintf(description, "megahal_open() opens a %s brain", format);
+	check(personality!=NULL, description);
+	if(personality==NULL) return;
+	census[0]='\0';
+	megahal_stats(personality, census_line);
+	sprintf(description, "a %s brain reads back in with the same census", format);
+	check((strcmp(before, census)==0)&&(words==known), description);
+	megahal_close(personality);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Has_Cookie
+ *
+ *		Purpose:		Return whether the brain in a directory starts with the
+ *						cookie given.
+ */
+int has_cookie(char *directory, char *cookie)
+{
+	char filename[1024];
+	char buffer[16];
+	FILE *file;
+	size_t length;
+
+	sprintf(filename, "%s/.megahal/megahal.brn", directory);
+	file=fopen(filename, "rb");
+	if(file==NULL) return(0);
+	length=fread(buffer, sizeof(char), strlen(cookie), file);
+	fclose(file);
+
+	return((length==strlen(cookie))&&(strncmp(buffer, cookie, length)==0));
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Separate
+ *
+ *		Purpose:		Return whether a reply keeps its words apart, by having
+ *						no run of letters longer than any word it could have
+ *						learnt.  No word in megahal.trn is longer than fifteen
+ *						letters, but a brain which has forgotten what separates
+ *						its words runs them together.  A reply may be a single
+ *						word, so whether there are spaces between words is
+ *						checked over several replies.
+ */
+int separate(char *reply)
+{
+	int run=0;
+	int longest=0;
+
+	for(; *reply!='\0'; ++reply) {
+		if((isalnum((unsigned char)*reply)!=0)||(*reply=='\'')) ++run;
+		else run=0;
+		if(run>longest) longest=run;
+	}
+
+	return(longest<=20);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Alongside
+ *
+ *		Purpose:		Open two personalities at once, each logging to its own
+ *						directory, and check that saving them leaves the files of
+ *						each in its own directory.
+ */
+void alongside(char *first, char *second)
+{
+	PERSONALITY *one;
+	PERSONALITY *two;
+	SESSION *session;
+	long before;
+
+	before=file_size(first, "megahal.log");
+	one=megahal_open(first, MEGAHAL_LOG);
+	two=megahal_open(second, MEGAHAL_LOG|MEGAHAL_FROZEN);
+	session=megahal_session(1);
+	check((one!=NULL)&&(two!=NULL)&&(session!=NULL),
+		"megahal_open() opens two personalities at once");
+	if((one==NULL)||(two==NULL)||(session==NULL)) {
+		megahal_end(session);
+		megahal_close(one);
+		megahal_close(two);
+		return;
+	}
+	megahal_limit(session, 100, 0, (float)0.0);
+
+	check(file_size(first, "megahal.log")>before,
+		"a personality opens the error log in its own directory");
+	check(file_size(second, "megahal.log")>0,
+		"the other personality opens an error log of its own");
+
+	remove_file(first, "megahal.dic");
+	remove_file(second, "megahal.dic");
+	converse(one, session, "Which of us are you?");
+	converse(two, session, "Which of us are you?");
+	check(megahal_save(one)==0, "megahal_save() saves the first personality");
+	check(file_size(first, "megahal.dic")>0,
+		"the first personality saves its dictionary in its own directory");
+	check(file_size(second, "megahal.dic")<0,
+		"saving one personality leaves the other's directory alone");
+	check(megahal_save(two)==0, "megahal_save() saves the other personality");
+	check(file_size(second, "megahal.dic")>0,
+		"the other personality saves its dictionary in its own directory");
+
+	megahal_end(session);
+	megahal_close(one);
+	megahal_close(two);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Forget
+ *
+ *		Purpose:		Check that a personality which keeps the journal goes on
+ *						keeping it after megahal_forget(), by learning new words
+ *						either side of it and opening the personality again
+ *						without saving it, as if it had crashed.  Only the words
+ *						learnt after forgetting should come back.
+ */
+void forget(char *directory)
+{
+	PERSONALITY *personality;
+	SESSION *session;
+	unsigned long before;
+
+	remove_file(directory, "megahal.jnl");
+	personality=megahal_open(directory, MEGAHAL_JOURNAL);
+	session=megahal_session(1);
+	check((personality!=NULL)&&(session!=NULL),
+		"megahal_open() opens a personality which keeps the journal");
+	if((personality==NULL)||(session==NULL)) {
+		megahal_end(session);
+		megahal_close(personality);
+		return;
+	}
+	megahal_stats(personality, count_line);
+	before=words;
+	megahal_learn(personality, session, "Xyzzy says plugh.");
+	megahal_forget(personality);
+	megahal_learn(personality, session, "Frobozz sells zorkmids.");
+	megahal_end(session);
+	megahal_close(personality);
+
+	personality=megahal_open(directory, MEGAHAL_JOURNAL);
+	check(personality!=NULL, "megahal_open() replays the journal");
+	if(personality==NULL) return;
+	megahal_stats(personality, count_line);
+	check(words==before+3, "megahal_forget() keeps journalling what is learnt next");
+	megahal_forget(personality);
+	megahal_close(personality);
+	remove_file(directory, "megahal.jnl");
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Replay
+ *
+ *		Purpose:		Check that what a personality which keeps the journal
+ *						learns survives a crash, by closing it without saving.
+ *						The journal is then moved aside, as a save does before
+ *						it writes the brain, to check that a rotated journal
+ *						left behind by a save which never finished is folded
+ *						in along with the new one, and is only removed once the
+ *						brain which holds it has been saved.
+ */
+void replay(char *directory)
+{
+	PERSONALITY *personality;
+	SESSION *session;
+	unsigned long before;
+
+	remove_file(directory, "megahal.jnl");
+	remove_file(directory, "megahal.jnl.old");
+	personality=megahal_open(directory, MEGAHAL_JOURNAL);
+	session=megahal_session(1);
+	check((personality!=NULL)&&(session!=NULL),
+		"megahal_open() opens a personality to crash");
+	if((personality==NULL)||(session==NULL)) {
+		megahal_end(session);
+		megahal_close(personality);
+		return;
+	}
+	megahal_stats(personality, count_line);
+	before=words;
+	megahal_learn(personality, session, "Quux wibbles blorpily.");
+	megahal_close(personality);
+	move_file(directory, "megahal.jnl", "megahal.jnl.old");
+
+	personality=megahal_open(directory, MEGAHAL_JOURNAL);
+	check(personality!=NULL, "megahal_open() opens a personality after a crash");
+	if(personality==NULL) {
+		megahal_end(session);
+		return;
+	}
+	megahal_stats(personality, count_line);
+	check(words==before+3, "a rotated journal is replayed after a crash");
+	megahal_learn(personality, session, "Snarf gronks the frobnitz.");
+	megahal_close(personality);
+
+	personality=megahal_open(directory, MEGAHAL_JOURNAL);
+	check(personality!=NULL, "megahal_open() opens a personality after another crash");
+	if(personality==NULL) {
+		megahal_end(session);
+		return;
+	}
+	megahal_stats(personality, count_line);
+	check(words==before+6, "both journals are replayed after a crash");
+	check(megahal_save(personality)==0, "megahal_save() folds the journals into the brain");
+	check(file_size(directory, "megahal.jnl.old")<0,
+		"the rotated journal is removed once the brain is saved");
+	megahal_end(session);
+	megahal_close(personality);
+
+	personality=megahal_open(directory, 0);
+	check(personality!=NULL, "megahal_open() opens the brain the journals went into");
+	if(personality==NULL) return;
+	megahal_stats(personality, count_line);
+	check(words==before+6, "the saved brain keeps what was journalled");
+	megahal_close(personality);
+	remove_file(directory, "megahal.jnl");
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	File_Size
+ *
+ *		Purpose:		Return the size of a file kept by a personality, or -1 if
+ *						it doesn't exist.
+ */
+long file_size(char *directory, char *name)
+{
+	char filename[1024];
+	FILE *file;
+	long size;
+
+	sprintf(filename, "%s/.megahal/%s", directory, name);
+	file=fopen(filename, "rb");
+	if(file==NULL) return(-1);
+	fseek(file, 0, SEEK_END);
+	size=ftell(file);
+	fclose(file);
+
+	return(size);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Remove_File
+ *
+ *		Purpose:		Remove a file kept by a personality, if it exists.
+ */
+void remove_file(char *directory, char *name)
+{
+	char filename[1024];
+
+	sprintf(filename, "%s/.megahal/%s", directory, name);
+	remove(filename);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Move_File
+ *
+ *		Purpose:		Rename a file kept by a personality.
+ */
+void move_file(char *directory, char *from, char *to)
+{
+	char source[1024];
+	char target[1024];
+
+	sprintf(source, "%s/.megahal/%s", directory, from);
+	sprintf(target, "%s/.megahal/%s", directory, to);
+	rename(source, target);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Converse
+ *
+ *		Purpose:		Reply to some text, and check that a reply came back.
+ */
+void converse(PERSONALITY *personality, SESSION *session, char *text)
+{
+	char buffer[1024];
+	int length;
+
+	length=megahal_reply(personality, session, text, buffer, sizeof(buffer));
+	check(length>0, "megahal_reply() replies");
+	check((length>=(int)sizeof(buffer))||(strlen(buffer)==(size_t)length),
+		"megahal_reply() returns the length of the reply");
+	printf("> %s\n%s\n", text, buffer);
+}
+
+/*===========================================================================*/
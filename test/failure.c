@@ -0,0 +1,164 @@
+
+/*===========================================================================*/
+
+/*
+ *  Copyright (C) 1998 Jason Hutchens
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the license or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE.  See the Gnu Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*===========================================================================*/
+
+/*
+ *		File:			failure.c
+ *
+ *		Purpose:		Make sure that the library gives back an error, rather
+ *						than exiting or crashing, when it runs out of memory.
+ *						It is linked against a copy of megahal.c built with
+ *						failure.h, and the same short conversation is held and
+ *						the brain saved over and over, with the first
+ *						allocation, then the second, and so on, made to fail.
+ *						Building it with -fsanitize=address catches anything
+ *						which is left half freed along the way.
+ *
+ *		Usage:		failure <directory> [<first> <last> <step>]
+ */
+
+/*===========================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "megahal.h"
+
+/*===========================================================================*/
+
+/*
+ *		The number of allocations left before one fails, or -1 if none will.
+ */
+long allocations=-1;
+pthread_mutex_t allocation_lock=PTHREAD_MUTEX_INITIALIZER;
+
+int allow(void);
+void *failing_malloc(size_t);
+void *failing_calloc(size_t, size_t);
+void *failing_realloc(void *, size_t);
+char *failing_strdup(const char *);
+
+/*===========================================================================*/
+
+int main(int argc, char *argv[])
+{
+	PERSONALITY *personality;
+	SESSION *session;
+	char buffer[256];
+	long first=0, last=3000, step=1;
+	long failure;
+	int failed=0, passed=0;
+
+	if((argc!=2)&&(argc!=5)) {
+		fprintf(stderr, "Usage: %s <directory> [<first> <last> <step>]\n", argv[0]);
+		return(2);
+	}
+	if(argc==5) {
+		first=atol(argv[2]);
+		last=atol(argv[3]);
+		step=atol(argv[4]);
+		if(step<1) step=1;
+	}
+
+	for(failure=first; failure<last; failure+=step) {
+		pthread_mutex_lock(&allocation_lock);
+		allocations=failure;
+		pthread_mutex_unlock(&allocation_lock);
+		personality=megahal_open(argv[1], 0);
+		session=megahal_session(2);
+		if((personality!=NULL)&&(session!=NULL)) megahal_limit(session, 1, 0, (float)0.0);
+		if((personality==NULL)||(session==NULL)||
+			(megahal_learn(personality, session, "Hello there, how are you?")<0)||
+			(megahal_reply(personality, session, "Hello there.", buffer, sizeof(buffer))<0)||
+			(megahal_greet(personality, session, buffer, sizeof(buffer))<0)||
+			(megahal_save(personality)<0))
+			++failed;
+		else
+			++passed;
+		pthread_mutex_lock(&allocation_lock);
+		allocations=-1;
+		pthread_mutex_unlock(&allocation_lock);
+		megahal_end(session);
+		megahal_close(personality);
+	}
+
+	/*
+	 *		Once nothing fails, the same personality must still work.
+	 */
+	personality=megahal_open(argv[1], 0);
+	session=megahal_session(2);
+	if((personality==NULL)||(session==NULL)||
+		(megahal_reply(personality, session, "Hello there.", buffer, sizeof(buffer))<=0)) {
+		printf("FAILED: the personality doesn't work once memory is available\n");
+		return(1);
+	}
+	megahal_end(session);
+	megahal_close(personality);
+
+	printf("%d conversations failed cleanly, %d completed\n", failed, passed);
+	return(0);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Allow
+ *
+ *		Purpose:		Decide whether the next allocation should succeed.  The
+ *						replies are found on several threads, so the count is
+ *						kept under a lock.
+ */
+int allow(void)
+{
+	int allowed=1;
+
+	pthread_mutex_lock(&allocation_lock);
+	if(allocations==0) allowed=0;
+	else if(allocations>0) --allocations;
+	pthread_mutex_unlock(&allocation_lock);
+	return(allowed);
+}
+
+/*---------------------------------------------------------------------------*/
+
+void *failing_malloc(size_t size)
+{
+	return(allow()?malloc(size):NULL);
+}
+
+void *failing_calloc(size_t number, size_t size)
+{
+	return(allow()?calloc(number, size):NULL);
+}
+
+void *failing_realloc(void *pointer, size_t size)
+{
+	return(allow()?realloc(pointer, size):NULL);
+}
+
+char *failing_strdup(const char *string)
+{
+	return(allow()?strdup(string):NULL);
+}
+
+/*===========================================================================*/
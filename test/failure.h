@@ -0,0 +1,29 @@
+
+/*===========================================================================*/
+
+/*
+ *		File:			failure.h
+ *
+ *		Purpose:		Included ahead of megahal.c when it is built for
+ *						test/failure, so that every allocation it makes goes
+ *						through a counter which can be told to fail.
+ */
+
+/*===========================================================================*/
+
+#include <stdlib.h>
+#include <string.h>
+
+extern long allocations;
+
+void *failing_malloc(size_t);
+void *failing_calloc(size_t, size_t);
+void *failing_realloc(void *, size_t);
+char *failing_strdup(const char *);
+
+#define malloc(size) failing_malloc(size)
+#define calloc(number, size) failing_calloc(number, size)
+#define realloc(pointer, size) failing_realloc(pointer, size)
+#define strdup(string) failing_strdup(string)
+
+/*===========================================================================*/